@@ -1,6 +1,5 @@
 #!/usr/bin/env python3
 
-import re
 import os
 import json
 import time
@@ -124,7 +123,7 @@ def main_benchmark(args):
                         client_id += 1
                         client_configs.append(client_config)
 
-                    thpt, lat = run_single_testcase(
+                    thpt, lat, lat_tail = run_single_testcase(
                         server_name=server,
                         server_args=server_config,
                         client_names=clients,
@@ -136,6 +135,7 @@ def main_benchmark(args):
                         result = {
                             "throughput": thpt,
                             "latency": lat,
+                            **lat_tail,
                             "server": server,
                             "clients": clients,
                             "thread": thread,
@@ -248,7 +248,7 @@ def run_single_testcase(
     # (3) deal with stdout/stderr and count latency and throughput
 
     name_buffer_map = receive_buffer_from_channelfile(client_channelfile_dict)
-    thpt, lat = aggregate_statics(name_buffer_map)
+    thpt, lat, lat_tail = aggregate_statics(name_buffer_map)
 
     # (4) close client and server
 
@@ -270,7 +270,7 @@ def run_single_testcase(
     server_session.close()
     print("done, close server session OK")
 
-    return thpt, lat
+    return thpt, lat, lat_tail
 
 
 def receive_buffer_from_channelfile(channelfile_dict: dict[str, paramiko.ChannelFile]) -> dict[str, str]:
@@ -325,6 +325,9 @@ def aggregate_statics(name_buffer_map: dict[str, str]):
 
     thpts = []
     latencys = []
+    # the latency percentiles of each client, averaged over the epochs
+    # (except max, which is the max of all epochs)
+    tails = []
 
     for stat_list in name_stats_map.values():
         cur_thpt = (
@@ -340,28 +343,65 @@ def aggregate_statics(name_buffer_map: dict[str, str]):
         thpts.append(cur_thpt)
         latencys.append(cur_latency)
 
-    return sum(thpts), sum(latencys) / len(latencys)
+        tail_list = [stat for stat in stat_list if "p50" in stat]
+        if len(tail_list) != 0:
+            tail = {
+                k: sum([stat[k] for stat in tail_list]) / len(tail_list)
+                for k in LAT_TAIL_KEYS
+            }
+            tail["max"] = max([stat["max"] for stat in tail_list])
+            tails.append(tail)
+
+    # report the worst client for the tail latency
+    lat_tail = {k: max([t[k] for t in tails]) if len(tails) != 0 else 0 for k in LAT_TAIL_KEYS}
+
+    # per-epoch CPU accounting, averaged over the epochs and summed over the clients
+    for k in CPU_KEYS:
+        lat_tail[k] = sum(
+            [
+                sum([stat[k] for stat in stat_list]) / len(stat_list)
+                for stat_list in name_stats_map.values()
+                if len(stat_list) != 0
+            ]
+        )
+
+    return sum(thpts), sum(latencys) / len(latencys), lat_tail
 
 
-STATICS_PATTERN = re.compile(
-    ".*?epoch[ :@\t]*([0-9\+e\.]*)[ \t]*([0-9\+e\.]*)[ :\t]*thpt[ :@\t]*([0-9\+e\.]*)[ \t]*reqs/sec"
-)
-"""[statucs.hh:78] epoch @ 0 2.02875 : thpt: 1.41981e+06 reqs/sec,"""
-"""[statucs.hh:78] epoch @ 8 1.73391 : thpt: 596948 reqs/sec,"""
+LAT_TAIL_KEYS = ["p50", "p90", "p99", "p999", "max"]
+CPU_KEYS = ["bytes", "post_cycles", "poll_cycles", "empty_polls"]
 
 
 def parse_buffer_into_statics(buffer: str):
+    """
+    Parse the per-epoch JSON records emitted by `Reporter::report_thpt`
+    (one line each, starting with '{'), e.g.,
+    {"epoch":8,"elapsed_us":1000012,"thpt":596948,"lat":1.73391,
+     "lat_us":{"p50":2.047,"p90":3.071,"p99":5.119,"p999":9.215,"max":40.959},
+     "threads":[{"id":0,"ops":..,"bytes":..,"post_cycles":..,"poll_cycles":..,"empty_polls":..}]}
+    """
     stats = []
     for line in buffer.split("\n"):
-        match_res = STATICS_PATTERN.match(line)
-        if match_res:
-            epoch = float(match_res.group(1))
-            latency = float(match_res.group(2))
-            throughput = float(match_res.group(3))
-            if epoch >= 5:
-                stats.append(
-                    {"epoch": epoch, "latency": latency, "throughput": throughput}
-                )
+        line = line.strip()
+        if not line.startswith("{"):
+            continue
+        try:
+            record = json.loads(line)
+        except json.JSONDecodeError:
+            continue
+        if "epoch" not in record or record["epoch"] < 5:
+            continue
+
+        stat = {
+            "epoch": record["epoch"],
+            "latency": record["lat"],
+            "throughput": record["thpt"],
+        }
+        if "lat_us" in record:
+            stat.update({k: record["lat_us"][k] for k in LAT_TAIL_KEYS})
+        for k in CPU_KEYS:
+            stat[k] = sum([t[k] for t in record.get("threads", [])])
+        stats.append(stat)
 
     return stats
 
@@ -27,13 +27,18 @@ def make_write_experiment_config(threads, coros, payload) -> dict:
 
 
 def make_thread_config(numa_type, force_use_numa_node, use_numa_node = 0) -> dict:
-    numa_dict = {
-        "numa_type": numa_type,
-        "force_use_numa_node": force_use_numa_node,
-    }
+    """
+    Map the machine config to the --bind_policy of the benchmark binaries.
+    numa_type 1 is the machine whose cpu ids interleave among the sockets,
+    where the threads should stay close to the NIC in use.
+    """
     if force_use_numa_node:
-        numa_dict["use_numa_node"] = use_numa_node
-    return numa_dict
+        policy = f"node:{use_numa_node}"
+    elif numa_type == 1:
+        policy = "nic"
+    else:
+        policy = "compact"
+    return {"bind_policy": policy}
 
 
 def build_sudo_exec_cmd(binary, cmd_dict: dict):
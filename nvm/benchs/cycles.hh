@@ -0,0 +1,33 @@
+#pragma once
+
+#include <chrono>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "rlib/core/common.hh" // for u64
+
+namespace nvm {
+
+using namespace rdmaio;
+
+/*!
+  Read the CPU's cycle counter (rdtsc on x86, cntvct_el0 on aarch64).
+  On other platforms, fall back to the nanoseconds of the steady clock.
+ */
+static inline u64 read_tsc() {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#elif defined(__aarch64__)
+  u64 val;
+  asm volatile("mrs %0, cntvct_el0" : "=r"(val));
+  return val;
+#else
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+#endif
+}
+
+} // namespace nvm
@@ -0,0 +1,386 @@
+#include <gflags/gflags.h>
+
+#include <atomic>
+#include <fstream>
+#include <iostream>
+
+#include "r2/src/common.hh"
+#include "r2/src/libroutine.hh"
+#include "rlib/core/lib.hh"
+
+#include "./latency.hh"
+#include "./statucs.hh"
+#include "./thread.hh"
+#include "./topology.hh"
+#include "./workload.hh"
+
+#include "../emu_region.hh"
+#include "../huge_region.hh"
+#include "../nvm_region.hh"
+#include "../persist.hh"
+
+#include "./one_sided/transport_op.hh"
+
+DEFINE_string(spec, "",
+              "The workload spec file (.json, or .yaml/.yml), see workload.hh");
+DEFINE_string(output, "",
+              "The file to append the summary JSON record of each run, which "
+              "is always printed to stdout");
+DEFINE_bool(dry_run, false, "Only print the resolved spec of each run");
+DEFINE_uint64(warmup, 1, "Seconds to run before the measurement of a run");
+
+using namespace rdmaio;
+using namespace rdmaio::rmem;
+using namespace rdmaio::qp;
+
+using namespace test;
+
+using namespace nvm;
+
+using namespace r2;
+
+namespace {
+
+volatile bool running = true;
+
+/*!
+  The memory accessed by the loopback and local transports
+ */
+Arc<MemoryRegion> create_memory(const Workload &w) {
+  if (w.memory == "emu")
+    return EmuRegion::create(w.space, w.emu).value();
+  if (w.memory == "nvm")
+    return NVMRegion::create(w.nvm_file, w.space).value();
+  if (w.memory == "huge")
+    return HugeRegion::create(w.space).value();
+  return DRAMRegion::create(w.space).value();
+}
+
+/*!
+  Create a transport to the accessed memory and bind its MRs;
+  local_buf is the (registered) buffer of the thread's requests, and
+  loopback_mr is the accessed memory registered (once per run) at
+  loopback_mem.
+ */
+Arc<AbsTransport> create_transport(const Workload &w, const usize &run,
+                                   const usize &thread_id,
+                                   const Arc<LoopbackMem> &loopback_mem,
+                                   const RegAttr &loopback_mr,
+                                   const Arc<RMem> &local_buf) {
+  Arc<AbsTransport> qp = nullptr;
+  RegAttr remote_attr;
+  RegAttr local_attr;
+
+  if (w.transport == "loopback") {
+    qp = LoopbackTransport::create(loopback_mem, QPConfig()).value();
+    remote_attr = loopback_mr;
+    local_attr = loopback_mem->reg(local_buf).value();
+  } else {
+    auto nic = RNic::create(RNicInfo::query_dev_names().at(w.nic_idx)).value();
+    auto rc = RC::create(nic, QPConfig()).value();
+
+    ConnectManager cm(w.server);
+    auto wait_res = cm.wait_ready(2000000, 12);
+    if (wait_res == IOCode::Timeout)
+      RDMA_ASSERT(false) << "cm connect to server timeout " << wait_res.desc;
+
+    // the runs of a driver create different QPs at the server
+    char qp_name[64];
+    snprintf(qp_name, 64, "driver:%lu:%lu:%lu", static_cast<u64>(run), w.id,
+             static_cast<u64>(thread_id));
+    auto qp_res = cm.cc_rc(qp_name, rc, w.remote_nic_idx, QPConfig());
+    RDMA_ASSERT(qp_res == IOCode::Ok) << std::get<0>(qp_res.desc);
+
+    auto fetch_res = cm.fetch_remote_mr(w.remote_nic_idx);
+    RDMA_ASSERT(fetch_res == IOCode::Ok) << std::get<0>(fetch_res.desc);
+    remote_attr = std::get<1>(fetch_res.desc);
+    RDMA_ASSERT(remote_attr.sz >= w.space)
+        << "the server's MR (" << remote_attr.sz
+        << "B) is smaller than the space of the workload";
+
+    auto local_mr = RegHandler::create(local_buf, nic).value();
+    local_attr = local_mr->get_reg_attr().value();
+    qp = RCTransport::create(rc).value();
+  }
+
+  qp->bind_remote_mr(remote_attr);
+  qp->bind_local_mr(local_attr);
+  return qp;
+}
+
+/*!
+  The one-sided (loopback and rc) benchmark of a thread: each coroutine
+  issues a doorbell of w.batch requests at a time, with an additional 1B read
+  after the writes if w.sync.
+ */
+void one_sided_thread(const Workload &w, const usize &run,
+                      const usize &thread_id, const u64 &slot,
+                      Statics &stat, LatHistogram &lats,
+                      const Arc<LoopbackMem> &loopback_mem,
+                      const RegAttr &loopback_mr) {
+  auto local_region = std::make_shared<DRAMRegion>(slot * (w.coros + 1));
+  auto local_buf = std::make_shared<RMem>(
+      local_region->size(),
+      [&local_region](u64 s) -> RMem::raw_ptr_t {
+        return local_region->start_ptr();
+      },
+      [](RMem::raw_ptr_t ptr) {
+        // freed with the region
+      });
+  auto qp = create_transport(w, run, thread_id, loopback_mem, loopback_mr,
+                             local_buf);
+  const auto local_attr = qp->local_mr.value();
+  const auto remote_attr = qp->remote_mr.value();
+
+  FastRandom rand(0xdeadbeaf + w.id * 0xdddd + thread_id);
+  auto rgen = create_addr_gen(w.addr, w.addr_space(), 0,
+                              thread_id + w.id * w.threads)
+                  .value();
+
+  SScheduler ssched;
+  usize exited = 0;
+  for (uint i = 0; i < w.coros; ++i) {
+    ssched.spawn([&, qp](R2_ASYNC) {
+      char *buf =
+          (char *)local_buf->raw_ptr + R2_COR_ID() % (w.coros + 1) * slot;
+      TOp op(&stat);
+      r2::Timer op_t;
+
+      while (running) {
+        op_t.reset();
+        if (w.batch == 1 && !w.sync) {
+          const u32 len = w.payload.gen(rand);
+          op.set_payload(buf, len).set_remote_addr(rgen->gen(rand));
+          if (w.is_read(rand))
+            op.set_read();
+          else
+            op.set_write();
+          auto ret = op.execute(qp, IBV_SEND_SIGNALED, R2_ASYNC_WAIT);
+          ASSERT(ret == IOCode::Ok) << RC::wc_status(ret.desc);
+        } else {
+          DoorbellHelper<16> doorbell(IBV_WR_RDMA_READ);
+          u64 last_write = 0;
+          bool has_write = false;
+          for (uint j = 0; j < w.batch; ++j) {
+            const u32 len = w.payload.gen(rand);
+            const u64 addr = rgen->gen(rand);
+            const bool read = w.is_read(rand);
+
+            doorbell.next();
+            doorbell.cur_wr().opcode =
+                read ? IBV_WR_RDMA_READ : IBV_WR_RDMA_WRITE;
+            doorbell.cur_wr().send_flags = 0;
+            doorbell.cur_wr().wr.rdma.remote_addr = remote_attr.buf + addr;
+            doorbell.cur_wr().wr.rdma.rkey = remote_attr.key;
+            doorbell.cur_sge() = {.addr = (u64)(buf + j * w.payload.max),
+                                  .length = len,
+                                  .lkey = local_attr.key};
+            if (!read) {
+              last_write = addr + len - sizeof(u8);
+              has_write = true;
+            }
+          }
+          if (w.sync && has_write) {
+            // read the last byte written, which flushes the writes out of
+            // the NIC (see one_sided/client.cc)
+            doorbell.next();
+            doorbell.cur_wr().opcode = IBV_WR_RDMA_READ;
+            doorbell.cur_wr().wr.rdma.remote_addr =
+                remote_attr.buf + last_write;
+            doorbell.cur_wr().wr.rdma.rkey = remote_attr.key;
+            doorbell.cur_sge() = {.addr = (u64)(buf + slot - sizeof(u8)),
+                                  .length = sizeof(u8),
+                                  .lkey = local_attr.key};
+          }
+          doorbell.cur_wr().send_flags = IBV_SEND_SIGNALED;
+          auto ret = op.execute_doorbell(qp, doorbell, R2_ASYNC_WAIT);
+          ASSERT(ret == IOCode::Ok) << RC::wc_status(ret.desc);
+        }
+
+        // the latency of the whole doorbell
+        lats.record_us(op_t.passed_msec());
+        stat.inc(w.batch);
+        R2_YIELD;
+      }
+      // the last coroutine to finish stops the scheduler
+      if (++exited == w.coros)
+        R2_STOP();
+      R2_RET;
+    });
+  }
+  ssched.run();
+}
+
+/*!
+  The local benchmark of a thread: requests are served by the CPU, writes
+  use the persist kernel (or a plain memcpy if w.persist is none)
+ */
+void local_thread(const Workload &w, const usize &thread_id, Statics &stat,
+                  LatHistogram &lats, const Arc<MemoryRegion> &mem) {
+  std::vector<char> buf(w.payload.max);
+  char *base = (char *)mem->start_ptr();
+
+  FastRandom rand(0xdeadbeaf + w.id * 0xdddd + thread_id);
+  auto rgen = create_addr_gen(w.addr, w.addr_space(), 0,
+                              thread_id + w.id * w.threads)
+                  .value();
+
+  u64 sum = 0;
+  r2::Timer op_t;
+  while (running) {
+    op_t.reset();
+    const u64 len = w.payload.gen(rand);
+    char *ptr = base + rgen->gen(rand);
+    if (w.is_read(rand)) {
+      emu::on_read(ptr, len);
+      memcpy(buf.data(), ptr, len);
+      sum += buf[0];
+    } else if (w.persist == "none") {
+      memcpy(ptr, buf.data(), len);
+      emu::on_write(ptr, len);
+    } else {
+      sum += persist::copy(ptr, buf.data(), len);
+    }
+    lats.record_us(op_t.passed_msec());
+    stat.inc(1);
+    stat.inc_bytes(len);
+  }
+  stat.float_data = sum; // avoid the reads being optimized out
+}
+
+/*!
+  Run the workload, and return the summary record of the run
+ */
+std::string run_workload(const usize &run, const Workload &w) {
+  CoreBinder::init(w.bind, {.nic_dev_id = w.transport == "rc" ? w.nic_idx : -1,
+                            .nvm_file = w.memory == "nvm" ? w.nvm_file : ""});
+  if (w.transport == "local") {
+    RDMA_ASSERT(persist::init(w.persist == "none" ? "auto" : w.persist))
+        << "invalid persist kernel: " << w.persist;
+    if (w.batch != 1 || w.sync)
+      RDMA_LOG(4) << "the local transport ignores batch and sync";
+  }
+
+  Arc<LoopbackMem> loopback_mem = nullptr;
+  // the memory is shared by the threads, so it is registered once, and
+  // each thread only registers its local buffer
+  RegAttr loopback_mr;
+  Arc<MemoryRegion> mem = nullptr;
+  if (w.transport == "rc") {
+    if (w.spec.find("memory") != nullptr)
+      RDMA_LOG(4) << "the rc transport ignores memory, which the server "
+                     "decides";
+  } else {
+    mem = create_memory(w);
+    if (w.transport == "loopback") {
+      RDMA_ASSERT(w.threads + 1 <= kMaxLoopbackMRs)
+          << "too many threads for the loopback MRs: " << w.threads;
+      loopback_mem = std::make_shared<LoopbackMem>();
+      loopback_mr = loopback_mem
+                        ->reg(mem->start_ptr(), mem->size(),
+                              ::nvm::emu::on_access)
+                        .value();
+    }
+  }
+
+  // the buffer of a coroutine: a doorbell of payloads, and the sync byte
+  const u64 slot = (w.payload.max * w.batch + 64 + 4095) / 4096 * 4096;
+
+  std::vector<Statics> statics(w.threads);
+  std::vector<LatHistogram> lat_hists(w.threads);
+  std::vector<std::unique_ptr<Thread<int>>> threads;
+
+  running = true;
+  for (uint thread_id = 0; thread_id < w.threads; ++thread_id) {
+    threads.push_back(std::make_unique<Thread<int>>([&, thread_id]() -> int {
+      bind_to_core(thread_id);
+      if (w.transport == "local")
+        local_thread(w, thread_id, statics[thread_id], lat_hists[thread_id],
+                     mem);
+      else
+        one_sided_thread(w, run, thread_id, slot, statics[thread_id],
+                         lat_hists[thread_id], loopback_mem, loopback_mr);
+      return 0;
+    }));
+  }
+  for (auto &t : threads)
+    t->start();
+
+  sleep(FLAGS_warmup);
+  std::vector<Statics> start_stats = statics;
+  LatSnapshot start_lats;
+  for (auto &h : lat_hists)
+    start_lats.merge(h);
+  r2::Timer timer;
+
+  Reporter::report_thpt(statics, w.duration, lat_hists);
+
+  const double passed_sec = timer.passed_msec() / 1000000.0;
+  u64 ops = 0, bytes = 0;
+  for (uint i = 0; i < statics.size(); ++i) {
+    ops += statics[i].counter - start_stats[i].counter;
+    bytes += statics[i].bytes - start_stats[i].bytes;
+  }
+  LatSnapshot end_lats;
+  for (auto &h : lat_hists)
+    end_lats.merge(h);
+  const auto lats = end_lats.since(start_lats);
+
+  running = false;
+  for (auto &t : threads)
+    t->join();
+
+  // no "epoch" key, so the record is not taken as an epoch by bench_master.py
+  std::ostringstream oss;
+  oss.precision(12);
+  oss << "{\"run\":" << run << ",\"name\":\"" << w.name
+      << "\",\"spec\":" << w.spec.to_json() << ",\"duration_s\":" << passed_sec
+      << ",\"ops\":" << ops << ",\"thpt\":" << ops / passed_sec
+      << ",\"bw_mbps\":" << bytes / passed_sec / (1024 * 1024)
+      << ",\"lat_us\":{\"p50\":" << lats.percentile(50)
+      << ",\"p90\":" << lats.percentile(90)
+      << ",\"p99\":" << lats.percentile(99)
+      << ",\"p999\":" << lats.percentile(99.9) << ",\"max\":" << lats.max()
+      << "}}";
+  return oss.str();
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  RDMA_ASSERT(!FLAGS_spec.empty()) << "no workload spec is given";
+
+  auto doc = Spec::parse_file(FLAGS_spec);
+  RDMA_ASSERT(doc) << "failed to parse the workload spec: " << FLAGS_spec;
+  auto runs = expand_sweep(doc.value());
+  RDMA_ASSERT(runs) << "invalid sweep in the workload spec: " << FLAGS_spec;
+
+  // validate all the runs before running any
+  std::vector<Workload> workloads;
+  for (auto &s : runs.value()) {
+    auto w = Workload::from_spec(s);
+    RDMA_ASSERT(w) << "invalid workload: " << s.to_json();
+    workloads.push_back(w.value());
+  }
+  RDMA_LOG(4) << "driver runs " << workloads.size() << " workloads of "
+              << FLAGS_spec;
+
+  std::ofstream output;
+  if (!FLAGS_output.empty())
+    output.open(FLAGS_output, std::ios::app);
+
+  for (usize i = 0; i < workloads.size(); ++i) {
+    const auto &w = workloads[i];
+    if (FLAGS_dry_run) {
+      std::cout << w.spec.to_json() << std::endl;
+      continue;
+    }
+    RDMA_LOG(4) << "run " << i << " (" << w.name << "): " << w.spec.to_json();
+    auto summary = run_workload(i, w);
+    std::cout << summary << std::endl;
+    if (output.is_open())
+      output << summary << std::endl;
+  }
+  return 0;
+}
@@ -1,20 +1,40 @@
 #pragma once
 
+#include <algorithm>
+#include <cmath>
+#include <string>
+
 #include "rlib/tests/random.hh"
 
 #include "r2/src/common.hh"
 
 namespace nvm {
 
-class RandomAddr {
+/*!
+  The interface of the (random) address generators.
+  An address is an offset in [off, off + space), aligned to the *align*
+  of the generator (e.g., 64B cache line, or 256B Optane XPLine).
+  So the caller should exclude the payload from the space.
+ */
+class AbsAddrGen {
+public:
+  virtual ~AbsAddrGen() = default;
+  virtual ::r2::u64 gen(::test::FastRandom &rand) = 0;
+};
+
+class RandomAddr : public AbsAddrGen {
   const ::r2::u64 space = 0;
   const ::r2::u64 off = 0;
+  const ::r2::u64 align = 1;
 
 public:
-  explicit RandomAddr(const ::r2::u64 &space, const ::r2::u64 off)
-      : space(space), off(off) {}
-  ::r2::u64 gen(::test::FastRandom &rand) {
-    return (off + rand.next() % space) + off;
+  explicit RandomAddr(const ::r2::u64 &space, const ::r2::u64 off,
+                      const ::r2::u64 &align = 1)
+      : space(space), off(off), align(align) {}
+
+  ::r2::u64 gen(::test::FastRandom &rand) override {
+    auto res = rand.next() % space;
+    return off + res - res % align;
   }
 };
 
@@ -33,4 +53,240 @@ public:
   }
 };
 
+/*!
+  Zipfian ranks in [0, n), following YCSB's ZipfianGenerator (Gray et al.,
+  "Quickly generating billion-record synthetic databases").
+  Rank 0 is the most popular one.
+  zeta(n) is computed exactly for the first kExactTerms terms, and the rest
+  is approximated by an integral, so that large spaces are cheap to set up.
+ */
+class ZipfRank {
+  static constexpr ::r2::u64 kExactTerms = 1 << 20;
+
+  const ::r2::u64 n;
+  const double theta;
+  double alpha, zetan, eta, half_pow_theta;
+
+public:
+  ZipfRank(const ::r2::u64 &n, const double &theta) : n(n), theta(theta) {
+    RDMA_ASSERT(n > 0);
+    RDMA_ASSERT(theta > 0 && theta < 1) << "zipf theta must be in (0, 1)";
+    alpha = 1.0 / (1.0 - theta);
+    zetan = zeta(n, theta);
+    eta = (1 - std::pow(2.0 / n, 1 - theta)) / (1 - zeta(2, theta) / zetan);
+    half_pow_theta = 1 + std::pow(0.5, theta);
+  }
+
+  ::r2::u64 next(::test::FastRandom &rand) const {
+    const double u = rand.next_uniform();
+    const double uz = u * zetan;
+    if (uz < 1.0)
+      return 0;
+    if (uz < half_pow_theta)
+      return 1 % n;
+    auto res = static_cast<::r2::u64>(n * std::pow(eta * u - eta + 1, alpha));
+    return res >= n ? n - 1 : res;
+  }
+
+  static double zeta(const ::r2::u64 &n, const double &theta) {
+    const auto exact = n < kExactTerms ? n : kExactTerms;
+    double sum = 0;
+    for (::r2::u64 i = 1; i <= exact; ++i)
+      sum += std::pow(static_cast<double>(i), -theta);
+    if (n > exact) {
+      // \sum_{i = exact + 1}^{n} i^-theta ~= \int_{exact + .5}^{n + .5}
+      sum += (std::pow(n + 0.5, 1 - theta) - std::pow(exact + 0.5, 1 - theta)) /
+             (1 - theta);
+    }
+    return sum;
+  }
+};
+
+/*!
+  Scrambled Zipfian: the ranks are hashed over the space, so the hot items
+  are spread rather than clustered at the beginning of the space.
+ */
+class ZipfAddr : public AbsAddrGen {
+  const ::r2::u64 off;
+  const ::r2::u64 align;
+  const ::r2::u64 items;
+  ZipfRank zipf;
+
+public:
+  ZipfAddr(const ::r2::u64 &space, const ::r2::u64 &off, const double &theta,
+           const ::r2::u64 &align = 64)
+      : off(off), align(align), items(space / align), zipf(items, theta) {}
+
+  ::r2::u64 gen(::test::FastRandom &rand) override {
+    return off + (fnv_hash(zipf.next(rand)) % items) * align;
+  }
+
+  // FNV-1a 64
+  static ::r2::u64 fnv_hash(::r2::u64 v) {
+    ::r2::u64 h = 0xcbf29ce484222325ULL;
+    for (int i = 0; i < 8; ++i) {
+      h ^= v & 0xff;
+      h *= 0x100000001b3ULL;
+      v >>= 8;
+    }
+    return h;
+  }
+};
+
+/*!
+  hot_ops of the accesses go to the first hot_space of the space, the others
+  are uniformly distributed over the rest.
+ */
+class HotspotAddr : public AbsAddrGen {
+  const ::r2::u64 off;
+  const ::r2::u64 align;
+  const ::r2::u64 items;
+  const ::r2::u64 hot_items;
+  const double hot_ops;
+
+public:
+  HotspotAddr(const ::r2::u64 &space, const ::r2::u64 &off,
+              const double &hot_ops, const double &hot_space,
+              const ::r2::u64 &align = 64)
+      : off(off), align(align), items(space / align),
+        hot_items(std::max<::r2::u64>(
+            1, std::min<::r2::u64>(items, items * hot_space))),
+        hot_ops(hot_ops) {
+    RDMA_ASSERT(items > 0);
+  }
+
+  ::r2::u64 gen(::test::FastRandom &rand) override {
+    ::r2::u64 item = 0;
+    if (hot_items == items || rand.next_uniform() < hot_ops)
+      item = rand.next() % hot_items;
+    else
+      item = hot_items + rand.next() % (items - hot_items);
+    return off + item * align;
+  }
+};
+
+/*!
+  The latest distribution of YCSB: recently inserted items are the most
+  popular. Items are "inserted" at the head of a ring over the space, which
+  moves forward with probability insert_prop at each generation.
+ */
+class LatestAddr : public AbsAddrGen {
+  const ::r2::u64 off;
+  const ::r2::u64 align;
+  const ::r2::u64 items;
+  const double insert_prop;
+  ZipfRank zipf;
+  ::r2::u64 head = 0;
+
+public:
+  LatestAddr(const ::r2::u64 &space, const ::r2::u64 &off, const double &theta,
+             const ::r2::u64 &align = 64, const double &insert_prop = 0.05)
+      : off(off), align(align), items(space / align), insert_prop(insert_prop),
+        zipf(items, theta) {}
+
+  ::r2::u64 gen(::test::FastRandom &rand) override {
+    if (rand.next_uniform() < insert_prop)
+      head = (head + 1) % items;
+    auto item = (head + items - zipf.next(rand)) % items;
+    return off + item * align;
+  }
+};
+
+/*!
+  Optane interleaves the physical address space among the DIMMs of a socket
+  every *interleave* bytes (4KB by default), so [k * interleave, (k + 1) *
+  interleave) belongs to DIMM k % num_dimms.
+  DimmAddr only generates addresses on one DIMM, either by striding through
+  its chunks sequentially, or by randomly picking a chunk and an offset.
+  Each thread can therefore target a (different) DIMM.
+ */
+class DimmAddr : public AbsAddrGen {
+  const ::r2::u64 off;
+  const ::r2::u64 align;
+  const ::r2::u64 interleave;
+  const ::r2::u64 num_dimms;
+  const ::r2::u64 dimm;
+  const ::r2::u64 chunks;     // #chunks of the DIMM in the space
+  const ::r2::u64 per_chunk;  // #aligned items per chunk
+  const bool random;
+  ::r2::u64 cur = 0;
+
+public:
+  DimmAddr(const ::r2::u64 &space, const ::r2::u64 &off,
+           const ::r2::u64 &num_dimms, const ::r2::u64 &dimm,
+           const bool &random = true, const ::r2::u64 &align = 256,
+           const ::r2::u64 &interleave = 4096)
+      : off(off), align(align), interleave(interleave), num_dimms(num_dimms),
+        dimm(dimm % num_dimms),
+        chunks((space / interleave + num_dimms - 1 - dimm % num_dimms) /
+               num_dimms),
+        per_chunk(interleave / align), random(random) {
+    RDMA_ASSERT(chunks > 0 && per_chunk > 0)
+        << "space too small for dimm " << dimm << " of " << num_dimms;
+  }
+
+  ::r2::u64 gen(::test::FastRandom &rand) override {
+    ::r2::u64 chunk, item;
+    if (random) {
+      chunk = rand.next() % chunks;
+      item = rand.next() % per_chunk;
+    } else {
+      chunk = (cur / per_chunk) % chunks;
+      item = cur % per_chunk;
+      cur += 1;
+    }
+    return off + (chunk * num_dimms + dimm) * interleave + item * align;
+  }
+};
+
+/*!
+  The parameters to create an address generator, typically from flags.
+ */
+struct AddrGenConfig {
+  // uniform | zipf | hotspot | latest | dimm | dimm_seq
+  std::string dist = "uniform";
+  ::r2::u64 align = 64;
+  double theta = 0.99;     // zipf, latest
+  double hot_ops = 0.9;    // hotspot
+  double hot_space = 0.1;  // hotspot
+  ::r2::u64 num_dimms = 6; // dimm
+  ::r2::u64 interleave = 4096;
+};
+
+/*!
+  Create a generator over [off, off + space).
+  id (e.g., the thread id) selects the DIMM of the dimm distributions.
+
+  Example:
+  `
+  auto gen = create_addr_gen({.dist = "zipf", .align = 256}, space, 0).value();
+  auto addr = gen->gen(rand);
+  `
+ */
+inline ::rdmaio::Option<std::shared_ptr<AbsAddrGen>>
+create_addr_gen(const AddrGenConfig &config, const ::r2::u64 &space,
+                const ::r2::u64 &off, const ::r2::u64 &id = 0) {
+  if (config.align == 0 || space < config.align)
+    return {};
+  const auto &d = config.dist;
+  if (d == "uniform")
+    return std::make_shared<RandomAddr>(space, off, config.align);
+  if (d == "zipf")
+    return std::make_shared<ZipfAddr>(space, off, config.theta, config.align);
+  if (d == "hotspot")
+    return std::make_shared<HotspotAddr>(space, off, config.hot_ops,
+                                         config.hot_space, config.align);
+  if (d == "latest")
+    return std::make_shared<LatestAddr>(space, off, config.theta,
+                                        config.align);
+  if (d == "dimm" || d == "dimm_seq") {
+    if (space < config.interleave * config.num_dimms)
+      return {};
+    return std::make_shared<DimmAddr>(space, off, config.num_dimms, id,
+                                      d == "dimm", config.align,
+                                      config.interleave);
+  }
+  return {};
+}
+
 } // namespace nvm
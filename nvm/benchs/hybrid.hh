@@ -0,0 +1,391 @@
+#pragma once
+
+#include <algorithm>
+#include <sstream>
+#include <string>
+
+#include "r2/src/libroutine.hh"
+
+#include "rlib/core/qps/transport.hh"
+#include "rlib/core/utils/timer.hh"
+
+#include "./two_sided/proto.hh"
+
+namespace nvm {
+
+using namespace rdmaio;
+using namespace rdmaio::qp;
+
+// the logical ops of a HybridClient
+enum HybridOp : u8 { HRead = 0, HWrite, HPWrite, kNumHybridOps };
+
+enum HybridPath : u8 { OneSided = 0, TwoSided, kNumHybridPaths };
+
+/*!
+  HybridModel estimates the latency of an op of sz bytes on each path, and
+  routes the op to the cheapest one.
+  - It is seeded with a linear model (base_us + per_kb_us * KB) per
+    (path, op), e.g., from a calibration run;
+  - once a (path, op, size class) is sampled, the EWMA of its observed
+    latencies overrides the seed;
+  - a (path, op, class) without a seed nor a sample is tried first, and
+    every explore-th op of a (op, class) takes the other path, so that a
+    path which becomes cheaper (e.g., the server is less loaded) is noticed.
+  A model is used by one thread (all its coroutines), so it takes no lock.
+
+  The spec is like "one.read=1.8+0.2,rpc.pwrite=3.1+0.4,explore=64,
+  alpha=0.1", where the paths are one (one-sided) and rpc (two-sided), and
+  the ops are read, write and pwrite (persistent write). "default" (or an
+  empty spec) has no seeds.
+  to_str() fits the seeds from the samples in the same format, so a
+  calibration run's model can seed the later ones.
+
+  Example:
+  `
+  auto model = HybridModel::parse("one.read=1.8+0.2,rpc.pwrite=3+0.4").value();
+  auto path = model.route(HPWrite, 256);
+  // ... execute the op on path
+  model.observe(path, HPWrite, 256, lat_us);
+  `
+ */
+struct HybridModel {
+  // 64B, 128B, ..., 4KB, and the larger ones
+  static const usize kNumClasses = 8;
+
+  struct Linear {
+    // < 0: unknown
+    double base_us = -1;
+    double per_kb_us = 0;
+
+    bool known() const { return base_us >= 0; }
+
+    double at(const u32 &sz) const { return base_us + per_kb_us * sz / 1024.0; }
+  };
+
+  struct Sample {
+    double ewma_us = 0;
+    u64 num = 0;
+  };
+
+  Linear seeds[kNumHybridPaths][kNumHybridOps];
+  Sample samples[kNumHybridPaths][kNumHybridOps][kNumClasses];
+  u64 routed[kNumHybridOps][kNumClasses] = {};
+
+  usize explore = 64;
+  double alpha = 0.1;
+
+  static Option<HybridModel> parse(const std::string &spec) {
+    HybridModel res;
+    std::istringstream iss(spec);
+    std::string item;
+    while (std::getline(iss, item, ',')) {
+      if (item.empty() || item == "default")
+        continue;
+      auto pos = item.find('=');
+      if (pos == std::string::npos)
+        return {};
+      auto key = item.substr(0, pos);
+      auto val = item.substr(pos + 1);
+      char *end = nullptr;
+      if (key == "explore") {
+        res.explore = std::strtoull(val.c_str(), &end, 10);
+        if (val.empty() || *end != '\0')
+          return {};
+        continue;
+      }
+      if (key == "alpha") {
+        res.alpha = std::strtod(val.c_str(), &end);
+        if (val.empty() || *end != '\0' || res.alpha <= 0 || res.alpha > 1)
+          return {};
+        continue;
+      }
+      auto path = path_of(key.substr(0, key.find('.')));
+      auto op = key.find('.') == std::string::npos
+                    ? Option<HybridOp>()
+                    : op_of(key.substr(key.find('.') + 1));
+      if (!path || !op)
+        return {};
+      // base+per_kb
+      Linear l;
+      l.base_us = std::strtod(val.c_str(), &end);
+      if (val.empty() || end == val.c_str() || l.base_us < 0)
+        return {};
+      if (*end == '+') {
+        const char *kb = end + 1;
+        l.per_kb_us = std::strtod(kb, &end);
+        if (end == kb)
+          return {};
+      }
+      if (*end != '\0')
+        return {};
+      res.seeds[path.value()][op.value()] = l;
+    }
+    return res;
+  }
+
+  /*!
+    The seeds (fitted from the samples, if any) in the spec format
+   */
+  std::string to_str() const {
+    std::ostringstream oss;
+    bool first = true;
+    for (uint p = 0; p < kNumHybridPaths; ++p) {
+      for (uint o = 0; o < kNumHybridOps; ++o) {
+        auto l = fit(static_cast<HybridPath>(p), static_cast<HybridOp>(o));
+        if (!l.known())
+          continue;
+        oss << (first ? "" : ",") << path_name(static_cast<HybridPath>(p))
+            << "." << op_name(static_cast<HybridOp>(o)) << "=" << l.base_us
+            << "+" << l.per_kb_us;
+        first = false;
+      }
+    }
+    oss << (first ? "" : ",") << "explore=" << explore << ",alpha=" << alpha;
+    return oss.str();
+  }
+
+  /*!
+    \ret the estimated latency (us), < 0 if unknown
+   */
+  double estimate(const HybridPath &path, const HybridOp &op,
+                  const u32 &sz) const {
+    auto &s = samples[path][op][class_of(sz)];
+    if (s.num > 0)
+      return s.ewma_us;
+    auto &l = seeds[path][op];
+    return l.known() ? l.at(sz) : -1;
+  }
+
+  HybridPath route(const HybridOp &op, const u32 &sz) {
+    auto &cnt = routed[op][class_of(sz)];
+    cnt += 1;
+    const double one = estimate(OneSided, op, sz);
+    const double rpc = estimate(TwoSided, op, sz);
+    if (one < 0)
+      return OneSided;
+    if (rpc < 0)
+      return TwoSided;
+    const HybridPath best = one <= rpc ? OneSided : TwoSided;
+    if (explore > 0 && cnt % explore == 0)
+      return best == OneSided ? TwoSided : OneSided;
+    return best;
+  }
+
+  void observe(const HybridPath &path, const HybridOp &op, const u32 &sz,
+               const double &us) {
+    auto &s = samples[path][op][class_of(sz)];
+    s.ewma_us = s.num == 0 ? us : (1 - alpha) * s.ewma_us + alpha * us;
+    s.num += 1;
+  }
+
+  static usize class_of(const u32 &sz) {
+    usize c = 0;
+    while (c + 1 < kNumClasses && sz > (64u << c))
+      c += 1;
+    return c;
+  }
+
+  static const char *path_name(const HybridPath &p) {
+    return p == OneSided ? "one" : "rpc";
+  }
+
+  static const char *op_name(const HybridOp &o) {
+    static const char *names[] = {"read", "write", "pwrite"};
+    return names[o];
+  }
+
+private:
+  static Option<HybridPath> path_of(const std::string &s) {
+    if (s == "one")
+      return OneSided;
+    if (s == "rpc")
+      return TwoSided;
+    return {};
+  }
+
+  static Option<HybridOp> op_of(const std::string &s) {
+    for (uint o = 0; o < kNumHybridOps; ++o) {
+      if (s == op_name(static_cast<HybridOp>(o)))
+        return static_cast<HybridOp>(o);
+    }
+    return {};
+  }
+
+  /*!
+    Least-squares fit of the sampled classes (by their upper sizes), or the
+    seed if less than two classes are sampled
+   */
+  Linear fit(const HybridPath &p, const HybridOp &o) const {
+    double n = 0, sx = 0, sy = 0, sxx = 0, sxy = 0;
+    for (uint c = 0; c < kNumClasses; ++c) {
+      auto &s = samples[p][o][c];
+      if (s.num == 0)
+        continue;
+      const double x = (64u << c) / 1024.0;
+      n += 1;
+      sx += x;
+      sy += s.ewma_us;
+      sxx += x * x;
+      sxy += x * s.ewma_us;
+    }
+    if (n == 0)
+      return seeds[p][o];
+    Linear res;
+    if (n == 1 || n * sxx == sx * sx) {
+      res.base_us = sy / n;
+      return res;
+    }
+    res.per_kb_us = std::max(0.0, (n * sxy - sx * sy) / (n * sxx - sx * sx));
+    res.base_us = std::max(0.0, (sy - res.per_kb_us * sx) / n);
+    return res;
+  }
+};
+
+/*!
+  The two-sided path of a HybridClient, implemented with the msg sessions
+  of the client. The server executes the Request on its NVM: a read copies
+  the data to the reply, and a write is persisted before the reply.
+ */
+class AbsRPCPath {
+public:
+  virtual ~AbsRPCPath() = default;
+
+  /*!
+    Send the request (with the payload in buf if it is a write), and yield
+    until its reply, whose data (of a read) is copied to buf
+   */
+  virtual Result<std::string> call(const Request &req, char *buf,
+                                   R2_ASYNC) = 0;
+};
+
+/*!
+  HybridClient executes the logical reads, writes and persistent writes of
+  the coroutines of a thread, each over the path the HybridModel predicts to
+  be the cheapest:
+  - one-sided: READ, WRITE, or WRITE followed by a READ of its last bytes
+    (a persistent write, since RC executes them in order);
+  - two-sided: an RPC, where the server persists a write locally.
+  The latency of each op is fed back to the model.
+
+  The one-sided transport should be bound with the local MR of the bufs and
+  the remote MR of the NVM, and is shared by the coroutines (the completion
+  of a request is identified by its coroutine id).
+
+  Example:
+  `
+  HybridClient client(transport, &rpc_path, model);
+  // in a coroutine
+  auto ret = client.execute(HPWrite, off, buf, 256, R2_ASYNC_WAIT);
+  `
+ */
+class HybridClient {
+  Arc<AbsTransport> one;
+  AbsRPCPath *rpc = nullptr;
+
+public:
+  HybridModel model;
+  // #ops of each (path, op)
+  u64 ops[kNumHybridPaths][kNumHybridOps] = {};
+
+  HybridClient(const Arc<AbsTransport> &one, AbsRPCPath *rpc,
+               const HybridModel &model)
+      : one(one), rpc(rpc), model(model) {
+    RDMA_ASSERT(one != nullptr || rpc != nullptr);
+  }
+
+  /*!
+    Execute op on the sz bytes at the remote NVM offset addr, using buf
+    (in the local MR) as the source of a write, or the destination of a read
+   */
+  Result<std::string> execute(const HybridOp &op, const u64 &addr, char *buf,
+                              const u32 &sz, R2_ASYNC) {
+    HybridPath path = one == nullptr   ? TwoSided
+                      : rpc == nullptr ? OneSided
+                                       : model.route(op, sz);
+    ::rdmaio::Timer t;
+    Result<std::string> res = path == OneSided
+                                  ? one_sided(op, addr, buf, sz, R2_ASYNC_WAIT)
+                                  : two_sided(op, addr, buf, sz, R2_ASYNC_WAIT);
+    if (likely(res == IOCode::Ok)) {
+      model.observe(path, op, sz,
+                    t.passed<std::chrono::nanoseconds>() / 1000.0);
+      ops[path][op] += 1;
+    }
+    return res;
+  }
+
+  std::string stats_str() const {
+    std::ostringstream oss;
+    for (uint p = 0; p < kNumHybridPaths; ++p) {
+      for (uint o = 0; o < kNumHybridOps; ++o) {
+        oss << (p + o == 0 ? "" : ", ")
+            << HybridModel::path_name(static_cast<HybridPath>(p)) << "."
+            << HybridModel::op_name(static_cast<HybridOp>(o)) << ": "
+            << ops[p][o];
+      }
+    }
+    return oss.str();
+  }
+
+private:
+  Result<std::string> two_sided(const HybridOp &op, const u64 &addr,
+                                char *buf, const u32 &sz, R2_ASYNC) {
+    Request req;
+    req.payload = sz;
+    req.addr = addr;
+    req.read = op == HRead ? 1 : 0;
+    return rpc->call(req, buf, R2_ASYNC_WAIT);
+  }
+
+  Result<std::string> one_sided(const HybridOp &op, const u64 &addr,
+                                char *buf, const u32 &sz, R2_ASYNC) {
+    const auto &lmr = one->local_mr.value();
+    const auto &rmr = one->remote_mr.value();
+
+    ibv_sge sges[2];
+    ibv_send_wr wrs[2];
+    memset(wrs, 0, sizeof(wrs));
+    sges[0] = {.addr = (u64)buf, .length = sz, .lkey = lmr.key};
+    wrs[0].opcode = op == HRead ? IBV_WR_RDMA_READ : IBV_WR_RDMA_WRITE;
+    wrs[0].num_sge = 1;
+    wrs[0].sg_list = &sges[0];
+    wrs[0].wr.rdma.remote_addr = rmr.buf + addr;
+    wrs[0].wr.rdma.rkey = rmr.key;
+    wrs[0].wr_id = R2_COR_ID();
+    wrs[0].send_flags = IBV_SEND_SIGNALED;
+
+    if (op == HPWrite) {
+      // read back the last bytes, which completes after the write is
+      // persisted (in the ADR domain) at the server, unless DDIO places it
+      // in the LLC
+      const u32 tail = std::min<u32>(sz, sizeof(u64));
+      wrs[0].send_flags = 0;
+      wrs[0].next = &wrs[1];
+      sges[1] = {.addr = (u64)(buf + sz - tail), .length = tail,
+                 .lkey = lmr.key};
+      wrs[1].opcode = IBV_WR_RDMA_READ;
+      wrs[1].num_sge = 1;
+      wrs[1].sg_list = &sges[1];
+      wrs[1].wr.rdma.remote_addr = rmr.buf + addr + sz - tail;
+      wrs[1].wr.rdma.rkey = rmr.key;
+      wrs[1].wr_id = R2_COR_ID();
+      wrs[1].send_flags = IBV_SEND_SIGNALED;
+    }
+
+    auto res = one->post_send(wrs[0]);
+    if (unlikely(res != IOCode::Ok))
+      return res;
+    while (true) {
+      auto wc = one->poll_for(R2_COR_ID());
+      if (wc) {
+        if (unlikely(wc.value().status != IBV_WC_SUCCESS))
+          return ::rdmaio::Err(
+              std::string(ibv_wc_status_str(wc.value().status)));
+        return ::rdmaio::Ok(std::string(""));
+      }
+      R2_YIELD;
+    }
+  }
+};
+
+} // namespace nvm
@@ -1,24 +1,152 @@
-
 #pragma once
 
-#include "r2/src/common.hh"
+#include <atomic>
+#include <vector>
+
+#include "rlib/core/common.hh" // for u64
 
 namespace nvm {
 
+using namespace rdmaio;
+
 /*!
-  Only record the *average* latency.
+  A log-bucketed (HDR-style) latency histogram.
+  Values (in nanoseconds) are bucketed by their highest kSubBits + 1
+  significant bits, so the relative error of any reported value is less
+  than 1 / 2^kSubBits (~3%), using a fixed number of buckets.
+
+  The histogram is written by its owner thread only, and can be concurrently
+  read by the reporter; so the recording is lock-free and uses no atomic RMW.
+
+  Example:
+  `
+  LatHistogram hist; // per-thread
+
+  r2::Timer t;
+  // ... issue a request and wait for it
+  hist.record_us(t.passed_msec());
+
+  LatSnapshot s;
+  s.merge(hist); // typically at the reporter
+  auto p99 = s.percentile(99);
+  `
  */
-struct FlatLatRecorder {
-  double cur_lat = 0.0;
-  ::r2::u64 counts = 1;
+class alignas(128) LatHistogram {
+public:
+  static constexpr u32 kSubBits = 5;
+  static constexpr u32 kSubBuckets = 1u << kSubBits;
+  static constexpr usize kNumBuckets = (64 - kSubBits + 1) * kSubBuckets;
 
-  FlatLatRecorder() = default;
+  static inline usize bucket_of(const u64 &v) {
+    if (v < kSubBuckets)
+      return static_cast<usize>(v);
+    const u32 msb = 63 - __builtin_clzll(v);
+    const u32 shift = msb - kSubBits;
+    return (shift + 1) * kSubBuckets +
+           static_cast<usize>((v >> shift) - kSubBuckets);
+  }
 
-  double get_lat() const { return cur_lat; }
+  /*!
+    The largest value (in ns) recorded to the bucket idx
+   */
+  static inline u64 bucket_upper(const usize &idx) {
+    if (idx < kSubBuckets)
+      return idx;
+    const u32 shift = idx / kSubBuckets - 1;
+    const u64 sub = idx % kSubBuckets;
+    return ((kSubBuckets + sub) << shift) + ((1ull << shift) - 1);
+  }
+
+  LatHistogram() {
+    for (usize i = 0; i < kNumBuckets; ++i)
+      counts[i].store(0, std::memory_order_relaxed);
+  }
+
+  inline void record(const u64 &ns) {
+    auto &c = counts[bucket_of(ns)];
+    c.store(c.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+  }
+
+  /*!
+    Record a latency measured in microseconds, e.g., by Timer::passed_msec()
+   */
+  inline void record_us(const double &us) {
+    record(us <= 0 ? 0 : static_cast<u64>(us * 1000));
+  }
+
+  inline u64 count_at(const usize &idx) const {
+    return counts[idx].load(std::memory_order_relaxed);
+  }
+
+private:
+  std::atomic<u64> counts[kNumBuckets];
+  DISABLE_COPY_AND_ASSIGN(LatHistogram);
+};
+
+/*!
+  A plain copy of (the sum of) LatHistograms, used by the reporter to compute
+  the percentiles.
+ */
+struct LatSnapshot {
+  std::vector<u64> counts;
+
+  LatSnapshot() : counts(LatHistogram::kNumBuckets, 0) {}
+
+  void merge(const LatHistogram &h) {
+    for (usize i = 0; i < counts.size(); ++i)
+      counts[i] += h.count_at(i);
+  }
+
+  void merge(const LatSnapshot &s) {
+    for (usize i = 0; i < counts.size(); ++i)
+      counts[i] += s.counts[i];
+  }
+
+  /*!
+    Return a snapshot of the values recorded since *prev*
+   */
+  LatSnapshot since(const LatSnapshot &prev) const {
+    LatSnapshot res;
+    for (usize i = 0; i < counts.size(); ++i)
+      res.counts[i] = counts[i] - prev.counts[i];
+    return res;
+  }
+
+  u64 total() const {
+    u64 sum = 0;
+    for (auto c : counts)
+      sum += c;
+    return sum;
+  }
+
+  /*!
+    The q-th (in [0, 100]) percentile, in microseconds; 0 if empty.
+   */
+  double percentile(const double &q) const {
+    const u64 num = total();
+    if (num == 0)
+      return 0;
+    u64 target = static_cast<u64>(q / 100.0 * num + 0.5);
+    if (target == 0)
+      target = 1;
+    u64 sum = 0;
+    for (usize i = 0; i < counts.size(); ++i) {
+      sum += counts[i];
+      if (sum >= target)
+        return LatHistogram::bucket_upper(i) / 1000.0;
+    }
+    return max();
+  }
 
-  void add_one(double lat) {
-    cur_lat += (lat - cur_lat) / counts;
-    counts += 1;
+  /*!
+    The max recorded value (up to the bucket precision), in microseconds
+   */
+  double max() const {
+    for (usize i = counts.size(); i > 0; --i) {
+      if (counts[i - 1] != 0)
+        return LatHistogram::bucket_upper(i - 1) / 1000.0;
+    }
+    return 0;
   }
 };
 
@@ -11,9 +11,10 @@
 #include "./gen_addr.hh"
 
 #include "two_sided/core.hh"
-#include "two_sided/r740.hh"
+#include "topology.hh"
 
 #include "../huge_region.hh"
+#include "../emu_region.hh"
 #include "../nvm_region.hh"
 
 #include "./statucs.hh"
@@ -22,15 +23,34 @@
 #include "./nt_memcpy.hh"
 
 DEFINE_string(nvm_file, "/dev/dax1.6", "Abstracted NVM device");
+DEFINE_string(nvm_emu, "",
+              "Emulate the NVM on DRAM instead of nvm_file, e.g., default, or "
+              "read_ns=300,write_ns=100,write_bw=2300,wc_lines=64,file=/path");
 DEFINE_uint64(nvm_sz, 10, "Mapped sz (in GB), should be larger than 2MB");
 DEFINE_int64(threads, 1, "Number of threads used.");
+DEFINE_string(bind_policy, "compact",
+              "How threads are pinned to cpus: compact | scatter | nic | nvm "
+              "| node:N | none, optionally suffixed with ,nosmt");
 DEFINE_int64(payload, 64, "Number of bytes to write");
 
 DEFINE_bool(clflush, false, "whether to flush write content");
+DEFINE_string(persist_kernel, "auto",
+              "How to persist NVM writes: auto | calibrate | nt | clwb | "
+              "clflushopt | clflush | barrier");
 
 DEFINE_bool(use_nvm, false, "whether to use NVM.");
 
 DEFINE_bool(random, false, "");
+DEFINE_string(addr_dist, "uniform",
+              "The distribution of random addresses: "
+              "uniform | zipf | hotspot | latest | dimm | dimm_seq");
+DEFINE_uint64(addr_align, 64,
+              "The alignment of random addresses, "
+              "e.g., 64 (cache line) or 256 (XPLine)");
+DEFINE_double(zipf_theta, 0.99, "The skewness of zipf and latest");
+DEFINE_double(hot_ops, 0.9, "The fraction of accesses to the hotspot");
+DEFINE_double(hot_space, 0.1, "The fraction of the space in the hotspot");
+DEFINE_uint64(num_dimms, 6, "The number of NVM DIMMs interleaved (every 4KB)");
 DEFINE_bool(round_up, false, "");
 DEFINE_uint32(round_payload, 256, "Roundup of the write payload");
 
@@ -47,23 +67,36 @@ volatile bool running = true;
 int NO_OPT main(int argc, char **argv) {
 
   gflags::ParseCommandLineFlags(&argc, &argv, true);
+  CoreBinder::init(FLAGS_bind_policy, {.nvm_file = FLAGS_nvm_file});
+  // the regions are per-thread, so no scratch area to calibrate on
+  RDMA_ASSERT(persist::init(FLAGS_persist_kernel))
+      << "invalid persist kernel: " << FLAGS_persist_kernel;
 
   LOG(4) << "Hello NVM!, using file: " << FLAGS_nvm_file;
 
   u64 sz = static_cast<u64>(FLAGS_nvm_sz) * (1024 * 1024 * 1024L);
 
+  // all threads map the same device, so they share one emulated region
+  Arc<MemoryRegion> emu_region = nullptr;
+  if (FLAGS_use_nvm && !FLAGS_nvm_emu.empty())
+    emu_region = EmuRegion::create(sz, FLAGS_nvm_emu).value();
+
   using TThread = Thread<int>;
   std::vector<std::unique_ptr<TThread>> threads;
   std::vector<Statics> statics(FLAGS_threads);
 
   for (uint thread_id = 0; thread_id < FLAGS_threads; ++thread_id) {
-    threads.push_back(std::make_unique<TThread>([thread_id, &statics, sz]() {
+    threads.push_back(std::make_unique<TThread>([thread_id, &statics, sz,
+                                                 emu_region]() {
       Arc<MemoryRegion> nvm_region = nullptr;
 
       if (FLAGS_use_nvm) {
         RDMA_LOG(4) << "server uses NVM with size: " << FLAGS_nvm_sz << " GB";
         u64 sz = static_cast<u64>(FLAGS_nvm_sz) * (1024 * 1024 * 1024L);
-        nvm_region = NVMRegion::create(FLAGS_nvm_file, sz).value();
+        if (emu_region != nullptr)
+          nvm_region = emu_region;
+        else
+          nvm_region = NVMRegion::create(FLAGS_nvm_file, sz).value();
       } else {
         RDMA_LOG(4) << "server uses DRAM (huge page)";
         u64 sz = static_cast<u64>(FLAGS_nvm_sz) * (1024 * 1024 * 1024L);
@@ -90,7 +123,15 @@ int NO_OPT main(int argc, char **argv) {
       u64 off = 0;
       // main evaluation loop
 
-      RandomAddr rgen(sz, 0); // random generator
+      // random generator, dimm distributions use a DIMM per thread
+      auto rgen = create_addr_gen({.dist = FLAGS_addr_dist,
+                                   .align = FLAGS_addr_align,
+                                   .theta = FLAGS_zipf_theta,
+                                   .hot_ops = FLAGS_hot_ops,
+                                   .hot_space = FLAGS_hot_space,
+                                   .num_dimms = FLAGS_num_dimms},
+                                  total_sz, 0, thread_id)
+                      .value();
 
       const usize access_gra = 1024 * 1024;
 
@@ -100,7 +141,7 @@ int NO_OPT main(int argc, char **argv) {
         // 64);
         u64 addr = 0;
         if (FLAGS_random) {
-          addr = rgen.gen(rand);
+          addr = rgen->gen(rand);
           if (FLAGS_round_up) {
             addr = round_up<u64>(addr, FLAGS_round_payload);
             ASSERT(addr % FLAGS_round_payload == 0);
@@ -149,6 +190,7 @@ int NO_OPT main(int argc, char **argv) {
           //ASSERT(memcpy_flush_write(local_buf, FLAGS_payload, server_buf_ptr)
           //>= FLAGS_payload);
           memcpy(server_buf_ptr, local_buf, FLAGS_payload);
+          emu::on_write(server_buf_ptr, FLAGS_payload);
         }
 #endif
         // ASSERT(nvm_read(local_buf, FLAGS_payload, server_buf_ptr) >=
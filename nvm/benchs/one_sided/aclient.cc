@@ -10,11 +10,14 @@
 #include "r2/src/rdma/sop.hh"
 
 #include "../thread.hh"
+#include "../topology.hh"
 
 #include "../statucs.hh"
 
 #include "../../huge_region.hh"
 
+#include "./transport_op.hh"
+
 DEFINE_string(addr, "localhost:8888", "Server address to connect to.");
 DEFINE_int64(use_nic_idx, 0, "Which NIC to create QP");
 DEFINE_int64(reg_nic_name, 73, "The name to register an opened NIC at rctrl.");
@@ -23,11 +26,18 @@ DEFINE_uint64(address_space, 4,
               "The random read/write space of the registered memory (in GB)");
 
 DEFINE_int64(threads, 8, "Number of threads to use.");
+DEFINE_string(bind_policy, "compact",
+              "How threads are pinned to cpus: compact | scatter | nic | nvm "
+              "| node:N | none, optionally suffixed with ,nosmt");
 
 DEFINE_uint64(coros, 8, "Number of coroutine used per thread.");
 
 DEFINE_int64(id, 0, "");
 
+DEFINE_string(report_file, "",
+              "The file to store the per-epoch JSON records, "
+              "which are always printed to stdout");
+
 using namespace rdmaio;
 using namespace rdmaio::rmem;
 using namespace rdmaio::qp;
@@ -39,54 +49,6 @@ using namespace test;
 
 using namespace nvm;
 
-static const int per_socket_cores = 12; // TODO!! hard coded
-// const int per_socket_cores = 8;//reserve 2 cores
-
-static int socket_0[] = {0,  2,  4,  6,  8,  10, 12, 14, 16, 18, 20, 22,
-                         24, 26, 28, 30, 32, 34, 36, 38, 40, 42, 44, 46};
-
-static int socket_1[] = {1,  3,  5,  7,  9,  11, 13, 15, 17, 19, 21, 23,
-                         25, 27, 29, 31, 33, 35, 37, 39, 41, 43, 45, 47};
-
-int BindToCore(int t_id) {
-
-  if (t_id >= (per_socket_cores * 2))
-    return 0;
-
-  int x = t_id;
-  int y = 0;
-
-#ifdef SCALE
-  assert(false);
-  // specific  binding for scale tests
-  int mac_per_node = 16 / nthreads; // there are total 16 threads avialable
-  int mac_num = current_partition % mac_per_node;
-
-  if (mac_num < mac_per_node / 2) {
-    y = socket_0[x + mac_num * nthreads];
-  } else {
-    y = socket_1[x + (mac_num - mac_per_node / 2) * nthreads];
-  }
-#else
-  // bind ,andway
-  if (x >= per_socket_cores) {
-    // there is no other cores in the first socket
-    y = socket_1[x - per_socket_cores];
-  } else {
-    y = socket_0[x];
-  }
-
-#endif
-
-  // fprintf(stdout,"worker: %d binding %d\n",x,y);
-  cpu_set_t mask;
-  CPU_ZERO(&mask);
-  CPU_SET(y, &mask);
-  sched_setaffinity(0, sizeof(mask), &mask);
-
-  return 0;
-}
-
 // issue RDMA requests in a window
 template <usize window_sz>
 void rdma_window(RC *qp, u64 *start_buf, FastRandom &rand, u64 &pending_reqs) {
@@ -138,6 +100,7 @@ void rdma_window(RC *qp, u64 *start_buf, FastRandom &rand, u64 &pending_reqs) {
 int main(int argc, char **argv) {
 
   gflags::ParseCommandLineFlags(&argc, &argv, true);
+  CoreBinder::init(FLAGS_bind_policy, {.nic_dev_id = FLAGS_use_nic_idx});
 
   RDMA_LOG(4) << "client bootstrap with " << FLAGS_threads << " threads";
 
@@ -151,6 +114,7 @@ int main(int argc, char **argv) {
   using TThread = Thread<int>;
   std::vector<std::unique_ptr<TThread>> threads;
   std::vector<Statics> statics(FLAGS_threads);
+  std::vector<LatHistogram> lat_hists(FLAGS_threads);
 
   auto address_space =
       static_cast<u64>(FLAGS_address_space) * (1024 * 1024 * 1024L);
@@ -189,8 +153,9 @@ int main(int argc, char **argv) {
   for (uint thread_id = 0; thread_id < FLAGS_threads; ++thread_id) {
 
     threads.push_back(std::make_unique<TThread>(
-        [thread_id, address_space, rmem, &statics, &ctrl]() -> int {
-          BindToCore(thread_id);
+        [thread_id, address_space, rmem, &statics, &lat_hists,
+         &ctrl]() -> int {
+          bind_to_core(thread_id);
           // 1. create a local QP to use
           // below are platform specific opts
           auto idx = 1;
@@ -271,12 +236,16 @@ int main(int argc, char **argv) {
 
           u64 *test_buf = (u64 *)((char *)(rmem->raw_ptr) + thread_id * 40960);
 
+          // qp has bound its MRs, which are inherited by the transport
+          Arc<AbsTransport> transport = RCTransport::create(qp).value();
+
           SScheduler ssched;
           for (uint i = 0; i < FLAGS_coros; ++i) {
-            ssched.spawn([test_buf, qp, thread_id, &sum, &statics,
-                          &rand](R2_ASYNC) {
+            ssched.spawn([test_buf, transport, thread_id, &sum, &statics,
+                          &lat_hists, &rand](R2_ASYNC) {
               r2::Timer timer;
-              SROp op;
+              r2::Timer op_t;
+              TOp op(&statics[thread_id]);
 
               const auto address_space =
                   static_cast<u64>(FLAGS_address_space) * (1024 * 1024 * 1024L);
@@ -285,15 +254,18 @@ int main(int argc, char **argv) {
 
               while (timer.passed_sec() < 100) {
               //while(1) {
+                op_t.reset();
                 u64 remote_addr = rand.next() % (address_space - 64);
                 op.set_read()
                     .set_payload(local_buf, sizeof(u64))
                     .set_remote_addr(remote_addr);
-                auto ret = op.execute(qp, IBV_SEND_SIGNALED, R2_ASYNC_WAIT);
+                auto ret =
+                    op.execute(transport, IBV_SEND_SIGNALED, R2_ASYNC_WAIT);
                 ASSERT(ret == IOCode::Ok);
 
                 sum += local_buf[0];
 
+                lat_hists[thread_id].record_us(op_t.passed_msec());
                 statics[thread_id].inc(1);
                 R2_YIELD;
               }
@@ -330,7 +302,7 @@ int main(int argc, char **argv) {
     t->start();
 
   sleep(1);
-  Reporter::report_thpt(statics, 200);
+  Reporter::report_thpt(statics, 200, lat_hists, FLAGS_report_file);
 
   RDMA_LOG(4) << "client returns";
 
@@ -0,0 +1,343 @@
+#include <gflags/gflags.h>
+
+#include <atomic>
+#include <deque>
+#include <iostream>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include "rlib/core/lib.hh"
+#include "rlib/core/qps/doorbell_helper.hh"
+#include "rlib/core/qps/loopback.hh"
+#include "rlib/tests/fast_random.hh"
+
+#include "../../huge_region.hh"
+
+DEFINE_string(transport, "loopback",
+              "loopback (in-process, no NIC) | rc (connect to a one-sided "
+              "server)");
+DEFINE_string(addr, "localhost:8888", "Server address to connect to (rc).");
+DEFINE_int64(use_nic_idx, 0, "Which NIC to create QP (rc).");
+DEFINE_int64(reg_nic_name, 0, "The name of the server's NIC to connect (rc).");
+DEFINE_uint64(remote_off, 0,
+              "Offset of the contended words in the remote MR, 4KB aligned");
+
+DEFINE_uint64(threads, 4, "#Threads, each has its own QP");
+DEFINE_double(seconds, 1, "Seconds to run each configuration");
+DEFINE_uint64(max_retries, 16,
+              "Failed attempts before a CAS-based op aborts; 0 aborts on the "
+              "first failure, e.g., as an OCC lock acquisition does");
+
+// each of the below is a comma-separated list, and all their combinations
+// are run
+DEFINE_string(ops, "cas,faa,masked", "cas | faa | masked");
+DEFINE_string(words, "1,8,64,4096", "#Contended 8-byte words");
+DEFINE_string(layouts, "line,xpline,distinct",
+              "line: words packed in cache lines (8B stride) | xpline: one "
+              "word per cache line (64B stride) | distinct: one word per "
+              "XPLine (256B stride)");
+DEFINE_string(batches, "1,8", "#Atomics posted per doorbell, at most 16");
+
+using namespace rdmaio;
+using namespace rdmaio::rmem;
+using namespace rdmaio::qp;
+
+using namespace nvm;
+using namespace test;
+
+namespace {
+
+/*!
+  The ops:
+  - cas: increment a word with CAS(cached, cached + 1); a failed CAS returns
+    the current value, which is cached to retry.
+  - faa: increment a word with FAA, which never fails.
+  - masked: increment the 8-bit field of the thread in a word.
+    ibverbs has no masked atomics (they are vendor extensions), so it is a
+    CAS on the whole word; a failure caused only by the other fields is
+    counted as a false conflict, which a masked CAS would not have.
+ */
+enum AtomicOp { CAS = 0, FAA, Masked };
+
+struct Config {
+  AtomicOp op;
+  std::string op_name;
+  u64 words;
+  std::string layout;
+  u64 stride;
+  u64 batch;
+};
+
+struct alignas(128) ThreadStat {
+  u64 ops = 0;     // finished ops
+  u64 atomics = 0; // posted atomic verbs
+  u64 retries = 0; // failed attempts retried
+  u64 aborts = 0;  // ops given up after max_retries
+  u64 false_conflicts = 0;
+};
+
+// a logical op, which may take multiple attempts
+struct PendingOp {
+  u64 word = 0;
+  u64 attempts = 0;
+};
+
+const u64 kMaxWords = 1 << 16;
+const u64 kMaxStride = 256;
+
+std::vector<std::string> split(const std::string &s) {
+  std::vector<std::string> res;
+  std::istringstream iss(s);
+  std::string item;
+  while (std::getline(iss, item, ','))
+    if (!item.empty())
+      res.push_back(item);
+  return res;
+}
+
+Arc<AbsTransport> create_transport(const Arc<LoopbackMem> &mem,
+                                   const RegAttr &loop_remote,
+                                   const Arc<RMem> &local) {
+  const auto config =
+      QPConfig().set_max_send(std::max<int>(kRcMaxSendSz, kNMaxDoorbell));
+  Arc<AbsTransport> t = nullptr;
+  if (FLAGS_transport == "loopback") {
+    t = LoopbackTransport::create(mem, config).value();
+    t->bind_local_mr(mem->reg(local).value());
+    t->bind_remote_mr(loop_remote);
+    return t;
+  }
+
+  auto nic =
+      RNic::create(RNicInfo::query_dev_names().at(FLAGS_use_nic_idx)).value();
+  auto rc = RC::create(nic, config).value();
+
+  ConnectManager cm(FLAGS_addr);
+  if (cm.wait_ready(1000000, 2) == IOCode::Timeout)
+    RDMA_ASSERT(false) << "cm connect to server timeout";
+
+  auto qp_res = cm.cc_rc("atomic_bench:" + std::to_string(rand()), rc,
+                         FLAGS_reg_nic_name, config);
+  RDMA_ASSERT(qp_res == IOCode::Ok) << std::get<0>(qp_res.desc);
+
+  auto fetch_res = cm.fetch_remote_mr(FLAGS_reg_nic_name);
+  RDMA_ASSERT(fetch_res == IOCode::Ok) << std::get<0>(fetch_res.desc);
+
+  auto local_mr = RegHandler::create(local, nic).value();
+  t = RCTransport::create(rc).value();
+  t->bind_local_mr(local_mr->get_reg_attr().value());
+  t->bind_remote_mr(std::get<1>(fetch_res.desc));
+  return t;
+}
+
+/*!
+  Keep posting doorbells of cfg.batch atomics, retrying the failed CAS.
+ */
+void run_thread(const uint &id, const Config &cfg, const Arc<AbsTransport> &t,
+                const Arc<RMem> &local, ThreadStat *stat,
+                std::atomic<bool> *running) {
+  const auto lkey = t->local_mr.value().key;
+  const auto &rmr = t->remote_mr.value();
+  // the returned values of the batch
+  u64 *results = reinterpret_cast<u64 *>(local->raw_ptr);
+  // the (possibly stale) values of the words seen by this thread
+  std::vector<u64> cache(cfg.words, 0);
+  // the field of this thread in a word, for masked
+  const u64 shift = (id % 8) * 8;
+  const u64 field = static_cast<u64>(0xff) << shift;
+
+  FastRandom rand(0xdeadbeaf + id);
+  std::deque<PendingOp> retrying;
+  std::vector<PendingOp> batch(cfg.batch);
+  std::vector<u64> expected(cfg.batch);
+
+  DoorbellHelper<kNMaxDoorbell> doorbell(cfg.op == FAA
+                                             ? IBV_WR_ATOMIC_FETCH_AND_ADD
+                                             : IBV_WR_ATOMIC_CMP_AND_SWP);
+  while (running->load(std::memory_order_relaxed)) {
+    for (uint i = 0; i < cfg.batch; ++i) {
+      if (!retrying.empty()) {
+        batch[i] = retrying.front();
+        retrying.pop_front();
+      } else
+        batch[i] = PendingOp{.word = rand.next() % cfg.words, .attempts = 0};
+
+      auto &cached = cache[batch[i].word];
+      u64 swap = cached + 1;
+      if (cfg.op == Masked)
+        swap = (cached & ~field) | ((cached + (1ul << shift)) & field);
+      expected[i] = cached;
+      // a later atomic of the batch to the same word executes after this
+      // one (RC executes in order), so it expects this one's swap; the
+      // results below restore the cache in the same order
+      cached = swap;
+
+      doorbell.next();
+      doorbell.cur_sge() = {.addr = reinterpret_cast<u64>(results + i),
+                            .length = sizeof(u64),
+                            .lkey = lkey};
+      auto &wr = doorbell.cur_wr();
+      wr.opcode = cfg.op == FAA ? IBV_WR_ATOMIC_FETCH_AND_ADD
+                                : IBV_WR_ATOMIC_CMP_AND_SWP;
+      wr.send_flags = (i + 1 == cfg.batch) ? IBV_SEND_SIGNALED : 0;
+      wr.wr.atomic.remote_addr =
+          rmr.buf + FLAGS_remote_off + batch[i].word * cfg.stride;
+      wr.wr.atomic.rkey = rmr.key;
+      wr.wr.atomic.compare_add = cfg.op == FAA ? 1 : expected[i];
+      wr.wr.atomic.swap = swap;
+      wr.wr_id = i;
+    }
+    doorbell.freeze();
+    auto res = t->post_send(*doorbell.first_wr_ptr());
+    RDMA_ASSERT(res == IOCode::Ok) << "post error: " << res.desc;
+    auto res_p = t->wait_one_comp();
+    RDMA_ASSERT(res_p == IOCode::Ok)
+        << "completion error: " << Dummy::wc_status(res_p.desc);
+    stat->atomics += cfg.batch;
+
+    // RC completes in order, so all the results are ready
+    for (uint i = 0; i < cfg.batch; ++i) {
+      const u64 old = results[i];
+      auto &op = batch[i];
+      if (cfg.op == FAA) {
+        cache[op.word] = old + 1;
+        stat->ops += 1;
+        continue;
+      }
+      if (old == expected[i]) {
+        cache[op.word] = doorbell.wrs[i].wr.atomic.swap;
+        stat->ops += 1;
+        continue;
+      }
+      // failed, the returned value is the current one
+      cache[op.word] = old;
+      if (cfg.op == Masked && (old & field) == (expected[i] & field))
+        stat->false_conflicts += 1;
+      op.attempts += 1;
+      if (op.attempts > FLAGS_max_retries) {
+        stat->aborts += 1;
+        continue;
+      }
+      stat->retries += 1;
+      retrying.push_back(op);
+    }
+    doorbell.clear();
+  }
+}
+
+void run(const Config &cfg, std::vector<Arc<AbsTransport>> &ts,
+         std::vector<Arc<RMem>> &locals, char *loop_remote) {
+  if (loop_remote != nullptr)
+    memset(loop_remote + FLAGS_remote_off, 0, cfg.words * cfg.stride);
+
+  std::vector<ThreadStat> stats(FLAGS_threads);
+  std::atomic<bool> running(true);
+  std::vector<std::thread> workers;
+  Timer timer;
+  for (uint i = 0; i < FLAGS_threads; ++i)
+    workers.push_back(std::thread(run_thread, i, std::cref(cfg),
+                                  std::cref(ts[i]), std::cref(locals[i]),
+                                  &stats[i], &running));
+  std::this_thread::sleep_for(
+      std::chrono::microseconds(static_cast<u64>(FLAGS_seconds * 1000000)));
+  running = false;
+  for (auto &w : workers)
+    w.join();
+  const double sec = timer.passed_msec() / 1000000.0;
+
+  ThreadStat sum;
+  for (auto &s : stats) {
+    sum.ops += s.ops;
+    sum.atomics += s.atomics;
+    sum.retries += s.retries;
+    sum.aborts += s.aborts;
+    sum.false_conflicts += s.false_conflicts;
+  }
+  const double attempts = std::max<u64>(1, sum.atomics);
+  std::cout << "{\"op\":\"" << cfg.op_name << "\",\"transport\":\""
+            << FLAGS_transport << "\",\"threads\":" << FLAGS_threads
+            << ",\"words\":" << cfg.words << ",\"layout\":\"" << cfg.layout
+            << "\",\"stride\":" << cfg.stride << ",\"batch\":" << cfg.batch
+            << ",\"ops\":" << sum.ops << ",\"thpt\":" << sum.ops / sec
+            << ",\"atomic_thpt\":" << sum.atomics / sec
+            << ",\"retry_rate\":" << sum.retries / attempts
+            << ",\"abort_rate\":"
+            << sum.aborts / static_cast<double>(
+                                std::max<u64>(1, sum.ops + sum.aborts))
+            << ",\"false_conflicts\":" << sum.false_conflicts << "}"
+            << std::endl;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  RDMA_ASSERT(FLAGS_threads > 0);
+  RDMA_ASSERT(FLAGS_remote_off % 4096 == 0);
+  RDMA_ASSERT(FLAGS_transport == "loopback" || FLAGS_transport == "rc")
+      << "unknown transport: " << FLAGS_transport;
+
+  std::vector<Config> configs;
+  for (auto &op : split(FLAGS_ops)) {
+    for (auto &w : split(FLAGS_words)) {
+      for (auto &layout : split(FLAGS_layouts)) {
+        for (auto &b : split(FLAGS_batches)) {
+          Config cfg;
+          cfg.op_name = op;
+          if (op == "cas")
+            cfg.op = CAS;
+          else if (op == "faa")
+            cfg.op = FAA;
+          else if (op == "masked")
+            cfg.op = Masked;
+          else
+            RDMA_ASSERT(false) << "unknown op: " << op;
+
+          cfg.layout = layout;
+          if (layout == "line")
+            cfg.stride = sizeof(u64);
+          else if (layout == "xpline")
+            cfg.stride = 64;
+          else if (layout == "distinct")
+            cfg.stride = kMaxStride;
+          else
+            RDMA_ASSERT(false) << "unknown layout: " << layout;
+
+          cfg.words = std::stoull(w);
+          cfg.batch = std::stoull(b);
+          RDMA_ASSERT(cfg.words > 0 && cfg.words <= kMaxWords)
+              << "words should be in [1, " << kMaxWords << "]";
+          RDMA_ASSERT(cfg.batch > 0 && cfg.batch <= kNMaxDoorbell);
+          configs.push_back(cfg);
+        }
+      }
+    }
+  }
+
+  // the contended words of the loopback transport
+  auto mem = std::make_shared<LoopbackMem>();
+  auto remote_region =
+      DRAMRegion::create(FLAGS_remote_off + kMaxWords * kMaxStride).value();
+  RegAttr loop_remote;
+  if (FLAGS_transport == "loopback")
+    loop_remote =
+        mem->reg(remote_region->start_ptr(), remote_region->size()).value();
+
+  std::vector<Arc<RMem>> locals;
+  std::vector<Arc<DRAMRegion>> local_regions;
+  std::vector<Arc<AbsTransport>> ts;
+  for (uint i = 0; i < FLAGS_threads; ++i) {
+    local_regions.push_back(
+        std::make_shared<DRAMRegion>(kNMaxDoorbell * sizeof(u64)));
+    locals.push_back(local_regions.back()->convert_to_rmem().value());
+    ts.push_back(create_transport(mem, loop_remote, locals.back()));
+  }
+
+  for (auto &cfg : configs)
+    run(cfg, ts, locals,
+        FLAGS_transport == "loopback"
+            ? static_cast<char *>(remote_region->start_ptr())
+            : nullptr);
+  return 0;
+}
@@ -0,0 +1,279 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <limits>
+#include <set>
+
+#include "r2/src/libroutine.hh"
+
+#include "rlib/core/qps/doorbell_helper.hh"
+#include "rlib/core/qps/transport.hh"
+
+#include "../statucs.hh"
+
+namespace nvm {
+
+using namespace rdmaio;
+using namespace rdmaio::qp;
+
+struct BatcherConfig {
+  // the max #requests of a doorbell, up to kNMaxDoorbell
+  usize max_batch = kNMaxDoorbell;
+  // the latency SLO (in us) of a request, from its submission to completion
+  double slo_us = 10;
+  // the max time (in us) a request waits for others before it is posted
+  double max_wait_us = 2;
+};
+
+/*!
+  AdaptiveBatcher coalesces the one-sided requests submitted by all the
+  coroutines of a thread into doorbells, so that a doorbell (one MMIO) posts
+  many requests. Only the last request of a doorbell is signaled, and as RC
+  completes requests in order, its completion completes the whole doorbell.
+
+  A pending doorbell is posted when it reaches the current target size, when
+  every coroutine is waiting (no more requests can join it), or when its
+  first request has waited for max_wait_us.
+  The target size adapts to the completions (AIMD): it grows by one while
+  the requests meet the SLO, halves when they miss it, and is capped by the
+  measured CQ drain rate, i.e., the #requests the NIC completes within the
+  SLO.
+
+  The batcher owns the completions of its transport, so the transport should
+  not be used by others at the same time.
+
+  Example:
+  `
+  AdaptiveBatcher batcher(qp, {.max_batch = 16, .slo_us = 10}, &stat);
+  batcher.set_producers(coros);
+  // in each coroutine
+  auto ticket = batcher.add(IBV_WR_RDMA_WRITE, buf, 256, remote_off);
+  auto ret = batcher.wait(ticket, R2_ASYNC_WAIT);
+  `
+ */
+class AdaptiveBatcher {
+public:
+  // the sequence of the doorbell a request joins
+  using ticket_t = u64;
+
+  AdaptiveBatcher(const Arc<AbsTransport> &t, const BatcherConfig &config,
+                  Statics *stat = nullptr)
+      : t(t), config(config), stat(stat), doorbell(IBV_WR_RDMA_READ) {
+    this->config.max_batch =
+        std::max<usize>(1, std::min<usize>(config.max_batch, kNMaxDoorbell));
+  }
+
+  /*!
+    Set the number of coroutines submitting requests
+   */
+  void set_producers(const usize &n) { producers = n; }
+
+  /*!
+    Add a request to the pending doorbell, which may be posted on return.
+    remote_off is the offset in the remote MR bound to the transport.
+   */
+  ticket_t add(const ibv_wr_opcode &op, void *local, const u32 &len,
+               const u64 &remote_off) {
+    if (doorbell.full())
+      flush();
+    if (doorbell.empty()) {
+      first_enqueued = clock::now();
+      pending_bytes = 0;
+    }
+    const auto &lmr = t->local_mr.value();
+    const auto &rmr = t->remote_mr.value();
+
+    doorbell.next();
+    doorbell.cur_wr().opcode = op;
+    doorbell.cur_wr().send_flags = 0;
+    doorbell.cur_wr().wr_id = cur_seq;
+    doorbell.cur_wr().wr.rdma.remote_addr = rmr.buf + remote_off;
+    doorbell.cur_wr().wr.rdma.rkey = rmr.key;
+    doorbell.cur_sge() = {.addr = (u64)local, .length = len, .lkey = lmr.key};
+    pending_bytes += len;
+
+    const ticket_t res = cur_seq;
+    if (static_cast<usize>(doorbell.size()) >= cur_target)
+      flush();
+    return res;
+  }
+
+  /*!
+    Post the pending doorbell, if any
+   */
+  bool flush() {
+    if (doorbell.empty())
+      return true;
+    doorbell.cur_wr().send_flags = IBV_SEND_SIGNALED;
+    inflight.push_back({.seq = cur_seq,
+                        .num = static_cast<usize>(doorbell.size()),
+                        .bytes = pending_bytes,
+                        .enqueued = first_enqueued,
+                        .posted = clock::now()});
+
+    doorbell.freeze();
+    auto start = read_tsc();
+    auto res = t->post_send(*doorbell.first_wr_ptr());
+    if (stat != nullptr)
+      stat->add_post(read_tsc() - start);
+    doorbell.clear();
+
+    doorbells += 1;
+    requests += inflight.back().num;
+    cur_seq += 1;
+    if (unlikely(res != IOCode::Ok)) {
+      // the requests of the doorbell will never complete
+      inflight.pop_back();
+      failed.insert(cur_seq - 1);
+      return false;
+    }
+    return true;
+  }
+
+  /*!
+    Yield until the doorbell of ticket completes; meanwhile, post the pending
+    doorbell once it should be.
+   */
+  Result<ibv_wc> wait(const ticket_t &ticket, R2_ASYNC) {
+    waiting += 1;
+    // a failed doorbell is never completed, but a later one may be
+    bool posted = true;
+    while (true) {
+      if (unlikely(!failed.empty()) && failed.count(ticket) > 0) {
+        posted = false;
+        break;
+      }
+      if (ticket <= completed_seq)
+        break;
+      if (ticket == cur_seq && should_flush())
+        flush();
+      poll();
+      R2_YIELD;
+    }
+    waiting -= 1;
+    if (unlikely(!posted)) {
+      ibv_wc wc = {};
+      wc.status = IBV_WC_GENERAL_ERR;
+      return ::rdmaio::Err(wc);
+    }
+    if (unlikely(ticket >= err_seq))
+      return ::rdmaio::Err(err_wc);
+    return ::rdmaio::Ok(last_wc);
+  }
+
+  usize target() const { return cur_target; }
+
+  double avg_batch() const {
+    return doorbells == 0 ? 0 : static_cast<double>(requests) / doorbells;
+  }
+
+  u64 doorbells = 0;
+  u64 requests = 0;
+
+private:
+  using clock = std::chrono::steady_clock;
+
+  struct Inflight {
+    ticket_t seq;
+    usize num;
+    u64 bytes;
+    clock::time_point enqueued; // the submission of its first request
+    clock::time_point posted;
+  };
+
+  Arc<AbsTransport> t;
+  BatcherConfig config;
+  Statics *stat = nullptr;
+
+  DoorbellHelper<kNMaxDoorbell> doorbell;
+  u64 pending_bytes = 0;
+  clock::time_point first_enqueued;
+
+  ticket_t cur_seq = 1; // the sequence of the pending doorbell
+  ticket_t completed_seq = 0;
+  // the doorbells failed to post, which are rare
+  std::set<ticket_t> failed;
+  ticket_t err_seq = std::numeric_limits<ticket_t>::max();
+  ibv_wc last_wc = {};
+  ibv_wc err_wc = {};
+  std::deque<Inflight> inflight;
+
+  usize producers = 1;
+  usize waiting = 0;
+
+  // the adaptive states
+  usize cur_target = 1;
+  double lat_ewma = 0;   // us
+  double drain_ewma = 0; // completed requests per us
+
+  static double passed_us(const clock::time_point &since) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() -
+                                                                since)
+               .count() /
+           1000.0;
+  }
+
+  bool should_flush() const {
+    if (doorbell.empty())
+      return false;
+    return waiting >= producers ||
+           passed_us(first_enqueued) >= config.max_wait_us;
+  }
+
+  void poll() {
+    ibv_wc wcs[kPollBatch];
+    auto start = read_tsc();
+    auto n = t->poll_comps(kPollBatch, wcs);
+    if (stat != nullptr)
+      stat->add_poll(read_tsc() - start, n <= 0);
+
+    for (int i = 0; i < n; ++i) {
+      if (unlikely(wcs[i].status != IBV_WC_SUCCESS)) {
+        // the failed doorbell, and the ones after it, report the error
+        err_seq = std::min<ticket_t>(err_seq, wcs[i].wr_id);
+        err_wc = wcs[i];
+      } else {
+        last_wc = wcs[i];
+      }
+      completed_seq = std::max<ticket_t>(completed_seq, wcs[i].wr_id);
+      while (!inflight.empty() && inflight.front().seq <= completed_seq) {
+        const auto &b = inflight.front();
+        if (stat != nullptr)
+          stat->inc_bytes(b.bytes);
+        adapt(b.num, passed_us(b.posted), passed_us(b.enqueued));
+        inflight.pop_front();
+      }
+    }
+  }
+
+  /*!
+    Update the target size by a completed doorbell of num requests, which
+    were served in service_us, and whose first request waited lat_us
+   */
+  void adapt(const usize &num, const double &service_us,
+             const double &lat_us) {
+    const double alpha = 0.125;
+    lat_ewma = lat_ewma == 0 ? lat_us : (1 - alpha) * lat_ewma + alpha * lat_us;
+    if (service_us > 0) {
+      const double rate = num / service_us;
+      drain_ewma =
+          drain_ewma == 0 ? rate : (1 - alpha) * drain_ewma + alpha * rate;
+    }
+
+    const usize cap = std::max<usize>(
+        1, std::min<usize>(config.max_batch,
+                           static_cast<usize>(drain_ewma * config.slo_us)));
+    if (lat_ewma > config.slo_us)
+      cur_target = std::max<usize>(1, cur_target / 2);
+    else if (cur_target < cap)
+      cur_target += 1;
+    else
+      cur_target = cap;
+  }
+
+  DISABLE_COPY_AND_ASSIGN(AdaptiveBatcher);
+};
+
+} // namespace nvm
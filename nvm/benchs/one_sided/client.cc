@@ -1,6 +1,7 @@
 #include <gflags/gflags.h>
 #include <infiniband/verbs.h>
 #include <new>
+#include <mutex>
 
 #include "r2/src/libroutine.hh"
 #include "rlib/core/lib.hh"
@@ -12,16 +13,22 @@
 #include "../latency.hh"
 #include "../statucs.hh"
 #include "../thread.hh"
+#include "../topology.hh"
 
+#include "../../emu_region.hh"
 #include "../../huge_region.hh"
 
-DEFINE_int32(dimm_stride, 6, "");
+#include "./batcher.hh"
+#include "./sync_write.hh"
+#include "./transport_op.hh"
+
+DEFINE_int32(dimm_stride, 6,
+             "The number of NVM DIMMs interleaved (every 4KB) at the server");
 DEFINE_bool(two_qp, false, "use twp QPs in READ Read");
 DEFINE_bool(cross_dimm, false, "");
 DEFINE_bool(round_up, true, "");
 DEFINE_uint32(round_payload, 256, "Roundup of the write payload");
 DEFINE_string(addr, "localhost:8888", "Server address to connect to.");
-DEFINE_int64(numa_type, 0, "The layout of cpu id in the client");
 DEFINE_int64(use_nic_idx, 0, "Which NIC to create QP");
 DEFINE_int64(remote_nic_idx, 0, "Which NIC to create QP");
 DEFINE_int64(reg_nic_name, 73, "The name to register an opened NIC at rctrl.");
@@ -32,6 +39,9 @@ DEFINE_uint64(address_space, 1,
 DEFINE_uint32(seq_payload, 2, "The sequential read/write payload (in MB)");
 
 DEFINE_int64(threads, 8, "Number of threads to use.");
+DEFINE_string(bind_policy, "compact",
+              "How threads are pinned to cpus: compact | scatter | nic | nvm "
+              "| node:N | none, optionally suffixed with ,nosmt");
 
 DEFINE_uint64(window_sz, 10, "The window sz of each coroutine.");
 
@@ -46,13 +56,44 @@ DEFINE_bool(CAS, false, "");
 
 DEFINE_bool(add_sync, false, "");
 DEFINE_bool(random, false, "");
+DEFINE_string(addr_dist, "uniform",
+              "The distribution of random addresses: "
+              "uniform | zipf | hotspot | latest | dimm | dimm_seq");
+DEFINE_uint64(addr_align, 64,
+              "The alignment of random addresses, "
+              "e.g., 64 (cache line) or 256 (XPLine)");
+DEFINE_double(zipf_theta, 0.99, "The skewness of zipf and latest");
+DEFINE_double(hot_ops, 0.9, "The fraction of accesses to the hotspot");
+DEFINE_double(hot_space, 0.1, "The fraction of the space in the hotspot");
 
 DEFINE_uint64(coros, 8, "Number of coroutine used per thread.");
-DEFINE_bool(force_use_numa_node, false, "ff");
-DEFINE_uint64(use_numa_node, 0, "ffff");
 DEFINE_uint64(batch, 2, "ffff");
 DEFINE_bool(read_write, false, "rw");
 DEFINE_bool(doorbell, false, "using doorbell batching");
+DEFINE_bool(adaptive_batch, false,
+            "Coalesce the requests of all coroutines of a thread into "
+            "doorbells of an adaptive size, up to --batch");
+DEFINE_double(batch_slo_us, 10,
+              "The latency SLO (in us) bounding the adaptive batch size");
+DEFINE_double(batch_max_wait_us, 2,
+              "The max time (in us) a request waits to join a doorbell");
+DEFINE_double(write_ratio, -1,
+              "The fraction of writes with --adaptive_batch, "
+              "-1 to follow --use_read");
+DEFINE_string(report_file, "",
+              "The file to store the per-epoch JSON records, "
+              "which are always printed to stdout");
+DEFINE_string(transport, "rc",
+              "The transport of one-sided requests: rc | loopback. "
+              "loopback executes requests in-process without a NIC");
+DEFINE_bool(transport_stats, false,
+            "Report the NIC transport events (sysfs counters) and the "
+            "per-QP counters of each epoch, with the rc transport");
+DEFINE_string(sysfs_root, "/sys/class/infiniband",
+              "The sysfs root of the RDMA devices");
+DEFINE_string(nvm_emu, "",
+              "With the loopback transport, emulate the server's NVM timing, "
+              "e.g., default, or read_ns=300,write_ns=100,wc_lines=64");
 
 using namespace rdmaio;
 using namespace rdmaio::rmem;
@@ -67,97 +108,6 @@ using namespace r2::rdma;
 
 volatile bool running = true;
 
-static const int per_socket_cores = 56; // TODO!! hard coded
-// const int per_socket_cores = 8;//reserve 2 cores
-
-static int socket_0[] = {0,  1,  2,  3,  4,  5,  6,  7,  8,  9,  10, 11,
-                         12, 13, 14, 15, 16, 17, 36, 37, 38, 39, 40, 41,
-                         42, 43, 44, 45, 46, 47, 48, 49, 50, 51, 52, 53};
-
-static int socket_1[] = {18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29,
-                         30, 31, 32, 33, 34, 35, 54, 55, 56, 57, 58, 59,
-                         60, 61, 62, 63, 64, 65, 66, 67, 68, 69, 70, 71};
-
-int BindToCore(int t_id) {
-  // DPU
-  if (FLAGS_numa_type == 3) {
-    cpu_set_t mask;
-    CPU_ZERO(&mask);
-    CPU_SET(t_id, &mask);
-    sched_setaffinity(0, sizeof(mask), &mask);
-    return 0;
-  }
-
-  if (t_id >= (per_socket_cores * 2))
-    return 0;
-
-  int x = t_id;
-  int y = 0;
-
-#ifdef SCALE
-  assert(false);
-  // specific  binding for scale tests
-  int mac_per_node = 16 / nthreads; // there are total 16 threads avialable
-  int mac_num = current_partition % mac_per_node;
-
-  if (mac_num < mac_per_node / 2) {
-    y = socket_0[x + mac_num * nthreads];
-  } else {
-    y = socket_1[x + (mac_num - mac_per_node / 2) * nthreads];
-  }
-#else
-  // bind ,andway
-  if (FLAGS_force_use_numa_node) {
-    RDMA_ASSERT(x < per_socket_cores);
-    if (FLAGS_use_numa_node == 0) {
-      y = socket_0[x];
-    } else {
-      y = socket_1[x];
-    }
-  } else {
-    if (FLAGS_numa_type == 1)
-    {
-      if (FLAGS_use_nic_idx == 0)
-      {
-        if (x >= per_socket_cores) {
-          // there is no other cores in the first socket
-          y = 2 * (x - per_socket_cores) + 1;
-        } else {
-          y = 2 * x;
-        }     
-      }
-      else{
-        if (x >= per_socket_cores) {
-          // there is no other cores in the first socket
-          y = 2 * (x - per_socket_cores);
-        } else {
-          y = 2 * x + 1;
-        }  
-      }      
-    }
-    else
-    {
-      ASSERT(FLAGS_numa_type != 3);
-      if (x >= per_socket_cores) {
-        // there is no other cores in the first socket
-        y = socket_1[x - per_socket_cores];
-      } else {
-        y = socket_0[x];
-      }  
-    }
-  }
-
-#endif
-
-  // fprintf(stdout,"worker: %d binding %d\n",x,y);
-  cpu_set_t mask;
-  CPU_ZERO(&mask);
-  CPU_SET(y, &mask);
-  sched_setaffinity(0, sizeof(mask), &mask);
-
-  return 0;
-}
-
 template <typename T>
 static constexpr T round_up(const T &num, const T &multiple) {
   assert(multiple && ((multiple & (multiple - 1)) == 0));
@@ -264,6 +214,7 @@ void seq_bench();
 int main(int argc, char **argv) {
 
   gflags::ParseCommandLineFlags(&argc, &argv, true);
+  CoreBinder::init(FLAGS_bind_policy, {.nic_dev_id = FLAGS_use_nic_idx});
 
   std::vector<gflags::CommandLineFlagInfo> all_flags;
   gflags::GetAllFlags(&all_flags);
@@ -277,6 +228,12 @@ int main(int argc, char **argv) {
   using TThread = Thread<int>;
   std::vector<std::unique_ptr<TThread>> threads;
   std::vector<Statics> statics(FLAGS_threads + 1);
+  std::vector<LatHistogram> lat_hists(FLAGS_threads);
+
+  // the QPs created by the threads, reported with --transport_stats
+  std::mutex created_lock;
+  std::vector<Arc<RC>> created_qps;
+  std::vector<Arc<RNic>> created_nics;
 
   auto address_space =
       static_cast<u64>(FLAGS_address_space) * (1024 * 1024 * 1024L) -
@@ -287,12 +244,50 @@ int main(int argc, char **argv) {
   } else {
     RDMA_LOG(4) << "eval use one-sided WRITE";
   }
+  // the in-process memory accessed by the loopback transport,
+  // it mimics the NVM and DRAM MRs registered at the server
+  Arc<LoopbackMem> loopback_mem = nullptr;
+  Arc<MemoryRegion> loopback_nvm = nullptr;
+  Arc<MemoryRegion> loopback_dram = nullptr;
+  // the (shared) remote MRs are registered once, and each thread only
+  // registers its local buffer
+  RegAttr loopback_nvm_mr;
+  RegAttr loopback_dram_mr;
+  if (FLAGS_transport == "loopback") {
+    RDMA_ASSERT(FLAGS_threads + 2 <= kMaxLoopbackMRs)
+        << "too many threads for the loopback MRs: " << FLAGS_threads;
+    RDMA_LOG(4) << "eval use the loopback transport";
+    loopback_mem = std::make_shared<LoopbackMem>();
+    const u64 nvm_sz = FLAGS_address_space * (1024 * 1024 * 1024L);
+    if (FLAGS_nvm_emu.empty())
+      loopback_nvm = DRAMRegion::create(nvm_sz).value();
+    else
+      loopback_nvm = EmuRegion::create(nvm_sz, FLAGS_nvm_emu).value();
+    loopback_dram = DRAMRegion::create(1024 * 1024 * 1024L * 2).value();
+
+    loopback_nvm_mr = loopback_mem
+                          ->reg(loopback_nvm->start_ptr(),
+                                loopback_nvm->size(), ::nvm::emu::on_access)
+                          .value();
+    loopback_dram_mr =
+        loopback_mem->reg(loopback_dram->start_ptr(), loopback_dram->size())
+            .value();
+  } else {
+    RDMA_ASSERT(FLAGS_transport == "rc")
+        << "unknown transport: " << FLAGS_transport;
+  }
+
   LOG(4) << "start to spawn " << FLAGS_threads << " threads";
 
   for (uint thread_id = 0; thread_id < FLAGS_threads; ++thread_id) {
 
     threads.push_back(std::make_unique<TThread>([thread_id, address_space,
-                                                 &statics]() -> int {
+                                                 &statics, &lat_hists,
+                                                 &created_lock, &created_qps,
+                                                 &created_nics,
+                                                 loopback_mem,
+                                                 loopback_nvm_mr,
+                                                 loopback_dram_mr]() -> int {
       // use huge page to for local RDMA buffer
       // auto huge_region = HugeRegion::create(2 * 1024 * 1024).value();
       auto huge_region = std::make_shared<DRAMRegion>(2 * 1024 * 1024);
@@ -306,64 +301,95 @@ int main(int argc, char **argv) {
             // since the region will use to the end
           });
 
-      BindToCore(thread_id);
-      // 1. create a local QP to use
-      // below are platform specific opts
-      auto idx = FLAGS_use_nic_idx;
+      bind_to_core(thread_id);
+
+      Arc<AbsTransport> qp = nullptr;
+      Arc<AbsTransport> qp2 = nullptr;
+      RegAttr remote_attr;
+      RegAttr dram_mr;
+      RegAttr local_attr;
+
+      if (loopback_mem != nullptr) {
+        // the loopback transport requires no NIC and no server
+        qp = LoopbackTransport::create(loopback_mem, QPConfig()).value();
+        qp2 = LoopbackTransport::create(loopback_mem, QPConfig()).value();
+
+        remote_attr = loopback_nvm_mr;
+        dram_mr = loopback_dram_mr;
+        local_attr = loopback_mem->reg(local_mem).value();
+      } else {
+        // 1. create a local QP to use
+        // below are platform specific opts
+        auto idx = FLAGS_use_nic_idx;
 #if 0
-      if (thread_id >= 12 && idx > 0)
-        idx -= 1;
+        if (thread_id >= 12 && idx > 0)
+          idx -= 1;
 #endif
-      auto nic = RNic::create(RNicInfo::query_dev_names().at(idx)).value();
-
-      auto qp = RC::create(nic, QPConfig()).value();
-      auto qp2 = RC::create(nic, QPConfig()).value();
-
-      // 2. create the pair QP at server using CM
-      ConnectManager cm(FLAGS_addr);
-      // RDMA_LOG(2) << "start to connect to server: " << FLAGS_addr;
-      auto wait_res = cm.wait_ready(2000000, 12);
-      if (wait_res ==
-          IOCode::Timeout) // wait 1 second for server to ready, retry 2 times
-        RDMA_ASSERT(false) << "cm connect to server timeout " << wait_res.desc;
-
-      char qp_name[64];
-      snprintf(qp_name, 64, "%rc:%d:@%d", thread_id, FLAGS_id);
-      u64 key = 0;
-
-      // int rnic_idx = idx;
-      int rnic_idx = FLAGS_remote_nic_idx;
-      //      int rnic_idx = 0;
-      // LOG(4) << "client use nic idx: " << rnic_idx << " @thread:" <<
-      // thread_id;
-      auto qp_res = cm.cc_rc(qp_name, qp, rnic_idx, QPConfig());
-      RDMA_ASSERT(qp_res == IOCode::Ok) << std::get<0>(qp_res.desc);
-      // RDMA_LOG(4) << "client fetch QP authentical key: " << key;
-      /**/
-      snprintf(qp_name, 64, "%rc:%d:@%d_2", thread_id, FLAGS_id);
-      auto qp_res2 = cm.cc_rc(qp_name, qp2, rnic_idx, QPConfig());
-      RDMA_ASSERT(qp_res2 == IOCode::Ok) << std::get<0>(qp_res2.desc);
-
-      // 3. create the local MR for usage, and create the remote MR for usage
-
-      auto local_mr = RegHandler::create(local_mem, nic).value();
-
-      auto fetch_res = cm.fetch_remote_mr(rnic_idx);
-      RDMA_ASSERT(fetch_res == IOCode::Ok) << std::get<0>(fetch_res.desc);
-      auto remote_attr = std::get<1>(fetch_res.desc);
-
-      fetch_res = cm.fetch_remote_mr(rnic_idx * 73 + 73);
-      RDMA_ASSERT(fetch_res == IOCode::Ok) << std::get<0>(fetch_res.desc);
-      auto dram_mr = std::get<1>(fetch_res.desc);
-
-      // RDMA_LOG(4) << "remote attr's key: " << remote_attr.key << " "
-      //<< local_mr->get_reg_attr().value().key;
+        auto nic = RNic::create(RNicInfo::query_dev_names().at(idx)).value();
+
+        auto rc = RC::create(nic, QPConfig()).value();
+        auto rc2 = RC::create(nic, QPConfig()).value();
+
+        // 2. create the pair QP at server using CM
+        ConnectManager cm(FLAGS_addr);
+        // RDMA_LOG(2) << "start to connect to server: " << FLAGS_addr;
+        auto wait_res = cm.wait_ready(2000000, 12);
+        if (wait_res ==
+            IOCode::Timeout) // wait 1 second for server to ready, retry 2 times
+          RDMA_ASSERT(false) << "cm connect to server timeout " << wait_res.desc;
+
+        char qp_name[64];
+        snprintf(qp_name, 64, "%rc:%d:@%d", thread_id, FLAGS_id);
+        u64 key = 0;
+
+        // int rnic_idx = idx;
+        int rnic_idx = FLAGS_remote_nic_idx;
+        //      int rnic_idx = 0;
+        // LOG(4) << "client use nic idx: " << rnic_idx << " @thread:" <<
+        // thread_id;
+        std::vector<std::string> qp_names = {qp_name};
+        snprintf(qp_name, 64, "%rc:%d:@%d_2", thread_id, FLAGS_id);
+        qp_names.push_back(qp_name);
+
+        // both QPs are created at the server in one round trip
+        auto qp_res = cm.cc_rc_batch(qp_names, {rc, rc2}, rnic_idx, QPConfig());
+        RDMA_ASSERT(qp_res == IOCode::Ok)
+            << std::get<0>(qp_res.desc.at(0)) << " "
+            << std::get<0>(qp_res.desc.at(1));
+        // RDMA_LOG(4) << "client fetch QP authentical key: " << key;
+
+        // 3. create the local MR for usage, and create the remote MR for usage
+
+        auto local_mr = RegHandler::create(local_mem, nic).value();
+
+        auto fetch_res = cm.fetch_remote_mr(rnic_idx);
+        RDMA_ASSERT(fetch_res == IOCode::Ok) << std::get<0>(fetch_res.desc);
+        remote_attr = std::get<1>(fetch_res.desc);
+
+        fetch_res = cm.fetch_remote_mr(rnic_idx * 73 + 73);
+        RDMA_ASSERT(fetch_res == IOCode::Ok) << std::get<0>(fetch_res.desc);
+        dram_mr = std::get<1>(fetch_res.desc);
+
+        // RDMA_LOG(4) << "remote attr's key: " << remote_attr.key << " "
+        //<< local_mr->get_reg_attr().value().key;
+
+        local_attr = local_mr->get_reg_attr().value();
+
+        qp = RCTransport::create(rc).value();
+        qp2 = RCTransport::create(rc2).value();
+        if (FLAGS_transport_stats) {
+          std::lock_guard<std::mutex> guard(created_lock);
+          created_qps.push_back(rc);
+          created_qps.push_back(rc2);
+          if (created_nics.empty())
+            created_nics.push_back(nic);
+        }
+      }
 
       qp->bind_remote_mr(remote_attr);
-      auto local_attr = local_mr->get_reg_attr().value();
       qp->bind_local_mr(local_attr);
-      qp2->bind_local_mr(local_attr);
       qp2->bind_remote_mr(remote_attr);
+      qp2->bind_local_mr(local_attr);
 
       // the benchmark code
 
@@ -375,7 +401,17 @@ int main(int argc, char **argv) {
       // const u64 four_h_mb = address_space / FLAGS_threads;
       ASSERT(four_h_mb > 0);
 
-      RandomAddr rgen(address_space, 0); // random generator
+      // random generator, dimm distributions use a DIMM per thread
+      auto rgen = create_addr_gen({.dist = FLAGS_addr_dist,
+                                   .align = FLAGS_addr_align,
+                                   .theta = FLAGS_zipf_theta,
+                                   .hot_ops = FLAGS_hot_ops,
+                                   .hot_space = FLAGS_hot_space,
+                                   .num_dimms = static_cast<u64>(
+                                       FLAGS_dimm_stride)},
+                                  address_space, 0,
+                                  thread_id + FLAGS_id * FLAGS_threads);
+      ASSERT(rgen) << "invalid address distribution: " << FLAGS_addr_dist;
       // RandomAddr rgen(four_h_mb, four_h_mb * thread_id);
       SeqAddr sgen(four_h_mb, four_h_mb * thread_id); // sequential generator
 
@@ -386,11 +422,19 @@ int main(int argc, char **argv) {
       SScheduler ssched;
       u64 *test_buf = (u64 *)(local_mem->raw_ptr);
 
+      AdaptiveBatcher batcher(qp,
+                              {.max_batch = FLAGS_batch,
+                               .slo_us = FLAGS_batch_slo_us,
+                               .max_wait_us = FLAGS_batch_max_wait_us},
+                              &statics[thread_id]);
+      batcher.set_producers(FLAGS_coros);
+
       // 4. Execute RDMA operations
       for (uint i = 0; i < FLAGS_coros; ++i) {
         ssched.spawn([local_attr, remote_attr, thread_id, test_buf, qp, qp2,
-                      &rand, four_h_mb, address_space, &statics, &rgen,
-                      &dram_mr, &sgen](R2_ASYNC) {
+                      &rand, four_h_mb, address_space, &statics,
+                      &lat_hists, rgen,
+                      &dram_mr, &sgen, &batcher](R2_ASYNC) {
           // auto my_buf_off = FLAGS_payload * thread_id;
           // u64 *my_buf = (u64 *)(my_buf_off + (char *)test_buf);
           u64 *my_buf = (u64 *)((char *)test_buf + R2_COR_ID() * 4096);
@@ -404,13 +448,16 @@ int main(int argc, char **argv) {
             assert(!FLAGS_use_read);
 
           // const u64 four_h_mb = 400 * 1024 * 1024;
-          SROp op;
-          SROp op2;
+          TOp op(&statics[thread_id]);
+          TOp op2(&statics[thread_id]);
 
-          FlatLatRecorder lats; // used to record lat
+          // used to record lat
+          LatHistogram &lats = lat_hists[thread_id];
+          u64 finished = 1;
 
           r2::Timer t;
           t.reset();
+          r2::Timer op_t;
 
           usize total_space = 4096;
 
@@ -429,6 +476,7 @@ int main(int argc, char **argv) {
           usize processed_ = 0;
 
           while (running) {
+            op_t.reset();
             /*
               We only record latency at the first thread.
               This is because latency timing using timer has overhead.
@@ -445,7 +493,7 @@ int main(int argc, char **argv) {
               {
                 // Create a batch of addresses to serve doorbell batching
                 while (true) {
-                  batch_addr[i] = rgen.gen(rand);
+                  batch_addr[i] = rgen.value()->gen(rand);
                   if (FLAGS_round_up) {
                     batch_addr[i] = round_up<usize>(batch_addr[i], FLAGS_round_payload);
                   }
@@ -453,7 +501,7 @@ int main(int argc, char **argv) {
                     auto start_addr = batch_addr[i] % 4096;
                     if (start_addr + FLAGS_payload > 4096) {
                       start_addr = 4096 - FLAGS_payload;
-                      batch_addr[i] = batch_addr[i] / 4096 + start_addr;
+                      batch_addr[i] = batch_addr[i] / 4096 * 4096 + start_addr;
                     }
                   }
                   // after round up, the addr may exceed the address space.
@@ -524,6 +572,19 @@ int main(int argc, char **argv) {
                   op.wait_one(qp, R2_ASYNC_WAIT);
                   auto ret3 = op2.execute(
                       qp2, IBV_SEND_SIGNALED | IBV_SEND_INLINE, R2_ASYNC_WAIT);
+                } else if (FLAGS_adaptive_batch) {
+                  // Case 3a: Coalescing the requests of all the coroutines
+                  // into doorbells, whose size adapts to the latency SLO
+                  bool write = !FLAGS_use_read;
+                  if (FLAGS_write_ratio >= 0)
+                    write = rand.next() % 10000 <
+                            static_cast<u64>(FLAGS_write_ratio * 10000);
+                  auto ticket = batcher.add(
+                      write ? IBV_WR_RDMA_WRITE : IBV_WR_RDMA_READ,
+                      &my_buf[0], FLAGS_payload, write_addr);
+                  auto ret = batcher.wait(ticket, R2_ASYNC_WAIT);
+                  ASSERT(ret == IOCode::Ok)
+                      << RC::wc_status(ret.desc) << " " << ret.code.name();
                 } else if (FLAGS_doorbell){
 // the doorbell version of the request
       // DoorbellHelper<2> *dp = new DoorbellHelper<2>(IBV_WR_RDMA_WRITE);
@@ -635,15 +696,22 @@ int main(int argc, char **argv) {
                   ::rdmaio::qp::Op op_cas;
                   op_cas.set_atomic_rbuf((u64 *)(remote_attr.buf+write_addr), remote_attr.key).set_cas(0,1);
                   op_cas.set_payload(my_buf, sizeof(u64), local_attr.key);
-   
+                  op_cas.set_flags(IBV_SEND_SIGNALED).set_wrid(R2_COR_ID());
+                  op_cas.wr.next = nullptr;
+
                   // post the requests
-                  auto ret = op_cas.execute(qp, IBV_SEND_SIGNALED);
+                  auto start = read_tsc();
+                  auto ret = qp->post_send(op_cas.wr);
+                  statics[thread_id].add_post(read_tsc() - start);
                   // could use poll_comp for waiting the resut to finish
                   ASSERT(ret == IOCode::Ok)
                       << "error" << ret.desc;
 
+                  start = read_tsc();
                   auto ret1 = qp->wait_one_comp();
+                  statics[thread_id].add_poll(read_tsc() - start, false);
                   ASSERT(ret1.code==rdmaio::IOCode::Ok) << "error: " << (u32)ret1.desc.status;
+                  statics[thread_id].inc_bytes(sizeof(u64));
 
                 }
                 else {
@@ -678,60 +746,15 @@ int main(int argc, char **argv) {
               // CASE 7: IGNORE THIS PART
 
 #if 1 // the doorbell version of the request
-      // DoorbellHelper<2> *dp = new DoorbellHelper<2>(IBV_WR_RDMA_WRITE);
-      // DoorbellHelper<2> &doorbell
               DoorbellHelper<2> doorbell(IBV_WR_RDMA_WRITE);
 
-              doorbell.next();
-
-              // 1. setup the write WR
-              doorbell.cur_wr().opcode = IBV_WR_RDMA_WRITE;
-              doorbell.cur_wr().send_flags =
-                  ((FLAGS_payload <= kMaxInlinSz) ? IBV_SEND_INLINE : 0);
-              doorbell.cur_wr().wr.rdma.remote_addr =
-                  remote_attr.buf + (write_addr);
-              doorbell.cur_wr().wr.rdma.rkey = remote_attr.key;
-
-              doorbell.cur_sge() = {.addr = (u64)(&my_buf[0]),
-                                    .length =
-                                        static_cast<uint32_t>(FLAGS_payload),
-                                    .lkey = local_attr.key};
-
-              // 2. setup the read WR
-              // this request ensure that the previous write request is flushed
-              // out of the NIC pipeline
-#if 1
-              if (1) {
-
-                doorbell.next();
-
-                auto &read_sr = doorbell.cur_wr();
-                auto &read_sge = doorbell.cur_sge();
-
-                read_sr.opcode = IBV_WR_RDMA_READ;
-                read_sr.send_flags = IBV_SEND_SIGNALED;
-                assert(FLAGS_payload >= sizeof(u8));
-                // read the last byte
-                read_sr.wr.rdma.remote_addr =
-                    // remote_attr.buf + write_addr + FLAGS_payload -
-                    // sizeof(u8);
-                    dram_mr.buf + 4096 * thread_id * 64 * R2_COR_ID();
-
-                /* XD: using a DRAM MR is ok, as the RDMA_send will also flush
-                   the buffer This improve the performance of about 1us
-                 */
-                read_sr.wr.rdma.rkey = dram_mr.key;
-
-                // read_sr.wr.rdma.rkey = remote_attr.key;
-
-                read_sge.addr = (u64)(&my_buf[0]);
-                // read_sge.length =
-                // sizeof(u8); // again, read a byte is sufficient
-                // read_sge.length = 1;
-                // read_sge.length = 0;
-                read_sge.length = sizeof(u8);
-                read_sge.lkey = local_attr.key;
-              }
+              // a write, then a read ensuring that the write is flushed out
+              // of the NIC pipeline
+              add_sync_write(doorbell, (char *)(&my_buf[0]),
+                             static_cast<u32>(FLAGS_payload), local_attr.key,
+                             remote_attr.buf + write_addr, remote_attr.key,
+                             dram_mr.buf + 4096 * thread_id * 64 * R2_COR_ID(),
+                             dram_mr.key);
 
               auto id = R2_COR_ID();
 
@@ -739,17 +762,15 @@ int main(int argc, char **argv) {
               auto res_d = op.execute_doorbell(qp, doorbell, R2_ASYNC_WAIT);
               ASSERT(res_d == IOCode::Ok)
                   << "error: " << RC::wc_status(res_d.desc);
-#endif
             }
 
             // record the latency
-            // if (thread_id == 0) {
-            lats.add_one(t.passed_msec());
-            //            statics[thread_id].float_data = lats.get_lat();
-            //}
+            lats.record_us(op_t.passed_msec());
+            finished += 1;
+
             statics[thread_id].inc(1);
-            if (lats.counts % 100000 == 0) {
-              statics[thread_id].float_data = t.passed_msec() / lats.counts;
+            if (finished % 100000 == 0) {
+              statics[thread_id].float_data = t.passed_msec() / finished;
             }
             R2_YIELD;
           }
@@ -772,7 +793,23 @@ int main(int argc, char **argv) {
   for (auto &t : threads)
     t->start();
   sleep(2);
-  Reporter::report_thpt(statics, 20);
+
+  TransportStats transport;
+  if (FLAGS_transport_stats) {
+    std::lock_guard<std::mutex> guard(created_lock);
+    for (auto &nic : created_nics) {
+      auto counters = NicCounters::create(nic, FLAGS_sysfs_root);
+      if (counters)
+        transport.add_nic(counters.value());
+      else
+        RDMA_LOG(4) << "no sysfs counters of " << nic->dev_name()
+                    << " under " << FLAGS_sysfs_root;
+    }
+    for (auto &qp : created_qps)
+      transport.add_qp(qp);
+  }
+  Reporter::report_thpt(statics, 20, lat_hists, FLAGS_report_file,
+                        &transport);
 
   running = false;
   return 0;
@@ -791,7 +828,7 @@ void seq_bench() {
   auto local_mem = huge_region->convert_to_rmem().value();
 
   usize thread_id = 0;
-  BindToCore(thread_id);
+  bind_to_core(thread_id);
 
   // 1. create a local QP to use
   // below are platform specific opts
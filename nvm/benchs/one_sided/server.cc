@@ -4,10 +4,10 @@
 
 #include "../../huge_region.hh"
 #include "../../nvm_region.hh"
+#include "../../prefault_region.hh"
 #include "rlib/core/lib.hh"
 
 #include "../thread.hh"
-#include "../two_sided/r740.hh"
 
 using namespace nvm;
 
@@ -26,51 +26,23 @@ DEFINE_bool(use_nvm, true, "Whether to use NVM for RDMA");
 DEFINE_string(nvm_file, "/dev/dax1.0", "Abstracted NVM device");
 DEFINE_uint64(nvm_sz, 2L, "Mapped sz (in GB), should be larger than 2MB");
 
+DEFINE_string(prefault, "",
+              "Allocate the DRAM regions with PrefaultRegion, configured by "
+              "e.g., \"threads=16,policy=interleave,nodes=0:1,page=1g\"; "
+              "empty to use HugeRegion.");
+
 DEFINE_bool(touch_mem, false,
             "whether to warm the LLC of the benchmark memory");
+DEFINE_uint64(cm_handlers, 4,
+              "Number of threads serving the connection requests of clients.");
+DEFINE_bool(persistent, false,
+            "Opt-in: keep the MRs across client runs, and a restarted client "
+            "re-creating a QP name replaces its stale QP (instead of failing "
+            "with WrongArg).");
 
 using namespace rdmaio;
 using namespace rdmaio::rmem;
 
-int BindToCore(int t_id) {
-
-  if (t_id >= (per_socket_cores * 2))
-    return 0;
-
-  int x = t_id;
-  int y = 0;
-
-#ifdef SCALE
-  assert(false);
-  // specific  binding for scale tests
-  int mac_per_node = 16 / nthreads; // there are total 16 threads avialable
-  int mac_num = current_partition % mac_per_node;
-
-  if (mac_num < mac_per_node / 2) {
-    y = socket_0[x + mac_num * nthreads];
-  } else {
-    y = socket_one[x + (mac_num - mac_per_node / 2) * nthreads];
-  }
-#else
-  // bind ,andway
-  if (x >= per_socket_cores) {
-    // there is no other cores in the first socket
-    y = socket_one[x - per_socket_cores];
-  } else {
-    y = socket_zero[x];
-  }
-
-#endif
-
-  // fprintf(stdout,"worker: %d binding %d\n",x,y);
-  cpu_set_t mask;
-  CPU_ZERO(&mask);
-  CPU_SET(y, &mask);
-  sched_setaffinity(0, sizeof(mask), &mask);
-
-  return 0;
-}
-
 int main(int argc, char **argv) {
 
   gflags::ParseCommandLineFlags(&argc, &argv, true);
@@ -87,14 +59,25 @@ int main(int argc, char **argv) {
   }
 
   RCtrl ctrl(FLAGS_port, FLAGS_host);
+  ctrl.set_persistent(FLAGS_persistent);
   RDMA_LOG(4) << "*NVM server* listenes at " << FLAGS_host << ":" << FLAGS_port;
 
+  auto alloc_dram = [](const u64 &sz) -> Arc<MemoryRegion> {
+    if (FLAGS_prefault.empty())
+      return HugeRegion::create(sz).value();
+    auto config = PrefaultConfig::parse(FLAGS_prefault);
+    RDMA_ASSERT(config) << "invalid prefault config: " << FLAGS_prefault;
+    auto region = PrefaultRegion::create(sz, config.value()).value();
+    RDMA_LOG(2) << "prefaulted " << sz << "B with " << config.value().to_str()
+                << "; page: " << region->page_size()
+                << "B; placement: " << region->placement_str();
+    return region;
+  };
+
   Arc<MemoryRegion> nvm_region = nullptr;
-  Arc<MemoryRegion> dram_region =
-      HugeRegion::create(1024 * 1024 * 1024L * 2).value();
+  Arc<MemoryRegion> dram_region = alloc_dram(1024 * 1024 * 1024L * 2);
 
-  Arc<MemoryRegion> dram_region1 =
-      HugeRegion::create(1024 * 1024 * 1024L * 2).value();
+  Arc<MemoryRegion> dram_region1 = alloc_dram(1024 * 1024 * 1024L * 2);
 
   // first we open the NIC
   {
@@ -122,7 +105,7 @@ int main(int argc, char **argv) {
       } else {
         RDMA_LOG(4) << "server uses DRAM";
         //nvm_region = DRAMRegion::create(sz,FLAGS_numa_node).value();
-        nvm_region = HugeRegion::create(sz).value();
+        nvm_region = alloc_dram(sz);
       }
     }
 
@@ -159,7 +142,7 @@ int main(int argc, char **argv) {
     // we touch the memory to fill cache line
     // thread on NUMA 0
     Thread<int> t0([&nvm_region]() -> int {
-      BindToCore(0);
+      numa_run_on_node(0);
       auto start_ptr = nvm_region->addr;
       memset(start_ptr, 0, 14080 * 1024);
       return 0;
@@ -169,7 +152,7 @@ int main(int argc, char **argv) {
 
     // thread on NUMA 1
     Thread<int> t1([&nvm_region]() -> int {
-      BindToCore(per_socket_cores + 1);
+      numa_run_on_node(1);
       auto start_ptr = nvm_region->addr;
       memset(start_ptr, 0, 14080 * 1024);
       return 0;
@@ -177,7 +160,7 @@ int main(int argc, char **argv) {
     t1.start();
     t1.join();
   }
-  ctrl.start_daemon();
+  ctrl.start_daemon(FLAGS_cm_handlers);
 
   RDMA_LOG(2) << "RC nvm server started!";
   while (1) {
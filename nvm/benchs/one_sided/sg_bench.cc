@@ -0,0 +1,179 @@
+#include <gflags/gflags.h>
+
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+#include "rlib/core/lib.hh"
+#include "rlib/core/qps/doorbell_helper.hh"
+#include "rlib/core/qps/loopback.hh"
+#include "rlib/core/qps/op.hh"
+
+#include "../../huge_region.hh"
+
+DEFINE_string(transport, "loopback",
+              "loopback (in-process, no NIC) | rc (connect to a one-sided "
+              "server)");
+DEFINE_string(addr, "localhost:8888", "Server address to connect to (rc).");
+DEFINE_int64(use_nic_idx, 0, "Which NIC to create QP (rc).");
+DEFINE_int64(reg_nic_name, 0, "The name of the server's NIC to connect (rc).");
+DEFINE_string(op, "write", "read | write");
+DEFINE_string(mode, "both",
+              "copy (stage the fragments in one buffer) | sge (one sge per "
+              "fragment) | both");
+DEFINE_uint64(frags, 4, "Number of local fragments of a request, at most 16");
+DEFINE_uint64(frag_sz, 64, "Bytes of a fragment");
+DEFINE_uint64(batch, 8, "Number of requests posted per doorbell, at most 16");
+DEFINE_uint64(ops, 1000000, "Number of requests per mode");
+
+using namespace rdmaio;
+using namespace rdmaio::rmem;
+using namespace rdmaio::qp;
+
+using namespace nvm;
+
+namespace {
+
+const usize kMaxFrags = 16;
+// fragments are scattered in the local memory, as separately allocated
+// record fields
+const usize kFragStride = 4096;
+
+Arc<AbsTransport> create_transport(const Arc<RMem> &local,
+                                   const Arc<RMem> &remote,
+                                   const QPConfig &config) {
+  Arc<AbsTransport> t = nullptr;
+  if (FLAGS_transport == "loopback") {
+    auto mem = std::make_shared<LoopbackMem>();
+    t = LoopbackTransport::create(mem, config).value();
+    t->bind_local_mr(mem->reg(local).value());
+    t->bind_remote_mr(mem->reg(remote).value());
+    return t;
+  }
+
+  auto nic =
+      RNic::create(RNicInfo::query_dev_names().at(FLAGS_use_nic_idx)).value();
+  auto caps = RNicInfo::query_caps(nic).value();
+  RDMA_ASSERT(caps.max_sge >= config.max_send_sge_sz())
+      << "the device supports at most " << caps.max_sge << " sges";
+  auto rc = RC::create(nic, config).value();
+
+  ConnectManager cm(FLAGS_addr);
+  if (cm.wait_ready(1000000, 2) == IOCode::Timeout)
+    RDMA_ASSERT(false) << "cm connect to server timeout";
+
+  auto qp_res = cm.cc_rc("sg_bench", rc, FLAGS_reg_nic_name, config);
+  RDMA_ASSERT(qp_res == IOCode::Ok) << std::get<0>(qp_res.desc);
+
+  auto fetch_res = cm.fetch_remote_mr(FLAGS_reg_nic_name);
+  RDMA_ASSERT(fetch_res == IOCode::Ok) << std::get<0>(fetch_res.desc);
+
+  auto local_mr = RegHandler::create(local, nic).value();
+  t = RCTransport::create(rc).value();
+  t->bind_local_mr(local_mr->get_reg_attr().value());
+  t->bind_remote_mr(std::get<1>(fetch_res.desc));
+  return t;
+}
+
+/*!
+  Issue FLAGS_ops requests (rounded up to batches), each accesses FLAGS_frags * FLAGS_frag_sz
+  contiguous remote bytes from/to the scattered local fragments.
+  \ret the elapsed seconds
+ */
+double run(const Arc<AbsTransport> &t, const Arc<RMem> &local,
+           const bool &use_sge, const bool &read) {
+  const auto lkey = t->local_mr.value().key;
+  const auto &rmr = t->remote_mr.value();
+  const u64 req_sz = FLAGS_frags * FLAGS_frag_sz;
+
+  char *frags = static_cast<char *>(local->raw_ptr);
+  // the staging buffer of the copy path, after the fragments
+  char *staging = frags + kMaxFrags * kFragStride;
+
+  std::vector<Op<kMaxFrags>> ops(FLAGS_batch);
+  for (uint i = 0; i < FLAGS_batch; ++i) {
+    ops[i].set_op(read ? IBV_WR_RDMA_READ : IBV_WR_RDMA_WRITE);
+    ops[i].clear_payloads();
+    if (use_sge) {
+      for (uint f = 0; f < FLAGS_frags; ++f)
+        ops[i].add_payload(frags + f * kFragStride, FLAGS_frag_sz, lkey);
+    } else {
+      ops[i].add_payload(staging + i * req_sz, req_sz, lkey);
+    }
+    ops[i].set_rdma_addr((i * req_sz) % (rmr.sz - req_sz), rmr);
+    ops[i].set_wrid(i);
+    ops[i].set_flags(i + 1 == FLAGS_batch ? IBV_SEND_SIGNALED : 0);
+    ops[i].wr.next = i + 1 == FLAGS_batch ? nullptr : &(ops[i + 1].wr);
+  }
+
+  Timer timer;
+  for (u64 done = 0; done < FLAGS_ops; done += FLAGS_batch) {
+    if (!use_sge && !read) {
+      // gather the fragments of each request into its staging slot
+      for (uint i = 0; i < FLAGS_batch; ++i)
+        for (uint f = 0; f < FLAGS_frags; ++f)
+          memcpy(staging + i * req_sz + f * FLAGS_frag_sz,
+                 frags + f * kFragStride, FLAGS_frag_sz);
+    }
+
+    auto res = t->post_send(ops[0].wr);
+    RDMA_ASSERT(res == IOCode::Ok) << "post error: " << res.desc;
+    auto res_p = t->wait_one_comp();
+    RDMA_ASSERT(res_p == IOCode::Ok)
+        << "completion error: " << Dummy::wc_status(res_p.desc);
+
+    if (!use_sge && read) {
+      // scatter each request's staging slot into the fragments
+      for (uint i = 0; i < FLAGS_batch; ++i)
+        for (uint f = 0; f < FLAGS_frags; ++f)
+          memcpy(frags + f * kFragStride,
+                 staging + i * req_sz + f * FLAGS_frag_sz, FLAGS_frag_sz);
+    }
+  }
+  return timer.passed_msec() / 1000000.0;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  RDMA_ASSERT(FLAGS_frags > 0 && FLAGS_frags <= kMaxFrags)
+      << "frags should be in [1, " << kMaxFrags << "]";
+  RDMA_ASSERT(FLAGS_frag_sz > 0 && FLAGS_frag_sz <= kFragStride);
+  RDMA_ASSERT(FLAGS_batch > 0 && FLAGS_batch <= kNMaxDoorbell);
+  RDMA_ASSERT(FLAGS_op == "read" || FLAGS_op == "write")
+      << "unknown op: " << FLAGS_op;
+
+  const u64 req_sz = FLAGS_frags * FLAGS_frag_sz;
+  auto local_region = std::make_shared<DRAMRegion>(
+      kMaxFrags * kFragStride + kNMaxDoorbell * req_sz);
+  auto local = local_region->convert_to_rmem().value();
+
+  // the remote memory of the loopback transport
+  auto remote_region = std::make_shared<DRAMRegion>(
+      std::max<u64>(64 * 1024 * 1024, 2 * kNMaxDoorbell * req_sz));
+  auto remote = remote_region->convert_to_rmem().value();
+
+  auto t = create_transport(
+      local, remote,
+      QPConfig().set_max_send_sge(FLAGS_frags).set_max_send(
+          std::max<int>(kRcMaxSendSz, FLAGS_batch)));
+
+  const bool read = FLAGS_op == "read";
+  for (auto mode : {"copy", "sge"}) {
+    if (FLAGS_mode != "both" && FLAGS_mode != mode)
+      continue;
+    const double sec = run(t, local, std::string(mode) == "sge", read);
+    const u64 ops = (FLAGS_ops + FLAGS_batch - 1) / FLAGS_batch * FLAGS_batch;
+    const double thpt = ops / sec;
+    std::cout << "{\"mode\":\"" << mode << "\",\"op\":\"" << FLAGS_op
+              << "\",\"transport\":\"" << FLAGS_transport
+              << "\",\"frags\":" << FLAGS_frags
+              << ",\"frag_sz\":" << FLAGS_frag_sz
+              << ",\"batch\":" << FLAGS_batch << ",\"ops\":" << ops
+              << ",\"thpt\":" << thpt
+              << ",\"bw_mbps\":" << thpt * req_sz / (1024 * 1024) << "}"
+              << std::endl;
+  }
+  return 0;
+}
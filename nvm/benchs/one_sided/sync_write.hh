@@ -0,0 +1,52 @@
+#pragma once
+
+#include "rlib/core/qps/doorbell_helper.hh"
+#include "rlib/core/qps/mod.hh"
+
+namespace nvm {
+
+using namespace rdmaio;
+using namespace rdmaio::qp;
+
+/*!
+  Append a synced write to the doorbell: an RDMA WRITE of
+  [buf, buf + sz) to remote_addr, followed by a signaled 1-byte READ of
+  sync_addr (into buf) on the same QP. The READ flushes the WRITE out of the
+  NIC pipeline, so the write is durable (unless DDIO places it in the LLC)
+  when the READ completes.
+  A DRAM address suffices for the READ, and it is faster than reading the
+  NVM (about 1us).
+
+  Example:
+  `
+  DoorbellHelper<2> doorbell(IBV_WR_RDMA_WRITE);
+  add_sync_write(doorbell, buf, sz, local_attr.key, remote_attr.buf + off,
+                 remote_attr.key, dram_attr.buf, dram_attr.key);
+  // then post the doorbell, and wait for the completion of the READ
+  `
+ */
+template <usize N>
+inline void add_sync_write(DoorbellHelper<N> &doorbell, char *buf,
+                           const u32 &sz, const u32 &lkey,
+                           const u64 &remote_addr, const u32 &rkey,
+                           const u64 &sync_addr, const u32 &sync_rkey) {
+  RDMA_ASSERT(sz >= sizeof(u8));
+
+  // 1. the write
+  doorbell.next();
+  doorbell.cur_wr().opcode = IBV_WR_RDMA_WRITE;
+  doorbell.cur_wr().send_flags = (sz <= kMaxInlinSz) ? IBV_SEND_INLINE : 0;
+  doorbell.cur_wr().wr.rdma.remote_addr = remote_addr;
+  doorbell.cur_wr().wr.rdma.rkey = rkey;
+  doorbell.cur_sge() = {.addr = (u64)buf, .length = sz, .lkey = lkey};
+
+  // 2. the read, a byte is sufficient
+  doorbell.next();
+  doorbell.cur_wr().opcode = IBV_WR_RDMA_READ;
+  doorbell.cur_wr().send_flags = IBV_SEND_SIGNALED;
+  doorbell.cur_wr().wr.rdma.remote_addr = sync_addr;
+  doorbell.cur_wr().wr.rdma.rkey = sync_rkey;
+  doorbell.cur_sge() = {.addr = (u64)buf, .length = sizeof(u8), .lkey = lkey};
+}
+
+} // namespace nvm
@@ -0,0 +1,181 @@
+#pragma once
+
+#include "r2/src/libroutine.hh"
+
+#include "rlib/core/qps/doorbell_helper.hh"
+#include "rlib/core/qps/loopback.hh"
+#include "rlib/core/qps/transport.hh"
+
+#include "../statucs.hh"
+
+namespace nvm {
+
+using namespace rdmaio;
+using namespace rdmaio::qp;
+
+/*!
+  A coroutine-aware one-sided op posted through an AbsTransport.
+  Its interface mirrors r2's SROp, so the benchmark code is agnostic to whether
+  the requests go to an RNIC (RCTransport), or to the loopback backend.
+
+  The completion of each request is identified by the coroutine id of its
+  issuer. While waiting, the coroutine yields so that others can run.
+
+  If a Statics is given, the cycles spent on posting and polling, the empty
+  polls, and the payload bytes of the finished requests are recorded to it.
+
+  Example:
+  `
+  TOp op;
+  op.set_payload(buf, 256).set_remote_addr(off).set_read();
+  auto ret = op.execute(transport, IBV_SEND_SIGNALED, R2_ASYNC_WAIT);
+  ASSERT(ret == IOCode::Ok) << RC::wc_status(ret.desc);
+  `
+ */
+class TOp {
+  ibv_send_wr wr;
+  ibv_sge sge;
+
+  void *local_ptr = nullptr;
+  u32 len = 0;
+  u64 remote_off = 0;
+
+  Statics *stat = nullptr;
+  // payload bytes posted but not completed
+  u64 pending_bytes = 0;
+
+  inline Result<std::string> post(AbsTransport *t, ibv_send_wr &sr) {
+    if (stat == nullptr)
+      return t->post_send(sr);
+    auto start = read_tsc();
+    auto res = t->post_send(sr);
+    stat->add_post(read_tsc() - start);
+    return res;
+  }
+
+  inline Option<ibv_wc> poll(AbsTransport *t, const u64 &wr_id) {
+    if (stat == nullptr)
+      return t->poll_for(wr_id);
+    auto start = read_tsc();
+    auto res = t->poll_for(wr_id);
+    stat->add_poll(read_tsc() - start, !res);
+    return res;
+  }
+
+public:
+  explicit TOp(Statics *stat = nullptr) : wr(), sge(), stat(stat) {
+    wr.opcode = IBV_WR_RDMA_READ;
+    wr.num_sge = 1;
+    wr.sg_list = &sge;
+  }
+
+  template <typename T> inline TOp &set_payload(const T *ptr, const u32 &sz) {
+    local_ptr = (void *)ptr;
+    len = sz;
+    return *this;
+  }
+
+  inline TOp &set_remote_addr(const u64 &off) {
+    remote_off = off;
+    return *this;
+  }
+
+  inline TOp &set_read() {
+    wr.opcode = IBV_WR_RDMA_READ;
+    return *this;
+  }
+
+  inline TOp &set_write() {
+    wr.opcode = IBV_WR_RDMA_WRITE;
+    return *this;
+  }
+
+  /*!
+    Post the request using the MRs bound to the transport, and return
+    without waiting for its completion.
+   */
+  Result<std::string> execute_no_wait(AbsTransport *t, const int &flags,
+                                      R2_ASYNC) {
+    const auto &lmr = t->local_mr.value();
+    const auto &rmr = t->remote_mr.value();
+
+    sge = {.addr = (u64)local_ptr, .length = len, .lkey = lmr.key};
+
+    wr.wr_id = R2_COR_ID();
+    wr.send_flags = flags;
+    wr.next = nullptr;
+    wr.wr.rdma.remote_addr = rmr.buf + remote_off;
+    wr.wr.rdma.rkey = rmr.key;
+
+    pending_bytes += len;
+    return post(t, wr);
+  }
+
+  Result<std::string> execute_no_wait(const Arc<AbsTransport> &t,
+                                      const int &flags, R2_ASYNC) {
+    return execute_no_wait(t.get(), flags, R2_ASYNC_WAIT);
+  }
+
+  /*!
+    Yield until the (signaled) request of this coroutine completes.
+   */
+  Result<ibv_wc> wait_one(AbsTransport *t, R2_ASYNC) {
+    while (true) {
+      auto wc = poll(t, R2_COR_ID());
+      if (wc) {
+        if (unlikely(wc.value().status != IBV_WC_SUCCESS))
+          return ::rdmaio::Err(wc.value());
+        if (stat != nullptr)
+          stat->inc_bytes(pending_bytes);
+        pending_bytes = 0;
+        return ::rdmaio::Ok(wc.value());
+      }
+      R2_YIELD;
+    }
+  }
+
+  Result<ibv_wc> wait_one(const Arc<AbsTransport> &t, R2_ASYNC) {
+    return wait_one(t.get(), R2_ASYNC_WAIT);
+  }
+
+  /*!
+    Post and wait for the completion.
+    flags must contain IBV_SEND_SIGNALED.
+   */
+  Result<ibv_wc> execute(const Arc<AbsTransport> &t, const int &flags,
+                         R2_ASYNC) {
+    auto res = execute_no_wait(t, flags, R2_ASYNC_WAIT);
+    if (unlikely(res != IOCode::Ok)) {
+      pending_bytes = 0;
+      ibv_wc wc = {};
+      return ::rdmaio::Err(wc);
+    }
+    return wait_one(t, R2_ASYNC_WAIT);
+  }
+
+  /*!
+    Post the requests stored in the doorbell, and wait for the completion.
+    The last request in the doorbell must be signaled.
+   */
+  template <usize N>
+  Result<ibv_wc> execute_doorbell(const Arc<AbsTransport> &t,
+                                  DoorbellHelper<N> &doorbell, R2_ASYNC) {
+    for (int i = 0; i < doorbell.size(); ++i) {
+      doorbell.wrs[i].wr_id = R2_COR_ID();
+      pending_bytes += doorbell.sges[i].length;
+    }
+
+    doorbell.freeze();
+    auto res = post(t.get(), *doorbell.first_wr_ptr());
+    doorbell.freeze_done();
+
+    if (unlikely(res != IOCode::Ok)) {
+      pending_bytes = 0;
+      ibv_wc wc = {};
+      return ::rdmaio::Err(wc);
+    }
+    return wait_one(t, R2_ASYNC_WAIT);
+  }
+};
+
+} // namespace nvm
@@ -7,7 +7,6 @@
 #include "rlib/core/lib.hh"
 
 #include "../thread.hh"
-#include "../two_sided/r740.hh"
 
 using namespace nvm;
 
@@ -32,45 +31,6 @@ DEFINE_bool(touch_mem, false,
 using namespace rdmaio;
 using namespace rdmaio::rmem;
 
-int BindToCore(int t_id) {
-
-  if (t_id >= (per_socket_cores * 2))
-    return 0;
-
-  int x = t_id;
-  int y = 0;
-
-#ifdef SCALE
-  assert(false);
-  // specific  binding for scale tests
-  int mac_per_node = 16 / nthreads; // there are total 16 threads avialable
-  int mac_num = current_partition % mac_per_node;
-
-  if (mac_num < mac_per_node / 2) {
-    y = socket_0[x + mac_num * nthreads];
-  } else {
-    y = socket_one[x + (mac_num - mac_per_node / 2) * nthreads];
-  }
-#else
-  // bind ,andway
-  if (x >= per_socket_cores) {
-    // there is no other cores in the first socket
-    y = socket_one[x - per_socket_cores];
-  } else {
-    y = socket_zero[x];
-  }
-
-#endif
-
-  // fprintf(stdout,"worker: %d binding %d\n",x,y);
-  cpu_set_t mask;
-  CPU_ZERO(&mask);
-  CPU_SET(y, &mask);
-  sched_setaffinity(0, sizeof(mask), &mask);
-
-  return 0;
-}
-
 int main(int argc, char **argv) {
 
   gflags::ParseCommandLineFlags(&argc, &argv, true);
@@ -155,7 +115,7 @@ int main(int argc, char **argv) {
     // we touch the memory to fill cache line
     // thread on NUMA 0
     Thread<int> t0([&nvm_region]() -> int {
-      BindToCore(0);
+      numa_run_on_node(0);
       auto start_ptr = nvm_region->addr;
       memset(start_ptr, 0, 14080 * 1024);
       return 0;
@@ -165,7 +125,7 @@ int main(int argc, char **argv) {
 
     // thread on NUMA 1
     Thread<int> t1([&nvm_region]() -> int {
-      BindToCore(per_socket_cores + 1);
+      numa_run_on_node(1);
       auto start_ptr = nvm_region->addr;
       memset(start_ptr, 0, 14080 * 1024);
       return 0;
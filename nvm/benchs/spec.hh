@@ -0,0 +1,637 @@
+#pragma once
+
+#include <cctype>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "rlib/core/common.hh"
+
+namespace nvm {
+
+using namespace rdmaio;
+
+/*!
+  A parsed (JSON or YAML) document: null, bool, number, string, array, or
+  object. The keys of an object keep their order in the document.
+
+  The YAML support covers what workload specs need: block mappings and
+  sequences (by indentation), flow collections ([a, b], {k: v}), plain and
+  quoted scalars, and comments; anchors, tags, and multi-line scalars are not
+  supported.
+
+  Example:
+  `
+  auto spec = Spec::parse_file("read.yaml").value();
+  auto threads = spec.get_u64("threads", 1);
+  auto dist = spec.get_path("addr.dist"); // Option<Spec>
+  `
+ */
+class Spec {
+public:
+  enum Type { kNull = 0, kBool, kNum, kStr, kArray, kObject };
+
+  Type type = kNull;
+  bool b = false;
+  double num = 0;
+  std::string str;
+  std::vector<Spec> arr;
+  std::vector<std::pair<std::string, Spec>> obj;
+
+  Spec() = default;
+  static Spec of_bool(bool v) {
+    Spec s;
+    s.type = kBool;
+    s.b = v;
+    return s;
+  }
+  static Spec of_num(double v) {
+    Spec s;
+    s.type = kNum;
+    s.num = v;
+    return s;
+  }
+  static Spec of_str(const std::string &v) {
+    Spec s;
+    s.type = kStr;
+    s.str = v;
+    return s;
+  }
+  static Spec object() {
+    Spec s;
+    s.type = kObject;
+    return s;
+  }
+  static Spec array() {
+    Spec s;
+    s.type = kArray;
+    return s;
+  }
+
+  bool is_null() const { return type == kNull; }
+  bool is_object() const { return type == kObject; }
+  bool is_array() const { return type == kArray; }
+
+  const Spec *find(const std::string &key) const {
+    for (auto &kv : obj) {
+      if (kv.first == key)
+        return &kv.second;
+    }
+    return nullptr;
+  }
+
+  Spec &set(const std::string &key, const Spec &v) {
+    type = kObject;
+    for (auto &kv : obj) {
+      if (kv.first == key) {
+        kv.second = v;
+        return kv.second;
+      }
+    }
+    obj.push_back(std::make_pair(key, v));
+    return obj.back().second;
+  }
+
+  void erase(const std::string &key) {
+    for (auto it = obj.begin(); it != obj.end(); ++it) {
+      if (it->first == key) {
+        obj.erase(it);
+        return;
+      }
+    }
+  }
+
+  /*!
+    Lookup a dot-separated path, e.g., "addr.dist"
+   */
+  Option<Spec> get_path(const std::string &path) const {
+    const Spec *cur = this;
+    std::istringstream iss(path);
+    std::string key;
+    while (std::getline(iss, key, '.')) {
+      cur = cur->find(key);
+      if (cur == nullptr)
+        return {};
+    }
+    return *cur;
+  }
+
+  /*!
+    Set a dot-separated path, creating the intermediate objects
+   */
+  void set_path(const std::string &path, const Spec &v) {
+    auto pos = path.find('.');
+    if (pos == std::string::npos) {
+      set(path, v);
+      return;
+    }
+    const auto key = path.substr(0, pos);
+    auto child = find(key);
+    Spec sub = (child != nullptr && child->is_object()) ? *child : object();
+    sub.set_path(path.substr(pos + 1), v);
+    set(key, sub);
+  }
+
+  // typed accessors of an object's members, with defaults
+
+  u64 get_u64(const std::string &key, const u64 &def) const {
+    auto v = find(key);
+    return (v != nullptr && v->type == kNum) ? static_cast<u64>(v->num) : def;
+  }
+
+  double get_double(const std::string &key, const double &def) const {
+    auto v = find(key);
+    return (v != nullptr && v->type == kNum) ? v->num : def;
+  }
+
+  bool get_bool(const std::string &key, const bool &def) const {
+    auto v = find(key);
+    return (v != nullptr && v->type == kBool) ? v->b : def;
+  }
+
+  std::string get_str(const std::string &key, const std::string &def) const {
+    auto v = find(key);
+    if (v == nullptr)
+      return def;
+    if (v->type == kStr)
+      return v->str;
+    if (v->type == kNum || v->type == kBool)
+      return v->to_json();
+    return def;
+  }
+
+  std::string to_json() const {
+    std::ostringstream oss;
+    oss.precision(15);
+    dump(oss);
+    return oss.str();
+  }
+
+  static Option<Spec> parse_json(const std::string &text) {
+    return Parser(text, false).parse_document();
+  }
+
+  static Option<Spec> parse_yaml(const std::string &text);
+
+  /*!
+    Parse a file by its extension: .json, or .yaml/.yml
+   */
+  static Option<Spec> parse_file(const std::string &path) {
+    std::ifstream ifs(path);
+    if (!ifs.is_open())
+      return {};
+    std::stringstream buf;
+    buf << ifs.rdbuf();
+    auto ends_with = [&path](const std::string &s) {
+      return path.size() >= s.size() &&
+             path.compare(path.size() - s.size(), s.size(), s) == 0;
+    };
+    if (ends_with(".yaml") || ends_with(".yml"))
+      return parse_yaml(buf.str());
+    return parse_json(buf.str());
+  }
+
+  /*!
+    Parse a plain (unquoted) YAML scalar
+   */
+  static Spec of_scalar(const std::string &s) {
+    if (s.empty() || s == "null" || s == "~")
+      return Spec();
+    if (s == "true")
+      return of_bool(true);
+    if (s == "false")
+      return of_bool(false);
+    char *end = nullptr;
+    double v = std::strtod(s.c_str(), &end);
+    if (*end == '\0' && (std::isdigit(s[0]) || s[0] == '-' || s[0] == '+' ||
+                         s[0] == '.'))
+      return of_num(v);
+    return of_str(s);
+  }
+
+private:
+  void dump(std::ostringstream &oss) const {
+    switch (type) {
+    case kNull:
+      oss << "null";
+      break;
+    case kBool:
+      oss << (b ? "true" : "false");
+      break;
+    case kNum:
+      oss << num;
+      break;
+    case kStr:
+      oss << '"';
+      for (char c : str) {
+        if (c == '"' || c == '\\')
+          oss << '\\' << c;
+        else if (c == '\n')
+          oss << "\\n";
+        else
+          oss << c;
+      }
+      oss << '"';
+      break;
+    case kArray:
+      oss << '[';
+      for (usize i = 0; i < arr.size(); ++i) {
+        oss << (i == 0 ? "" : ",");
+        arr[i].dump(oss);
+      }
+      oss << ']';
+      break;
+    case kObject:
+      oss << '{';
+      for (usize i = 0; i < obj.size(); ++i) {
+        oss << (i == 0 ? "" : ",") << '"' << obj[i].first << "\":";
+        obj[i].second.dump(oss);
+      }
+      oss << '}';
+      break;
+    }
+  }
+
+  /*!
+    A recursive-descent parser of JSON, and of YAML flow collections
+    (relaxed: strings may be unquoted)
+   */
+  class Parser {
+    const std::string &s;
+    const bool relaxed;
+    usize pos = 0;
+
+  public:
+    Parser(const std::string &s, bool relaxed) : s(s), relaxed(relaxed) {}
+
+    Option<Spec> parse_document() {
+      Spec res;
+      if (!parse_value(res))
+        return {};
+      skip_ws();
+      if (pos != s.size())
+        return {};
+      return res;
+    }
+
+  private:
+    void skip_ws() {
+      while (pos < s.size() && std::isspace(s[pos]))
+        pos += 1;
+    }
+
+    bool consume(char c) {
+      skip_ws();
+      if (pos < s.size() && s[pos] == c) {
+        pos += 1;
+        return true;
+      }
+      return false;
+    }
+
+    bool parse_value(Spec &out) {
+      skip_ws();
+      if (pos >= s.size())
+        return false;
+      const char c = s[pos];
+      if (c == '{')
+        return parse_object(out);
+      if (c == '[')
+        return parse_array(out);
+      if (c == '"' || (relaxed && c == '\'')) {
+        out.type = kStr;
+        return parse_string(out.str);
+      }
+      // literals, numbers and (relaxed) plain strings
+      const usize start = pos;
+      while (pos < s.size() && s[pos] != ',' && s[pos] != ']' &&
+             s[pos] != '}' && !(relaxed && s[pos] == ':') &&
+             !(!relaxed && std::isspace(s[pos])))
+        pos += 1;
+      std::string token = s.substr(start, pos - start);
+      while (!token.empty() && std::isspace(token.back()))
+        token.pop_back();
+      if (token.empty())
+        return false;
+      out = of_scalar(token);
+      if (!relaxed && out.type == kStr)
+        return false;
+      return true;
+    }
+
+    bool parse_string(std::string &out) {
+      const char quote = s[pos++];
+      out.clear();
+      while (pos < s.size() && s[pos] != quote) {
+        if (s[pos] == '\\' && quote == '"' && pos + 1 < s.size()) {
+          pos += 1;
+          switch (s[pos]) {
+          case 'n':
+            out.push_back('\n');
+            break;
+          case 't':
+            out.push_back('\t');
+            break;
+          case 'r':
+            out.push_back('\r');
+            break;
+          case 'b':
+            out.push_back('\b');
+            break;
+          case 'f':
+            out.push_back('\f');
+            break;
+          case 'u':
+            if (!parse_unicode(out))
+              return false;
+            continue;
+          default:
+            out.push_back(s[pos]);
+          }
+        } else {
+          out.push_back(s[pos]);
+        }
+        pos += 1;
+      }
+      if (pos >= s.size())
+        return false;
+      pos += 1;
+      return true;
+    }
+
+    // 4 hex digits at pos
+    bool parse_hex4(u32 &out) {
+      if (pos + 4 > s.size())
+        return false;
+      out = 0;
+      for (usize i = 0; i < 4; ++i) {
+        const char c = s[pos + i];
+        if (!std::isxdigit(static_cast<unsigned char>(c)))
+          return false;
+        out = out * 16 +
+              (std::isdigit(static_cast<unsigned char>(c))
+                   ? c - '0'
+                   : std::tolower(static_cast<unsigned char>(c)) - 'a' + 10);
+      }
+      pos += 4;
+      return true;
+    }
+
+    /*!
+      Decode the \uXXXX escape at pos (right after the 'u'), or a surrogate
+      pair of two, to UTF-8
+     */
+    bool parse_unicode(std::string &out) {
+      pos += 1;
+      u32 cp = 0;
+      if (!parse_hex4(cp))
+        return false;
+      if (cp >= 0xD800 && cp <= 0xDBFF) {
+        u32 low = 0;
+        if (pos + 1 >= s.size() || s[pos] != '\\' || s[pos + 1] != 'u')
+          return false;
+        pos += 2;
+        if (!parse_hex4(low) || low < 0xDC00 || low > 0xDFFF)
+          return false;
+        cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+      } else if (cp >= 0xDC00 && cp <= 0xDFFF) {
+        return false;
+      }
+
+      if (cp < 0x80) {
+        out.push_back(static_cast<char>(cp));
+      } else if (cp < 0x800) {
+        out.push_back(static_cast<char>(0xC0 | (cp >> 6)));
+        out.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+      } else if (cp < 0x10000) {
+        out.push_back(static_cast<char>(0xE0 | (cp >> 12)));
+        out.push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3F)));
+        out.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+      } else {
+        out.push_back(static_cast<char>(0xF0 | (cp >> 18)));
+        out.push_back(static_cast<char>(0x80 | ((cp >> 12) & 0x3F)));
+        out.push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3F)));
+        out.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+      }
+      return true;
+    }
+
+    bool parse_array(Spec &out) {
+      out = array();
+      pos += 1;
+      if (consume(']'))
+        return true;
+      do {
+        Spec v;
+        if (!parse_value(v))
+          return false;
+        out.arr.push_back(v);
+      } while (consume(','));
+      return consume(']');
+    }
+
+    bool parse_object(Spec &out) {
+      out = object();
+      pos += 1;
+      if (consume('}'))
+        return true;
+      do {
+        skip_ws();
+        Spec key;
+        if (!parse_value(key) || key.type == kArray || key.type == kObject)
+          return false;
+        if (!consume(':'))
+          return false;
+        Spec v;
+        if (!parse_value(v))
+          return false;
+        out.set(key.type == kStr ? key.str : key.to_json(), v);
+      } while (consume(','));
+      return consume('}');
+    }
+  };
+
+  struct YamlLine {
+    usize indent;
+    std::string text;
+  };
+
+  class YamlParser {
+    std::vector<YamlLine> lines;
+    usize cur = 0;
+
+  public:
+    explicit YamlParser(const std::string &text) {
+      std::istringstream iss(text);
+      std::string line;
+      while (std::getline(iss, line)) {
+        line = strip_comment(line);
+        while (!line.empty() && std::isspace(line.back()))
+          line.pop_back();
+        usize indent = 0;
+        while (indent < line.size() && line[indent] == ' ')
+          indent += 1;
+        if (indent == line.size() || line == "---")
+          continue;
+        lines.push_back({indent, line.substr(indent)});
+      }
+    }
+
+    Option<Spec> parse_document() {
+      if (lines.empty())
+        return Spec();
+      Spec res;
+      if (!parse_block(lines[0].indent, res) || cur != lines.size())
+        return {};
+      return res;
+    }
+
+  private:
+    static std::string strip_comment(const std::string &line) {
+      char quote = 0;
+      for (usize i = 0; i < line.size(); ++i) {
+        const char c = line[i];
+        if (quote != 0) {
+          if (c == quote)
+            quote = 0;
+        } else if (c == '"' || c == '\'') {
+          quote = c;
+        } else if (c == '#' && (i == 0 || std::isspace(line[i - 1]))) {
+          return line.substr(0, i);
+        }
+      }
+      return line;
+    }
+
+    static bool is_seq_item(const std::string &t) {
+      return t == "-" || (t.size() >= 2 && t[0] == '-' && t[1] == ' ');
+    }
+
+    /*!
+      The position of the ':' separating a key, or npos
+     */
+    static std::size_t key_sep(const std::string &t) {
+      if (t.empty() || t[0] == '[' || t[0] == '{')
+        return std::string::npos;
+      char quote = 0;
+      for (std::size_t i = 0; i < t.size(); ++i) {
+        const char c = t[i];
+        if (quote != 0) {
+          if (c == quote)
+            quote = 0;
+        } else if (c == '"' || c == '\'') {
+          quote = c;
+        } else if (c == ':' && (i + 1 == t.size() || t[i + 1] == ' ')) {
+          return i;
+        }
+      }
+      return std::string::npos;
+    }
+
+    static bool parse_inline(const std::string &t, Spec &out) {
+      if (t.empty()) {
+        out = Spec();
+        return true;
+      }
+      if (t[0] == '[' || t[0] == '{' || t[0] == '"' || t[0] == '\'') {
+        auto res = Parser(t, true).parse_document();
+        if (!res)
+          return false;
+        out = res.value();
+        return true;
+      }
+      out = of_scalar(t);
+      return true;
+    }
+
+    static std::string unquote(const std::string &key) {
+      if (key.size() >= 2 && (key[0] == '"' || key[0] == '\'') &&
+          key.back() == key[0])
+        return key.substr(1, key.size() - 2);
+      return key;
+    }
+
+    bool parse_block(const usize indent, Spec &out) {
+      if (is_seq_item(lines[cur].text))
+        return parse_seq(indent, out);
+      return parse_map(indent, out);
+    }
+
+    /*!
+      The value after "key:" or "-" is either inline, or a nested block
+      in the following lines
+     */
+    bool parse_nested(const usize indent, const std::string &rest,
+                      bool allow_seq_same_indent, Spec &out) {
+      if (!rest.empty())
+        return parse_inline(rest, out);
+      if (cur < lines.size() &&
+          (lines[cur].indent > indent ||
+           (allow_seq_same_indent && lines[cur].indent == indent &&
+            is_seq_item(lines[cur].text))))
+        return parse_block(lines[cur].indent, out);
+      out = Spec();
+      return true;
+    }
+
+    bool parse_map(const usize indent, Spec &out) {
+      out = object();
+      while (cur < lines.size() && lines[cur].indent == indent &&
+             !is_seq_item(lines[cur].text)) {
+        const auto text = lines[cur].text;
+        const auto sep = key_sep(text);
+        if (sep == std::string::npos)
+          return false;
+        const auto key = unquote(text.substr(0, sep));
+        auto rest = text.substr(sep + 1);
+        while (!rest.empty() && std::isspace(rest.front()))
+          rest.erase(rest.begin());
+        cur += 1;
+        Spec v;
+        if (!parse_nested(indent, rest, true, v))
+          return false;
+        out.set(key, v);
+      }
+      return cur == lines.size() || lines[cur].indent < indent;
+    }
+
+    bool parse_seq(const usize indent, Spec &out) {
+      out = array();
+      while (cur < lines.size() && lines[cur].indent == indent &&
+             is_seq_item(lines[cur].text)) {
+        auto rest = lines[cur].text.substr(1);
+        usize skip = 1;
+        while (!rest.empty() && rest.front() == ' ') {
+          rest.erase(rest.begin());
+          skip += 1;
+        }
+        Spec v;
+        if (!rest.empty() && (key_sep(rest) != std::string::npos ||
+                              is_seq_item(rest))) {
+          // "- key: v" starts a mapping (or "- - v" a sequence) indented
+          // by the dash
+          lines[cur].indent = indent + skip;
+          lines[cur].text = rest;
+          if (!parse_block(indent + skip, v))
+            return false;
+        } else {
+          cur += 1;
+          if (!parse_nested(indent, rest, false, v))
+            return false;
+        }
+        out.arr.push_back(v);
+      }
+      // a sequence may be indented the same as the key it belongs to
+      return cur == lines.size() || lines[cur].indent <= indent;
+    }
+  };
+};
+
+inline Option<Spec> Spec::parse_yaml(const std::string &text) {
+  return YamlParser(text).parse_document();
+}
+
+} // namespace nvm
@@ -1,9 +1,17 @@
+#pragma once
+
 #include "rlib/core/common.hh" // for u64
+#include "rlib/core/nic_stats.hh"
 
+#include "./cycles.hh"
+#include "./latency.hh"
 #include "./timer.hpp"
 
+#include <chrono>
 #include <iomanip>
 #include <iostream>
+#include <sstream>
+#include <thread>
 #include <vector>
 #include <fstream>
 
@@ -16,12 +24,33 @@ struct alignas(128) Statics
   u64 counter = 0;       // record thpt
   double float_data = 0; // record lat
 
+  u64 bytes = 0;       // payload bytes of the finished reqs
+  u64 post_cycles = 0; // cycles spent on posting reqs
+  u64 poll_cycles = 0; // cycles spent on polling completions
+  u64 empty_polls = 0; // #polls that return no completion
+
   void increment() { inc(1); }
 
   void inc(u64 num) __attribute__((optimize(0))) { counter += num; }
 
+  void inc_bytes(u64 num) __attribute__((optimize(0))) { bytes += num; }
+
+  void add_post(u64 cycles) __attribute__((optimize(0)))
+  {
+    post_cycles += cycles;
+  }
+
+  /*!
+    Record a poll which spent *cycles*; empty is true if nothing is polled.
+   */
+  void add_poll(u64 cycles, bool empty) __attribute__((optimize(0)))
+  {
+    poll_cycles += cycles;
+    empty_polls += empty ? 1 : 0;
+  }
+
   // private:
-  char pad[128 - sizeof(u64) - sizeof(double)];
+  char pad[128 - 5 * sizeof(u64) - sizeof(double)];
 };
 
 class Reporter
@@ -38,34 +67,75 @@ class Reporter
 
 #define LAT 0
 public:
+  /*!
+    Report the statics of each epoch (1 second).
+    Besides a human-readable log line, each epoch emits one JSON record
+    (a single line starting with '{') to stdout, and to record_file if given:
+    {"epoch":0,"elapsed_us":..,"thpt":..,"lat":..,
+     "lat_us":{"p50":..,"p90":..,"p99":..,"p999":..,"max":..},
+     "threads":[{"id":0,"ops":..,"bytes":..,"post_cycles":..,
+                 "poll_cycles":..,"empty_polls":..}, ..]}
+    The per-thread numbers are the deltas of the epoch.
+    "lat_us" is only present if lats (one histogram per thread) is given.
+    "transport" (the NIC transport events and the per-QP counters of the
+    epoch, see rdmaio::TransportStats) is only present if transport is given.
+   */
   static inline double report_thpt(const std::vector<Statics>& statics,
-                                   int epoches) __attribute__((optimize(0)))
+                                   int epoches,
+                                   const std::vector<LatHistogram>& lats = {},
+                                   const std::string& record_file = "",
+                                   TransportStats* transport = nullptr)
+    __attribute__((optimize(0)))
   {
+    std::ofstream ofstr;
+    if (!record_file.empty())
+      ofstr.open(record_file);
 
-    std::ofstream ofstr("aaa.txt");
-    std::vector<Statics> old_statics(statics.size() + 1);
+    std::vector<Statics> old_statics(statics.size());
     LOG(4) << "size of report: " << sizeof(Statics);
+    LatSnapshot old_lats;
     r2::Timer timer;
+    auto next_epoch = std::chrono::steady_clock::now();
     for (int epoch = 0; epoch < epoches; epoch += 1) {
-      sleep(1);
+      // sleep to the end of this epoch, so that epochs donot drift
+      next_epoch += std::chrono::seconds(1);
+      std::this_thread::sleep_until(next_epoch);
       r2::compile_fence();
       u64 sum = 0;
       double lat_cnt = 0;
       double lat = 0.0;
 
+      std::stringstream record;
+      record.precision(12);
+      record << "{\"epoch\":" << epoch;
+
+      std::stringstream threads;
+      threads << "\"threads\":[";
+
       // now report the throughput
-      for (uint i = 0; i < statics.size() - 1; ++i) {
-        auto temp = statics[i].counter;
-        auto thread_thpt = (temp - old_statics[i].counter);
+      for (uint i = 0; i < statics.size(); ++i) {
+        const Statics cur = statics[i];
+        auto& old = old_statics[i];
+        auto thread_thpt = (cur.counter - old.counter);
         // LOG(4) << "thread: " << i << " thpt: " << thread_thpt;
         sum += thread_thpt;
-        old_statics[i].counter = temp;
-        if (statics[i].float_data != 0) {
+        if (cur.float_data != 0) {
 
           lat_cnt += 1;
-          lat += statics[i].float_data;
+          lat += cur.float_data;
         }
+
+        threads << (i == 0 ? "" : ",") << "{\"id\":" << i
+                << ",\"ops\":" << thread_thpt
+                << ",\"bytes\":" << cur.bytes - old.bytes
+                << ",\"post_cycles\":" << cur.post_cycles - old.post_cycles
+                << ",\"poll_cycles\":" << cur.poll_cycles - old.poll_cycles
+                << ",\"empty_polls\":" << cur.empty_polls - old.empty_polls
+                << "}";
+        old = cur;
       }
+      threads << "]";
+
       if (lat_cnt > 0)
         lat = lat / lat_cnt;
       double passed_msec = timer.passed_msec();
@@ -73,11 +143,41 @@ public:
       double res = static_cast<double>(sum) / passed_msec * 1000000.0;
       asm volatile("" : : : "memory");
       timer.reset();
-      ofstr << (uint64_t)res << ' ' << lat << std::endl;
 
-      RDMA_LOG(3) << "epoch @ " << epoch << ' ' << lat << ' ' 
+      RDMA_LOG(3) << "epoch @ " << epoch << ' ' << lat << ' '
                   << ": thpt: " << // format_value(res, 0)
         res << " reqs/sec, ";
+
+      record << ",\"elapsed_us\":" << passed_msec << ",\"thpt\":" << res
+             << ",\"lat\":" << lat;
+
+      if (!lats.empty()) {
+        LatSnapshot cur_lats;
+        for (auto& h : lats)
+          cur_lats.merge(h);
+        auto epoch_lats = cur_lats.since(old_lats);
+        old_lats = cur_lats;
+
+        RDMA_LOG(3) << "epoch @ " << epoch << " lat(us)"
+                    << " p50: " << epoch_lats.percentile(50)
+                    << " p90: " << epoch_lats.percentile(90)
+                    << " p99: " << epoch_lats.percentile(99)
+                    << " p99.9: " << epoch_lats.percentile(99.9)
+                    << " max: " << epoch_lats.max();
+
+        record << ",\"lat_us\":{\"p50\":" << epoch_lats.percentile(50)
+               << ",\"p90\":" << epoch_lats.percentile(90)
+               << ",\"p99\":" << epoch_lats.percentile(99)
+               << ",\"p999\":" << epoch_lats.percentile(99.9)
+               << ",\"max\":" << epoch_lats.max() << "}";
+      }
+      if (transport != nullptr && !transport->empty())
+        record << ",\"transport\":" << transport->epoch_json();
+      record << "," << threads.str() << "}";
+
+      std::cout << record.str() << std::endl;
+      if (ofstr.is_open())
+        ofstr << record.str() << std::endl;
     }
     return 0.0;
   }
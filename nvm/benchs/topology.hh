@@ -0,0 +1,414 @@
+#pragma once
+
+#include <algorithm>
+#include <dirent.h>
+#include <fstream>
+#include <map>
+#include <numa.h>
+#include <sched.h>
+#include <sstream>
+#include <string>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <vector>
+
+#include "rlib/core/common.hh"
+
+namespace nvm {
+
+using namespace rdmaio;
+
+/*!
+  The location of one logical CPU (hardware thread).
+ */
+struct CPUInfo {
+  int cpu = 0;
+  int core = 0;   // physical core id, unique within a socket
+  int socket = 0; // physical package id
+  int node = 0;   // NUMA node
+  // the rank of this cpu among its SMT siblings; 0 is the primary thread
+  int smt_idx = 0;
+};
+
+/*!
+  CPUTopology discovers the cpus, SMT siblings and NUMA nodes of the host
+  from sysfs (falling back to libnuma for the node of a cpu), as well as the
+  NUMA nodes of the RNICs and the NVM devices.
+  The sysfs root is configurable so that the topology of a different machine
+  can be inspected from a copy of its /sys.
+
+  Only cpus in the affinity mask of the calling process are used, so the
+  topology respects taskset/cgroup restrictions.
+
+  Example:
+  `
+  auto topo = CPUTopology::create().value();
+  RDMA_LOG(4) << topo->to_str();
+  auto nic_node = topo->nic_node(0); // -1 if unknown
+  `
+ */
+class CPUTopology {
+  const std::string root;
+  std::vector<CPUInfo> cpus;
+
+public:
+  explicit CPUTopology(const std::string &root = "/sys") : root(root) {
+    discover();
+  }
+
+  static Option<Arc<CPUTopology>> create(const std::string &root = "/sys") {
+    auto res = std::make_shared<CPUTopology>(root);
+    if (res->cpus.empty())
+      return {};
+    return res;
+  }
+
+  const std::vector<CPUInfo> &all() const { return cpus; }
+
+  usize num_cpus() const { return cpus.size(); }
+
+  std::vector<int> nodes() const {
+    std::vector<int> res;
+    for (auto &c : cpus) {
+      if (std::find(res.begin(), res.end(), c.node) == res.end())
+        res.push_back(c.node);
+    }
+    std::sort(res.begin(), res.end());
+    return res;
+  }
+
+  /*!
+    The cpus of a node: primary threads first, then their SMT siblings,
+    each in the ascending order of the cpu id.
+   */
+  std::vector<CPUInfo> cpus_of(const int &node) const {
+    std::vector<CPUInfo> res;
+    for (auto &c : cpus) {
+      if (c.node == node)
+        res.push_back(c);
+    }
+    std::sort(res.begin(), res.end(), [](const CPUInfo &a, const CPUInfo &b) {
+      return a.smt_idx != b.smt_idx ? a.smt_idx < b.smt_idx : a.cpu < b.cpu;
+    });
+    return res;
+  }
+
+  /*!
+    The NUMA node of the RNIC opened by RLib with *dev_id*, -1 if unknown
+   */
+  int nic_node(const i64 &dev_id) const {
+    int num_devices = 0;
+    auto dev_list = ibv_get_device_list(&num_devices);
+    int res = -1;
+    if (dev_list != nullptr && dev_id >= 0 && dev_id < num_devices) {
+      res = read_int(root + "/class/infiniband/" +
+                         ibv_get_device_name(dev_list[dev_id]) +
+                         "/device/numa_node",
+                     -1);
+    }
+    if (dev_list != nullptr)
+      ibv_free_device_list(dev_list);
+    return res;
+  }
+
+  /*!
+    The NUMA node of an NVM device (e.g., /dev/dax1.0, /dev/pmem0), or of the
+    device hosting a file on a DAX file system; -1 if unknown
+   */
+  int nvm_node(const std::string &path) const {
+    auto name = path.substr(path.find_last_of('/') + 1);
+    if (name.compare(0, 3, "dax") == 0) {
+      auto res = read_int(root + "/bus/dax/devices/" + name + "/target_node",
+                          -1);
+      if (res < 0)
+        res = read_int(root + "/bus/dax/devices/" + name + "/numa_node", -1);
+      if (res >= 0)
+        return res;
+    }
+
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0)
+      return -1;
+    auto dev = S_ISBLK(st.st_mode) ? st.st_rdev : st.st_dev;
+    auto dev_dir = root + "/dev/block/" + std::to_string(major(dev)) + ":" +
+                   std::to_string(minor(dev));
+    auto res = read_int(dev_dir + "/device/numa_node", -1);
+    if (res < 0) // a partition
+      res = read_int(dev_dir + "/../device/numa_node", -1);
+    return res;
+  }
+
+  std::string to_str() const {
+    std::ostringstream oss;
+    oss << cpus.size() << " cpus, " << nodes().size() << " nodes:";
+    for (auto n : nodes()) {
+      auto cs = cpus_of(n);
+      usize primary = std::count_if(cs.begin(), cs.end(),
+                                    [](const CPUInfo &c) { return c.smt_idx == 0; });
+      oss << " [node " << n << ": " << primary << " cores, " << cs.size()
+          << " threads]";
+    }
+    return oss.str();
+  }
+
+  /*!
+    Parse a cpulist (e.g., "0-3,8,10-11") in sysfs
+   */
+  static std::vector<int> parse_cpulist(const std::string &s) {
+    std::vector<int> res;
+    std::istringstream iss(s);
+    std::string range;
+    while (std::getline(iss, range, ',')) {
+      if (range.empty() || range == "\n")
+        continue;
+      auto dash = range.find('-');
+      try {
+        int lo = std::stoi(range.substr(0, dash));
+        int hi = dash == std::string::npos ? lo : std::stoi(range.substr(dash + 1));
+        for (int i = lo; i <= hi; ++i)
+          res.push_back(i);
+      } catch (...) {
+        // ignore malformed ranges
+      }
+    }
+    return res;
+  }
+
+private:
+  static std::string read_line(const std::string &path) {
+    std::ifstream f(path);
+    std::string s;
+    if (f.is_open())
+      std::getline(f, s);
+    return s;
+  }
+
+  static int read_int(const std::string &path, const int &def) {
+    auto s = read_line(path);
+    try {
+      return s.empty() ? def : std::stoi(s);
+    } catch (...) {
+      return def;
+    }
+  }
+
+  void discover() {
+    auto cpu_dir = root + "/devices/system/cpu";
+    auto online = parse_cpulist(read_line(cpu_dir + "/online"));
+
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    const bool use_mask =
+        root == "/sys" && sched_getaffinity(0, sizeof(allowed), &allowed) == 0;
+
+    // cpu -> node, from /sys/devices/system/node/nodeX/cpulist
+    std::map<int, int> node_of;
+    auto node_dir = root + "/devices/system/node";
+    if (auto dir = opendir(node_dir.c_str())) {
+      while (auto ent = readdir(dir)) {
+        std::string name(ent->d_name);
+        if (name.compare(0, 4, "node") != 0 || name.size() == 4 ||
+            !isdigit(name[4]))
+          continue;
+        int node = std::stoi(name.substr(4));
+        for (auto c : parse_cpulist(read_line(node_dir + "/" + name + "/cpulist")))
+          node_of[c] = node;
+      }
+      closedir(dir);
+    }
+
+    for (auto c : online) {
+      if (use_mask && !CPU_ISSET(c, &allowed))
+        continue;
+      auto topo = cpu_dir + "/cpu" + std::to_string(c) + "/topology/";
+
+      CPUInfo info;
+      info.cpu = c;
+      info.core = read_int(topo + "core_id", c);
+      info.socket = read_int(topo + "physical_package_id", 0);
+      if (node_of.find(c) != node_of.end())
+        info.node = node_of[c];
+      else if (root == "/sys" && numa_available() >= 0)
+        info.node = std::max(numa_node_of_cpu(c), 0);
+      else
+        info.node = std::max(info.socket, 0);
+
+      auto siblings = parse_cpulist(read_line(topo + "thread_siblings_list"));
+      auto it = std::find(siblings.begin(), siblings.end(), c);
+      info.smt_idx = it == siblings.end() ? 0 : it - siblings.begin();
+      cpus.push_back(info);
+    }
+  }
+};
+
+/*!
+  The placement hints used by the NIC-/NVM-local policies.
+ */
+struct BindHints {
+  i64 nic_dev_id = -1;  // the RNIC used by the threads, in RLib's dev_id
+  std::string nvm_file; // the NVM device/file accessed by the threads
+};
+
+/*!
+  CoreBinder maps thread ids to cpus according to a policy, and pins threads.
+  The policy is given as "<name>[,nosmt]", where name is one of:
+  - compact: fill the cores of node 0 (primary threads before SMT siblings),
+             then those of node 1, ...;
+  - scatter: round-robin the threads over the nodes, each filled compactly;
+  - nic:     compact, starting from the node of the RNIC;
+  - nvm:     compact, starting from the node of the NVM device;
+  - node:N:  only use the cpus of node N;
+  - none:    do not bind.
+  nosmt leaves the SMT siblings unused, i.e., one thread per physical core.
+
+  Threads with an id beyond the available cpus are left unbound.
+
+  Example:
+  `
+  CoreBinder::init(FLAGS_bind_policy, {.nic_dev_id = FLAGS_use_nic_idx});
+  // in each thread
+  bind_to_core(thread_id);
+  `
+ */
+class CoreBinder {
+  std::vector<int> plan;
+  bool enabled = true;
+
+public:
+  CoreBinder(const CPUTopology &topo, const std::string &spec,
+             const BindHints &hints = BindHints()) {
+    std::string name = spec;
+    bool nosmt = false;
+    auto comma = spec.find(',');
+    if (comma != std::string::npos) {
+      name = spec.substr(0, comma);
+      nosmt = spec.substr(comma + 1) == "nosmt";
+      RDMA_ASSERT(nosmt) << "unknown bind policy modifier: "
+                         << spec.substr(comma + 1);
+    }
+
+    auto nodes = topo.nodes();
+    std::vector<std::vector<int>> per_node;
+    auto push_node = [&](const int &n) {
+      std::vector<int> cs;
+      for (auto &c : topo.cpus_of(n)) {
+        if (!nosmt || c.smt_idx == 0)
+          cs.push_back(c.cpu);
+      }
+      per_node.push_back(cs);
+    };
+    auto local_first = [&](const int &local) {
+      if (local < 0 ||
+          std::find(nodes.begin(), nodes.end(), local) == nodes.end()) {
+        RDMA_LOG(WARNING) << "the node of policy " << name
+                          << " is unknown, fallback to compact";
+      } else {
+        push_node(local);
+      }
+      for (auto n : nodes) {
+        if (n != local)
+          push_node(n);
+      }
+    };
+
+    if (name == "none") {
+      enabled = false;
+      return;
+    } else if (name == "compact" || name == "scatter") {
+      for (auto n : nodes)
+        push_node(n);
+    } else if (name == "nic") {
+      local_first(topo.nic_node(hints.nic_dev_id));
+    } else if (name == "nvm") {
+      local_first(topo.nvm_node(hints.nvm_file));
+    } else if (name.compare(0, 5, "node:") == 0) {
+      push_node(std::stoi(name.substr(5)));
+    } else {
+      RDMA_ASSERT(false) << "unknown bind policy: " << name;
+    }
+
+    if (name == "scatter") {
+      for (usize i = 0;; ++i) {
+        bool added = false;
+        for (auto &cs : per_node) {
+          if (i < cs.size()) {
+            plan.push_back(cs[i]);
+            added = true;
+          }
+        }
+        if (!added)
+          break;
+      }
+    } else {
+      for (auto &cs : per_node)
+        plan.insert(plan.end(), cs.begin(), cs.end());
+    }
+  }
+
+  /*!
+    Initialize the process-wide binder used by bind_to_core()
+   */
+  static void init(const std::string &spec,
+                   const BindHints &hints = BindHints()) {
+    auto topo = CPUTopology::create();
+    if (!topo) {
+      RDMA_LOG(WARNING) << "failed to discover the cpu topology, "
+                        << "threads will not be bound";
+      global() = {};
+      return;
+    }
+    RDMA_LOG(4) << "cpu topology: " << topo.value()->to_str();
+    global() = std::make_shared<CoreBinder>(*(topo.value()), spec, hints);
+    RDMA_LOG(4) << "bind policy " << spec << ": "
+                << global().value()->to_str();
+  }
+
+  static Option<Arc<CoreBinder>> &global() {
+    static Option<Arc<CoreBinder>> binder = {};
+    return binder;
+  }
+
+  /*!
+    The cpu assigned to thread t_id, if any
+   */
+  Option<int> cpu_of(const int &t_id) const {
+    if (!enabled || t_id < 0 || t_id >= static_cast<int>(plan.size()))
+      return {};
+    return plan[t_id];
+  }
+
+  /*!
+    Pin the calling thread to the cpu of t_id
+   */
+  bool bind(const int &t_id) const {
+    auto cpu = cpu_of(t_id);
+    if (!cpu)
+      return false;
+    cpu_set_t mask;
+    CPU_ZERO(&mask);
+    CPU_SET(cpu.value(), &mask);
+    return sched_setaffinity(0, sizeof(mask), &mask) == 0;
+  }
+
+  std::string to_str() const {
+    if (!enabled)
+      return "not bound";
+    std::ostringstream oss;
+    for (usize i = 0; i < plan.size(); ++i)
+      oss << (i == 0 ? "" : ",") << plan[i];
+    return oss.str();
+  }
+};
+
+/*!
+  Pin the calling thread according to the process-wide binder.
+  Do nothing if CoreBinder::init() has not been called.
+ */
+inline int bind_to_core(const int &t_id) {
+  auto &binder = CoreBinder::global();
+  if (binder)
+    binder.value()->bind(t_id);
+  return 0;
+}
+
+} // namespace nvm
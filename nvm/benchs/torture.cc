@@ -0,0 +1,348 @@
+#include <gflags/gflags.h>
+
+#include <vector>
+
+#include "rlib/core/qps/loopback.hh"
+#include "rlib/tests/random.hh"
+
+#include "../crash_region.hh"
+
+#include "./one_sided/sync_write.hh"
+#include "./two_sided/core.hh"
+
+DEFINE_string(writer, "copy",
+              "The NVM write path to torture: copy (the write requests of the "
+              "two-sided servers) | rdma (one-sided writes) | log (DrTM+H "
+              "log entries, via copy or rdma)");
+DEFINE_string(mode, "",
+              "The persistence mode: none | nt | clwb | clflushopt | clflush | "
+              "barrier for copy; write | write_read for rdma; any of them for "
+              "log. Empty to run all the modes of the writer");
+DEFINE_bool(eadr, false, "Whether the CPU caches are in the persistence domain");
+DEFINE_bool(ddio, true, "Whether RDMA writes are placed in the LLC (DDIO)");
+DEFINE_uint64(ops, 256, "Number of writes per run");
+DEFINE_uint64(max_payload, 512, "The max payload (in bytes) of a write");
+DEFINE_uint64(crashes, 2000, "Number of crash points replayed per mode");
+DEFINE_uint64(seed, 0xdeadbeaf, "Random seed");
+
+using namespace nvm;
+using namespace nvm::crash;
+using namespace test;
+
+namespace {
+
+const std::vector<std::string> kCopyModes = {
+    "none", "nt", "clwb", "clflushopt", "clflush", "barrier"};
+const std::vector<std::string> kRDMAModes = {"write", "write_read"};
+
+bool is_rdma_mode(const std::string &mode) {
+  return mode == "write" || mode == "write_read";
+}
+
+/*!
+  A writer durably writes [buf, buf + len) to [off, off + len) of the region
+  (as its mode guarantees), and returns after the write is acknowledged.
+ */
+using writer_t =
+    std::function<void(const u64 &off, const char *buf, const u64 &len)>;
+
+/*!
+  The write requests of the two-sided servers: execute_nvm_ops() persists the
+  payload by persist::copy (with the kernel of mode), or by a plain memcpy
+  for mode none (i.e., without sync).
+ */
+writer_t rpc_writer(const Arc<CrashRegion> &r, const std::string &mode,
+                    const u64 &max_len) {
+  const bool sync = mode != "none";
+  if (sync && !persist::init(mode))
+    return nullptr;
+
+  auto msg_buf =
+      std::make_shared<std::vector<char>>(2 * persist::kCacheLine + max_len);
+  auto reply_buf = std::make_shared<std::vector<char>>(max_len);
+  return [r, sync, msg_buf, reply_buf](const u64 &off, const char *buf,
+                                       const u64 &len) {
+    // the layout read by execute_nvm_ops: the payload starts at the next
+    // cache line of the message
+    char *base = reinterpret_cast<char *>(
+        round_up<u64>(reinterpret_cast<u64>(msg_buf->data()),
+                      persist::kCacheLine));
+    MemBlock msg(base + sizeof(u64), sizeof(MsgHeader) + sizeof(Request));
+    auto req = msg.interpret_as<Request>(sizeof(MsgHeader));
+    req->read = 0;
+    req->addr = off;
+    req->payload = len;
+    memcpy(base + persist::kCacheLine, buf, len);
+
+    Arc<MemoryRegion> nvm = r;
+    if (sync) {
+      Recording rec(*r);
+      execute_nvm_ops(nvm, msg, true, reply_buf->data());
+    } else {
+      execute_nvm_ops(nvm, msg, false, reply_buf->data());
+      // the memcpy is not instrumented, so record its stores afterwards
+      r->store(off, reinterpret_cast<char *>(r->addr) + off, len);
+    }
+  };
+}
+
+/*!
+  The log entries of DrTM+H: RpcLogger::log_remote_handler appends an entry
+  by persist::copy (with the kernel of mode), or by a plain memcpy for mode
+  none. The handler runs in the nocc framework, so its call is issued
+  directly here.
+ */
+writer_t log_copy_writer(const Arc<CrashRegion> &r, const std::string &mode) {
+  const bool sync = mode != "none";
+  if (sync && !persist::init(mode))
+    return nullptr;
+
+  return [r, sync](const u64 &off, const char *buf, const u64 &len) {
+    char *dst = reinterpret_cast<char *>(r->addr) + off;
+    if (sync) {
+      Recording rec(*r);
+      persist::copy(dst, buf, len);
+    } else {
+      r->store(off, buf, len);
+    }
+  };
+}
+
+/*!
+  The one-sided writes of the client through a loopback transport, whose
+  accesses to the region are recorded: an RDMA WRITE (mode write), or a
+  WRITE followed by the read "sync" of the client (see add_sync_write) for
+  mode write_read, which is also how DrTM+H persists its remote log entries.
+ */
+writer_t rdma_writer(const Arc<CrashRegion> &r, const std::string &mode,
+                     const u64 &max_len) {
+  struct Conn {
+    std::vector<char> local;
+    std::vector<char> dram;
+    RegAttr local_mr, nvm_mr, dram_mr;
+    Arc<LoopbackTransport> qp;
+  };
+  auto c = std::make_shared<Conn>();
+  c->local.resize(max_len);
+  c->dram.resize(persist::kCacheLine);
+
+  auto mem = std::make_shared<LoopbackMem>();
+  c->local_mr = mem->reg(c->local.data(), c->local.size()).value();
+  c->nvm_mr = mem->reg(r->addr, r->sz, r->dma_hook()).value();
+  c->dram_mr =
+      mem->reg(c->dram.data(), c->dram.size(), r->flush_hook()).value();
+  c->qp = LoopbackTransport::create(mem).value();
+
+  const bool sync = mode == "write_read";
+  return [c, sync](const u64 &off, const char *buf, const u64 &len) {
+    memcpy(c->local.data(), buf, len);
+
+    DoorbellHelper<2> doorbell(IBV_WR_RDMA_WRITE);
+    if (sync) {
+      add_sync_write(doorbell, c->local.data(), len, c->local_mr.key,
+                     c->nvm_mr.buf + off, c->nvm_mr.key, c->dram_mr.buf,
+                     c->dram_mr.key);
+    } else {
+      doorbell.next();
+      doorbell.cur_wr().send_flags = IBV_SEND_SIGNALED;
+      doorbell.cur_wr().wr.rdma.remote_addr = c->nvm_mr.buf + off;
+      doorbell.cur_wr().wr.rdma.rkey = c->nvm_mr.key;
+      doorbell.cur_sge() = {.addr = (u64)(c->local.data()),
+                            .length = static_cast<u32>(len),
+                            .lkey = c->local_mr.key};
+    }
+    doorbell.freeze();
+    RDMA_ASSERT(c->qp->post_send(*doorbell.first_wr_ptr()) == IOCode::Ok);
+    auto res = c->qp->wait_one_comp();
+    RDMA_ASSERT(res == IOCode::Ok) << "write error: " << res.desc.status;
+  };
+}
+
+/*!
+  The writer of mode for writes of at most max_len bytes, nullptr if the mode
+  is unsupported on this CPU
+ */
+writer_t make_writer(const Arc<CrashRegion> &r, const std::string &mode,
+                     const u64 &max_len) {
+  if (is_rdma_mode(mode))
+    return rdma_writer(r, mode, max_len);
+  RDMA_ASSERT(mode == "none" || persist::kernel_of(mode))
+      << "unknown persistence mode: " << mode;
+  if (FLAGS_writer == "log")
+    return log_copy_writer(r, mode);
+  return rpc_writer(r, mode, max_len);
+}
+
+inline char payload_byte(const u64 &id, const u64 &i) {
+  return static_cast<char>((id * 131 + i * 7 + 1) % 251 + 1);
+}
+
+/*!
+  Requests write to disjoint slots at random offsets, and each is
+  acknowledged after its write; so every acknowledged payload must survive.
+ */
+Option<Report> torture_writes(const std::string &mode, FastRandom &rand) {
+  const u64 slot = FLAGS_max_payload + CrashRegion::kLine;
+  auto r = CrashRegion::create(slot * FLAGS_ops,
+                               {.eadr = FLAGS_eadr, .ddio = FLAGS_ddio})
+               .value();
+  auto write = make_writer(r, mode, FLAGS_max_payload);
+  if (write == nullptr)
+    return {};
+
+  std::vector<std::pair<u64, u64>> writes; // (off, len)
+  std::vector<char> buf(FLAGS_max_payload);
+  for (u64 id = 0; id < FLAGS_ops; ++id) {
+    const u64 len = rand.next() % FLAGS_max_payload + 1;
+    const u64 off = id * slot + rand.next() % (slot - len + 1);
+    for (u64 i = 0; i < len; ++i)
+      buf[i] = payload_byte(id, i);
+    write(off, buf.data(), len);
+    r->mark(id);
+    writes.push_back(std::make_pair(off, len));
+  }
+
+  return torture(
+      *r,
+      [&](const std::vector<char> &image,
+          const std::vector<u64> &acked) -> std::string {
+        for (auto id : acked) {
+          for (u64 i = 0; i < writes[id].second; ++i) {
+            if (image[writes[id].first + i] != payload_byte(id, i))
+              return "acked write " + std::to_string(id) + " lost at byte " +
+                     std::to_string(i);
+          }
+        }
+        return "";
+      },
+      FLAGS_crashes, rand);
+}
+
+struct __attribute__((packed)) LogHeader {
+  u64 seq; // starts from 1, 0 marks the end of the log
+  u32 len;
+  u32 checksum;
+};
+
+u32 log_checksum(const u64 &seq, const char *payload, const u32 &len) {
+  u32 res = 2166136261u ^ static_cast<u32>(seq);
+  for (u32 i = 0; i < len; ++i)
+    res = (res ^ static_cast<u8>(payload[i])) * 16777619u;
+  return res;
+}
+
+/*!
+  Transactions append entries to a log, and each commits after its entry is
+  persisted. The recovery scans the log until the first invalid entry, and
+  must find the entries of all the committed transactions.
+ */
+Option<Report> torture_log(const std::string &mode, FastRandom &rand) {
+  const u64 max_entry = sizeof(LogHeader) + FLAGS_max_payload;
+  auto r = CrashRegion::create(max_entry * (FLAGS_ops + 1),
+                               {.eadr = FLAGS_eadr, .ddio = FLAGS_ddio})
+               .value();
+  auto write = make_writer(r, mode, max_entry);
+  if (write == nullptr)
+    return {};
+
+  std::vector<char> buf(max_entry);
+  u64 tail = 0;
+  for (u64 seq = 1; seq <= FLAGS_ops; ++seq) {
+    auto header = reinterpret_cast<LogHeader *>(buf.data());
+    header->seq = seq;
+    header->len = rand.next() % FLAGS_max_payload + 1;
+    char *payload = buf.data() + sizeof(LogHeader);
+    for (u32 i = 0; i < header->len; ++i)
+      payload[i] = payload_byte(seq, i);
+    header->checksum = log_checksum(seq, payload, header->len);
+
+    const u64 entry_sz = sizeof(LogHeader) + header->len;
+    write(tail, buf.data(), entry_sz);
+    r->mark(seq);
+    tail += entry_sz;
+  }
+
+  return torture(
+      *r,
+      [&](const std::vector<char> &image,
+          const std::vector<u64> &acked) -> std::string {
+        // recover
+        u64 off = 0, recovered = 0;
+        while (off + sizeof(LogHeader) <= image.size()) {
+          auto header = reinterpret_cast<const LogHeader *>(&image[off]);
+          if (header->seq != recovered + 1 || header->len == 0 ||
+              header->len > FLAGS_max_payload ||
+              off + sizeof(LogHeader) + header->len > image.size())
+            break;
+          const char *payload = &image[off] + sizeof(LogHeader);
+          if (header->checksum !=
+              log_checksum(header->seq, payload, header->len))
+            break;
+          recovered += 1;
+          off += sizeof(LogHeader) + header->len;
+        }
+        if (!acked.empty() && acked.back() > recovered)
+          return "committed entry " + std::to_string(recovered + 1) +
+                 " is not recovered";
+        return "";
+      },
+      FLAGS_crashes, rand);
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  RDMA_ASSERT(FLAGS_ops > 0 && FLAGS_max_payload > 0);
+
+  std::vector<std::string> modes;
+  if (!FLAGS_mode.empty()) {
+    modes.push_back(FLAGS_mode);
+  } else if (FLAGS_writer == "copy") {
+    modes = kCopyModes;
+  } else if (FLAGS_writer == "rdma") {
+    modes = kRDMAModes;
+  } else {
+    modes = kCopyModes;
+    modes.insert(modes.end(), kRDMAModes.begin(), kRDMAModes.end());
+  }
+
+  RDMA_LOG(4) << "torture the " << FLAGS_writer
+              << " writer, eADR: " << FLAGS_eadr << ", DDIO: " << FLAGS_ddio;
+
+  bool all_durable = true;
+  for (auto &mode : modes) {
+    RDMA_ASSERT(FLAGS_writer != "copy" || !is_rdma_mode(mode))
+        << "the copy writer does not support mode " << mode;
+    RDMA_ASSERT(FLAGS_writer != "rdma" || is_rdma_mode(mode))
+        << "the rdma writer does not support mode " << mode;
+
+    FastRandom rand(FLAGS_seed);
+    Option<Report> res;
+    if (FLAGS_writer == "log")
+      res = torture_log(mode, rand);
+    else if (FLAGS_writer == "copy" || FLAGS_writer == "rdma")
+      res = torture_writes(mode, rand);
+    else
+      RDMA_ASSERT(false) << "unknown writer: " << FLAGS_writer;
+
+    if (!res) {
+      RDMA_LOG(4) << "mode " << mode << ": unsupported on this CPU, skipped";
+      all_durable = all_durable && FLAGS_mode.empty();
+      continue;
+    }
+    const Report &report = res.value();
+
+    if (report.durable()) {
+      RDMA_LOG(4) << "mode " << mode << ": durable (" << report.crashes
+                  << " crashes checked)";
+    } else {
+      RDMA_LOG(4) << "mode " << mode << ": NOT durable, " << report.violations
+                  << " of " << report.crashes << " crashes violated; first at op "
+                  << report.first_crash << ": " << report.first_reason;
+    }
+    all_durable = all_durable && report.durable();
+  }
+  // a mode given explicitly is expected to be durable
+  return (FLAGS_mode.empty() || all_durable) ? 0 : -1;
+}
@@ -15,7 +15,7 @@
 #include "../statucs.hh"
 #include "../thread.hh"
 
-#include "val19.hh"
+#include "../topology.hh"
 
 #include "./proto.hh"
 
@@ -32,6 +32,9 @@ DEFINE_string(addr, "localhost:8888", "Server address to connect to.");
 DEFINE_int64(use_nic_idx, 0, "Which NIC to create QP");
 
 DEFINE_int64(threads, 8, "Number of threads to use.");
+DEFINE_string(bind_policy, "compact",
+              "How threads are pinned to cpus: compact | scatter | nic | nvm "
+              "| node:N | none, optionally suffixed with ,nosmt");
 
 DEFINE_int64(payload, 256, "Number of payload to read/write");
 
@@ -44,50 +47,15 @@ DEFINE_uint64(coros, 8, "Number of coroutine used per thread.");
 
 DEFINE_bool(use_read, true, "");
 
+DEFINE_string(report_file, "",
+              "The file to store the per-epoch JSON records, "
+              "which are always printed to stdout");
+
 template <typename Nat> Nat align(const Nat &x, const Nat &a) {
   auto r = x % a;
   return r ? (x + a - r) : x;
 }
 
-int BindToCore(int t_id) {
-
-  if (t_id >= (per_socket_cores * 2))
-    return 0;
-
-  int x = t_id;
-  int y = 0;
-
-#ifdef SCALE
-  assert(false);
-  // specific  binding for scale tests
-  int mac_per_node = 16 / nthreads; // there are total 16 threads avialable
-  int mac_num = current_partition % mac_per_node;
-
-  if (mac_num < mac_per_node / 2) {
-    y = socket_0[x + mac_num * nthreads];
-  } else {
-    y = socket_1[x + (mac_num - mac_per_node / 2) * nthreads];
-  }
-#else
-  // bind ,andway
-  if (x >= per_socket_cores) {
-    // there is no other cores in the first socket
-    y = socket_1[x - per_socket_cores];
-  } else {
-    y = socket_0[x];
-  }
-
-#endif
-
-  // fprintf(stdout,"worker: %d binding %d\n",x,y);
-  cpu_set_t mask;
-  CPU_ZERO(&mask);
-  CPU_SET(y, &mask);
-  sched_setaffinity(0, sizeof(mask), &mask);
-
-  return 0;
-}
-
 // an allocator to allocate recv buffer for messages
 class SimpleAllocator : AbsRecvAllocator {
   RMem::raw_ptr_t buf = nullptr;
@@ -118,6 +86,7 @@ public:
 
 int main(int argc, char **argv) {
   gflags::ParseCommandLineFlags(&argc, &argv, true);
+  CoreBinder::init(FLAGS_bind_policy, {.nic_dev_id = FLAGS_use_nic_idx});
 
   RDMA_LOG(4) << "Msg client bootstrap with " << FLAGS_threads << " threads";
 
@@ -138,8 +107,7 @@ int main(int argc, char **argv) {
   for (uint thread_id = 0; thread_id < FLAGS_threads; ++thread_id) {
 
     threads.push_back(std::make_unique<TThread>([thread_id, &statics]() -> int {
-    //                                                  BindToCore(thread_id +
-    //                                                  per_socket_cores);
+      bind_to_core(thread_id);
 
                                                   auto idx = FLAGS_use_nic_idx;
       auto nic = RNic::create(RNicInfo::query_dev_names().at(idx)).value();
@@ -212,12 +180,15 @@ int main(int argc, char **argv) {
         replies, the coroutine are waken up for the execution.
        */
       poll_func_t reply_future =
-          [&ud, &recv_rs, &ssched, &wait_replies,
-           &reply_bufs]() -> Result<std::pair<::r2::Routine::id_t, usize>> {
+          [&ud, &recv_rs, &ssched, &wait_replies, &reply_bufs, &statics,
+           thread_id]() -> Result<std::pair<::r2::Routine::id_t, usize>> {
+        auto start = read_tsc();
+        usize polled = 0;
         // iterate through all the pending messages
         for (RecvIter<UD, 2048> iter(ud, recv_rs); iter.has_msgs();
              iter.next()) {
           auto imm_msg = iter.cur_msg().value();
+          polled += 1;
 
           auto session_id = std::get<0>(imm_msg);
           auto buf = static_cast<char *>(std::get<1>(imm_msg)) + kGRHSz;
@@ -245,6 +216,7 @@ int main(int argc, char **argv) {
             ssched.addback_coroutine(coro_id);
           }
         }
+        statics[thread_id].add_poll(read_tsc() - start, polled == 0);
         // this future shall never return
         return NotReady(std::make_pair<::r2::Routine::id_t, usize>(0u, 0u));
       };
@@ -344,6 +316,7 @@ int main(int argc, char **argv) {
 #else
               // use doorbell, need to hard code
               assert(doorbell.empty());
+              auto start = read_tsc();
               for (uint i = 0; i < window_sz; ++i) {
 
                 *header = {.type = Req,
@@ -374,6 +347,7 @@ int main(int argc, char **argv) {
                 ASSERT(ret == IOCode::Ok) << "error: " << ret.desc;
               }
               ASSERT(ud_session->flush_a_doorbell(doorbell) == IOCode::Ok);
+              statics[thread_id].add_post(read_tsc() - start);
 #endif
               //wait_replies[R2_COR_ID()] = window_sz;
               //reply_bufs[R2_COR_ID()] = reply_buf;
@@ -381,6 +355,7 @@ int main(int argc, char **argv) {
               //auto ret = R2_PAUSE_AND_YIELD;
               //ASSERT(ret == IOCode::Ok);
               statics[thread_id].inc(window_sz);
+              statics[thread_id].inc_bytes(FLAGS_payload * window_sz);
               continue;
               R2_YIELD;
             }
@@ -401,7 +376,7 @@ int main(int argc, char **argv) {
     t->start();
   LOG(2) << "all thread run";
 
-  Reporter::report_thpt(statics, 40);
+  Reporter::report_thpt(statics, 40, {}, FLAGS_report_file);
 
   for (auto &t : threads) {
     t->join();
@@ -0,0 +1,262 @@
+#pragma once
+
+#include <algorithm>
+#include <vector>
+
+#include "../../memory_region.hh"
+#include "../../persist.hh"
+
+namespace nvm {
+
+/*!
+  WriteCoalescer stages the NVM writes of a batch of requests (e.g., all
+  the msgs drained by one RecvIter pass), and merges them by the 256B
+  Optane XPLine. On flush(), the touched XPLines are persisted in the order
+  of their offsets, each with one aligned store sequence and fence (NT
+  stores for a full line), instead of one per request, so that small writes
+  to the same line are not amplified to multiple 256B media writes.
+  It pays off when the writes of a batch share XPLines (e.g., hot or
+  sequential small writes); for random writes larger than a line, it only
+  adds the staging cost.
+
+  Only the written bytes are persisted: a partially written cache line is
+  stored byte-wise and written back, instead of being loaded from the NVM
+  and written whole, so the coalescer never overwrites the bytes written by
+  others (e.g., another server thread sharing the region).
+  The writes are not durable (nor visible in the NVM) before flush(), so the
+  replies of a batch should be sent after it.
+
+  Example:
+  `
+  WriteCoalescer coalescer(nvm_region);
+  for (RecvIter<..> iter(..); iter.has_msgs(); iter.next()) {
+    if (!coalescer.add(req->addr, payload, req->payload)) {
+      coalescer.flush();
+      coalescer.add(req->addr, payload, req->payload);
+    }
+    // ... prepare the reply
+  }
+  coalescer.flush();
+  // ... send the replies
+  `
+ */
+class WriteCoalescer {
+public:
+  static const usize kXPLine = 256;
+  static const usize kLinesPerXP = kXPLine / persist::kCacheLine;
+
+  struct Stats {
+    // the writes and bytes added
+    u64 writes = 0;
+    u64 bytes = 0;
+    // the XPLines and the cache lines persisted
+    u64 xplines = 0;
+    u64 lines = 0;
+    // the cache lines partially written, whose written bytes are persisted
+    u64 partial_lines = 0;
+
+    // the average #writes merged into one persisted XPLine
+    double merge_ratio() const {
+      return xplines == 0 ? 0 : static_cast<double>(writes) / xplines;
+    }
+  };
+
+private:
+  struct alignas(persist::kCacheLine) XPLine {
+    char data[kXPLine];
+    // the offset of the line in the NVM region
+    u64 off = 0;
+    // bit i: the i-th cache line is staged
+    u8 staged = 0;
+    // bit j of dirty[i]: the j-th byte of the i-th cache line is written
+    u64 dirty[kLinesPerXP];
+  };
+
+  Arc<MemoryRegion> nvm;
+  char *base = nullptr;
+
+  std::vector<XPLine> lines;
+  usize used = 0;
+  // an open-addressing table of XPLine offset -> its index (+1) in lines,
+  // whose used buckets are cleared by flush()
+  std::vector<std::pair<u64, u32>> index;
+  std::vector<u32> buckets;
+  std::vector<u32> order;
+
+public:
+  Stats stats;
+
+  /*!
+    max_lines: the #XPLines that can be staged before a flush
+   */
+  explicit WriteCoalescer(const Arc<MemoryRegion> &nvm,
+                          const usize &max_lines = 1024)
+      : nvm(nvm), base(static_cast<char *>(nvm->addr)), lines(max_lines) {
+    RDMA_ASSERT(max_lines > 0);
+    usize n = 1;
+    while (n < max_lines * 2)
+      n <<= 1;
+    index.resize(n, std::make_pair(0, 0));
+    buckets.reserve(max_lines);
+    order.reserve(max_lines);
+  }
+
+  /*!
+    Stage a write of [src, src + sz) to the offset off of the NVM region
+    \ret false if there is no space to stage it, then the caller should
+    flush() and retry; the write is not staged at all in this case
+   */
+  bool add(const u64 &off, const char *src, const usize &sz) {
+    if (sz == 0)
+      return true;
+    RDMA_ASSERT(off + sz <= nvm->sz)
+        << "write out of the region: " << off << " + " << sz;
+
+    const u64 first = off / kXPLine * kXPLine;
+    const u64 last = (off + sz - 1) / kXPLine * kXPLine;
+    usize new_lines = 0;
+    for (u64 l = first; l <= last; l += kXPLine)
+      new_lines += index[find(l)].second == 0 ? 1 : 0;
+    if (used + new_lines > lines.size())
+      return false;
+
+    usize copied = 0;
+    for (u64 l = first; l <= last; l += kXPLine) {
+      auto &line = stage_line(l);
+      const u64 start = std::max<u64>(off, l);
+      const u64 end = std::min<u64>(off + sz, l + kXPLine);
+      copy_to_line(line, start - l, src + copied, end - start);
+      copied += end - start;
+    }
+    stats.writes += 1;
+    stats.bytes += sz;
+    return true;
+  }
+
+  // #XPLines staged
+  usize pending() const { return used; }
+
+  /*!
+    Persist all the staged XPLines, in the order of their offsets
+    \ret the #XPLines persisted
+   */
+  usize flush() {
+    if (used == 0)
+      return 0;
+    std::sort(order.begin(), order.end(), [this](u32 a, u32 b) {
+      return lines[a].off < lines[b].off;
+    });
+    for (auto i : order)
+      persist_line(lines[i]);
+
+    const usize res = used;
+    stats.xplines += res;
+    used = 0;
+    for (auto b : buckets)
+      index[b].second = 0;
+    buckets.clear();
+    order.clear();
+    return res;
+  }
+
+private:
+  // the bucket of off, or the empty one to insert it
+  usize find(const u64 &off) const {
+    const usize mask = index.size() - 1;
+    usize b = (off / kXPLine * 0x9E3779B97F4A7C15UL) >> 20 & mask;
+    while (index[b].second != 0 && index[b].first != off)
+      b = (b + 1) & mask;
+    return b;
+  }
+
+  XPLine &stage_line(const u64 &off) {
+    const usize b = find(off);
+    if (index[b].second != 0)
+      return lines[index[b].second - 1];
+    const u32 idx = used++;
+    index[b] = std::make_pair(off, idx + 1);
+    buckets.push_back(b);
+    order.push_back(idx);
+    auto &line = lines[idx];
+    line.off = off;
+    line.staged = 0;
+    return line;
+  }
+
+  static constexpr u64 kFullLine = ~static_cast<u64>(0);
+
+  // the mask of bytes [from, to) of a cache line
+  static u64 byte_mask(const usize &from, const usize &to) {
+    const u64 high = to >= 64 ? kFullLine : ((static_cast<u64>(1) << to) - 1);
+    return high & ~((static_cast<u64>(1) << from) - 1);
+  }
+
+  void copy_to_line(XPLine &line, const usize &pos, const char *src,
+                    const usize &sz) {
+    const usize first = pos / persist::kCacheLine;
+    const usize last = (pos + sz - 1) / persist::kCacheLine;
+    for (usize cl = first; cl <= last; ++cl) {
+      const usize cl_start = cl * persist::kCacheLine;
+      const usize from = std::max(pos, cl_start) - cl_start;
+      const usize to =
+          std::min(pos + sz, cl_start + persist::kCacheLine) - cl_start;
+      if (!(line.staged & (1 << cl))) {
+        line.staged |= (1 << cl);
+        line.dirty[cl] = 0;
+      }
+      line.dirty[cl] |= byte_mask(from, to);
+    }
+    memcpy(line.data + pos, src, sz);
+  }
+
+  /*!
+    Store the written bytes of a partial cache line, and write it back
+   */
+  void persist_partial(XPLine &line, const usize &cl) {
+    const usize cl_start = cl * persist::kCacheLine;
+    char *dst = base + line.off + cl_start;
+    const u64 dirty = line.dirty[cl];
+    for (usize b = 0; b < persist::kCacheLine;) {
+      if (!(dirty & (static_cast<u64>(1) << b))) {
+        b += 1;
+        continue;
+      }
+      usize end = b + 1;
+      while (end < persist::kCacheLine && (dirty & (static_cast<u64>(1) << end)))
+        end += 1;
+      memcpy(dst + b, line.data + cl_start + b, end - b);
+      b = end;
+    }
+    persist::flush(dst, persist::kCacheLine);
+    stats.partial_lines += 1;
+  }
+
+  void persist_line(XPLine &line) {
+    // each run of fully written cache lines is written with one store
+    // sequence and fence, using the persist kernel for its size (NT stores
+    // for a full XPLine); the holes are not loaded, since reading the NVM
+    // costs more than a partial XPLine write
+    for (usize cl = 0; cl < kLinesPerXP;) {
+      if (!(line.staged & (1 << cl))) {
+        cl += 1;
+        continue;
+      }
+      if (line.dirty[cl] != kFullLine) {
+        persist_partial(line, cl);
+        cl += 1;
+        continue;
+      }
+      usize end = cl + 1;
+      while (end < kLinesPerXP && (line.staged & (1 << end)) &&
+             line.dirty[end] == kFullLine)
+        end += 1;
+      const usize pos = cl * persist::kCacheLine;
+      const usize sz = (end - cl) * persist::kCacheLine;
+      persist::copy(base + line.off + pos, line.data + pos, sz);
+      stats.lines += end - cl;
+      cl = end;
+    }
+  }
+};
+
+} // namespace nvm
@@ -1,16 +1,11 @@
 #pragma once
 
-#include <emmintrin.h>
-#include <immintrin.h>
-#include <x86intrin.h>
-#include <xmmintrin.h>
-
 #include "r2/src/common.hh"
 #include "r2/src/mem_block.hh"
 
-#include "./avx_512.hh"
-
+#include "../../kv_store.hh"
 #include "../../nvm_region.hh"
+#include "../../persist.hh"
 
 #include "./proto.hh"
 
@@ -24,97 +19,20 @@ static constexpr T round_up(const T &num, const T &multiple) {
 
 using namespace r2;
 
-inline void clwb(void *p) {
-  asm volatile("clwb (%0)\n\t" : : "r"(p) : "memory");
-}
-
-inline void flush_cache(char *ptr, u64 size) {
-  char *cur_ptr = ptr;
-  for (u64 cur = 0; cur < size; cur += 64) {
-    _mm_clflush(cur_ptr);
-    r2::compile_fence();
-    cur_ptr += 64;
-  }
-}
-
-usize nt_memcpy_512(char *src, u64 size, char *target) {
-  auto cur_ptr = src;
-  usize cur = 0;
-  //LOG(4) << "in copy"; sleep(1);
-  ASSERT((u64)src % 32 == 0);
-  ASSERT((u64)target % 32 == 0);
-
-  for (cur = 0; cur < size;) {
-    cur += sizeof(__m512i);
-    _mm512_stream_si512((__m512i *)(target + cur), *((__m512i *)(src + cur)));
-    //LOG(4) << "copied: " << cur;
-  }
-  //LOG(4) << "copy done: " << cur;
-  return cur;
-}
-
-usize nt_memcpy_512_pure(char *src, u64 size, char *target) {
-  auto cur_ptr = src;
-  usize cur = 0;
-  // LOG(4) << "in copy"; sleep(1);
-  //ASSERT((u64)src % 32 == 0);
-  //ASSERT((u64)target % 32 == 0);
-
-  __m512i temp;
-
-  for (cur = 0; cur < size;) {
-    cur += sizeof(__m512i);
-    _mm512_stream_si512((__m512i *)(target + cur), temp);
-    // LOG(4) << "copied: " << cur;
-  }
-  // LOG(4) << "copy done: " << cur;
-  return cur;
-}
+inline void flush_cache(char *ptr, u64 size) { persist::flush(ptr, size); }
 
+/*!
+  Copy with non-temporal stores (the widest supported by the CPU), and fence.
+ */
 inline usize nt_memcpy(char *src, u64 size, char *target) {
-  auto cur_ptr = src;
-  usize cur = 0;
-
-  for(cur = 0; cur < size;) {
-    // in 64 bytes granulaity
-    for (uint i = 0; i < 8; ++i) {
-      // I believe that compiler will unroll this
-      _mm_stream_pi((__m64 *)(target + cur), *((__m64 *)(src + cur)));
-      cur += sizeof(u64);
-      if (cur >= size) {
-        return cur;
-      }
-    }
-  }
-  return cur;
+  return persist::copy_with(persist::kNT, target, src, size);
 }
 
-  inline usize NO_OPT memcpy_flush_write(char *src,u64 size, char *target) {
-    auto cur_ptr = src;
-    for (usize cur = 0; cur < size; cur += 64) {
-      memcpy(target + cur, cur_ptr, std::min<u64>(64, size));
-      r2::compile_fence();
-      //    _mm_clflush(target + cur);
-      clwb(target + cur);
-
-      cur_ptr += 64;
-    }
-
-    asm volatile("sfence" : : : "memory");
-    return size;
-  }
-
-usize NO_OPT nt_write(char *src, u64 size, char *target) {
-#if 1
-  // auto res = nt_memcpy_512_pure(src,size,target);
-  //auto res = nt_memcpy_512(src,size,target);
-  auto res = nt_memcpy(src, size, target);
-  asm volatile("sfence" : : : "memory");
-  return res;
-#else
-  stride_nt(target,size,0,10,1);
-  return size;
-#endif
+/*!
+  Persistently write, using the kernel selected by persist::init()
+ */
+inline usize NO_OPT nt_write(char *src, u64 size, char *target) {
+  return persist::copy(target, src, size);
 }
 
 inline usize NO_OPT nvm_read(char *src, u64 size, char *target) {
@@ -126,6 +44,7 @@ inline usize NO_OPT nvm_read(char *src, u64 size, char *target) {
     r2::compile_fence();
     cur_ptr += 64;
   }
+  emu::on_read(src, size);
   return cur;
 }
 
@@ -142,7 +61,7 @@ inline usize NO_OPT normal_write(char *src, u64 size, char *target,bool sync = f
     __builtin_prefetch(cur_ptr);
     memcpy(target + cur, cur_ptr, std::min<u64>(64, size));
     if (sync)
-      _mm_clflush(target + cur);
+      flush_cache(target + cur, 64);
     r2::compile_fence();
     cur_ptr += 64;
   }
@@ -193,6 +112,7 @@ inline usize NO_OPT execute_nvm_ops(Arc<MemoryRegion> &nvm, ::r2::MemBlock &msg,
 
       //ASSERT(req->payload <= normal_write(payload, req->payload, server_buf_ptr));
       ASSERT(memcpy(server_buf_ptr,(char *)ptr,req->payload));
+      emu::on_write(server_buf_ptr, req->payload);
       //ASSERT(req->payload <= nt_write((char *)ptr, req->payload, server_buf_ptr));
     }
     else {
@@ -210,4 +130,101 @@ inline usize NO_OPT execute_nvm_ops(Arc<MemoryRegion> &nvm, ::r2::MemBlock &msg,
   return 0;
 }
 
+/*!
+  execute the Request of a HybridClient's RPC path (see ../hybrid.hh):
+  a read copies the NVM to reply_buf (at most max_reply bytes), and a write
+  persists the payload following the Request before the reply
+  \ret the bytes of the reply
+ */
+inline usize execute_rpc_op(const Arc<MemoryRegion> &nvm,
+                            ::r2::MemBlock &msg, char *reply_buf,
+                            const usize &max_reply) {
+  auto header = msg.interpret_as<MsgHeader>();
+  Request *req = msg.interpret_as<Request>(sizeof(MsgHeader));
+  ASSERT(req != nullptr);
+  RDMA_ASSERT(req->addr + req->payload <= nvm->sz)
+      << "op out of the region: " << req->addr << " + " << req->payload;
+  char *server_buf_ptr = reinterpret_cast<char *>(nvm->addr) + req->addr;
+
+  if (req->read == 1) {
+    RDMA_ASSERT(req->payload <= max_reply)
+        << "too large read: " << req->payload;
+    memcpy(reply_buf, server_buf_ptr, req->payload);
+    emu::on_read(server_buf_ptr, req->payload);
+    return req->payload;
+  }
+
+  RDMA_ASSERT(header->sz >= sizeof(Request) + req->payload)
+      << "the msg does not carry the payload: " << header->sz;
+  char *payload = msg.interpret_as<char>(sizeof(MsgHeader) + sizeof(Request));
+  persist::copy(server_buf_ptr, payload, req->payload);
+  return 0;
+}
+
+/*!
+  execute the KV request of the msg on the store, and fill the reply entries
+  (at most max_reply bytes) to reply_buf
+  \ret the bytes of the reply
+ */
+inline usize execute_kv_ops(kv::NVMKV &store, ::r2::MemBlock &msg,
+                            char *reply_buf, const usize &max_reply) {
+  auto header = msg.interpret_as<MsgHeader>();
+  KVRequest *req = msg.interpret_as<KVRequest>(sizeof(MsgHeader));
+  ASSERT(req != nullptr);
+  char *payload = msg.interpret_as<char>(sizeof(MsgHeader) + sizeof(KVRequest));
+
+  usize cur = 0;
+  auto add_entry = [&](const KVStatus &status, const u32 &sz) -> char * {
+    auto entry = reinterpret_cast<KVReplyEntry *>(reply_buf + cur);
+    entry->status = status;
+    entry->sz = sz;
+    cur += sizeof(KVReplyEntry);
+    return reply_buf + cur;
+  };
+
+  switch (req->op) {
+  case KVGet:
+  case KVMultiGet: {
+    const usize num = req->op == KVGet ? 1 : req->num;
+    if (num == 0 || num > kMaxKVMultiGet ||
+        header->sz < sizeof(KVRequest) + (num - 1) * sizeof(u64)) {
+      add_entry(KVBadReq, 0);
+      break;
+    }
+    for (uint i = 0; i < num; ++i) {
+      const u64 key =
+          i == 0 ? req->key : reinterpret_cast<u64 *>(payload)[i - 1];
+      if (cur + sizeof(KVReplyEntry) > max_reply)
+        break;
+      const u32 space = max_reply - cur - sizeof(KVReplyEntry);
+      auto entry = reinterpret_cast<KVReplyEntry *>(reply_buf + cur);
+      auto val = add_entry(KVOk, 0);
+      auto sz = store.get(key, val, space);
+      if (!sz) {
+        entry->status = KVNotFound;
+      } else if (sz.value() > space) {
+        entry->status = KVNoSpace;
+        entry->sz = sz.value();
+      } else {
+        entry->sz = sz.value();
+        cur += sz.value();
+      }
+    }
+  } break;
+  case KVPut: {
+    if (header->sz < sizeof(KVRequest) + req->val_sz) {
+      add_entry(KVBadReq, 0);
+      break;
+    }
+    add_entry(store.put(req->key, payload, req->val_sz) ? KVOk : KVFull, 0);
+  } break;
+  case KVDel:
+    add_entry(store.del(req->key) ? KVOk : KVNotFound, 0);
+    break;
+  default:
+    add_entry(KVBadReq, 0);
+  }
+  return cur;
+}
+
 } // namespace nvm
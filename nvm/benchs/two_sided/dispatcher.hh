@@ -0,0 +1,222 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include "../../persist.hh"
+
+namespace nvm {
+
+/*!
+  The NVM copy of a request, which can run on any server thread
+ */
+struct CopyTask {
+  char *dst = nullptr;
+  const char *src = nullptr;
+  u32 sz = 0;
+  // true: persist the write to NVM at dst; false: read the NVM at src
+  bool write = true;
+  // decreased when done
+  std::atomic<u32> *pending = nullptr;
+
+  inline void run() {
+    if (write)
+      persist::copy(dst, src, sz);
+    else {
+      memcpy(dst, src, sz);
+      emu::on_read(src, sz);
+    }
+    pending->fetch_sub(1, std::memory_order_release);
+  }
+};
+
+/*!
+  A bounded Chase-Lev work-stealing deque (Le et al., PPoPP'13): its owner
+  pushes and pops at the bottom, and the others steal from the top,
+  all lock-free.
+ */
+template <typename T> class StealDeque {
+  std::vector<std::atomic<T *>> buf;
+  const i64 mask;
+
+  alignas(64) std::atomic<i64> top{0};
+  alignas(64) std::atomic<i64> bottom{0};
+
+public:
+  // cap should be a power of 2
+  explicit StealDeque(const usize &cap) : buf(cap), mask(cap - 1) {
+    RDMA_ASSERT(cap > 0 && (cap & (cap - 1)) == 0);
+  }
+
+  // owner only; false if full
+  bool push(T *t) {
+    const i64 b = bottom.load(std::memory_order_relaxed);
+    const i64 tp = top.load(std::memory_order_acquire);
+    if (b - tp > mask)
+      return false;
+    buf[b & mask].store(t, std::memory_order_relaxed);
+    bottom.store(b + 1, std::memory_order_release);
+    return true;
+  }
+
+  // owner only; nullptr if empty
+  T *pop() {
+    const i64 b = bottom.load(std::memory_order_relaxed) - 1;
+    bottom.store(b, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    i64 tp = top.load(std::memory_order_relaxed);
+    if (tp > b) {
+      bottom.store(b + 1, std::memory_order_relaxed);
+      return nullptr;
+    }
+    T *res = buf[b & mask].load(std::memory_order_relaxed);
+    if (tp == b) {
+      // the last one, race with the thieves
+      if (!top.compare_exchange_strong(tp, tp + 1, std::memory_order_seq_cst,
+                                       std::memory_order_relaxed))
+        res = nullptr;
+      bottom.store(b + 1, std::memory_order_relaxed);
+    }
+    return res;
+  }
+
+  // any thread; nullptr if empty or lost a race
+  T *steal() {
+    i64 tp = top.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    const i64 b = bottom.load(std::memory_order_acquire);
+    if (tp >= b)
+      return nullptr;
+    T *res = buf[tp & mask].load(std::memory_order_relaxed);
+    if (!top.compare_exchange_strong(tp, tp + 1, std::memory_order_seq_cst,
+                                     std::memory_order_relaxed))
+      return nullptr;
+    return res;
+  }
+};
+
+/*!
+  StealDispatcher balances the NVM copies of the requests across the server
+  threads (workers), without more QPs: a thread still polls its own QP,
+  but pushes the copies of the requests it receives to its deque, and
+  an idle thread steals them.
+  Since the requests' payloads are in the recv buffers of the owner, the
+  owner joins its tasks (running the rest itself) before the buffers are
+  re-posted, and sends the replies on its own sessions after that.
+
+  Example:
+  `
+  StealDispatcher dispatcher(threads);
+  // at thread id
+  {
+    RecvIter<UD, 2048> iter(ud, recv_rs);
+    for (; iter.has_msgs(); iter.next())
+      dispatcher.submit(id, dst, payload, sz);
+    dispatcher.join(id); // before iter re-posts the recv buffers
+    // ... send the replies
+  }
+  if (idle)
+    dispatcher.steal(id);
+  `
+ */
+class StealDispatcher {
+public:
+  struct Stats {
+    // tasks run by the worker itself, including those run inline
+    u64 own = 0;
+    // tasks run inline, since the deque is full
+    u64 inline_run = 0;
+    // tasks stolen from the others
+    u64 stolen = 0;
+  };
+
+private:
+  struct alignas(64) Worker {
+    StealDeque<CopyTask> deque;
+    std::vector<CopyTask> tasks;
+    usize used = 0;
+    std::atomic<u32> pending{0};
+    Stats stats;
+
+    explicit Worker(const usize &depth) : deque(depth), tasks(depth) {}
+  };
+
+  std::vector<std::unique_ptr<Worker>> workers;
+
+public:
+  /*!
+    depth: the most pending tasks of a worker (a power of 2), which should
+    cover the msgs of a recv pass
+   */
+  explicit StealDispatcher(const usize &num_workers, const usize &depth = 4096) {
+    RDMA_ASSERT(num_workers > 0);
+    for (uint i = 0; i < num_workers; ++i)
+      workers.push_back(std::make_unique<Worker>(depth));
+  }
+
+  usize num_workers() const { return workers.size(); }
+
+  const Stats &stats(const usize &id) const { return workers[id]->stats; }
+
+  /*!
+    Submit a copy at worker id, which runs it inline if its deque is full
+   */
+  void submit(const usize &id, char *dst, const char *src, const u32 &sz,
+              const bool &write = true) {
+    auto &w = *workers[id];
+    w.pending.fetch_add(1, std::memory_order_relaxed);
+    if (w.used == w.tasks.size()) {
+      run_inline(w, {dst, src, sz, write, &w.pending});
+      return;
+    }
+    auto &t = w.tasks[w.used];
+    t = {dst, src, sz, write, &w.pending};
+    if (w.deque.push(&t))
+      w.used += 1;
+    else
+      run_inline(w, t);
+  }
+
+  /*!
+    Run the tasks of worker id (and wait for the stolen ones), after which
+    all its submitted copies are done
+   */
+  void join(const usize &id) {
+    auto &w = *workers[id];
+    for (auto t = w.deque.pop(); t != nullptr; t = w.deque.pop()) {
+      t->run();
+      w.stats.own += 1;
+    }
+    // help the others while the thieves run our tasks
+    while (w.pending.load(std::memory_order_acquire) != 0)
+      steal(id);
+    w.used = 0;
+  }
+
+  /*!
+    Steal and run one task of the other workers
+    \ret whether a task is run
+   */
+  bool steal(const usize &id) {
+    for (usize i = 1; i < workers.size(); ++i) {
+      auto &victim = *workers[(id + i) % workers.size()];
+      auto t = victim.deque.steal();
+      if (t != nullptr) {
+        t->run();
+        workers[id]->stats.stolen += 1;
+        return true;
+      }
+    }
+    return false;
+  }
+
+private:
+  void run_inline(Worker &w, CopyTask t) {
+    t.run();
+    w.stats.own += 1;
+    w.stats.inline_run += 1;
+  }
+};
+
+} // namespace nvm
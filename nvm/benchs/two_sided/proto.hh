@@ -10,7 +10,11 @@ namespace nvm {
 using namespace rdmaio;
 using namespace rdmaio::qp;
 
-enum MsgType : u8 { Req = 0, Reply, Connect, ConnectR };
+enum MsgType : u8 { Req = 0, Reply, Connect, ConnectR, KVReq };
+
+// the imm of the replies of an RC server (as RCRecvSession sends),
+// which the RC clients check
+const u32 kRCReplyImm = 123;
 
 struct __attribute__((packed)) MsgHeader {
   MsgType type;
@@ -43,4 +47,40 @@ struct __attribute__((packed)) Request {
   u64 addr;
   u8  read = 0; // if read == 1, just read the value
 } __attribute__((aligned(sizeof(uint64_t))));
+
+/*!
+  used for the KV service (MsgType KVReq), see nvm/kv_store.hh
+ */
+enum KVOp : u8 { KVGet = 0, KVPut, KVDel, KVMultiGet };
+
+enum KVStatus : u8 {
+  KVOk = 0,
+  KVNotFound,
+  // the store is full, or the value is too large
+  KVFull,
+  KVBadReq,
+  // the value does not fit in the reply msg, only its size is returned
+  KVNoSpace
+};
+
+// the most keys of a KVMultiGet
+const u8 kMaxKVMultiGet = 16;
+
+/*!
+  followed by the value (KVPut), or num - 1 more u64 keys (KVMultiGet)
+ */
+struct __attribute__((packed)) KVRequest {
+  KVOp op;
+  u8 num = 1;
+  u32 val_sz = 0;
+  u64 key;
+};
+
+/*!
+  the reply has one entry per key, each followed by its value (if KVOk)
+ */
+struct __attribute__((packed)) KVReplyEntry {
+  KVStatus status;
+  u32 sz = 0;
+};
 }// namespace nvm
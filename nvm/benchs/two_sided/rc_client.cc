@@ -13,10 +13,13 @@
 #include "r2/src/libroutine.hh"
 
 #include "../../huge_region.hh"
+#include "../../kv_store.hh"
+#include "../hybrid.hh"
+#include "../latency.hh"
 #include "../statucs.hh"
 #include "../thread.hh"
 
-#include "val19.hh"
+#include "../topology.hh"
 
 #include "./proto.hh"
 
@@ -33,6 +36,9 @@ DEFINE_string(addr, "localhost:8888", "Server address to connect to.");
 DEFINE_int64(use_nic_idx, 0, "Which NIC to create QP");
 
 DEFINE_int64(threads, 8, "Number of threads to use.");
+DEFINE_string(bind_policy, "compact",
+              "How threads are pinned to cpus: compact | scatter | nic | nvm "
+              "| node:N | none, optionally suffixed with ,nosmt");
 
 DEFINE_int64(payload, 256, "Number of payload to read/write");
 
@@ -45,50 +51,37 @@ DEFINE_uint64(coros, 8, "Number of coroutine used per thread.");
 
 DEFINE_bool(use_read, true, "");
 
+// KV service related settings, the server should run with --kv
+DEFINE_bool(kv, false, "Send KV requests, whose value size is the payload.");
+DEFINE_uint64(kv_keys, 1024 * 1024, "Keys are uniformly chosen in [0, kv_keys).");
+DEFINE_double(kv_get_ratio, 0.9, "The ratio of GETs, the others are PUTs.");
+DEFINE_uint64(kv_mget, 1, "#Keys of a GET, > 1 uses multi-GET.");
+
+// hybrid client related settings, the server should run with --hybrid
+DEFINE_bool(hybrid, false,
+            "Route each op over one-sided verbs or RPC, by a cost model "
+            "(../hybrid.hh)");
+DEFINE_string(hybrid_model, "default",
+              "The seeds of the cost model, e.g., the one logged by a "
+              "calibration run: one.read=1.8+0.2,rpc.pwrite=3+0.4,explore=64");
+DEFINE_double(hybrid_read_ratio, 0.5,
+              "The ratio of reads, the others are writes.");
+DEFINE_bool(hybrid_persist, true, "Whether the writes are persistent writes.");
+DEFINE_string(hybrid_payloads, "",
+              "The payloads mixed uniformly, e.g., 64,256,4096; "
+              "empty uses the payload");
+DEFINE_int64(reg_mem_name, 73,
+             "The NVM MR of server thread i is registered at reg_mem_name + i");
+
+DEFINE_string(report_file, "",
+              "The file to store the per-epoch JSON records, "
+              "which are always printed to stdout");
+
 template <typename Nat> Nat align(const Nat &x, const Nat &a) {
   auto r = x % a;
   return r ? (x + a - r) : x;
 }
 
-int BindToCore(int t_id) {
-
-  if (t_id >= (per_socket_cores * 2))
-    return 0;
-
-  int x = t_id;
-  int y = 0;
-
-#ifdef SCALE
-  assert(false);
-  // specific  binding for scale tests
-  int mac_per_node = 16 / nthreads; // there are total 16 threads avialable
-  int mac_num = current_partition % mac_per_node;
-
-  if (mac_num < mac_per_node / 2) {
-    y = socket_0[x + mac_num * nthreads];
-  } else {
-    y = socket_1[x + (mac_num - mac_per_node / 2) * nthreads];
-  }
-#else
-  // bind ,andway
-  if (x >= per_socket_cores) {
-    // there is no other cores in the first socket
-    y = socket_1[x - per_socket_cores];
-  } else {
-    y = socket_0[x];
-  }
-
-#endif
-
-  // fprintf(stdout,"worker: %d binding %d\n",x,y);
-  cpu_set_t mask;
-  CPU_ZERO(&mask);
-  CPU_SET(y, &mask);
-  sched_setaffinity(0, sizeof(mask), &mask);
-
-  return 0;
-}
-
 // an allocator to allocate recv buffer for messages
 class SimpleAllocator : public AbsRecvAllocator {
   RMem::raw_ptr_t buf = nullptr;
@@ -117,8 +110,107 @@ public:
   }
 };
 
+/*!
+  The RPC path of a HybridClient, over the msg session of a thread, whose
+  replies are received (and copied to the op's buf) by the reply future
+ */
+class SessionRPCPath : public AbsRPCPath {
+  RCSession &session;
+  std::vector<usize> &wait_replies;
+  std::vector<char *> &reply_bufs;
+  // the send buffer of each coroutine
+  std::vector<char *> send_bufs;
+
+public:
+  SessionRPCPath(RCSession &session, std::vector<usize> &wait_replies,
+                 std::vector<char *> &reply_bufs,
+                 const Arc<AbsRecvAllocator> &alloc)
+      : session(session), wait_replies(wait_replies), reply_bufs(reply_bufs) {
+    for (uint i = 0; i < wait_replies.size(); ++i)
+      send_bufs.push_back(
+          (char *)(std::get<0>(alloc->alloc_one(4096).value())));
+  }
+
+  Result<std::string> call(const Request &req, char *buf, R2_ASYNC) override {
+    char *send_buf = send_bufs[R2_COR_ID()];
+    const u32 payload = req.read == 1 ? 0 : req.payload;
+
+    MsgHeader *header = (MsgHeader *)send_buf;
+    *header = {.type = Req,
+               .magic = 73,
+               .coro_id = R2_COR_ID(),
+               .sz = static_cast<u32>(sizeof(Request) + payload)};
+    *((Request *)(send_buf + sizeof(MsgHeader))) = req;
+    memcpy(send_buf + sizeof(MsgHeader) + sizeof(Request), buf, payload);
+
+    auto ret = session.send_unsignaled(
+        {(void *)(send_buf), sizeof(MsgHeader) + header->sz});
+    if (unlikely(ret != IOCode::Ok))
+      return ::rdmaio::Err(std::string("post the rpc error"));
+
+    wait_replies[R2_COR_ID()] = 1;
+    reply_bufs[R2_COR_ID()] = buf;
+    auto res = R2_PAUSE_AND_YIELD;
+    if (unlikely(res != IOCode::Ok))
+      return ::rdmaio::Err(std::string("wait the rpc reply error"));
+    return ::rdmaio::Ok(std::string(""));
+  }
+};
+
+/*!
+  fill a KV request (GET/multi-GET or PUT) after the header
+  \ret the request size
+ */
+u32 fill_kv_request(FastRandom &rand, char *buf) {
+  KVRequest *req = (KVRequest *)buf;
+  req->key = rand.next() % FLAGS_kv_keys;
+  const bool get = (rand.next() % 10000) < FLAGS_kv_get_ratio * 10000;
+  if (!get) {
+    *req = {.op = KVPut, .num = 1, .val_sz = static_cast<u32>(FLAGS_payload),
+            .key = req->key};
+    memset(buf + sizeof(KVRequest), req->key & 0xff, FLAGS_payload);
+    return sizeof(KVRequest) + FLAGS_payload;
+  }
+  *req = {.op = FLAGS_kv_mget > 1 ? KVMultiGet : KVGet,
+          .num = static_cast<u8>(FLAGS_kv_mget),
+          .val_sz = 0,
+          .key = req->key};
+  u64 *keys = (u64 *)(buf + sizeof(KVRequest));
+  for (uint i = 1; i < FLAGS_kv_mget; ++i)
+    keys[i - 1] = rand.next() % FLAGS_kv_keys;
+  return sizeof(KVRequest) + (FLAGS_kv_mget - 1) * sizeof(u64);
+}
+
 int main(int argc, char **argv) {
   gflags::ParseCommandLineFlags(&argc, &argv, true);
+  if (FLAGS_kv) {
+    RDMA_ASSERT(FLAGS_kv_mget > 0 && FLAGS_kv_mget <= kMaxKVMultiGet)
+        << "kv_mget at most: " << (int)kMaxKVMultiGet;
+    RDMA_ASSERT(FLAGS_payload <= kv::NVMKV::kMaxValSz &&
+                sizeof(MsgHeader) + sizeof(KVRequest) + FLAGS_payload <= 4096)
+        << "too large kv value: " << FLAGS_payload;
+  }
+
+  std::vector<u32> hybrid_payloads;
+  {
+    std::istringstream iss(FLAGS_hybrid_payloads);
+    std::string item;
+    while (std::getline(iss, item, ','))
+      hybrid_payloads.push_back(std::stoul(item));
+    if (hybrid_payloads.empty())
+      hybrid_payloads.push_back(FLAGS_payload);
+  }
+  auto hybrid_model = HybridModel::parse(FLAGS_hybrid_model);
+  if (FLAGS_hybrid) {
+    RDMA_ASSERT(!FLAGS_kv) << "hybrid and kv cannot be used together";
+    RDMA_ASSERT(hybrid_model) << "invalid hybrid model: " << FLAGS_hybrid_model;
+    for (auto p : hybrid_payloads)
+      RDMA_ASSERT(p > 0 &&
+                  sizeof(MsgHeader) + sizeof(Request) + p <= 4096 &&
+                  p <= FLAGS_address_space * (1024 * 1024 * 1024L))
+          << "invalid hybrid payload: " << p;
+  }
+  CoreBinder::init(FLAGS_bind_policy, {.nic_dev_id = FLAGS_use_nic_idx});
 
   RDMA_LOG(4) << "Msg client bootstrap with " << FLAGS_threads << " threads";
 
@@ -132,25 +224,18 @@ int main(int argc, char **argv) {
   using TThread = Thread<int>;
   std::vector<std::unique_ptr<TThread>> threads;
   std::vector<Statics> statics(FLAGS_threads);
+  std::vector<LatHistogram> lat_hists(FLAGS_threads);
 
   // auto address_space =
   // static_cast<u64>(FLAGS_address_space) * (1024 * 1024 * 1024L);
 
   for (uint thread_id = 0; thread_id < FLAGS_threads; ++thread_id) {
 
-    threads.push_back(std::make_unique<TThread>([thread_id, &statics]() -> int {
-    //                                                  BindToCore(thread_id +
-    //                                                  per_socket_cores);
-    BindToCore(thread_id);
-#if 1
+    threads.push_back(std::make_unique<TThread>([thread_id, &statics,
+                                                 &lat_hists, &hybrid_payloads,
+                                                 &hybrid_model]() -> int {
+    bind_to_core(thread_id);
     int idx = 0;
-      // if (thread_id >= per_socket_cores)
-      //        idx += 1;
-#else
-    int idx = 1;
-    if (thread_id >= per_socket_cores)
-      idx -= 1;
-#endif
     /**
      * Tedius setup process
      */
@@ -192,6 +277,22 @@ int main(int argc, char **argv) {
     // qp->bind_local_mr(handler_s->get_reg_attr().value());
     qp->bind_local_mr(handler->get_reg_attr().value());
 
+    // the one-sided path of the hybrid client, with another QP whose remote
+    // MR is the server's NVM
+    Arc<AbsTransport> one_sided = nullptr;
+    if (FLAGS_hybrid) {
+      auto one_qp = RC::create(nic, QPConfig()).value();
+      auto one_res = cm.cc_rc(std::to_string(my_id) + "-one", one_qp,
+                              thread_id, QPConfig());
+      RDMA_ASSERT(one_res == IOCode::Ok) << std::get<0>(one_res.desc);
+
+      auto nvm_res = cm.fetch_remote_mr(FLAGS_reg_mem_name + thread_id);
+      RDMA_ASSERT(nvm_res == IOCode::Ok) << std::get<0>(nvm_res.desc);
+      one_qp->bind_remote_mr(std::get<1>(nvm_res.desc));
+      one_qp->bind_local_mr(handler->get_reg_attr().value());
+      one_sided = RCTransport::create(one_qp).value();
+    }
+
     // post recvs
     auto recv_rs = RecvEntriesFactoryv2<128>::create(alloc, 4096);
     auto res = qp->post_recvs(*recv_rs, 128);
@@ -212,6 +313,16 @@ int main(int argc, char **argv) {
 
     ibv_wc *wcs = new ibv_wc[4096];
 
+    // routes the ops of all the coroutines of the thread, only with --hybrid
+    std::unique_ptr<SessionRPCPath> rpc_path;
+    std::unique_ptr<HybridClient> hybrid;
+    if (FLAGS_hybrid) {
+      rpc_path = std::unique_ptr<SessionRPCPath>(
+          new SessionRPCPath(rc_session, wait_replies, reply_bufs, alloc));
+      hybrid = std::unique_ptr<HybridClient>(new HybridClient(
+          one_sided, rpc_path.get(), hybrid_model.value()));
+    }
+
     /*
      * the future for receiving replies from the server
      * if the expected replies of a coroutine is all received
@@ -222,14 +333,18 @@ int main(int argc, char **argv) {
 
     poll_func_t reply_future =
         [&rc_session, &ssched, &wait_replies, &recv_cq, &rss, wcs, &counter,
-         mem, &reply_bufs]() -> Result<std::pair<::r2::Routine::id_t, usize>> {
+         mem, &reply_bufs, &statics,
+         thread_id]() -> Result<std::pair<::r2::Routine::id_t, usize>> {
+      auto start = read_tsc();
+      usize polled = 0;
       // iterate through all the pending messages
       for (RecvIter<RC, 4096> iter(recv_cq, wcs); iter.has_msgs();
            iter.next()) {
         auto imm_msg = iter.cur_msg().value();
+        polled += 1;
 
         auto session_id = std::get<0>(imm_msg);
-        ASSERT(session_id == 123);
+        ASSERT(session_id == kRCReplyImm);
         auto buf = static_cast<char *>(std::get<1>(imm_msg));
 
         MemBlock msg(buf, 4096);
@@ -256,6 +371,7 @@ int main(int argc, char **argv) {
         rss.consume_one();
         // end receiving all msgs
       }
+      statics[thread_id].add_poll(read_tsc() - start, polled == 0);
       // this future shall never return
       return NotReady(std::make_pair<::r2::Routine::id_t, usize>(0u, 0u));
     };
@@ -265,7 +381,8 @@ int main(int argc, char **argv) {
     FastRandom rand(0xdeadbeaf + FLAGS_id * 0xdddd + thread_id);
 
     ssched.spawn([handler, &rc_session, thread_id, &reply_bufs, mem, &rand,
-                  mem_s, alloc, &wait_replies, &statics](R2_ASYNC) {
+                  mem_s, alloc, &wait_replies, &statics, &lat_hists, &hybrid,
+                  &hybrid_payloads](R2_ASYNC) {
       char *send_buf = (char *)(std::get<0>(alloc->alloc_one(4096).value()));
 
       // connect to the server
@@ -294,8 +411,9 @@ int main(int argc, char **argv) {
 
       // connect done, we start coroutines
       for (uint i = 0; i < FLAGS_coros; ++i) {
-        R2_EXECUTOR.spawn([&rand, &rc_session, &statics, i, alloc, mem_s, mem,
-                           &reply_bufs, &wait_replies, thread_id](R2_ASYNC) {
+        R2_EXECUTOR.spawn([&rand, &rc_session, &statics, &lat_hists, i, alloc,
+                           mem_s, mem, &reply_bufs, &wait_replies, thread_id,
+                           &hybrid, &hybrid_payloads](R2_ASYNC) {
           assert(wait_replies.size() > R2_COR_ID());
 
           char *local_buf =
@@ -309,8 +427,36 @@ int main(int argc, char **argv) {
               static_cast<u64>(FLAGS_address_space) * (1024 * 1024 * 1024L);
 
           char *reply_buf = new char[window_sz * 4096];
+          r2::Timer op_t;
+
+          if (FLAGS_hybrid) {
+            // a mixed workload of reads and (persistent) writes, whose ops
+            // are routed by the hybrid client
+            for (u64 n = 1;; ++n) {
+              const u32 sz =
+                  hybrid_payloads[rand.next() % hybrid_payloads.size()];
+              const HybridOp op =
+                  (rand.next() % 10000) < FLAGS_hybrid_read_ratio * 10000
+                      ? HRead
+                      : (FLAGS_hybrid_persist ? HPWrite : HWrite);
+              // 64B aligned, within the address space
+              const u64 addr = rand.next() % (address_space - sz + 1) / 64 * 64;
+              op_t.reset();
+              auto ret =
+                  hybrid->execute(op, addr, local_buf, sz, R2_ASYNC_WAIT);
+              ASSERT(ret == IOCode::Ok) << "hybrid op error: " << ret.desc;
+              lat_hists[thread_id].record_us(op_t.passed_msec());
+              statics[thread_id].inc_bytes(sz);
+              statics[thread_id].inc(1);
+
+              if (thread_id == 0 && i == 0 && n % (1 << 20) == 0)
+                RDMA_LOG(4) << "hybrid model: " << hybrid->model.to_str()
+                            << "; ops: " << hybrid->stats_str();
+            }
+          }
 
           while (1) {
+            op_t.reset();
             for (uint i = 0; i < window_sz; ++i) {
 
               MsgHeader *header = (MsgHeader *)local_buf;
@@ -319,7 +465,11 @@ int main(int argc, char **argv) {
                          .magic = 73,
                          .coro_id = R2_COR_ID(),
                          .sz = sizeof(Request)};
-              {
+              if (FLAGS_kv) {
+                header->type = KVReq;
+                header->sz = fill_kv_request(
+                    rand, (char *)header + sizeof(MsgHeader));
+              } else {
                 // fill in the request payload
                 Request *req = (Request *)((char *)header + sizeof(MsgHeader));
                 //*req = {.payload = FLAGS_payload,
@@ -327,9 +477,11 @@ int main(int argc, char **argv) {
                 //.read = static_cast<u8>((FLAGS_use_read) ? 1 : 0)};
               }
 
+              auto start = read_tsc();
               auto ret = rc_session.send_unsignaled(
                   {(void *)(local_buf),
-                   sizeof(MsgHeader) + sizeof(Request)});
+                   sizeof(MsgHeader) + header->sz});
+              statics[thread_id].add_post(read_tsc() - start);
               ASSERT(ret == IOCode::Ok);
             }
             wait_replies[R2_COR_ID()] = window_sz;
@@ -337,6 +489,8 @@ int main(int argc, char **argv) {
 
             auto ret = R2_PAUSE_AND_YIELD;
             ASSERT(ret == IOCode::Ok);
+            lat_hists[thread_id].record_us(op_t.passed_msec());
+            statics[thread_id].inc_bytes(FLAGS_payload * window_sz);
             statics[thread_id].inc(window_sz);
           }
 
@@ -352,7 +506,7 @@ int main(int argc, char **argv) {
     t->start();
   LOG(2) << "all thread run";
 
-  Reporter::report_thpt(statics, 40);
+  Reporter::report_thpt(statics, 40, lat_hists, FLAGS_report_file);
 
   for (auto &t : threads) {
     t->join();
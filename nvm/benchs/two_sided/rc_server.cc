@@ -9,11 +9,16 @@
 #include "r2/src/mem_block.hh"
 #include "r2/src/msg/rc_session.hh"
 
+#include "./core.hh"
 #include "./proto.hh"
-#include "./r740.hh"
+#include "./reply_pool.hh"
+#include "../topology.hh"
 
 #include "../../huge_region.hh"
+#include "../../emu_region.hh"
+#include "../../kv_store.hh"
 #include "../../nvm_region.hh"
+#include "../../persist.hh"
 
 #include "../thread.hh"
 
@@ -21,14 +26,50 @@ DEFINE_int64(port, 8888, "Server listener (UDP) port.");
 DEFINE_int64(use_nic_idx, 0, "Which NIC to create QP");
 DEFINE_int64(reg_mem_name, 73, "The name to register an MR at rctrl.");
 DEFINE_int64(threads, 1, "Number of threads used.");
+DEFINE_string(bind_policy, "compact",
+              "How threads are pinned to cpus: compact | scatter | nic | nvm "
+              "| node:N | none, optionally suffixed with ,nosmt");
 
 // NVM related settings
 DEFINE_bool(use_nvm, true, "Whether to use NVM for RDMA");
 DEFINE_string(nvm_file, "/dev/dax1.0", "Abstracted NVM device");
+DEFINE_string(nvm_emu, "",
+              "Emulate the NVM on DRAM instead of nvm_file, e.g., default, or "
+              "read_ns=300,write_ns=100,write_bw=2300,wc_lines=64,file=/path");
 DEFINE_uint64(nvm_sz, 2L * 1024 * 1024 * 1024,
               "Mapped sz, should be larger than 2MB");
 
 DEFINE_bool(clfush, false, "whether to flush write content");
+DEFINE_uint64(reply_bufs, 2048,
+              "#Reply buffers of a thread, which bounds its in-flight replies; "
+              "a smaller one than #clients * signal_every makes the replies "
+              "stall to reclaim the buffers of idle clients");
+DEFINE_uint64(signal_every, 32,
+              "Signal one reply of a client every it, to reclaim the buffers");
+DEFINE_bool(use_srq, false,
+            "Whether the QPs of a thread share one SRQ, i.e., a fixed pool of "
+            "recv buffers, instead of per-QP recv entries");
+
+DEFINE_string(persist_kernel, "auto",
+              "How to persist NVM writes: auto | calibrate | nt | clwb | "
+              "clflushopt | clflush | barrier");
+
+// KV service related settings
+DEFINE_bool(kv, false,
+            "Serve the KV requests with a store on the NVM (nvm/kv_store.hh)");
+DEFINE_string(kv_config, "default",
+              "The store's config, e.g., shards=16,slots=1m,checkpoint=1024");
+DEFINE_bool(kv_format, false,
+            "Format the store, instead of recovering the existing one; "
+            "required by the first run on a region");
+DEFINE_uint64(kv_preload, 0, "Put keys [0, kv_preload) before serving.");
+DEFINE_uint64(kv_preload_sz, 256, "The value size of the preloaded keys.");
+
+// hybrid client (../hybrid.hh) related settings
+DEFINE_bool(hybrid, false,
+            "Execute the Req msgs on the NVM, and register the NVM (at "
+            "reg_mem_name + thread id) for the one-sided ops of the hybrid "
+            "clients");
 
 using namespace rdmaio;
 using namespace rdmaio::rmem;
@@ -37,12 +78,11 @@ using namespace rdmaio::qp;
 using namespace r2;
 using namespace nvm;
 
-void flush_cache(char *ptr, u64 size) {
-  for (u64 cur = 0; cur < size; cur += 64) {
-    _mm_clflush(ptr);
-    ptr += 64;
-  }
-}
+// #recv buffers of a thread's SRQ, shared by all its clients
+const usize kSRQEntries = 2048;
+
+// the size of a reply buffer, i.e., the max reply msg
+const usize kReplyBufSz = 4096;
 
 template <typename Nat> Nat align(const Nat &x, const Nat &a) {
   auto r = x % a;
@@ -79,47 +119,10 @@ public:
   }
 };
 
-int BindToCore(int t_id) {
-
-  if (t_id >= (per_socket_cores * 2))
-    return 0;
-
-  int x = t_id;
-  int y = 0;
-
-#ifdef SCALE
-  assert(false);
-  // specific  binding for scale tests
-  int mac_per_node = 16 / nthreads; // there are total 16 threads avialable
-  int mac_num = current_partition % mac_per_node;
-
-  if (mac_num < mac_per_node / 2) {
-    y = socket_0[x + mac_num * nthreads];
-  } else {
-    y = socket_one[x + (mac_num - mac_per_node / 2) * nthreads];
-  }
-#else
-  // bind ,andway
-  if (x >= per_socket_cores) {
-    // there is no other cores in the first socket
-    y = socket_one[x - per_socket_cores];
-  } else {
-    y = socket_zero[x];
-  }
-
-#endif
-
-  cpu_set_t mask;
-  CPU_ZERO(&mask);
-  CPU_SET(y, &mask);
-  sched_setaffinity(0, sizeof(mask), &mask);
-
-  return 0;
-}
-
 int main(int argc, char **argv) {
 
   gflags::ParseCommandLineFlags(&argc, &argv, true);
+  CoreBinder::init(FLAGS_bind_policy, {.nic_dev_id = FLAGS_use_nic_idx, .nvm_file = FLAGS_nvm_file});
 
   std::vector<gflags::CommandLineFlagInfo> all_flags;
   gflags::GetAllFlags(&all_flags);
@@ -139,14 +142,54 @@ int main(int argc, char **argv) {
 
   if (FLAGS_use_nvm) {
     RDMA_LOG(4) << "server uses NVM with size: " << FLAGS_nvm_sz;
-    nvm_region = NVMRegion::create(FLAGS_nvm_file, FLAGS_nvm_sz).value();
+    if (FLAGS_nvm_emu.empty())
+      nvm_region = NVMRegion::create(FLAGS_nvm_file, FLAGS_nvm_sz).value();
+    else
+      nvm_region = EmuRegion::create(FLAGS_nvm_sz, FLAGS_nvm_emu).value();
   } else {
     RDMA_LOG(4) << "server uses DRAM (huge page)";
     // nvm_region = std::make_shared<DRAMRegion>(FLAGS_nvm_sz);
     nvm_region = HugeRegion::create(FLAGS_nvm_sz).value();
   }
 
-  // we donot need to register this memory to RNic since this is messaging
+  // the calibration overwrites its scratch, so with the KV store, the scratch
+  // is the tail of the region, which is excluded from the store
+  const u64 scratch_sz = std::min<u64>(
+      FLAGS_kv ? nvm_region->sz / 2 : nvm_region->sz, 16 * 1024 * 1024);
+  char *scratch = (char *)nvm_region->addr +
+                  (FLAGS_kv ? nvm_region->sz - scratch_sz : 0);
+  RDMA_ASSERT(persist::init(FLAGS_persist_kernel, scratch, scratch_sz))
+      << "invalid persist kernel: " << FLAGS_persist_kernel;
+
+  // we donot need to register this memory to RNic since this is messaging,
+  // unless the hybrid clients also access it with one-sided ops
+  RDMA_ASSERT(!FLAGS_hybrid || FLAGS_reg_mem_name >= FLAGS_threads)
+      << "reg_mem_name should not overlap the thread ids: "
+      << FLAGS_reg_mem_name;
+
+  Arc<kv::NVMKV> store = nullptr;
+  if (FLAGS_kv) {
+    auto config = kv::KVConfig::parse(FLAGS_kv_config);
+    RDMA_ASSERT(config) << "invalid kv config: " << FLAGS_kv_config;
+    auto kv_region = std::make_shared<MemoryRegion>(
+        nvm_region->sz - scratch_sz, nvm_region->addr);
+    auto store_res =
+        kv::NVMKV::create(kv_region, config.value(), FLAGS_kv_format);
+    RDMA_ASSERT(store_res)
+        << "failed to open the kv store, run with --kv_format to create one";
+    store = store_res.value();
+    RDMA_LOG(4) << "KV store opened with " << store->num_shards()
+                << " shards, log used: " << store->log_used() << "/"
+                << store->log_capacity()
+                << "; recovery redone: " << store->recovery.redone
+                << " records, fixed: " << store->recovery.fixed_slots
+                << " slots, in " << store->recovery.msec << " ms";
+
+    std::vector<char> val(FLAGS_kv_preload_sz, 'v');
+    for (u64 k = 0; k < FLAGS_kv_preload; ++k)
+      RDMA_ASSERT(store->put(k, val.data(), val.size()))
+          << "preload failed at key: " << k;
+  }
 
   using TThread = Thread<int>;
   std::vector<std::unique_ptr<TThread>> threads;
@@ -154,8 +197,8 @@ int main(int argc, char **argv) {
   for (uint thread_id = 0; thread_id < FLAGS_threads; ++thread_id) {
 
     threads.push_back(std::make_unique<TThread>([thread_id, &ctrl, &manager,
-                                                 nvm_region]() -> int {
-                                                  //      BindToCore(thread_id);
+                                                 nvm_region, store]() -> int {
+      bind_to_core(thread_id);
       int idx = 0;
       auto nic = RNic::create(RNicInfo::query_dev_names().at(idx)).value();
 
@@ -178,22 +221,47 @@ int main(int argc, char **argv) {
       auto mr = handler->get_reg_attr().value();
       ctrl.registered_mrs.reg(thread_id, handler);
 
+      // the clients connect their QPs on the NIC of thread_id, so the NVM is
+      // registered with each thread's NIC
+      if (FLAGS_hybrid)
+        RDMA_ASSERT(ctrl.registered_mrs.create_then_reg(
+            FLAGS_reg_mem_name + thread_id,
+            nvm_region->convert_to_rmem().value(), nic))
+            << "reg the NVM for thread: " << thread_id << " failed";
+
       Arc<AbsRecvAllocator> alloc = std::make_shared<SimpleAllocator>(
           mem, handler->get_reg_attr().value().key);
 
+      // with an SRQ, the QPs of the clients share the recv_cq and
+      // kSRQEntries recv buffers, no matter how many clients connect
+      Arc<SRQ> srq = nullptr;
+      Arc<RecvEntries<kSRQEntries>> srq_entries = nullptr;
+      // RCRecvSession requires recv entries, which are unused with an SRQ
+      Arc<RecvEntries<128>> dummy_entries = nullptr;
+      if (FLAGS_use_srq) {
+        srq = SRQ::create(nic, kSRQEntries, recv_cq).value();
+        srq_entries = RecvEntriesFactoryv2<kSRQEntries>::create(alloc, 4096);
+        RDMA_ASSERT(srq->attach(*srq_entries) == IOCode::Ok);
+        dummy_entries = std::make_shared<RecvEntries<128>>();
+      }
+
+      // the replies are sent from registered buffers, each reclaimed after
+      // its send completes; the replies of a recv pass are batched per QP
+      ReplyPool replies(
+          static_cast<char *>(std::get<0>(
+              alloc->alloc_one(FLAGS_reply_bufs * kReplyBufSz).value())),
+          kReplyBufSz, FLAGS_reply_bufs, mr.key, FLAGS_signal_every);
+
       manager.reg_recv_cqs.create_then_reg(std::to_string(thread_id), recv_cq,
-                                           alloc);
+                                           alloc, srq);
 
       // this is benchmark code, so there is memory leakage anyway
       std::unordered_map<u32, RCRecvSession<128> *> incoming_sessions;
+      std::unordered_map<u32, Arc<RC>> session_qps;
 
-      usize counter = 0;
-      while (1) {
-        ibv_wc wcs[4096];
-
-        for (RecvIter<RC, 4096> iter(recv_cq, wcs); iter.has_msgs();
-             iter.next()) {
-          auto imm_msg = iter.cur_msg().value();
+      // handle one msg, and return the session it belongs to
+      auto serve = [&](const std::pair<u32, RMem::raw_ptr_t> &imm_msg)
+          -> RCRecvSession<128> * {
           auto buf = static_cast<char *>(std::get<1>(imm_msg));
           auto session_id = std::get<0>(imm_msg);
 
@@ -219,8 +287,11 @@ int main(int argc, char **argv) {
                   ctrl.registered_qps.query(std::to_string(session_id))
                       .value());
               auto s_rs =
-                  manager.reg_recv_entries.query(std::to_string(session_id))
-                      .value();
+                  FLAGS_use_srq
+                      ? dummy_entries
+                      : manager.reg_recv_entries
+                            .query(std::to_string(session_id))
+                            .value();
 
               ConnectReq2 *req =
                   msg.interpret_as<ConnectReq2>(sizeof(MsgHeader));
@@ -229,6 +300,7 @@ int main(int argc, char **argv) {
 
               auto rs = new RCRecvSession<128>(s_qp, s_rs);
               incoming_sessions.insert(std::make_pair(session_id, rs));
+              session_qps.insert(std::make_pair(session_id, s_qp));
             } else
               ASSERT(false);
 
@@ -247,34 +319,69 @@ int main(int argc, char **argv) {
             ASSERT(endpoint->end_point.send_unsignaled(reply) == IOCode::Ok);
           } break;
           case Req: {
-            char reply_buf[64];
-            MemBlock reply(reply_buf, 64);
-            // MemBlock reply(buf, 64);
+            char *reply_buf = replies.alloc_blocking();
+            usize sz = 0;
+            if (FLAGS_hybrid)
+              sz = execute_rpc_op(nvm_region, msg,
+                                  reply_buf + sizeof(MsgHeader),
+                                  kReplyBufSz - sizeof(MsgHeader));
             {
               r2::compile_fence();
-              MsgHeader *header = (MsgHeader *)(reply.mem_ptr);
+              MsgHeader *header = (MsgHeader *)(reply_buf);
               header->type = Reply;
-              header->sz = 0;
+              header->sz = sz;
               header->coro_id = coro_id;
             }
 
             r2::compile_fence();
             endpoint = (incoming_sessions[session_id]);
-            //RDMA_LOG(4) << "reply req to qp: "
-                        //<< endpoint->end_point.qp << "; check recv cq: " << recv_cq<< "\nQP's two cq: "
-            //<< endpoint->end_point.qp->cq << " " <<
-            //endpoint->end_point.qp->recv_cq;
-            ASSERT(endpoint->end_point.send_unsignaled(reply) == IOCode::Ok);
+            replies.send(session_qps[session_id], reply_buf,
+                         sizeof(MsgHeader) + sz, kRCReplyImm);
+          } break;
+          case KVReq: {
+            RDMA_ASSERT(store != nullptr) << "the server is not in KV mode";
+            char *reply_buf = replies.alloc_blocking();
+            auto sz = execute_kv_ops(*store, msg,
+                                     reply_buf + sizeof(MsgHeader),
+                                     kReplyBufSz - sizeof(MsgHeader));
+            {
+              MsgHeader *header = (MsgHeader *)(reply_buf);
+              header->type = Reply;
+              header->sz = sz;
+              header->coro_id = coro_id;
+            }
+            endpoint = (incoming_sessions[session_id]);
+            replies.send(session_qps[session_id], reply_buf,
+                         sizeof(MsgHeader) + sz, kRCReplyImm);
           } break;
           default:
             ASSERT(false) << "receive a req of: " << (int)header->type;
           }
 
           ASSERT(endpoint != nullptr);
-          endpoint->consume_one();
+          return endpoint;
+      };
+
+      usize counter = 0;
+      while (1) {
+        ibv_wc wcs[4096];
 
+        if (FLAGS_use_srq) {
+          // the iter re-posts the consumed buffers to the SRQ
+          for (RecvIter<SRQ, kSRQEntries> iter(srq, srq_entries);
+               iter.has_msgs(); iter.next()) {
+            serve(iter.cur_msg().value());
+          }
+          replies.flush();
+          continue;
+        }
+
+        for (RecvIter<RC, 4096> iter(recv_cq, wcs); iter.has_msgs();
+             iter.next()) {
+          serve(iter.cur_msg().value())->consume_one();
           // end receiving messages
         }
+        replies.flush();
       }
       return 0;
     }));
@@ -0,0 +1,294 @@
+#pragma once
+
+#include <unordered_map>
+#include <vector>
+
+#include "rlib/core/qps/doorbell_helper.hh"
+#include "rlib/core/qps/rc.hh"
+
+namespace nvm {
+
+using namespace rdmaio;
+using namespace rdmaio::qp;
+
+/*!
+  ReplyPool hands out the (registered) reply buffers of a server thread,
+  and reclaims a buffer only after the NIC has completed sending it, so a
+  buffer is never overwritten while an unsignaled reply still reads it.
+
+  Replies are queued per QP with send(), and flush() posts the replies of
+  each QP as doorbell batches (of at most kNMaxDoorbell). A reply's wr_id
+  encodes its buffer (RC::encode_my_wr), and only the last reply of a batch
+  is (selectively) signaled, every signal_every replies of a QP; since RC
+  completes in order, a signaled completion reclaims all the buffers posted
+  before it (RC::poll_rc_comps).
+
+  The replies of a QP which turns idle before its next signaled one are not
+  reclaimed until a later signal: when the pool runs low, every batch is
+  signaled, and when it runs out, alloc_blocking() signals the idle QPs by
+  a zero-length RDMA WRITE. So the pool should have more than
+  #QPs * signal_every buffers to avoid the stalls, but it is not required.
+
+  Example:
+  `
+  ReplyPool pool(alloc->alloc_one(4096 * 2048), 4096, 2048, mr.key);
+  for (RecvIter<..> iter(..); iter.has_msgs(); iter.next()) {
+    char *reply = pool.alloc_blocking();
+    // ... fill the reply
+    pool.send(qp, reply, reply_sz, imm);
+  }
+  pool.flush();
+  `
+ */
+class ReplyPool {
+public:
+  struct Stats {
+    u64 replies = 0;
+    u64 doorbells = 0;
+    u64 signaled = 0;
+    // the allocs which wait for a completion to reclaim a buffer
+    u64 stalls = 0;
+  };
+
+private:
+  struct QueuedReply {
+    u32 buf;
+    u32 sz;
+    u32 imm;
+  };
+
+  struct QPState {
+    RC *qp = nullptr;
+    // #replies posted since the last signaled one
+    usize since_signal = 0;
+    std::vector<QueuedReply> queued;
+  };
+
+  std::vector<char *> bufs;
+  const usize buf_sz;
+  const u32 lkey;
+  const usize signal_every;
+
+  std::vector<u32> free_bufs;
+  std::vector<QPState> qps;
+  std::unordered_map<RC *, u32> qp_idx;
+  // the QPs with queued replies
+  std::vector<u32> dirty;
+
+  DoorbellHelper<kNMaxDoorbell> doorbell;
+
+public:
+  Stats stats;
+
+  /*!
+    mem: num * buf_sz bytes registered with the lkey
+    signal_every: should be at most half of the QPs' send queue depth
+   */
+  ReplyPool(char *mem, const usize &buf_sz, const usize &num, const u32 &lkey,
+            const usize &signal_every = 32)
+      : buf_sz(buf_sz), lkey(lkey), signal_every(signal_every),
+        doorbell(IBV_WR_SEND_WITH_IMM) {
+    RDMA_ASSERT(num > 0 && signal_every > 0);
+    for (u32 i = 0; i < num; ++i) {
+      bufs.push_back(mem + i * buf_sz);
+      free_bufs.push_back(num - 1 - i);
+    }
+  }
+
+  usize num_free() const { return free_bufs.size(); }
+
+  usize in_flight() const { return bufs.size() - free_bufs.size(); }
+
+  usize max_reply_sz() const { return buf_sz; }
+
+  /*!
+    A free reply buffer, reclaiming the completed ones if there is none
+    \ret None if all the buffers are in flight (or queued)
+   */
+  Option<char *> alloc() {
+    if (unlikely(free_bufs.empty()) && reclaim() == 0)
+      return {};
+    auto res = bufs[free_bufs.back()];
+    free_bufs.pop_back();
+    return res;
+  }
+
+  /*!
+    Alloc a buffer, posting the queued replies and waiting for their
+    completions if there is none
+   */
+  char *alloc_blocking() {
+    auto res = alloc();
+    if (likely(res))
+      return res.value();
+    stats.stalls += 1;
+    flush(true);
+    signal_idle();
+    while (!res) {
+      res = alloc();
+      RDMA_ASSERT(res || pending())
+          << "no reply buffer to reclaim, all the " << bufs.size()
+          << " buffers are held by the caller";
+    }
+    return res.value();
+  }
+
+  /*!
+    Queue the reply of sz bytes in buf (from alloc()) to the qp, which is
+    posted by the next flush()
+   */
+  void send(const Arc<RC> &qp, char *buf, const u32 &sz, const u32 &imm) {
+    RDMA_ASSERT(sz <= buf_sz);
+    auto &s = state_of(qp.get());
+    if (s.queued.empty())
+      dirty.push_back(qp_idx[qp.get()]);
+    s.queued.push_back({buf_idx(buf), sz, imm});
+  }
+
+  /*!
+    Post all the queued replies, as doorbell batches per QP
+    force_signal: signal the last batch of each QP, e.g., to reclaim the
+    buffers as soon as possible
+    \ret the #replies posted
+   */
+  usize flush(const bool &force_signal = false) {
+    usize res = 0;
+    for (auto i : dirty) {
+      auto &s = qps[i];
+      for (usize start = 0; start < s.queued.size();
+           start += kNMaxDoorbell) {
+        const usize n =
+            std::min<usize>(kNMaxDoorbell, s.queued.size() - start);
+        const bool last = start + n == s.queued.size();
+        post_batch(s, &s.queued[start], n, force_signal && last);
+        res += n;
+      }
+      s.queued.clear();
+    }
+    dirty.clear();
+    return res;
+  }
+
+  /*!
+    Poll the completions of all the QPs, and free their buffers
+    \ret the #buffers reclaimed
+   */
+  usize reclaim() {
+    usize res = 0;
+    for (auto &s : qps)
+      res += reclaim(s);
+    return res;
+  }
+
+private:
+  /*!
+    Post a signaled zero-length RDMA WRITE on each QP with unsignaled
+    replies, whose completion reclaims their buffers; it needs no remote
+    memory, and consumes no recv entry of the client
+   */
+  void signal_idle() {
+    for (auto &s : qps) {
+      if (s.since_signal == 0)
+        continue;
+      while (s.qp->pending_reqs() + 1 > static_cast<u64>(s.qp->max_send_sz()))
+        reclaim(s);
+
+      ibv_send_wr wr = {};
+      // 0 is not a buffer of the pool
+      wr.wr_id = s.qp->encode_my_wr(0, 1);
+      wr.opcode = IBV_WR_RDMA_WRITE;
+      wr.num_sge = 0;
+      wr.sg_list = nullptr;
+      wr.send_flags = IBV_SEND_SIGNALED;
+      s.qp->out_signaled += 1;
+      s.since_signal = 0;
+      stats.signaled += 1;
+
+      ibv_send_wr *bad_sr = nullptr;
+      auto res = s.qp->send(wr, 1, &bad_sr);
+      RDMA_ASSERT(res == IOCode::Ok) << "post signal error: " << res.desc;
+    }
+  }
+
+  // whether any request of the QPs is not completed
+  bool pending() const {
+    for (auto &s : qps) {
+      if (s.qp->pending_reqs() > 0)
+        return true;
+    }
+    return false;
+  }
+
+  u32 buf_idx(const char *buf) const {
+    auto idx = static_cast<u32>((buf - bufs[0]) / buf_sz);
+    RDMA_ASSERT(idx < bufs.size() && bufs[idx] == buf)
+        << "not a buffer of the pool: " << (void *)buf;
+    return idx;
+  }
+
+  QPState &state_of(RC *qp) {
+    auto it = qp_idx.find(qp);
+    if (likely(it != qp_idx.end()))
+      return qps[it->second];
+    RDMA_ASSERT(static_cast<usize>(qp->max_send_sz()) >= 2 * signal_every)
+        << "the send queue of the QP is too small: " << qp->max_send_sz();
+    qp_idx.insert(std::make_pair(qp, static_cast<u32>(qps.size())));
+    qps.push_back(QPState());
+    qps.back().qp = qp;
+    return qps.back();
+  }
+
+  usize reclaim(QPState &s) {
+    usize res = 0;
+    auto num = s.qp->poll_rc_comps(
+        int(RC::kMaxRcPollBatch),
+        [this, &res](const u64 &user_wr, const u64 &seq, const ibv_wc &wc) {
+          RDMA_ASSERT(wc.status == IBV_WC_SUCCESS)
+              << "reply failed: " << ibv_wc_status_str(wc.status);
+          // 0 is a request not posted by the pool
+          if (user_wr != 0) {
+            free_bufs.push_back(user_wr - 1);
+            res += 1;
+          }
+        });
+    RDMA_ASSERT(num >= 0) << "poll reply completions error";
+    return res;
+  }
+
+  void post_batch(QPState &s, const QueuedReply *replies, const usize &n,
+                  const bool &force_signal) {
+    // the send queue should have room for the batch
+    while (s.qp->pending_reqs() + n > static_cast<u64>(s.qp->max_send_sz()))
+      reclaim(s);
+
+    const bool signal = force_signal || s.since_signal + n >= signal_every ||
+                        free_bufs.size() < bufs.size() / 4;
+    for (usize i = 0; i < n; ++i) {
+      doorbell.next();
+      doorbell.cur_sge() = {.addr = (u64)(bufs[replies[i].buf]),
+                            .length = replies[i].sz,
+                            .lkey = lkey};
+      auto &wr = doorbell.cur_wr();
+      wr.wr_id = s.qp->encode_my_wr(replies[i].buf + 1, 1);
+      wr.imm_data = replies[i].imm;
+      wr.send_flags = (signal && i == n - 1) ? IBV_SEND_SIGNALED : 0;
+    }
+    if (signal) {
+      s.qp->out_signaled += 1;
+      s.since_signal = 0;
+      stats.signaled += 1;
+    } else
+      s.since_signal += n;
+
+    doorbell.freeze();
+    ibv_send_wr *bad_sr = nullptr;
+    auto res = s.qp->send(*doorbell.first_wr_ptr(), n, &bad_sr);
+    RDMA_ASSERT(res == IOCode::Ok) << "post replies error: " << res.desc;
+    doorbell.clear();
+
+    stats.replies += n;
+    stats.doorbells += 1;
+  }
+};
+
+} // namespace nvm
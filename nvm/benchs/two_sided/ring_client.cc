@@ -11,7 +11,7 @@
 #include "../statucs.hh"
 #include "../thread.hh"
 
-#include "val19.hh"
+#include "../topology.hh"
 
 #include "./proto.hh"
 
@@ -21,6 +21,9 @@ DEFINE_string(addr, "localhost:8888", "Server address to connect to.");
 DEFINE_int64(use_nic_idx, 0, "Which NIC to create QP");
 
 DEFINE_int64(threads, 8, "Number of threads to use.");
+DEFINE_string(bind_policy, "compact",
+              "How threads are pinned to cpus: compact | scatter | nic | nvm "
+              "| node:N | none, optionally suffixed with ,nosmt");
 
 DEFINE_int64(payload, 256, "Number of payload to read/write");
 
@@ -34,13 +37,15 @@ DEFINE_int64(id, 0, "");
 DEFINE_uint64(coros, 8, "Number of coroutine used per thread.");
 
 DEFINE_bool(use_read, true, "");
+
+DEFINE_string(report_file, "",
+              "The file to store the per-epoch JSON records, "
+              "which are always printed to stdout");
 DEFINE_bool(random, true, "");
 
 DEFINE_bool(round_up, false, "");
 DEFINE_uint32(round_payload, 256, "Roundup of the write payload");
 
-DEFINE_bool (force_use_numa_node, false, "ff");
-DEFINE_uint64(use_numa_node, 0, "ffff");
 
 
 using namespace nvm;
@@ -96,56 +101,9 @@ template <typename Nat> Nat align(const Nat &x, const Nat &a) {
   return r ? (x + a - r) : x;
 }
 
-int BindToCore(int t_id) {
-
-  if (t_id >= (per_socket_cores * 2))
-    return 0;
-
-  int x = t_id;
-  int y = 0;
-
-#ifdef SCALE
-  assert(false);
-  // specific  binding for scale tests
-  int mac_per_node = 16 / nthreads; // there are total 16 threads avialable
-  int mac_num = current_partition % mac_per_node;
-
-  if (mac_num < mac_per_node / 2) {
-    y = socket_0[x + mac_num * nthreads];
-  } else {
-    y = socket_1[x + (mac_num - mac_per_node / 2) * nthreads];
-  }
-#else
-  // bind ,andway
-   if (FLAGS_force_use_numa_node) {
-    RDMA_ASSERT(x < per_socket_cores);
-    if (FLAGS_use_numa_node == 0) {
-      y = socket_0[x];
-    } else {
-      y = socket_1[x];
-    }
-  } else {
-    if (x >= per_socket_cores) {
-      // there is no other cores in the first socket
-      y = socket_1[x - per_socket_cores];
-    } else {
-      y = socket_0[x];
-    }
-  }
-
-#endif
-
-  // fprintf(stdout,"worker: %d binding %d\n",x,y);
-  cpu_set_t mask;
-  CPU_ZERO(&mask);
-  CPU_SET(y, &mask);
-  sched_setaffinity(0, sizeof(mask), &mask);
-
-  return 0;
-}
-
 int main(int argc, char **argv) {
   gflags::ParseCommandLineFlags(&argc, &argv, true);
+  CoreBinder::init(FLAGS_bind_policy, {.nic_dev_id = FLAGS_use_nic_idx});
 
   RDMA_LOG(4) << "Msg Ring client bootstrap with " << FLAGS_threads
               << " threads";
@@ -159,6 +117,7 @@ int main(int argc, char **argv) {
   using TThread = Thread<int>;
   std::vector<std::unique_ptr<TThread>> threads;
   std::vector<Statics> statics(FLAGS_threads);
+  std::vector<LatHistogram> lat_hists(FLAGS_threads);
 
   using RI = RingRecvIter<ring_entry, ring_sz, max_msg_sz>;
 
@@ -169,8 +128,9 @@ int main(int argc, char **argv) {
   for (uint thread_id = 0; thread_id < FLAGS_threads; ++thread_id) {
 
     threads.push_back(std::make_unique<TThread>([thread_id, &statics,
+                                                 &lat_hists,
                                                  address_space]() -> int {
-                                                  //BindToCore(thread_id);
+      bind_to_core(thread_id);
       int idx = 0;
       while (idx >= RNicInfo::query_dev_names().size())
         idx -= 1;
@@ -218,10 +178,13 @@ int main(int argc, char **argv) {
       std::vector<char *> reply_bufs(2 + FLAGS_coros, nullptr);
 
       poll_func_t reply_future =
-          [&receiver, &wait_replies, &ssched,
-           &reply_bufs]() -> Result<std::pair<::r2::Routine::id_t, usize>> {
+          [&receiver, &wait_replies, &ssched, &reply_bufs, &statics,
+           thread_id]() -> Result<std::pair<::r2::Routine::id_t, usize>> {
+        auto start = read_tsc();
+        usize polled = 0;
         for (RI iter(receiver); iter.has_msgs(); iter.next()) {
           auto msg = iter.cur_msg();
+          polled += 1;
 
           MsgHeader *header = msg.interpret_as<MsgHeader>();
 
@@ -244,6 +207,7 @@ int main(int argc, char **argv) {
             ssched.addback_coroutine(coro_id);
           }
         }
+        statics[thread_id].add_poll(read_tsc() - start, polled == 0);
         // this future shall never return
         return NotReady(std::make_pair<::r2::Routine::id_t, usize>(0u, 0u));
       };
@@ -270,6 +234,7 @@ int main(int argc, char **argv) {
         ssched.spawn([&ss,
                       alloc,
                       &statics,
+                      &lat_hists,
                       &wait_replies,
                       &reply_bufs,
                       &rand,
@@ -287,13 +252,12 @@ int main(int argc, char **argv) {
 
           char *reply_buf = new char[window_sz * 4096];
 
-//          FlatLatRecorder lats; // used to record lat
+          LatHistogram &lats = lat_hists[thread_id]; // used to record lat
           t.reset();
 
           while (1) {
             r2::compile_fence();
-            if (thread_id == 0)
-              t.reset();
+            t.reset();
 
             for (uint i = 0; i < window_sz; ++i) {
               // u64 addr = rand.next() % (four_h_mb) + four_h_mb * thread_id;
@@ -326,10 +290,12 @@ int main(int argc, char **argv) {
                         .read = static_cast<u8>((FLAGS_use_read) ? 1 : 0)};
               }
 
+              auto start = read_tsc();
               auto ret = ss->send_unsignaled(
                   {(void *)(msg_buf),
                    sizeof(MsgHeader) + sizeof(Request) +
                          (FLAGS_use_read ? 0 : FLAGS_payload)});
+              statics[thread_id].add_post(read_tsc() - start);
               ASSERT(ret == IOCode::Ok);
 
             }
@@ -341,10 +307,8 @@ int main(int argc, char **argv) {
             ASSERT(ret == IOCode::Ok);
 
             // record the latency
-            if (thread_id == 0) {
-//              lats.add_one(t.passed_msec());
-//              statics[thread_id].float_data = lats.get_lat();
-            }
+            lats.record_us(t.passed_msec());
+            statics[thread_id].inc_bytes(FLAGS_payload * window_sz);
 
             statics[thread_id].inc(window_sz);
           }
@@ -364,7 +328,7 @@ int main(int argc, char **argv) {
     t->start();
   LOG(2) << "all thread run";
 
-  Reporter::report_thpt(statics, 40);
+  Reporter::report_thpt(statics, 40, lat_hists, FLAGS_report_file);
 
   for (auto &t : threads) {
     t->join();
@@ -3,12 +3,14 @@
 
 #include "r2/src/ring_msg/mod.hh"
 
-#include "./r740.hh"
+#include "../topology.hh"
 
 #include "../../huge_region.hh"
+#include "../../emu_region.hh"
 #include "../../nvm_region.hh"
 
 #include "../thread.hh"
+#include "./coalescer.hh"
 #include "./constants.hh"
 #include "./core.hh"
 
@@ -16,15 +18,27 @@ DEFINE_int64(port, 8888, "Server listener (UDP) port.");
 DEFINE_int64(use_nic_idx, 0, "Which NIC to create QP");
 DEFINE_int64(reg_mem_name, 73, "The name to register an MR at rctrl.");
 DEFINE_int64(threads, 1, "Number of threads used.");
+DEFINE_string(bind_policy, "compact",
+              "How threads are pinned to cpus: compact | scatter | nic | nvm "
+              "| node:N | none, optionally suffixed with ,nosmt");
 
 // NVM related settings
 DEFINE_bool(use_nvm, true, "Whether to use NVM for RDMA");
 DEFINE_bool(non_null, false, "whether to execute null RPC");
 DEFINE_string(nvm_file, "/dev/dax1.6", "Abstracted NVM device");
+DEFINE_string(nvm_emu, "",
+              "Emulate the NVM on DRAM instead of nvm_file, e.g., default, or "
+              "read_ns=300,write_ns=100,write_bw=2300,wc_lines=64,file=/path");
 DEFINE_uint64(nvm_sz, 10, "Mapped sz (in GB), should be larger than 2MB");
 DEFINE_bool (use_read, true, "read");
 
 DEFINE_bool(clflush, false, "whether to flush write content");
+DEFINE_bool(coalesce, false,
+            "Stage the writes drained by one recv pass, and persist them by "
+            "256B XPLine (one NT-store and fence per line) before replying");
+DEFINE_string(persist_kernel, "auto",
+              "How to persist NVM writes: auto | calibrate | nt | clwb | "
+              "clflushopt | clflush | barrier");
 
 using namespace rdmaio;
 using namespace rdmaio::rmem;
@@ -91,47 +105,10 @@ public:
   }
 };
 
-int BindToCore(int t_id) {
-
-  if (t_id >= (per_socket_cores * 2))
-    return 0;
-
-  int x = t_id;
-  int y = 0;
-
-#ifdef SCALE
-  assert(false);
-  // specific  binding for scale tests
-  int mac_per_node = 16 / nthreads; // there are total 16 threads avialable
-  int mac_num = current_partition % mac_per_node;
-
-  if (mac_num < mac_per_node / 2) {
-    y = socket_0[x + mac_num * nthreads];
-  } else {
-    y = socket_one[x + (mac_num - mac_per_node / 2) * nthreads];
-  }
-#else
-  // bind ,andway
-  if (x >= per_socket_cores) {
-    // there is no other cores in the first socket
-    y = socket_one[x - per_socket_cores];
-  } else {
-    y = socket_zero[x];
-  }
-
-#endif
-
-  cpu_set_t mask;
-  CPU_ZERO(&mask);
-  CPU_SET(y, &mask);
-  sched_setaffinity(0, sizeof(mask), &mask);
-
-  return 0;
-}
-
 int main(int argc, char **argv) {
 
   gflags::ParseCommandLineFlags(&argc, &argv, true);
+  CoreBinder::init(FLAGS_bind_policy, {.nic_dev_id = FLAGS_use_nic_idx, .nvm_file = FLAGS_nvm_file});
 
   std::vector<gflags::CommandLineFlagInfo> all_flags;
   gflags::GetAllFlags(&all_flags);
@@ -152,7 +129,10 @@ int main(int argc, char **argv) {
   if (FLAGS_use_nvm) {
     RDMA_LOG(4) << "server uses NVM with size: " << FLAGS_nvm_sz << " GB";
     u64 sz = static_cast<u64>(FLAGS_nvm_sz) * (1024 * 1024 * 1024L);
-    nvm_region = NVMRegion::create(FLAGS_nvm_file, sz).value();
+    if (FLAGS_nvm_emu.empty())
+      nvm_region = NVMRegion::create(FLAGS_nvm_file, sz).value();
+    else
+      nvm_region = EmuRegion::create(sz, FLAGS_nvm_emu).value();
   } else {
     RDMA_LOG(4) << "server uses DRAM (huge page)";
     u64 sz = static_cast<u64>(FLAGS_nvm_sz) * (1024 * 1024 * 1024L);
@@ -160,6 +140,10 @@ int main(int argc, char **argv) {
     nvm_region = HugeRegion::create(sz).value();
   }
 
+  RDMA_ASSERT(persist::init(FLAGS_persist_kernel, (char *)nvm_region->addr,
+                            std::min<u64>(nvm_region->sz, 16 * 1024 * 1024)))
+      << "invalid persist kernel: " << FLAGS_persist_kernel;
+
   // we donot need to register this memory to RNic since this is messaging
 
   using TThread = Thread<int>;
@@ -171,8 +155,7 @@ int main(int argc, char **argv) {
 
     threads.push_back(std::make_unique<TThread>([thread_id, &ctrl, &rm,
                                                  &nvm_region]() -> int {
-                                                  BindToCore(thread_id);
-                                                  //bind_to_core(thread_id);
+      bind_to_core(thread_id);
       int idx = 1;
       //int idx = 0;
 
@@ -219,6 +202,23 @@ int main(int argc, char **argv) {
       }
 
       usize cur_idx = 0;
+
+      // with coalescing, the replies of a pass are sent after its writes
+      // are persisted; a pass is cut before it reuses a pending reply buf
+      WriteCoalescer coalescer(nvm_region);
+      using session_t = decltype(std::declval<RI>().cur_session());
+      std::vector<std::pair<session_t, usize>> pending_replies;
+      auto flush_and_reply = [&]() {
+        coalescer.flush();
+        for (auto &r : pending_replies) {
+          auto res_s = r.first->send_unsignaled(
+              {(void *)(reply_buf_pool[r.second]), sizeof(MsgHeader)});
+          ASSERT(res_s == IOCode::Ok);
+        }
+        pending_replies.clear();
+      };
+      const bool coalesce = FLAGS_coalesce && FLAGS_non_null && !FLAGS_use_read;
+
       // now start to recv messages
       while (1) {
 
@@ -240,6 +240,7 @@ int main(int argc, char **argv) {
 
           // send the reply
           //char reply_buf[4096];
+          const usize reply_idx = cur_idx;
           char *reply_buf = reply_buf_pool[cur_idx];
           cur_idx += 1;
           if (cur_idx >= max_reply_buf) {
@@ -253,8 +254,17 @@ int main(int argc, char **argv) {
             if (FLAGS_use_read) {
               ASSERT(req != nullptr);
               memcpy(reply_buf + sizeof(MsgHeader), (char *)nvm_region->addr + req->addr, req->payload);
+              emu::on_read((char *)nvm_region->addr + req->addr, req->payload);
               reply_sz = req->payload;
             }
+            else if (coalesce) {
+              char *payload =
+                  msg.interpret_as<char>(sizeof(MsgHeader) + sizeof(Request));
+              if (!coalescer.add(req->addr, payload, req->payload)) {
+                flush_and_reply();
+                ASSERT(coalescer.add(req->addr, payload, req->payload));
+              }
+            }
             else{
               reply_sz =
                 ::nvm::execute_nvm_ops(nvm_region, msg, FLAGS_clflush,reply_buf);
@@ -272,6 +282,12 @@ int main(int argc, char **argv) {
             header->sz = reply_sz;
             header->coro_id = coro_id;
           }
+          if (coalesce) {
+            pending_replies.push_back(std::make_pair(cur_session, reply_idx));
+            if (pending_replies.size() >= max_reply_buf / 2)
+              flush_and_reply();
+            continue;
+          }
 #if 1
           auto res_s = cur_session->send_unsignaled(
               {(void *)(reply_buf),
@@ -280,6 +296,8 @@ int main(int argc, char **argv) {
 #endif
 
         }
+        if (coalesce)
+          flush_and_reply();
       }
 
       return 0;
@@ -4,15 +4,20 @@
 
 #include "rlib/core/lib.hh"
 #include "rlib/core/qps/recv_iter.hh"
+#include "rlib/core/qps/stride_recv.hh"
 
 #include "r2/src/mem_block.hh"
 #include "r2/src/msg/ud_session.hh"
 
+#include "./coalescer.hh"
+#include "./dispatcher.hh"
 #include "./proto.hh"
-#include "./r740.hh"
+#include "../topology.hh"
 
 #include "../../huge_region.hh"
+#include "../../emu_region.hh"
 #include "../../nvm_region.hh"
+#include "../../persist.hh"
 
 #include "../thread.hh"
 
@@ -20,14 +25,37 @@ DEFINE_int64(port, 8888, "Server listener (UDP) port.");
 DEFINE_int64(use_nic_idx, 0, "Which NIC to create QP");
 DEFINE_int64(reg_mem_name, 73, "The name to register an MR at rctrl.");
 DEFINE_int64(threads, 1, "Number of threads used.");
+DEFINE_string(bind_policy, "compact",
+              "How threads are pinned to cpus: compact | scatter | nic | nvm "
+              "| node:N | none, optionally suffixed with ,nosmt");
 
 // NVM related settings
 DEFINE_bool(use_nvm, true, "Whether to use NVM for RDMA");
 DEFINE_string(nvm_file, "/dev/dax1.0", "Abstracted NVM device");
+DEFINE_string(nvm_emu, "",
+              "Emulate the NVM on DRAM instead of nvm_file, e.g., default, or "
+              "read_ns=300,write_ns=100,write_bw=2300,wc_lines=64,file=/path");
 DEFINE_uint64(nvm_sz, 2L * 1024 * 1024 * 1024,
               "Mapped sz, should be larger than 2MB");
 
+DEFINE_uint64(max_msg_sz, 0,
+              "If > 0, receive with strided buffers packed in one region, "
+              "each holds a msg of at most max_msg_sz bytes; otherwise each "
+              "recv uses a 4KB buffer");
+DEFINE_uint64(repost_batch, 64,
+              "Re-post the consumed strided recvs in batches of it");
+
 DEFINE_bool(clfush, false, "whether to flush write content");
+DEFINE_bool(coalesce, false,
+            "Stage the writes drained by one recv pass, and persist them by "
+            "256B XPLine (one NT-store and fence per line)");
+DEFINE_bool(dispatch, false,
+            "Balance the NVM writes across the server threads: a thread "
+            "pushes the writes of its recv pass to its deque, and idle "
+            "threads steal them");
+DEFINE_string(persist_kernel, "auto",
+              "How to persist NVM writes: auto | calibrate | nt | clwb | "
+              "clflushopt | clflush | barrier");
 
 using namespace rdmaio;
 using namespace rdmaio::rmem;
@@ -36,13 +64,6 @@ using namespace rdmaio::qp;
 using namespace r2;
 using namespace nvm;
 
-void flush_cache(char *ptr, u64 size) {
-  for (u64 cur = 0; cur < size; cur += 64) {
-    _mm_clflush(ptr);
-    ptr += 64;
-  }
-}
-
 template <typename Nat> Nat align(const Nat &x, const Nat &a) {
   auto r = x % a;
   return r ? (x + a - r) : x;
@@ -78,47 +99,10 @@ public:
   }
 };
 
-int BindToCore(int t_id) {
-
-  if (t_id >= (per_socket_cores * 2))
-    return 0;
-
-  int x = t_id;
-  int y = 0;
-
-#ifdef SCALE
-  assert(false);
-  // specific  binding for scale tests
-  int mac_per_node = 16 / nthreads; // there are total 16 threads avialable
-  int mac_num = current_partition % mac_per_node;
-
-  if (mac_num < mac_per_node / 2) {
-    y = socket_0[x + mac_num * nthreads];
-  } else {
-    y = socket_one[x + (mac_num - mac_per_node / 2) * nthreads];
-  }
-#else
-  // bind ,andway
-  if (x >= per_socket_cores) {
-    // there is no other cores in the first socket
-    y = socket_one[x - per_socket_cores];
-  } else {
-    y = socket_zero[x];
-  }
-
-#endif
-
-  cpu_set_t mask;
-  CPU_ZERO(&mask);
-  CPU_SET(y, &mask);
-  sched_setaffinity(0, sizeof(mask), &mask);
-
-  return 0;
-}
-
 int main(int argc, char **argv) {
 
   gflags::ParseCommandLineFlags(&argc, &argv, true);
+  CoreBinder::init(FLAGS_bind_policy, {.nic_dev_id = FLAGS_use_nic_idx, .nvm_file = FLAGS_nvm_file});
 
   std::vector<gflags::CommandLineFlagInfo> all_flags;
   gflags::GetAllFlags(&all_flags);
@@ -136,31 +120,46 @@ int main(int argc, char **argv) {
 
   if (FLAGS_use_nvm) {
     RDMA_LOG(4) << "server uses NVM with size: " << FLAGS_nvm_sz;
-    nvm_region = NVMRegion::create(FLAGS_nvm_file, FLAGS_nvm_sz).value();
+    if (FLAGS_nvm_emu.empty())
+      nvm_region = NVMRegion::create(FLAGS_nvm_file, FLAGS_nvm_sz).value();
+    else
+      nvm_region = EmuRegion::create(FLAGS_nvm_sz, FLAGS_nvm_emu).value();
   } else {
     RDMA_LOG(4) << "server uses DRAM (huge page)";
     // nvm_region = std::make_shared<DRAMRegion>(FLAGS_nvm_sz);
     nvm_region = HugeRegion::create(FLAGS_nvm_sz).value();
   }
 
+  RDMA_ASSERT(persist::init(FLAGS_persist_kernel, (char *)nvm_region->addr,
+                            std::min<u64>(nvm_region->sz, 16 * 1024 * 1024)))
+      << "invalid persist kernel: " << FLAGS_persist_kernel;
+
   // we donot need to register this memory to RNic since this is messaging
 
+  RDMA_ASSERT(!(FLAGS_dispatch && FLAGS_coalesce))
+      << "dispatch and coalesce cannot be both enabled";
+  StealDispatcher dispatcher(FLAGS_threads);
+
   using TThread = Thread<int>;
   std::vector<std::unique_ptr<TThread>> threads;
 
   for (uint thread_id = 0; thread_id < FLAGS_threads; ++thread_id) {
 
-    threads.push_back(std::make_unique<TThread>([thread_id, &ctrl,
+    threads.push_back(std::make_unique<TThread>([thread_id, &ctrl, &dispatcher,
                                                  nvm_region]() -> int {
-    // BindToCore(thread_id + per_socket_cores);
-                                                  BindToCore(thread_id);
-                                                  //bind_to_core(thread_id);
+      bind_to_core(thread_id);
       auto idx = FLAGS_use_nic_idx;
 
       auto nic = RNic::create(RNicInfo::query_dev_names().at(idx)).value();
       // prepare the message buf
 
-      auto mem_region = std::make_shared<DRAMRegion>(16 * 1024 * 1024);
+      // strided recvs use a single buffer of 2048 entries
+      const usize stride =
+          StridedRecvEntries<2048>::stride_of(FLAGS_max_msg_sz, kGRHSz);
+      const usize mem_sz = FLAGS_max_msg_sz > 0
+                               ? align<usize>(stride * 2048, 4096)
+                               : 16 * 1024 * 1024;
+      auto mem_region = std::make_shared<DRAMRegion>(mem_sz);
       // auto mem_region = HugeRegion::create(64 * 1024 * 1024).value();
       auto mem = mem_region->convert_to_rmem().value();
 
@@ -168,8 +167,19 @@ int main(int argc, char **argv) {
       SimpleAllocator alloc(mem, handler->get_reg_attr().value().key);
 
       // prepare buffer, contain 2048 recv entries, each has 4096 bytes
-      auto recv_rs =
-          RecvEntriesFactory<SimpleAllocator, 2048, 4096>::create(alloc);
+      Arc<RecvEntries<2048>> recv_rs = nullptr;
+      Arc<StridedRecvEntries<2048>> strided_rs = nullptr;
+      if (FLAGS_max_msg_sz > 0) {
+        strided_rs = StridedRecvEntries<2048>::create(alloc, FLAGS_max_msg_sz,
+                                                      kGRHSz)
+                         .value();
+        strided_rs->set_repost_batch(FLAGS_repost_batch);
+        recv_rs = strided_rs;
+        RDMA_LOG(4) << "use strided recvs of " << strided_rs->stride
+                    << " bytes, total " << strided_rs->mem_sz() << " bytes";
+      } else {
+        recv_rs = RecvEntriesFactory<SimpleAllocator, 2048, 4096>::create(alloc);
+      }
       // ctrl.registered_mrs.reg(FLAGS_reg_mem_name, handler);
 
       auto ud = UD::create(nic, QPConfig().set_qkey(thread_id + 73)).value();
@@ -195,17 +205,13 @@ int main(int argc, char **argv) {
 
       // while (t.passed_sec() < 100) {
 
-      while (1) {
-        u64 sum = 0;
-        for (RecvIter<UD, 2048> iter(ud, recv_rs); iter.has_msgs();
-             iter.next()) {
-          auto imm_msg = iter.cur_msg().value();
-
-          auto session_id = std::get<0>(imm_msg);
-          auto buf = static_cast<char *>(std::get<1>(imm_msg)) + kGRHSz;
-
+      u64 sum = 0;
+      // the writes of a recv pass, persisted at the end of the pass
+      WriteCoalescer coalescer(nvm_region);
+      // handle one msg of buf, which has buf_sz bytes (excluding GRH)
+      auto serve = [&](const u32 &session_id, char *buf, const usize &buf_sz) {
           // wrapper the message to avoid overflow
-          MemBlock msg(buf, 4096 - kGRHSz);
+          MemBlock msg(buf, buf_sz);
           MsgHeader *header = msg.interpret_as<MsgHeader>();
           RDMA_ASSERT(header != nullptr);
 
@@ -267,9 +273,18 @@ int main(int argc, char **argv) {
                   char *server_buf_ptr =
                       reinterpret_cast<char *>(nvm_region->addr) + req->addr;
                   r2::compile_fence();
-                  sum += (u64)(memcpy(server_buf_ptr, payload, req->payload));
-                  r2::compile_fence();
-                  flush_cache(server_buf_ptr, req->payload);
+                  if (FLAGS_coalesce) {
+                    if (!coalescer.add(req->addr, payload, req->payload)) {
+                      coalescer.flush();
+                      ASSERT(coalescer.add(req->addr, payload, req->payload));
+                    }
+                    sum += req->payload;
+                  } else if (FLAGS_dispatch) {
+                    dispatcher.submit(thread_id, server_buf_ptr, payload,
+                                      req->payload);
+                    sum += req->payload;
+                  } else
+                    sum += persist::copy(server_buf_ptr, payload, req->payload);
                   r2::compile_fence();
                 }
                 break;
@@ -330,7 +345,43 @@ int main(int argc, char **argv) {
           default:
             RDMA_ASSERT(false) << "unknown msg type: " << header->type;
           }
+      };
+
+      // with dispatch, the writes of a pass should be done before the iter
+      // (destructed) re-posts their recv buffers; an idle thread steals
+      auto end_pass = [&](const bool &idle) {
+        if (!FLAGS_dispatch)
+          return;
+        if (idle)
+          dispatcher.steal(thread_id);
+        else
+          dispatcher.join(thread_id);
+      };
+
+      while (1) {
+        if (strided_rs != nullptr) {
+          StridedRecvIter<UD, 2048> iter(ud, strided_rs);
+          const bool idle = !iter.has_msgs();
+          for (; iter.has_msgs(); iter.next()) {
+            auto m = iter.cur_msg().value();
+            serve(m.imm_data, m.payload, strided_rs->max_msg_sz());
+          }
+          coalescer.flush();
+          end_pass(idle);
+          continue;
+        }
+
+        RecvIter<UD, 2048> iter(ud, recv_rs);
+        const bool idle = !iter.has_msgs();
+        for (; iter.has_msgs(); iter.next()) {
+          auto imm_msg = iter.cur_msg().value();
+
+          auto session_id = std::get<0>(imm_msg);
+          auto buf = static_cast<char *>(std::get<1>(imm_msg)) + kGRHSz;
+          serve(session_id, buf, 4096 - kGRHSz);
         }
+        coalescer.flush();
+        end_pass(idle);
         // auto ret_flush = reply_s->flush_a_doorbell(doorbell);
         // ASSERT(ret_flush == IOCode::Ok) << "error: " << ret_flush.desc;
       }
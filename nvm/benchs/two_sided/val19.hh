@@ -1,52 +0,0 @@
-/*!
-  The lscpu setup of val19.
- */
-namespace nvm {
-
-
-static const int per_socket_cores = 36; // TODO!! hard coded
-// const int per_socket_cores = 8;//reserve 2 cores
-
-static int socket_0[] = {  0,1,2,3 ,4 ,5 ,6 ,7 ,8 ,9 ,10, 11, 12, 13 ,14 ,15 ,16 ,17, 36, 37, 38 ,39 ,40 ,41 ,42 ,43 ,44 ,45 ,46 ,47 ,48 ,49 ,50 ,51 ,52, 53};
-
-static int socket_1[] = {  18, 19 ,20 ,21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35, 54, 55, 56, 57, 58, 59, 60, 61, 62, 63, 64, 65, 66, 67, 68, 69, 70 ,71 };
-
-int bind_to_core(int t_id) {
-
-  if (t_id >= (per_socket_cores * 2))
-    return 0;
-
-  int x = t_id;
-  int y = 0;
-
-#ifdef SCALE
-  assert(false);
-  // specific  binding for scale tests
-  int mac_per_node = 16 / nthreads; // there are total 16 threads avialable
-  int mac_num = current_partition % mac_per_node;
-
-  if (mac_num < mac_per_node / 2) {
-    y = socket_0[x + mac_num * nthreads];
-  } else {
-    y = socket_one[x + (mac_num - mac_per_node / 2) * nthreads];
-  }
-#else
-  // bind ,andway
-  if (x >= per_socket_cores) {
-    // there is no other cores in the first socket
-    y = socket_0[x - per_socket_cores];
-  } else {
-    y = socket_1[x];
-  }
-
-#endif
-
-  // fprintf(stdout,"worker: %d binding %d\n",x,y);
-  cpu_set_t mask;
-  CPU_ZERO(&mask);
-  CPU_SET(y, &mask);
-  sched_setaffinity(0, sizeof(mask), &mask);
-
-  return 0;
-}
-}
@@ -0,0 +1,305 @@
+#pragma once
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "rlib/tests/random.hh"
+
+#include "./gen_addr.hh"
+#include "./spec.hh"
+
+namespace nvm {
+
+/*!
+  The distribution of request payloads:
+  - fixed: always max;
+  - uniform: uniformly in [min, max];
+  - choice: uniformly one of values.
+  In a spec, it is either a number (fixed), or an object, e.g.,
+  {dist: uniform, min: 64, max: 4096}, or {dist: choice, values: [64, 256]}.
+ */
+struct PayloadDist {
+  std::string dist = "fixed";
+  u64 min = 256;
+  u64 max = 256;
+  std::vector<u64> values;
+
+  static Option<PayloadDist> from_spec(const Spec &s) {
+    PayloadDist res;
+    if (s.type == Spec::kNum) {
+      res.min = res.max = static_cast<u64>(s.num);
+    } else if (s.is_object()) {
+      res.dist = s.get_str("dist", "fixed");
+      res.max = s.get_u64("max", s.get_u64("size", res.max));
+      res.min = s.get_u64("min", res.dist == "fixed" ? res.max : 1);
+      if (auto v = s.find("values")) {
+        for (auto &e : v->arr) {
+          if (e.type != Spec::kNum)
+            return {};
+          res.values.push_back(static_cast<u64>(e.num));
+        }
+        if (!res.values.empty())
+          res.max = *std::max_element(res.values.begin(), res.values.end());
+      }
+    } else {
+      return {};
+    }
+
+    if (res.dist == "fixed")
+      res.min = res.max;
+    else if (res.dist == "choice" && res.values.empty())
+      return {};
+    else if (res.dist != "uniform" && res.dist != "choice")
+      return {};
+    if (res.min == 0 || res.min > res.max)
+      return {};
+    return res;
+  }
+
+  u64 gen(::test::FastRandom &rand) const {
+    if (dist == "uniform")
+      return min + rand.next() % (max - min + 1);
+    if (dist == "choice")
+      return values[rand.next() % values.size()];
+    return max;
+  }
+};
+
+/*!
+  A benchmark workload, described by a declarative spec (see spec.hh), e.g.,
+  in YAML:
+  `
+  name: emu-read
+  transport: loopback       # loopback | rc | local
+  memory: {backend: emu, emu: "read_ns=300", space_mb: 1024}
+  threads: 4
+  coros: 8
+  batch: 1                  # doorbell batch, up to 16
+  duration: 10              # seconds
+  ops: {read: 0.9, write: 0.1}
+  sync: false               # a read-after-write to flush each write
+  payload: {dist: uniform, min: 64, max: 1024}
+  addr: {dist: zipf, align: 256, theta: 0.99}
+  `
+
+  The fields:
+  - transport: loopback executes one-sided requests in-process, rc connects
+    to a one-sided server (server, nic_idx, remote_nic_idx, id), and local
+    reads/writes the memory with the CPU (persist for the persist kernel of
+    writes, or none for a plain memcpy);
+  - memory: the backend of the accessed memory for loopback and local, one of
+    dram | huge | nvm (file) | emu (emu, the EmuConfig spec); the server
+    decides it for rc;
+  - addr: the AddrGenConfig of remote addresses;
+  - bind: the CoreBinder policy of the threads.
+
+  A spec may carry a "sweep", mapping a (dot-separated) path to the values
+  to run, e.g., {payload: [64, 256], addr.dist: [uniform, zipf]} runs the
+  four combinations. A spec file may also be an array of specs, run in
+  order.
+ */
+struct Workload {
+  // the resolved spec of the workload, reported with the results
+  Spec spec;
+
+  std::string name = "";
+  std::string transport = "loopback";
+
+  std::string server = "localhost:8888";
+  i64 nic_idx = 0;
+  i64 remote_nic_idx = 0;
+  u64 id = 0;
+
+  std::string memory = "dram";
+  std::string nvm_file = "/dev/dax1.6";
+  std::string emu = "default";
+  u64 space = 1024 * 1024 * 1024L;
+
+  u64 threads = 1;
+  u64 coros = 8;
+  u64 batch = 1;
+  u64 duration = 10;
+
+  double read_ratio = 1.0;
+  bool sync = false;
+  PayloadDist payload;
+  AddrGenConfig addr;
+
+  std::string persist = "auto";
+  std::string bind = "compact";
+
+  static const std::vector<std::string> &known_keys() {
+    static const std::vector<std::string> keys = {
+        "name",  "transport", "server", "nic_idx", "remote_nic_idx", "id",
+        "memory", "threads",  "coros",  "batch",   "duration",       "ops",
+        "sync",  "payload",   "addr",   "persist", "bind"};
+    return keys;
+  }
+
+  /*!
+    Parse a (swept) workload spec; log the reason and return {} if it is
+    invalid.
+   */
+  static Option<Workload> from_spec(const Spec &s) {
+    if (!s.is_object()) {
+      RDMA_LOG(4) << "a workload spec must be an object: " << s.to_json();
+      return {};
+    }
+    for (auto &kv : s.obj) {
+      auto &keys = known_keys();
+      if (std::find(keys.begin(), keys.end(), kv.first) == keys.end()) {
+        RDMA_LOG(4) << "unknown workload field: " << kv.first;
+        return {};
+      }
+    }
+
+    Workload w;
+    w.spec = s;
+    w.name = s.get_str("name", w.name);
+    w.transport = s.get_str("transport", w.transport);
+    w.server = s.get_str("server", w.server);
+    w.nic_idx = s.get_u64("nic_idx", w.nic_idx);
+    w.remote_nic_idx = s.get_u64("remote_nic_idx", w.remote_nic_idx);
+    w.id = s.get_u64("id", w.id);
+
+    if (auto m = s.find("memory")) {
+      if (m->type == Spec::kStr) {
+        w.memory = m->str;
+      } else {
+        w.memory = m->get_str("backend", w.memory);
+        w.nvm_file = m->get_str("file", w.nvm_file);
+        w.emu = m->get_str("emu", w.emu);
+        w.space = m->get_u64("space_mb", w.space >> 20) << 20;
+      }
+    }
+
+    w.threads = s.get_u64("threads", w.threads);
+    w.coros = s.get_u64("coros", w.coros);
+    w.batch = s.get_u64("batch", w.batch);
+    w.duration = s.get_u64("duration", w.duration);
+    w.sync = s.get_bool("sync", w.sync);
+    w.persist = s.get_str("persist", w.persist);
+    w.bind = s.get_str("bind", w.bind);
+
+    if (auto ops = s.find("ops")) {
+      const double r = ops->get_double("read", 0);
+      const double wr = ops->get_double("write", 0);
+      if (r < 0 || wr < 0 || r + wr <= 0) {
+        RDMA_LOG(4) << "invalid op mix: " << ops->to_json();
+        return {};
+      }
+      w.read_ratio = r / (r + wr);
+    }
+
+    if (auto p = s.find("payload")) {
+      auto res = PayloadDist::from_spec(*p);
+      if (!res) {
+        RDMA_LOG(4) << "invalid payload: " << p->to_json();
+        return {};
+      }
+      w.payload = res.value();
+    }
+
+    if (auto a = s.find("addr")) {
+      auto &c = w.addr;
+      c.dist = a->get_str("dist", c.dist);
+      c.align = a->get_u64("align", c.align);
+      c.theta = a->get_double("theta", c.theta);
+      c.hot_ops = a->get_double("hot_ops", c.hot_ops);
+      c.hot_space = a->get_double("hot_space", c.hot_space);
+      c.num_dimms = a->get_u64("num_dimms", c.num_dimms);
+      c.interleave = a->get_u64("interleave", c.interleave);
+    }
+
+    if (w.transport != "loopback" && w.transport != "rc" &&
+        w.transport != "local") {
+      RDMA_LOG(4) << "unknown transport: " << w.transport;
+      return {};
+    }
+    if (w.memory != "dram" && w.memory != "huge" && w.memory != "nvm" &&
+        w.memory != "emu") {
+      RDMA_LOG(4) << "unknown memory backend: " << w.memory;
+      return {};
+    }
+    if (w.threads == 0 || w.coros == 0 || w.duration == 0) {
+      RDMA_LOG(4) << "threads, coros and duration must be positive";
+      return {};
+    }
+    // the sync read takes one doorbell slot
+    if (w.batch == 0 || w.batch + (w.sync ? 1 : 0) > 16) {
+      RDMA_LOG(4) << "invalid doorbell batch: " << w.batch;
+      return {};
+    }
+    if (w.space <= w.payload.max + w.addr.align) {
+      RDMA_LOG(4) << "the memory space is smaller than the payload";
+      return {};
+    }
+    if (!create_addr_gen(w.addr, w.addr_space(), 0)) {
+      RDMA_LOG(4) << "invalid address distribution: " << w.addr.dist;
+      return {};
+    }
+    return w;
+  }
+
+  /*!
+    The space of random addresses, which excludes the max payload
+   */
+  u64 addr_space() const { return space - payload.max; }
+
+  bool is_read(::test::FastRandom &rand) const {
+    if (read_ratio >= 1.0)
+      return true;
+    if (read_ratio <= 0.0)
+      return false;
+    return (rand.next() % 10000) < static_cast<u64>(read_ratio * 10000);
+  }
+};
+
+/*!
+  Expand a spec document into the specs of the runs: a document may be an
+  array of specs, and each spec's "sweep" is expanded to the cartesian
+  product of its values (the first path varies slowest).
+ */
+inline Option<std::vector<Spec>> expand_sweep(const Spec &doc) {
+  std::vector<Spec> res;
+  if (doc.is_array()) {
+    for (auto &s : doc.arr) {
+      auto sub = expand_sweep(s);
+      if (!sub)
+        return {};
+      res.insert(res.end(), sub.value().begin(), sub.value().end());
+    }
+    return res;
+  }
+  if (!doc.is_object())
+    return {};
+
+  Spec base = doc;
+  base.erase("sweep");
+  res.push_back(base);
+
+  auto sweep = doc.find("sweep");
+  if (sweep == nullptr)
+    return res;
+  if (!sweep->is_object())
+    return {};
+  for (auto &kv : sweep->obj) {
+    std::vector<Spec> values = kv.second.arr;
+    if (!kv.second.is_array())
+      values.push_back(kv.second);
+
+    std::vector<Spec> next;
+    for (auto &s : res) {
+      for (auto &v : values) {
+        Spec cur = s;
+        cur.set_path(kv.first, v);
+        next.push_back(cur);
+      }
+    }
+    res.swap(next);
+  }
+  return res;
+}
+
+} // namespace nvm
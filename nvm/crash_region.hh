@@ -0,0 +1,449 @@
+#pragma once
+
+#include <cstring>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "rlib/tests/random.hh"
+
+#include "./memory_region.hh"
+#include "./persist.hh"
+
+namespace nvm {
+
+namespace crash {
+
+using namespace rdmaio;
+
+/*!
+  Where the persistence domain ends on the emulated platform.
+  - eadr: the CPU caches are in the persistence domain, so a store is
+    durable once it is executed;
+  - ddio: incoming RDMA writes are placed in the LLC (Intel DDIO), so they
+    are not durable until the CPU flushes them.
+ */
+struct Platform {
+  bool eadr = false;
+  bool ddio = true;
+};
+
+enum OpType : u8 {
+  kStore = 0, // a normal (cached) store
+  kNTStore,   // a non-temporal store
+  kCLWB,      // also dc cvap on arm
+  kCLFLUSHOPT,
+  kCLFLUSH,
+  kFence,     // sfence (or dsb)
+  kDMAWrite,  // an incoming RDMA write
+  kDMARead,   // an incoming RDMA read, which flushes the earlier DMA writes
+  kMark,      // a user-defined point, e.g., a request is acknowledged
+};
+
+struct TraceOp {
+  OpType type;
+  u64 off; // offset in the region
+  u64 len;
+  u64 data_off; // the offset of the stored data in the trace's data buffer
+  u64 tag;      // for kMark
+};
+
+/*!
+  CrashRegion is a DRAM region which records every store, flush and fence
+  applied to it through its instrumented primitives, so that the possible
+  persisted states at any point of the execution can be replayed.
+  The writers are traced unmodified: the persist kernels record through
+  crash::Recorder (see below), and the RDMA accesses of a loopback transport
+  through dma_hook().
+
+  replay(k) returns one persisted image after a crash right before the k-th
+  op: each cache line holds the effect of some prefix of the stores to it
+  (a line is written back atomically, at any time), which must include all
+  the stores guaranteed to be durable before the crash, e.g., those written
+  back and then fenced. The prefix is randomly chosen, biased to the
+  shortest one (the worst case).
+
+  Example:
+  `
+  CrashRegion r(4096);
+  {
+    crash::Recording rec(r);
+    persist::copy(r.addr, buf, 128); // as a writer does
+  }
+  r.mark(0); // the write is acknowledged
+
+  std::vector<char> image;
+  r.replay(r.trace_len(), rand, image);
+  // check that image[0, 128) == buf[0, 128)
+  `
+ */
+class CrashRegion : public MemoryRegion {
+public:
+  static const u64 kLine = 64;
+
+  explicit CrashRegion(const u64 &sz, const Platform &platform = Platform())
+      : MemoryRegion(sz, nullptr), platform(platform), mem(sz, 0) {
+    this->addr = mem.data();
+  }
+
+  static Option<Arc<CrashRegion>> create(const u64 &sz,
+                                         const Platform &p = Platform()) {
+    if (sz == 0)
+      return {};
+    return std::make_shared<CrashRegion>(sz, p);
+  }
+
+  const Platform &get_platform() const { return platform; }
+
+  // instrumented primitives, which also update the (volatile) memory
+
+  void store(const u64 &off, const void *src, const u64 &len) {
+    record_data(kStore, off, src, len);
+  }
+
+  void nt_store(const u64 &off, const void *src, const u64 &len) {
+    record_data(kNTStore, off, src, len);
+  }
+
+  void clwb(const u64 &off, const u64 &len) { record(kCLWB, off, len); }
+
+  void clflushopt(const u64 &off, const u64 &len) {
+    record(kCLFLUSHOPT, off, len);
+  }
+
+  void clflush(const u64 &off, const u64 &len) { record(kCLFLUSH, off, len); }
+
+  void fence() { record(kFence, 0, 0); }
+
+  void dma_write(const u64 &off, const void *src, const u64 &len) {
+    record_data(kDMAWrite, off, src, len);
+  }
+
+  void dma_read(const u64 &off, void *dst, const u64 &len) {
+    RDMA_ASSERT(off + len <= sz);
+    memcpy(dst, mem.data() + off, len);
+    record(kDMARead, off, len);
+  }
+
+  /*!
+    The LoopbackMem access hook (see rlib/core/qps/loopback.hh) of the
+    region registered as an MR, which records the executed RDMA accesses
+   */
+  std::function<void(const u64 &, const u64 &, bool)> dma_hook() {
+    return [this](const u64 &addr, const u64 &len, bool is_write) {
+      const u64 off = addr - reinterpret_cast<u64>(this->addr);
+      if (is_write)
+        record_data(kDMAWrite, off, mem.data() + off, len);
+      else
+        record(kDMARead, off, len);
+    };
+  }
+
+  /*!
+    The access hook of another MR on the same RNIC, e.g., the DRAM MR read
+    by the one-sided client's sync: a read of it also flushes the earlier
+    RDMA writes to this region
+   */
+  std::function<void(const u64 &, const u64 &, bool)> flush_hook() {
+    return [this](const u64 &addr, const u64 &len, bool is_write) {
+      if (!is_write)
+        record(kDMARead, 0, 0);
+    };
+  }
+
+  void mark(const u64 &tag) {
+    ops.push_back({.type = kMark, .off = 0, .len = 0, .data_off = 0,
+                   .tag = tag});
+  }
+
+  usize trace_len() const { return ops.size(); }
+
+  const TraceOp &op_at(const usize &i) const { return ops[i]; }
+
+  /*!
+    The tags marked before the k-th op
+   */
+  std::vector<u64> marks_before(const usize &k) const {
+    std::vector<u64> res;
+    for (usize i = 0; i < k && i < ops.size(); ++i) {
+      if (ops[i].type == kMark)
+        res.push_back(ops[i].tag);
+    }
+    return res;
+  }
+
+  /*!
+    Fill image with a persisted state after a crash before the k-th op
+   */
+  void replay(const usize &k, ::test::FastRandom &rand,
+              std::vector<char> &image) const {
+    // the stores to each line, and how many of them must be durable
+    struct Line {
+      std::vector<usize> stores; // index of the ops
+      usize durable = 0;
+      usize written_back = 0; // by clwb/clflushopt, durable after a fence
+      usize nt = 0;           // by NT stores, durable after a fence
+    };
+    std::unordered_map<u64, Line> lines;
+    std::unordered_set<u64> to_fence;
+    // (line, #stores) of the DMA writes not yet flushed by a DMA read
+    std::vector<std::pair<u64, usize>> pending_dma;
+
+    for (usize i = 0; i < k && i < ops.size(); ++i) {
+      const auto &op = ops[i];
+      switch (op.type) {
+      case kStore:
+      case kNTStore:
+      case kDMAWrite:
+        for_lines(op.off, op.len, [&](const u64 &l) {
+          auto &line = lines[l];
+          line.stores.push_back(i);
+          const usize n = line.stores.size();
+          if (op.type == kNTStore) {
+            line.nt = n;
+            to_fence.insert(l);
+          } else if (op.type == kDMAWrite) {
+            pending_dma.push_back(std::make_pair(l, n));
+          } else if (platform.eadr) {
+            line.durable = n;
+          }
+        });
+        break;
+      case kCLWB:
+      case kCLFLUSHOPT:
+        for_lines(op.off, op.len, [&](const u64 &l) {
+          auto it = lines.find(l);
+          if (it != lines.end()) {
+            it->second.written_back = it->second.stores.size();
+            to_fence.insert(l);
+          }
+        });
+        break;
+      case kCLFLUSH:
+        // clflush is ordered with the stores, and needs no fence
+        for_lines(op.off, op.len, [&](const u64 &l) {
+          auto it = lines.find(l);
+          if (it != lines.end())
+            it->second.durable = it->second.stores.size();
+        });
+        break;
+      case kFence:
+        for (auto l : to_fence) {
+          auto &line = lines[l];
+          line.durable =
+              std::max(line.durable, std::max(line.written_back, line.nt));
+        }
+        to_fence.clear();
+        break;
+      case kDMARead:
+        // the read flushes the earlier writes out of the NIC and PCIe, to the
+        // memory (durable) or to the LLC (durable only if eADR)
+        if (!platform.ddio || platform.eadr) {
+          for (auto &p : pending_dma) {
+            auto &line = lines[p.first];
+            line.durable = std::max(line.durable, p.second);
+          }
+        }
+        pending_dma.clear();
+        break;
+      default:
+        break;
+      }
+    }
+
+    image.assign(sz, 0);
+    for (auto &kv : lines) {
+      const auto &line = kv.second;
+      const usize n = line.stores.size();
+      usize prefix = line.durable;
+      if (n > prefix && rand.next() % 2 == 0)
+        prefix += rand.next() % (n - prefix + 1);
+      const u64 lstart = kv.first * kLine;
+      const u64 lend = std::min(lstart + kLine, sz);
+      for (usize s = 0; s < prefix; ++s) {
+        const auto &op = ops[line.stores[s]];
+        const u64 start = std::max(op.off, lstart);
+        const u64 end = std::min(op.off + op.len, lend);
+        memcpy(image.data() + start, data.data() + op.data_off + (start - op.off),
+               end - start);
+      }
+    }
+  }
+
+private:
+  const Platform platform;
+  std::vector<char> mem;
+  std::vector<TraceOp> ops;
+  std::vector<char> data;
+
+  void record(const OpType &type, const u64 &off, const u64 &len) {
+    RDMA_ASSERT(off + len <= sz) << "access out of the region: " << off;
+    ops.push_back({.type = type, .off = off, .len = len, .data_off = 0,
+                   .tag = 0});
+  }
+
+  void record_data(const OpType &type, const u64 &off, const void *src,
+                   const u64 &len) {
+    record(type, off, len);
+    ops.back().data_off = data.size();
+    data.insert(data.end(), (const char *)src, (const char *)src + len);
+    // src is in the region for the recorded DMA writes
+    memmove(mem.data() + off, src, len);
+  }
+
+  template <typename F>
+  static void for_lines(const u64 &off, const u64 &len, F &&f) {
+    if (len == 0)
+      return;
+    for (u64 l = off / kLine; l <= (off + len - 1) / kLine; ++l)
+      f(l);
+  }
+};
+
+/*!
+  The memory operations of the persist kernels (see persist::CPUOps) on the
+  recording region: each is recorded to the region, which also executes it
+  on its (volatile) memory. So the traced stores, flushes and fences are
+  exactly those of the kernels the writers call.
+  \note: the kernels must write to the recording region
+ */
+struct Recorder {
+  static CrashRegion *&current() {
+    static CrashRegion *r = nullptr;
+    return r;
+  }
+
+  static void store(void *dst, const void *src, const usize &sz) {
+    region().store(off_of(dst, sz), src, sz);
+  }
+
+  template <persist::nt_body_t Body>
+  static void nt_store(char *dst, const char *src, const usize &sz) {
+    region().nt_store(off_of(dst, sz), src, sz);
+  }
+
+  template <void (*F)(const void *)>
+  static void flush(const void *p, const usize &sz) {
+    if (F == persist::clwb)
+      region().clwb(off_of(p, sz), sz);
+    else if (F == persist::clflushopt)
+      region().clflushopt(off_of(p, sz), sz);
+    else
+      region().clflush(off_of(p, sz), sz);
+  }
+
+  static void writeback(const void *p, const usize &sz) {
+    switch (persist::writeback_kernel()) {
+    case persist::kCLWB:
+      flush<persist::clwb>(p, sz);
+      break;
+    case persist::kCLFLUSHOPT:
+      flush<persist::clflushopt>(p, sz);
+      break;
+    default:
+      flush<persist::clflush>(p, sz);
+    }
+  }
+
+  static void fence() { region().fence(); }
+
+  static void store_barrier() { region().fence(); }
+
+private:
+  static CrashRegion &region() {
+    RDMA_ASSERT(current() != nullptr) << "no region is recording";
+    return *current();
+  }
+
+  static u64 off_of(const void *p, const usize &sz) {
+    const u64 off = reinterpret_cast<u64>(p) -
+                    reinterpret_cast<u64>(region().addr);
+    RDMA_ASSERT(off + sz <= region().sz)
+        << "the kernel writes out of the recording region";
+    return off;
+  }
+};
+
+/*!
+  Record the persist::copy (and persist::copy_with) calls to the region
+  during the lifetime of Recording, by building the kernels of the global
+  dispatcher from crash::Recorder.
+ */
+class Recording {
+  CrashRegion *prev;
+
+public:
+  explicit Recording(CrashRegion &r) : prev(Recorder::current()) {
+    Recorder::current() = &r;
+    persist::Dispatcher::global().use_ops<Recorder>();
+  }
+
+  ~Recording() {
+    Recorder::current() = prev;
+    if (prev == nullptr)
+      persist::Dispatcher::global().use_ops<persist::CPUOps>();
+  }
+};
+
+/*!
+  Record persist::copy_with(k) to [off, off + len) of the region.
+  Return false if k is unsupported on this CPU.
+ */
+inline bool copy(CrashRegion &r, const persist::Kernel &k, const u64 &off,
+                 const void *src, const u64 &len) {
+  if (!persist::Features::get().support(k))
+    return false;
+  Recording rec(r);
+  persist::copy_with(k, reinterpret_cast<char *>(r.addr) + off, src, len);
+  return true;
+}
+
+/*!
+  The result of a torture run
+ */
+struct Report {
+  usize crashes = 0;
+  usize violations = 0;
+  usize first_crash = 0; // the crash point of the first violation
+  std::string first_reason;
+
+  bool durable() const { return violations == 0; }
+};
+
+/*!
+  The checker of a replayed image: it returns an empty string if the image is
+  consistent w.r.t. the acknowledged tags, or the reason otherwise.
+ */
+using checker_t = std::function<std::string(
+    const std::vector<char> &image, const std::vector<u64> &acked)>;
+
+/*!
+  Replay num_crashes random crash points (always including the end of the
+  trace) of the region, and check each persisted image.
+ */
+inline Report torture(const CrashRegion &r, const checker_t &check,
+                      const usize &num_crashes, ::test::FastRandom &rand) {
+  Report res;
+  std::vector<char> image;
+  for (usize i = 0; i < num_crashes; ++i) {
+    const usize k =
+        i == 0 ? r.trace_len() : rand.next() % (r.trace_len() + 1);
+    r.replay(k, rand, image);
+    auto reason = check(image, r.marks_before(k));
+    res.crashes += 1;
+    if (!reason.empty()) {
+      if (res.violations == 0) {
+        res.first_crash = k;
+        res.first_reason = reason;
+      }
+      res.violations += 1;
+    }
+  }
+  return res;
+}
+
+} // namespace crash
+
+} // namespace nvm
@@ -0,0 +1,288 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <sstream>
+#include <string>
+
+// use some utilities (i.e., Option) defined in RLib
+#include "rlib/core/common.hh"
+
+namespace nvm {
+
+using namespace rdmaio;
+
+/*!
+  The parameters of an emulated NVM media.
+  The defaults roughly follow a socket of 6 interleaved Optane DIMMs
+  (Yang et al., FAST'20): reads are ~220ns slower than DRAM, each 256B media
+  line written back costs ~100ns, the bandwidth is ~39GB/s (read) and
+  ~13GB/s (write), and each DIMM has a 16KB write-combining buffer.
+ */
+struct EmuConfig {
+  u64 line = 256;       // the media access granularity (XPLine)
+  u64 read_ns = 220;    // the latency injected per media line read
+  u64 write_ns = 100;   // the latency injected per media line written
+  u64 read_bw = 39000;  // MB/s, 0 for unlimited
+  u64 write_bw = 13000; // MB/s, 0 for unlimited
+  // the #lines of the write-combining buffer (per thread), 0 to disable;
+  // writes to a buffered line cost no media write
+  usize wc_lines = 64;
+  // the backing file of the region, empty to use (huge) anonymous pages
+  std::string file = "";
+
+  /*!
+    Parse a spec like "read_ns=300,write_bw=2300,file=/tmp/nvm".
+    "default" (or an empty spec) keeps all the defaults.
+   */
+  static Option<EmuConfig> parse(const std::string &spec) {
+    EmuConfig res;
+    std::istringstream iss(spec);
+    std::string item;
+    while (std::getline(iss, item, ',')) {
+      if (item.empty() || item == "default")
+        continue;
+      auto pos = item.find('=');
+      if (pos == std::string::npos)
+        return {};
+      auto key = item.substr(0, pos);
+      auto val = item.substr(pos + 1);
+      if (key == "file") {
+        res.file = val;
+        continue;
+      }
+      char *end = nullptr;
+      u64 v = std::strtoull(val.c_str(), &end, 10);
+      if (val.empty() || *end != '\0')
+        return {};
+      if (key == "line")
+        res.line = v;
+      else if (key == "read_ns")
+        res.read_ns = v;
+      else if (key == "write_ns")
+        res.write_ns = v;
+      else if (key == "read_bw")
+        res.read_bw = v;
+      else if (key == "write_bw")
+        res.write_bw = v;
+      else if (key == "wc_lines")
+        res.wc_lines = v;
+      else
+        return {};
+    }
+    if (res.line == 0 || (res.line & (res.line - 1)) != 0 ||
+        res.wc_lines > kMaxWCLines)
+      return {};
+    return res;
+  }
+
+  std::string to_str() const {
+    std::ostringstream oss;
+    oss << "line: " << line << "B, read: " << read_ns << "ns, write: "
+        << write_ns << "ns, read bw: " << read_bw << "MB/s, write bw: "
+        << write_bw << "MB/s, wc lines: " << wc_lines
+        << ", backing: " << (file.empty() ? "anonymous" : file);
+    return oss.str();
+  }
+
+  static const usize kMaxWCLines = 256;
+};
+
+/*!
+  EmuMedia emulates the timing of an NVM media on a DRAM range
+  [base, base + sz). Since plain loads and stores cannot be intercepted,
+  the accessors report their accesses via on_read()/on_write() (e.g.,
+  persist::copy, or the loopback transport), which spin for the injected
+  latency, and for the time to transfer the lines under the bandwidth cap.
+
+  The bandwidth is shared by all threads, while the write-combining buffer
+  is per-thread, which approximates the per-DIMM XPBuffer when threads
+  write to disjoint areas.
+  Note that RDMA requests served by an RNIC are not observed.
+ */
+class EmuMedia {
+public:
+  EmuMedia(const u64 &base, const u64 &sz, const EmuConfig &config)
+      : config(config), base(base), sz(sz), id(next_id().fetch_add(1)),
+        read_cost(config.read_bw == 0 ? 0 : config.line * 1000.0 /
+                                                config.read_bw),
+        write_cost(config.write_bw == 0 ? 0 : config.line * 1000.0 /
+                                                  config.write_bw) {}
+
+  inline bool covers(const u64 &addr, const u64 &len) const {
+    return addr >= base && addr + len <= base + sz;
+  }
+
+  void read(const u64 &addr, const u64 &len) {
+    if (len == 0)
+      return;
+    const u64 lines = line_of(addr + len - 1) - line_of(addr) + 1;
+    read_lines.fetch_add(lines, std::memory_order_relaxed);
+    delay(lines * config.read_ns, read_free, lines * read_cost);
+  }
+
+  void write(const u64 &addr, const u64 &len) {
+    if (len == 0)
+      return;
+    u64 misses = 0;
+    const u64 last = line_of(addr + len - 1);
+    for (u64 l = line_of(addr); l <= last; ++l)
+      misses += wc_insert(l) ? 0 : 1;
+    written_lines.fetch_add(last - line_of(addr) + 1,
+                            std::memory_order_relaxed);
+    media_writes.fetch_add(misses, std::memory_order_relaxed);
+    if (misses > 0)
+      delay(misses * config.write_ns, write_free, misses * write_cost);
+  }
+
+  const EmuConfig &get_config() const { return config; }
+
+  std::string stats_str() const {
+    std::ostringstream oss;
+    oss << "lines read: " << read_lines.load() << ", lines written: "
+        << written_lines.load() << ", media writes: " << media_writes.load();
+    return oss.str();
+  }
+
+  /*!
+    The media whose accesses are emulated, nullptr if none.
+    Only one region can be emulated at a time.
+   */
+  static EmuMedia *installed() {
+    return slot().load(std::memory_order_acquire);
+  }
+
+  static bool install(EmuMedia *m) {
+    EmuMedia *expected = nullptr;
+    return slot().compare_exchange_strong(expected, m);
+  }
+
+  static void uninstall(EmuMedia *m) {
+    EmuMedia *expected = m;
+    slot().compare_exchange_strong(expected, nullptr);
+  }
+
+private:
+  const EmuConfig config;
+  const u64 base;
+  const u64 sz;
+  const u64 id;
+
+  // ns per line to transfer under the bandwidth cap
+  const double read_cost;
+  const double write_cost;
+
+  // the time (ns) when the media bandwidth is available again
+  std::atomic<u64> read_free{0};
+  std::atomic<u64> write_free{0};
+
+  std::atomic<u64> read_lines{0};
+  std::atomic<u64> written_lines{0};
+  std::atomic<u64> media_writes{0};
+
+  struct WCBuffer {
+    u64 owner = 0;
+    u64 lines[EmuConfig::kMaxWCLines];
+    usize num = 0;
+    usize next = 0;
+  };
+
+  inline u64 line_of(const u64 &addr) const {
+    return (addr - base) / config.line;
+  }
+
+  /*!
+    Return true if the line hits in the write-combining buffer;
+    otherwise it is inserted, evicting the oldest one.
+   */
+  bool wc_insert(const u64 &line) {
+    if (config.wc_lines == 0)
+      return false;
+    static thread_local WCBuffer buf;
+    if (buf.owner != id) {
+      buf.owner = id;
+      buf.num = 0;
+      buf.next = 0;
+    }
+    for (usize i = 0; i < buf.num; ++i) {
+      if (buf.lines[i] == line)
+        return true;
+    }
+    buf.lines[buf.next] = line;
+    buf.next = (buf.next + 1) % config.wc_lines;
+    if (buf.num < config.wc_lines)
+      buf.num += 1;
+    return false;
+  }
+
+  static inline u64 now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+  }
+
+  /*!
+    Spin until both the latency has passed, and the transfer has been
+    scheduled on the (shared) media bandwidth.
+   */
+  void delay(const u64 &lat, std::atomic<u64> &free_at, const double &cost) {
+    const u64 now = now_ns();
+    u64 done = now + lat;
+    if (cost > 0) {
+      u64 prev = free_at.load(std::memory_order_relaxed);
+      u64 start;
+      do {
+        start = prev > now ? prev : now;
+      } while (!free_at.compare_exchange_weak(prev, start + (u64)cost,
+                                              std::memory_order_relaxed));
+      done = std::max(done, start + (u64)cost);
+    }
+    while (now_ns() < done)
+      asm volatile("" : : : "memory");
+  }
+
+  static std::atomic<EmuMedia *> &slot() {
+    static std::atomic<EmuMedia *> m(nullptr);
+    return m;
+  }
+
+  static std::atomic<u64> &next_id() {
+    static std::atomic<u64> id(1);
+    return id;
+  }
+
+  DISABLE_COPY_AND_ASSIGN(EmuMedia);
+};
+
+namespace emu {
+
+/*!
+  Report an access to NVM; a no-op unless it falls in the emulated region.
+ */
+inline void on_read(const void *p, const u64 &len) {
+  auto m = EmuMedia::installed();
+  if (unlikely(m != nullptr) && m->covers((u64)p, len))
+    m->read((u64)p, len);
+}
+
+inline void on_write(const void *p, const u64 &len) {
+  auto m = EmuMedia::installed();
+  if (unlikely(m != nullptr) && m->covers((u64)p, len))
+    m->write((u64)p, len);
+}
+
+/*!
+  In the form of a LoopbackMem access hook
+ */
+inline void on_access(const u64 &addr, const u64 &len, bool is_write) {
+  if (is_write)
+    on_write((const void *)addr, len);
+  else
+    on_read((const void *)addr, len);
+}
+
+} // namespace emu
+
+} // namespace nvm
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <memory>
+
+#include "./emu_media.hh"
+#include "./memory_region.hh"
+
+namespace nvm {
+
+/*!
+  An emulated NVM region, for machines without NVM DIMMs.
+  The memory is backed by huge pages (or normal pages if no huge page is
+  reserved), or by a file if config.file is given, e.g., on a tmpfs or on a
+  fsdax mount.
+  The timing of the media is emulated by an EmuMedia (see emu_media.hh),
+  which is installed on creation so that persist::copy, and the benchmarks'
+  NVM accessors inject its latency.
+
+  Example:
+  `
+  auto region = EmuRegion::create(sz, "read_ns=300,wc_lines=0").value();
+  persist::copy(region->addr, buf, 256); // takes >= 100ns more
+  `
+ */
+class EmuRegion : public MemoryRegion {
+  int fd = -1;
+  u64 map_sz = 0;
+  std::unique_ptr<EmuMedia> media;
+
+  static u64 align_to_sz(const u64 &x, const u64 &align_sz) {
+    return (x + align_sz - 1) / align_sz * align_sz;
+  }
+
+public:
+  EmuRegion(const u64 &sz, const EmuConfig &config) {
+    this->sz = sz;
+    if (config.file.empty()) {
+      map_sz = align_to_sz(sz, 2 << 20);
+      void *ptr = mmap(nullptr, map_sz, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE | MAP_HUGETLB,
+                       -1, 0);
+      if (ptr == MAP_FAILED) {
+        RDMA_LOG(4) << "emulated NVM falls back to normal pages: "
+                    << strerror(errno);
+        ptr = mmap(nullptr, map_sz, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+      }
+      this->addr = ptr == MAP_FAILED ? nullptr : ptr;
+    } else {
+      map_sz = sz;
+      fd = open(config.file.c_str(), O_RDWR | O_CREAT, 0666);
+      if (fd >= 0 && ftruncate(fd, sz) == 0) {
+        void *ptr = mmap(nullptr, map_sz, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, fd, 0);
+        this->addr = ptr == MAP_FAILED ? nullptr : ptr;
+      }
+    }
+
+    if (this->addr == nullptr) {
+      RDMA_LOG(4) << "failed to map the emulated NVM with sz: " << sz
+                  << "; with error: " << strerror(errno);
+      return;
+    }
+    media = std::unique_ptr<EmuMedia>(
+        new EmuMedia(reinterpret_cast<u64>(this->addr), sz, config));
+    if (!EmuMedia::install(media.get()))
+      RDMA_LOG(4) << "another emulated NVM is installed, so this one does "
+                     "not inject latency";
+  }
+
+  static Option<Arc<EmuRegion>> create(const u64 &sz,
+                                       const EmuConfig &config = EmuConfig()) {
+    auto region = std::make_shared<EmuRegion>(sz, config);
+    if (region->valid())
+      return region;
+    return {};
+  }
+
+  /*!
+    Create by a spec parsed by EmuConfig::parse()
+   */
+  static Option<Arc<EmuRegion>> create(const u64 &sz, const std::string &spec) {
+    auto config = EmuConfig::parse(spec);
+    if (!config) {
+      RDMA_LOG(4) << "invalid NVM emulation spec: " << spec;
+      return {};
+    }
+    RDMA_LOG(4) << "emulate NVM (" << config.value().to_str() << ")";
+    return create(sz, config.value());
+  }
+
+  EmuMedia &model() { return *media; }
+
+  ~EmuRegion() {
+    if (media != nullptr) {
+      RDMA_LOG(4) << "emulated NVM " << media->stats_str();
+      EmuMedia::uninstall(media.get());
+    }
+    if (this->addr != nullptr)
+      munmap(this->addr, map_sz);
+    if (fd >= 0)
+      close(fd);
+  }
+
+  DISABLE_COPY_AND_ASSIGN(EmuRegion);
+};
+
+} // namespace nvm
@@ -0,0 +1,507 @@
+#pragma once
+
+#include <chrono>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <vector>
+
+#include "./memory_region.hh"
+#include "./persist.hh"
+
+namespace nvm {
+
+namespace kv {
+
+using namespace rdmaio;
+
+struct KVConfig {
+  // #shards, each has its own index, log and lock
+  u64 shards = 16;
+  // #index slots (in total), which bounds the #keys
+  u64 slots = 1 << 20;
+  // #appends of a shard between two checkpoints, which bounds the log
+  // replayed on recovery
+  u64 checkpoint = 1024;
+
+  /*!
+    Parse a spec like "shards=16,slots=1m,checkpoint=1024", where a number
+    can have a k/m suffix.
+    "default" (or an empty spec) keeps all the defaults.
+   */
+  static Option<KVConfig> parse(const std::string &spec) {
+    KVConfig res;
+    std::istringstream iss(spec);
+    std::string item;
+    while (std::getline(iss, item, ',')) {
+      if (item.empty() || item == "default")
+        continue;
+      auto pos = item.find('=');
+      if (pos == std::string::npos)
+        return {};
+      auto key = item.substr(0, pos);
+      auto val = parse_num(item.substr(pos + 1));
+      if (!val || val.value() == 0)
+        return {};
+      if (key == "shards")
+        res.shards = val.value();
+      else if (key == "slots")
+        res.slots = val.value();
+      else if (key == "checkpoint")
+        res.checkpoint = val.value();
+      else
+        return {};
+    }
+    if (res.slots < res.shards)
+      return {};
+    return res;
+  }
+
+  std::string to_str() const {
+    std::ostringstream oss;
+    oss << "shards: " << shards << ", slots: " << slots
+        << ", checkpoint: " << checkpoint;
+    return oss.str();
+  }
+
+private:
+  static Option<u64> parse_num(const std::string &s) {
+    char *end = nullptr;
+    u64 v = std::strtoull(s.c_str(), &end, 10);
+    if (s.empty() || end == s.c_str())
+      return {};
+    if (*end == 'k')
+      v <<= 10, end += 1;
+    else if (*end == 'm')
+      v <<= 20, end += 1;
+    if (*end != '\0')
+      return {};
+    return v;
+  }
+};
+
+enum RecordType : u8 { kPut = 1, kDel = 2 };
+
+/*!
+  The layout of the NVM region:
+  | SuperBlock (4KB) | ShardMeta * shards (4KB aligned) |
+  | Slot * slots     | the logs of the shards            |
+ */
+struct __attribute__((packed)) SuperBlock {
+  u64 magic;
+  u64 shards;
+  u64 slots_per_shard;
+  u64 log_per_shard;
+  // changed by each format, so the records of an old store are invalid
+  u32 epoch;
+};
+
+// persisted by each checkpoint
+struct alignas(64) ShardMeta {
+  // the log before it is reflected in the index
+  u64 checkpoint;
+  // the seq of the last record before the checkpoint
+  u64 seq;
+};
+
+// a slot of the open-addressing index
+struct Slot {
+  u64 key;
+  // the offset (+1) of the latest record of the key in the log, 0 if empty
+  u64 loc;
+};
+
+struct __attribute__((packed)) RecordHeader {
+  u32 checksum; // of the rest of the record
+  u8 type;
+  u8 pad[3];
+  u32 val_sz;
+  u32 epoch;
+  u64 key;
+  u64 seq; // consecutive in a shard's log
+};
+
+struct RecoveryStats {
+  // the records after the checkpoints, which are re-applied to the index
+  u64 redone = 0;
+  // the slots whose key is torn by a crash
+  u64 fixed_slots = 0;
+  double msec = 0;
+};
+
+/*!
+  NVMKV is a key-value store on an NVM MemoryRegion, with u64 keys and
+  values of at most kMaxValSz bytes.
+
+  Each key is hashed to a shard. A shard appends each PUT/DELETE as a
+  record to its log (log-structured, the space is not reclaimed), and points
+  the key's slot of its persistent index to the record:
+  1. the record is persisted (persist::copy), with a checksum and a
+     consecutive seq;
+  2. the slot is updated and flushed, after which the op is durable;
+  3. every config.checkpoint appends, the log tail is persisted in the
+     shard's meta.
+  On open, the index is ready except for the appends after the last
+  checkpoint, which are replayed from the log until a torn record.
+  Updates of a shard are serialized by its lock. GET takes no lock, since
+  a published record is never modified.
+
+  Example:
+  `
+  auto store = NVMKV::create(nvm_region, KVConfig::parse("shards=8").value())
+                   .value();
+  store->put(73, buf, 256);
+  char out[NVMKV::kMaxValSz];
+  auto sz = store->get(73, out, sizeof(out)); // Option<u32>
+  `
+ */
+class NVMKV {
+public:
+  static const u64 kMagic = 0x313030564b4d564eUL; // "NVMKV001"
+  static const u32 kMaxValSz = 4096;
+
+private:
+  static const u64 kAlign = 4096;
+
+  struct Shard {
+    ShardMeta *meta = nullptr;
+    Slot *slots = nullptr;
+    char *log = nullptr;
+    u64 tail = 0;
+    u64 seq = 0;
+    u64 since_checkpoint = 0;
+    std::mutex lock;
+  };
+
+  Arc<MemoryRegion> region;
+  SuperBlock *sb = nullptr;
+  std::vector<std::unique_ptr<Shard>> shards;
+  u64 checkpoint_every = 1024;
+
+public:
+  const RecoveryStats recovery;
+
+  /*!
+    Open the existing store on the region, or format a new one if format is
+    true. The geometry of an existing store is kept.
+    \ret None if the region has no (valid) store and format is false, so
+    that a damaged store is never silently formatted
+   */
+  static Option<Arc<NVMKV>> create(const Arc<MemoryRegion> &region,
+                                   const KVConfig &config = KVConfig(),
+                                   const bool &format = false) {
+    if (region == nullptr || !region->valid())
+      return {};
+    auto sb = reinterpret_cast<SuperBlock *>(region->addr);
+    if (format) {
+      if (!NVMKV::format(region, config))
+        return {};
+    } else if (sb->magic != kMagic) {
+      RDMA_LOG(4) << "no kv store found in the region, format it first";
+      return {};
+    } else if (sb->shards == 0 || sb->slots_per_shard == 0 ||
+               logs_off(sb->shards, sb->slots_per_shard) +
+                       sb->shards * sb->log_per_shard >
+                   region->sz) {
+      RDMA_LOG(4) << "the kv store does not fit the region of sz: "
+                  << region->sz;
+      return {};
+    }
+    return std::shared_ptr<NVMKV>(new NVMKV(region, config));
+  }
+
+  u64 num_shards() const { return shards.size(); }
+
+  /*!
+    Durably insert or update key
+    \ret false if the value is too large, or the shard is full
+   */
+  bool put(const u64 &key, const char *val, const u32 &sz) {
+    if (sz > kMaxValSz)
+      return false;
+    return append(key, kPut, val, sz);
+  }
+
+  /*!
+    Durably delete key
+    \ret false if the key does not exist, or the shard is full
+   */
+  bool del(const u64 &key) {
+    if (!get(key, nullptr, 0))
+      return false;
+    return append(key, kDel, nullptr, 0);
+  }
+
+  /*!
+    Copy at most max_sz bytes of the key's value to out
+    \ret the size of the value, None if not found
+   */
+  Option<u32> get(const u64 &key, char *out, const u32 &max_sz) const {
+    auto &s = *shards[shard_of(key)];
+    const auto slot = find_slot(s, key);
+    if (slot == nullptr)
+      return {};
+    const u64 loc = __atomic_load_n(&slot->loc, __ATOMIC_ACQUIRE);
+    if (loc == 0)
+      return {};
+    auto rec = s.log + loc - 1;
+    auto header = reinterpret_cast<const RecordHeader *>(rec);
+    emu::on_read(rec, sizeof(RecordHeader));
+    if (header->type != kPut)
+      return {};
+    auto sz = header->val_sz;
+    if (out != nullptr && max_sz > 0) {
+      memcpy(out, rec + sizeof(RecordHeader), std::min(sz, max_sz));
+      emu::on_read(rec + sizeof(RecordHeader), std::min(sz, max_sz));
+    }
+    return sz;
+  }
+
+  /*!
+    The bytes of the logs used
+   */
+  u64 log_used() const {
+    u64 res = 0;
+    for (auto &s : shards)
+      res += s->tail;
+    return res;
+  }
+
+  u64 log_capacity() const { return sb->log_per_shard * shards.size(); }
+
+private:
+  NVMKV(const Arc<MemoryRegion> &region, const KVConfig &config)
+      : region(region), sb(reinterpret_cast<SuperBlock *>(region->addr)),
+        checkpoint_every(config.checkpoint), recovery(open()) {}
+
+  static u64 align_up(const u64 &x, const u64 a) {
+    return (x + a - 1) / a * a;
+  }
+
+  static u64 meta_off() { return kAlign; }
+
+  static u64 slots_off(const u64 &shards) {
+    return meta_off() + align_up(shards * sizeof(ShardMeta), kAlign);
+  }
+
+  static u64 logs_off(const u64 &shards, const u64 &slots_per_shard) {
+    return slots_off(shards) +
+           align_up(shards * slots_per_shard * sizeof(Slot), kAlign);
+  }
+
+  static bool format(const Arc<MemoryRegion> &region, const KVConfig &config) {
+    const u64 per_shard = (config.slots + config.shards - 1) / config.shards;
+    const u64 logs = logs_off(config.shards, per_shard);
+    if (logs >= region->sz) {
+      RDMA_LOG(4) << "region of sz: " << region->sz
+                  << " is too small for the kv: " << config.to_str();
+      return false;
+    }
+    const u64 log_per_shard =
+        (region->sz - logs) / config.shards / kAlign * kAlign;
+    if (log_per_shard == 0)
+      return false;
+
+    char *base = static_cast<char *>(region->addr);
+    auto sb = reinterpret_cast<SuperBlock *>(base);
+    const u32 epoch =
+        (sb->magic == kMagic ? sb->epoch : 0) + 1 +
+        static_cast<u32>(
+            std::chrono::system_clock::now().time_since_epoch().count());
+    // invalidate the old store first
+    sb->magic = 0;
+    persist::flush(sb, sizeof(SuperBlock));
+
+    memset(base + meta_off(), 0, logs - meta_off());
+    persist::flush(base + meta_off(), logs - meta_off());
+
+    sb->shards = config.shards;
+    sb->slots_per_shard = per_shard;
+    sb->log_per_shard = log_per_shard;
+    sb->epoch = epoch;
+    persist::flush(sb, sizeof(SuperBlock));
+    sb->magic = kMagic;
+    persist::flush(sb, sizeof(SuperBlock));
+    return true;
+  }
+
+  static u64 hash(u64 key) {
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdUL;
+    key ^= key >> 33;
+    key *= 0xc4ceb9fe1a85ec53UL;
+    key ^= key >> 33;
+    return key;
+  }
+
+  u64 shard_of(const u64 &key) const { return hash(key) % shards.size(); }
+
+  u64 slot_of(const u64 &key) const {
+    // the high bits, since the low ones select the shard
+    return (hash(key) >> 20) % sb->slots_per_shard;
+  }
+
+  static u32 checksum(const RecordHeader &h, const char *val) {
+    // FNV-1a over the header (after the checksum) and the value
+    u32 res = 2166136261u;
+    auto mix = [&res](const char *p, const usize &sz) {
+      for (usize i = 0; i < sz; ++i) {
+        res ^= static_cast<u8>(p[i]);
+        res *= 16777619u;
+      }
+    };
+    mix(reinterpret_cast<const char *>(&h) + sizeof(u32),
+        sizeof(RecordHeader) - sizeof(u32));
+    mix(val, h.val_sz);
+    return res;
+  }
+
+  /*!
+    The slot of key, or the empty slot to insert it
+    \ret nullptr if not found and the index is full
+   */
+  Slot *find_slot(const Shard &s, const u64 &key) const {
+    const u64 n = sb->slots_per_shard;
+    const u64 start = slot_of(key);
+    for (u64 i = 0; i < n; ++i) {
+      auto slot = s.slots + (start + i) % n;
+      if (__atomic_load_n(&slot->loc, __ATOMIC_ACQUIRE) == 0)
+        return slot->key == key ? slot : nullptr;
+      if (slot->key == key)
+        return slot;
+    }
+    return nullptr;
+  }
+
+  Slot *find_or_insert_slot(Shard &s, const u64 &key) {
+    const u64 n = sb->slots_per_shard;
+    const u64 start = slot_of(key);
+    for (u64 i = 0; i < n; ++i) {
+      auto slot = s.slots + (start + i) % n;
+      if (slot->loc == 0) {
+        slot->key = key;
+        return slot;
+      }
+      if (slot->key == key)
+        return slot;
+    }
+    return nullptr;
+  }
+
+  void publish(Slot *slot, const u64 &loc) {
+    __atomic_store_n(&slot->loc, loc, __ATOMIC_RELEASE);
+    persist::flush(slot, sizeof(Slot));
+  }
+
+  void checkpoint(Shard &s) {
+    s.meta->checkpoint = s.tail;
+    s.meta->seq = s.seq;
+    persist::flush(s.meta, sizeof(ShardMeta));
+    s.since_checkpoint = 0;
+  }
+
+  bool append(const u64 &key, const RecordType &type, const char *val,
+              const u32 &sz) {
+    auto &s = *shards[shard_of(key)];
+    std::lock_guard<std::mutex> guard(s.lock);
+
+    const u64 rec_sz =
+        align_up(sizeof(RecordHeader) + sz, persist::kCacheLine);
+    if (s.tail + rec_sz > sb->log_per_shard)
+      return false;
+    auto slot = find_or_insert_slot(s, key);
+    if (slot == nullptr)
+      return false;
+
+    char buf[sizeof(RecordHeader) + kMaxValSz];
+    auto header = reinterpret_cast<RecordHeader *>(buf);
+    memset(header, 0, sizeof(RecordHeader));
+    header->type = type;
+    header->val_sz = sz;
+    header->epoch = sb->epoch;
+    header->key = key;
+    header->seq = s.seq + 1;
+    if (sz > 0)
+      memcpy(buf + sizeof(RecordHeader), val, sz);
+    header->checksum = checksum(*header, buf + sizeof(RecordHeader));
+
+    // 1. the record
+    persist::copy(s.log + s.tail, buf, sizeof(RecordHeader) + sz);
+    // 2. the index
+    publish(slot, s.tail + 1);
+
+    s.tail += rec_sz;
+    s.seq += 1;
+    // 3. the checkpoint
+    if (++s.since_checkpoint >= checkpoint_every)
+      checkpoint(s);
+    return true;
+  }
+
+  /*!
+    Attach the shards, and recover their index from the checkpoints
+   */
+  RecoveryStats open() {
+    auto start = std::chrono::steady_clock::now();
+    RecoveryStats res;
+    char *base = static_cast<char *>(region->addr);
+    const u64 n = sb->shards;
+    const u64 per_shard = sb->slots_per_shard;
+    for (u64 i = 0; i < n; ++i) {
+      auto s = std::unique_ptr<Shard>(new Shard());
+      s->meta = reinterpret_cast<ShardMeta *>(base + meta_off()) + i;
+      s->slots = reinterpret_cast<Slot *>(base + slots_off(n)) + i * per_shard;
+      s->log = base + logs_off(n, per_shard) + i * sb->log_per_shard;
+      shards.push_back(std::move(s));
+    }
+
+    for (auto &s : shards) {
+      // a crash may tear the key of a slot from its loc
+      for (u64 i = 0; i < per_shard; ++i) {
+        auto &slot = s->slots[i];
+        if (slot.loc == 0)
+          continue;
+        auto header = reinterpret_cast<RecordHeader *>(s->log + slot.loc - 1);
+        if (header->key != slot.key) {
+          slot.key = header->key;
+          persist::flush(&slot, sizeof(Slot));
+          res.fixed_slots += 1;
+        }
+      }
+
+      // replay the log after the checkpoint
+      s->tail = s->meta->checkpoint;
+      s->seq = s->meta->seq;
+      while (s->tail + sizeof(RecordHeader) <= sb->log_per_shard) {
+        auto rec = s->log + s->tail;
+        auto header = reinterpret_cast<RecordHeader *>(rec);
+        if (header->seq != s->seq + 1 || header->epoch != sb->epoch ||
+            (header->type != kPut && header->type != kDel) ||
+            header->val_sz > kMaxValSz ||
+            s->tail + sizeof(RecordHeader) + header->val_sz >
+                sb->log_per_shard ||
+            header->checksum != checksum(*header, rec + sizeof(RecordHeader)))
+          break;
+        auto slot = find_or_insert_slot(*s, header->key);
+        RDMA_ASSERT(slot != nullptr) << "index full on recovery";
+        if (slot->loc < s->tail + 1)
+          publish(slot, s->tail + 1);
+        s->tail +=
+            align_up(sizeof(RecordHeader) + header->val_sz, persist::kCacheLine);
+        s->seq += 1;
+        res.redone += 1;
+      }
+      checkpoint(*s);
+    }
+    res.msec = std::chrono::duration_cast<std::chrono::microseconds>(
+                   std::chrono::steady_clock::now() - start)
+                   .count() /
+               1000.0;
+    return res;
+  }
+};
+
+} // namespace kv
+
+} // namespace nvm
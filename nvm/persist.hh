@@ -0,0 +1,585 @@
+#pragma once
+
+#include <chrono>
+#include <cstring>
+#include <sstream>
+#include <string>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#include <sys/auxv.h>
+#endif
+
+// use some utilities (i.e., Option) defined in RLib
+#include "rlib/core/common.hh"
+
+#include "./emu_media.hh"
+
+namespace nvm {
+
+/*!
+  Persistent copies to NVM.
+  A persistent copy returns after the written data has reached the
+  persistence domain (the ADR domain of Optane), i.e., the write is durable.
+
+  Several kernels are provided, and the fastest one supported by the CPU is
+  picked at runtime (via CPUID on x86, HWCAP on aarch64) for each payload
+  size, so the binaries need no ISA-specific compile flags (e.g., -mavx512f):
+  - NT:         non-temporal stores (AVX-512 / AVX2 / SSE2 / NEON), then a fence;
+  - CLWB:       a normal copy, write back each line by clwb (dc cvap on arm);
+  - CLFLUSHOPT: a normal copy, flush each line by clflushopt (dc civac on arm);
+  - CLFLUSH:    a normal copy, flush each line by clflush (x86 only);
+  - Barrier:    a normal copy followed by a store barrier, for platforms whose
+                caches are in the persistence domain (eADR), or for DRAM.
+  The copies (and flushes) to an emulated NVM (see emu_region.hh) also
+  inject the write latency of the emulated media.
+
+  Example:
+  `
+  persist::init("auto");  // or, e.g., "calibrate" with a scratch NVM area
+  persist::copy(nvm_ptr, buf, sz);
+  `
+ */
+namespace persist {
+
+using namespace rdmaio;
+
+const usize kCacheLine = 64;
+
+enum Kernel : u8 {
+  kNT = 0,
+  kCLWB,
+  kCLFLUSHOPT,
+  kCLFLUSH,
+  kBarrier,
+  kNumKernels
+};
+
+inline const char *kernel_name(const Kernel &k) {
+  static const char *names[] = {"nt", "clwb", "clflushopt", "clflush",
+                                "barrier"};
+  return k < kNumKernels ? names[k] : "unknown";
+}
+
+inline Option<Kernel> kernel_of(const std::string &name) {
+  for (u8 k = 0; k < kNumKernels; ++k) {
+    if (name == kernel_name(static_cast<Kernel>(k)))
+      return static_cast<Kernel>(k);
+  }
+  return {};
+}
+
+/*!
+  The persistence-related features of the CPU
+ */
+struct Features {
+  bool sse2 = false;
+  bool avx2 = false;
+  bool avx512f = false;
+  bool clwb = false;
+  bool clflushopt = false;
+  bool dcpop = false; // aarch64 DC CVAP
+
+  static const Features &get() {
+    static const Features f = detect();
+    return f;
+  }
+
+  bool support(const Kernel &k) const {
+#if defined(__x86_64__) || defined(__i386__)
+    switch (k) {
+    case kNT:
+      return sse2;
+    case kCLWB:
+      return clwb;
+    case kCLFLUSHOPT:
+      return clflushopt;
+    case kCLFLUSH:
+    case kBarrier:
+      return true;
+    default:
+      return false;
+    }
+#elif defined(__aarch64__)
+    return k != kCLFLUSH && k < kNumKernels;
+#else
+    return k == kBarrier;
+#endif
+  }
+
+  std::string to_str() const {
+    std::ostringstream oss;
+    oss << "sse2: " << sse2 << " avx2: " << avx2 << " avx512f: " << avx512f
+        << " clwb: " << clwb << " clflushopt: " << clflushopt
+        << " dcpop: " << dcpop;
+    return oss.str();
+  }
+
+private:
+  static Features detect() {
+    Features f;
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    // the builtins also check whether the OS saves the vector states
+    f.sse2 = __builtin_cpu_supports("sse2");
+    f.avx2 = __builtin_cpu_supports("avx2");
+    f.avx512f = __builtin_cpu_supports("avx512f");
+    unsigned int eax, ebx, ecx, edx;
+    if (__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) {
+      f.clflushopt = (ebx >> 23) & 1;
+      f.clwb = (ebx >> 24) & 1;
+    }
+#elif defined(__aarch64__)
+    f.sse2 = f.avx2 = f.avx512f = false;
+#ifdef HWCAP_DCPOP
+    f.dcpop = getauxval(AT_HWCAP) & HWCAP_DCPOP;
+#endif
+#endif
+    return f;
+  }
+};
+
+/*!
+  Per-line write back/flush and the fences
+ */
+#if defined(__x86_64__) || defined(__i386__)
+
+inline void clwb(const void *p) {
+  asm volatile("clwb %0" : "+m"(*(volatile char *)p));
+}
+
+inline void clflushopt(const void *p) {
+  asm volatile("clflushopt %0" : "+m"(*(volatile char *)p));
+}
+
+inline void clflush(const void *p) {
+  asm volatile("clflush %0" : "+m"(*(volatile char *)p));
+}
+
+// order the write backs (and NT stores) before the later stores
+inline void fence() { asm volatile("sfence" : : : "memory"); }
+
+inline void store_barrier() { asm volatile("sfence" : : : "memory"); }
+
+#elif defined(__aarch64__)
+
+inline void clwb(const void *p) {
+  if (Features::get().dcpop)
+    asm volatile("dc cvap, %0" : : "r"(p) : "memory");
+  else
+    asm volatile("dc cvac, %0" : : "r"(p) : "memory");
+}
+
+inline void clflushopt(const void *p) {
+  asm volatile("dc civac, %0" : : "r"(p) : "memory");
+}
+
+inline void clflush(const void *p) { clflushopt(p); }
+
+inline void fence() { asm volatile("dsb ish" : : : "memory"); }
+
+inline void store_barrier() { asm volatile("dmb ishst" : : : "memory"); }
+
+#else
+
+inline void clwb(const void *p) {}
+inline void clflushopt(const void *p) {}
+inline void clflush(const void *p) {}
+inline void fence() { __atomic_thread_fence(__ATOMIC_SEQ_CST); }
+inline void store_barrier() { __atomic_thread_fence(__ATOMIC_RELEASE); }
+
+#endif
+
+template <void (*F)(const void *)>
+inline void flush_lines(const void *p, const usize &sz) {
+  auto cur = reinterpret_cast<uintptr_t>(p) &
+             ~static_cast<uintptr_t>(kCacheLine - 1);
+  const auto end = reinterpret_cast<uintptr_t>(p) + sz;
+  for (; cur < end; cur += kCacheLine)
+    F(reinterpret_cast<const void *>(cur));
+}
+
+using flush_t = void (*)(const void *, const usize &);
+
+/*!
+  The best supported per-line write back: kCLWB, kCLFLUSHOPT or kCLFLUSH
+ */
+inline Kernel writeback_kernel() {
+  static const Kernel k = []() -> Kernel {
+    auto &feat = Features::get();
+    if (feat.support(kCLWB))
+      return kCLWB;
+    if (feat.support(kCLFLUSHOPT))
+      return kCLFLUSHOPT;
+    return kCLFLUSH;
+  }();
+  return k;
+}
+
+/*!
+  Write back [p, p + sz) with the best supported instruction, without fence
+ */
+inline void writeback(const void *p, const usize &sz) {
+  static const flush_t f = []() -> flush_t {
+    switch (writeback_kernel()) {
+    case kCLWB:
+      return flush_lines<clwb>;
+    case kCLFLUSHOPT:
+      return flush_lines<clflushopt>;
+    default:
+      return flush_lines<clflush>;
+    }
+  }();
+  f(p, sz);
+}
+
+/*!
+  Make [p, p + sz), written by normal stores, durable
+ */
+inline void flush(const void *p, const usize &sz) {
+  writeback(p, sz);
+  fence();
+  emu::on_write(p, sz);
+}
+
+/*!
+  The kernels. Each returns the number of bytes copied, and the copied
+  data is durable on return.
+ */
+using kernel_t = usize (*)(void *, const void *, usize);
+
+using nt_body_t = void (*)(char *, const char *, usize);
+
+/*!
+  The memory operations the kernels are built from, executed by the CPU.
+  The kernels take them as a template argument, so that another
+  implementation can observe them, e.g., crash::Recorder (see
+  crash_region.hh) traces the stores, flushes and fences of the kernels.
+ */
+struct CPUOps {
+  static void store(void *dst, const void *src, const usize &sz) {
+    memcpy(dst, src, sz);
+  }
+
+  // dst is cache-line aligned, sz is a multiple of lines
+  template <nt_body_t Body>
+  static void nt_store(char *dst, const char *src, const usize &sz) {
+    Body(dst, src, sz);
+  }
+
+  template <void (*F)(const void *)>
+  static void flush(const void *p, const usize &sz) {
+    flush_lines<F>(p, sz);
+  }
+
+  static void writeback(const void *p, const usize &sz) {
+    persist::writeback(p, sz);
+  }
+
+  static void fence() { persist::fence(); }
+
+  static void store_barrier() { persist::store_barrier(); }
+};
+
+namespace kernels {
+
+// the NT bodies: dst is cache-line aligned, sz is a multiple of lines
+#if defined(__x86_64__) || defined(__i386__)
+
+__attribute__((target("avx512f"))) inline void
+nt_body_avx512(char *d, const char *s, usize sz) {
+  for (usize i = 0; i < sz; i += 64)
+    _mm512_stream_si512((__m512i *)(d + i),
+                        _mm512_loadu_si512((const void *)(s + i)));
+}
+
+__attribute__((target("avx2"))) inline void nt_body_avx2(char *d, const char *s,
+                                                         usize sz) {
+  for (usize i = 0; i < sz; i += 32)
+    _mm256_stream_si256((__m256i *)(d + i),
+                        _mm256_loadu_si256((const __m256i *)(s + i)));
+}
+
+__attribute__((target("sse2"))) inline void nt_body_sse2(char *d, const char *s,
+                                                         usize sz) {
+  for (usize i = 0; i < sz; i += 16)
+    _mm_stream_si128((__m128i *)(d + i),
+                     _mm_loadu_si128((const __m128i *)(s + i)));
+}
+
+#elif defined(__aarch64__)
+
+// stnp is only a non-temporal hint, so the lines are written back as well
+inline void nt_body_neon(char *d, const char *s, usize sz) {
+  for (usize i = 0; i < sz; i += 32) {
+    uint8x16_t a = vld1q_u8((const uint8_t *)(s + i));
+    uint8x16_t b = vld1q_u8((const uint8_t *)(s + i + 16));
+    asm volatile("stnp %q0, %q1, [%2]" : : "w"(a), "w"(b), "r"(d + i)
+                 : "memory");
+  }
+  flush_lines<clwb>(d, sz);
+}
+
+#endif
+
+template <nt_body_t Body, typename Ops = CPUOps>
+inline usize copy_nt(void *dst, const void *src, usize sz) {
+  char *d = static_cast<char *>(dst);
+  const char *s = static_cast<const char *>(src);
+
+  // the unaligned head and tail are written with normal stores
+  usize head = (kCacheLine - reinterpret_cast<uintptr_t>(d) % kCacheLine) %
+               kCacheLine;
+  head = head > sz ? sz : head;
+  const usize body = (sz - head) / kCacheLine * kCacheLine;
+  const usize tail = sz - head - body;
+
+  if (head != 0) {
+    Ops::store(d, s, head);
+    Ops::writeback(d, head);
+  }
+  if (body != 0)
+    Ops::template nt_store<Body>(d + head, s + head, body);
+  if (tail != 0) {
+    Ops::store(d + head + body, s + head + body, tail);
+    Ops::writeback(d + head + body, tail);
+  }
+  Ops::fence();
+  return sz;
+}
+
+template <void (*F)(const void *), typename Ops = CPUOps>
+inline usize copy_flush(void *dst, const void *src, usize sz) {
+  Ops::store(dst, src, sz);
+  Ops::template flush<F>(dst, sz);
+  Ops::fence();
+  return sz;
+}
+
+template <typename Ops = CPUOps>
+inline usize copy_barrier(void *dst, const void *src, usize sz) {
+  Ops::store(dst, src, sz);
+  Ops::store_barrier();
+  return sz;
+}
+
+/*!
+  The implementation of kernel k on this CPU (built from the memory
+  operations Ops), nullptr if unsupported
+ */
+template <typename Ops = CPUOps> inline kernel_t get(const Kernel &k) {
+  auto &feat = Features::get();
+  if (!feat.support(k))
+    return nullptr;
+  switch (k) {
+  case kNT:
+#if defined(__x86_64__) || defined(__i386__)
+    if (feat.avx512f)
+      return copy_nt<nt_body_avx512, Ops>;
+    if (feat.avx2)
+      return copy_nt<nt_body_avx2, Ops>;
+    return copy_nt<nt_body_sse2, Ops>;
+#elif defined(__aarch64__)
+    return copy_nt<nt_body_neon, Ops>;
+#else
+    return nullptr;
+#endif
+  case kCLWB:
+    return copy_flush<clwb, Ops>;
+  case kCLFLUSHOPT:
+    return copy_flush<clflushopt, Ops>;
+  case kCLFLUSH:
+    return copy_flush<clflush, Ops>;
+  case kBarrier:
+    return copy_barrier<Ops>;
+  default:
+    return nullptr;
+  }
+}
+
+} // namespace kernels
+
+/*!
+  Dispatcher selects a kernel for each payload size class:
+  <= 64B, <= 128B, ..., <= 4KB, and larger.
+  By default, small payloads use the best per-line write back (as NT stores
+  pay for the partial XPLine writes), and the others use NT stores;
+  calibrate() instead measures all the supported kernels on the target memory.
+ */
+class Dispatcher {
+public:
+  static const usize kNumClasses = 8;
+  static const usize kNTThreshold = 256;
+
+  Dispatcher() { use_default(); }
+
+  static usize class_of(const usize &sz) {
+    usize c = 0;
+    while (c + 1 < kNumClasses && sz > (kCacheLine << c))
+      c += 1;
+    return c;
+  }
+
+  static constexpr usize size_of_class(const usize &c) {
+    return kCacheLine << c;
+  }
+
+  void use_default() {
+    auto &feat = Features::get();
+    Kernel small = kBarrier;
+    for (auto k : {kCLWB, kCLFLUSHOPT, kCLFLUSH}) {
+      if (feat.support(k)) {
+        small = k;
+        break;
+      }
+    }
+    const Kernel large = feat.support(kNT) ? kNT : small;
+    for (usize c = 0; c < kNumClasses; ++c)
+      set(c, size_of_class(c) < kNTThreshold ? small : large);
+  }
+
+  bool use(const Kernel &k) {
+    if (!Features::get().support(k))
+      return false;
+    for (usize c = 0; c < kNumClasses; ++c)
+      set(c, k);
+    return true;
+  }
+
+  /*!
+    Measure the supported kernels (except Barrier, which is not durable
+    without eADR) by copying to the scratch memory, which should be on the
+    target NVM, and use the fastest for each size class.
+    \note: the content of the scratch is overwritten
+   */
+  void calibrate(char *scratch, const usize &scratch_sz,
+                 const usize &rounds = 4096) {
+    const usize max_sz = size_of_class(kNumClasses - 1);
+    if (scratch == nullptr || scratch_sz < max_sz * 2)
+      return;
+
+    alignas(kCacheLine) static char src[size_of_class(kNumClasses - 1)];
+    memset(src, 0x73, sizeof(src));
+
+    for (usize c = 0; c < kNumClasses; ++c) {
+      const usize sz = size_of_class(c);
+      const usize slots = scratch_sz / sz;
+      double best = 0;
+      for (u8 k = 0; k < kBarrier; ++k) {
+        auto f = kernels::get(static_cast<Kernel>(k));
+        if (f == nullptr)
+          continue;
+        auto start = std::chrono::steady_clock::now();
+        for (usize i = 0; i < rounds; ++i)
+          f(scratch + (i * 7919 % slots) * sz, src, sz);
+        const double t = std::chrono::duration<double>(
+                             std::chrono::steady_clock::now() - start)
+                             .count();
+        if (best == 0 || t < best) {
+          best = t;
+          set(c, static_cast<Kernel>(k));
+        }
+      }
+    }
+  }
+
+  inline usize copy(void *dst, const void *src, const usize &sz) const {
+    return fns[class_of(sz)](dst, src, sz);
+  }
+
+  Kernel kernel_at(const usize &c) const { return ks[c]; }
+
+  /*!
+    Build the selected kernels (and the later selected ones) from the
+    memory operations Ops, e.g., crash::Recorder to trace the writers
+    calling persist::copy; persist::CPUOps restores the normal ones.
+   */
+  template <typename Ops> void use_ops() {
+    resolve = kernels::get<Ops>;
+    for (usize c = 0; c < kNumClasses; ++c)
+      set(c, ks[c]);
+  }
+
+  /*!
+    The implementation of kernel k, built from the current memory operations
+   */
+  kernel_t impl_of(const Kernel &k) const { return resolve(k); }
+
+  std::string to_str() const {
+    std::ostringstream oss;
+    for (usize c = 0; c < kNumClasses; ++c) {
+      oss << (c == 0 ? "" : ", ") << (c + 1 == kNumClasses ? ">" : "<=")
+          << size_of_class(c == kNumClasses - 1 ? c - 1 : c)
+          << "B: " << kernel_name(ks[c]);
+    }
+    return oss.str();
+  }
+
+  static Dispatcher &global() {
+    static Dispatcher d;
+    return d;
+  }
+
+private:
+  Kernel ks[kNumClasses];
+  kernel_t fns[kNumClasses];
+  kernel_t (*resolve)(const Kernel &) = kernels::get<CPUOps>;
+
+  void set(const usize &c, const Kernel &k) {
+    ks[c] = k;
+    fns[c] = resolve(k);
+  }
+};
+
+/*!
+  Configure the global dispatcher by spec:
+  - auto: the default per-size choice;
+  - calibrate: measure on [scratch, scratch + scratch_sz);
+  - a kernel name (nt, clwb, clflushopt, clflush, barrier): always use it.
+  Return false if the spec is invalid or unsupported on this CPU.
+ */
+inline bool init(const std::string &spec, char *scratch = nullptr,
+                 const usize &scratch_sz = 0) {
+  auto &d = Dispatcher::global();
+  bool ret = true;
+  if (spec == "auto") {
+    d.use_default();
+  } else if (spec == "calibrate") {
+    ret = scratch != nullptr;
+    d.calibrate(scratch, scratch_sz);
+  } else {
+    auto k = kernel_of(spec);
+    ret = k && d.use(k.value());
+  }
+  RDMA_LOG(4) << "persist features: " << Features::get().to_str();
+  RDMA_LOG(4) << "persist kernels: " << d.to_str();
+  return ret;
+}
+
+/*!
+  Durably copy [src, src + sz) to dst using the global dispatcher
+ */
+inline usize copy(void *dst, const void *src, const usize &sz) {
+  auto res = Dispatcher::global().copy(dst, src, sz);
+  emu::on_write(dst, sz);
+  return res;
+}
+
+/*!
+  Durably copy with a specific kernel, which must be supported
+ */
+inline usize copy_with(const Kernel &k, void *dst, const void *src,
+                       const usize &sz) {
+  auto f = Dispatcher::global().impl_of(k);
+  RDMA_ASSERT(f != nullptr) << "unsupported persist kernel: " << kernel_name(k);
+  auto res = f(dst, src, sz);
+  emu::on_write(dst, sz);
+  return res;
+}
+
+} // namespace persist
+
+} // namespace nvm
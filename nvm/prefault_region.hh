@@ -0,0 +1,283 @@
+#pragma once
+
+#include <sched.h>
+#include <sys/mman.h>
+
+#include <map>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include "./memory_region.hh"
+
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+
+namespace nvm {
+
+/*!
+  Where the pages of a PrefaultRegion are placed
+ */
+enum PlacePolicy {
+  Bind = 0,   // all pages on the nodes (the caller's node if none is given)
+  Interleave, // pages interleaved across the nodes
+  Split,      // the i-th of the #threads contiguous chunks on the
+              // (i % #nodes)-th node, for per-thread partitions
+};
+
+struct PrefaultConfig {
+  // #threads faulting the pages in parallel
+  usize threads = 4;
+  PlacePolicy policy = Bind;
+  // the NUMA nodes to place, empty for the caller's node (Bind) or all the
+  // nodes (Interleave, Split)
+  std::vector<int> nodes;
+  // the largest page to use, falls back to 2MB and 4KB pages if the huge
+  // pages are not reserved
+  u64 max_page = 1L << 30;
+
+  /*!
+    Parse a spec like "threads=8,policy=interleave,nodes=0:1,page=2m".
+    "default" (or an empty spec) keeps all the defaults.
+   */
+  static Option<PrefaultConfig> parse(const std::string &spec) {
+    PrefaultConfig res;
+    std::istringstream iss(spec);
+    std::string item;
+    while (std::getline(iss, item, ',')) {
+      if (item.empty() || item == "default")
+        continue;
+      auto pos = item.find('=');
+      if (pos == std::string::npos)
+        return {};
+      auto key = item.substr(0, pos);
+      auto val = item.substr(pos + 1);
+      if (key == "policy") {
+        if (val == "bind")
+          res.policy = Bind;
+        else if (val == "interleave")
+          res.policy = Interleave;
+        else if (val == "split")
+          res.policy = Split;
+        else
+          return {};
+      } else if (key == "page") {
+        if (val == "1g")
+          res.max_page = 1L << 30;
+        else if (val == "2m")
+          res.max_page = 2L << 20;
+        else if (val == "4k")
+          res.max_page = 4096;
+        else
+          return {};
+      } else if (key == "nodes") {
+        std::istringstream nss(val);
+        std::string n;
+        while (std::getline(nss, n, ':')) {
+          char *end = nullptr;
+          auto node = std::strtol(n.c_str(), &end, 10);
+          if (n.empty() || *end != '\0' || node < 0)
+            return {};
+          res.nodes.push_back(static_cast<int>(node));
+        }
+      } else if (key == "threads") {
+        char *end = nullptr;
+        u64 v = std::strtoull(val.c_str(), &end, 10);
+        if (val.empty() || *end != '\0' || v == 0)
+          return {};
+        res.threads = v;
+      } else
+        return {};
+    }
+    return res;
+  }
+
+  std::string to_str() const {
+    std::ostringstream oss;
+    oss << "threads: " << threads << ", policy: "
+        << (policy == Bind ? "bind"
+                           : (policy == Interleave ? "interleave" : "split"))
+        << ", nodes: ";
+    if (nodes.empty())
+      oss << "default";
+    for (uint i = 0; i < nodes.size(); ++i)
+      oss << (i ? ":" : "") << nodes[i];
+    oss << ", max page: " << max_page << "B";
+    return oss.str();
+  }
+};
+
+/*!
+  A DRAM region whose pages are faulted in by a pool of threads, and placed
+  on the NUMA nodes by a PlacePolicy.
+  Compared to HugeRegion, which populates all the pages from the calling
+  thread (on the calling thread's node), a large region is ready several
+  times faster, and its pages are where the accessing threads are.
+
+  Example:
+  `
+  auto region = PrefaultRegion::create(
+      64L << 30, PrefaultConfig::parse("threads=16,policy=interleave").value())
+      .value();
+  RDMA_LOG(2) << region->page_size() << " " << region->placement_str();
+  `
+ */
+class PrefaultRegion : public MemoryRegion {
+  u64 map_sz = 0;
+  u64 page_sz = 0;
+
+  static u64 align_to_sz(const u64 &x, const u64 &align_sz) {
+    return (x + align_sz - 1) / align_sz * align_sz;
+  }
+
+  static int page_flags(const u64 &page) {
+    if (page == 4096)
+      return 0;
+    return MAP_HUGETLB | (__builtin_ctzll(page) << MAP_HUGE_SHIFT);
+  }
+
+public:
+  const PrefaultConfig config;
+
+  PrefaultRegion(const u64 &sz, const PrefaultConfig &config)
+      : config(config) {
+    this->sz = sz;
+    for (u64 page : {1L << 30, 2L << 20, 4096L}) {
+      if (page > config.max_page)
+        continue;
+      map_sz = align_to_sz(sz, page);
+      void *ptr = mmap(nullptr, map_sz, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | page_flags(page), -1, 0);
+      if (ptr != MAP_FAILED) {
+        this->addr = ptr;
+        page_sz = page;
+        break;
+      }
+      RDMA_LOG(2) << "no " << page << "B pages for sz: " << map_sz << ": "
+                  << strerror(errno);
+    }
+    if (this->addr == nullptr) {
+      RDMA_LOG(4) << "error allocating prefault region with sz: " << sz;
+      return;
+    }
+    prefault();
+  }
+
+  static Option<Arc<PrefaultRegion>>
+  create(const u64 &sz, const PrefaultConfig &config = PrefaultConfig()) {
+    auto region = std::make_shared<PrefaultRegion>(sz, config);
+    if (region->valid())
+      return region;
+    return {};
+  }
+
+  ~PrefaultRegion() {
+    if (this->addr != nullptr)
+      munmap(this->addr, map_sz);
+  }
+
+  u64 page_size() const { return page_sz; }
+
+  /*!
+    The bytes placed on each NUMA node, which is sampled from (at most)
+    kMaxSamples pages
+   */
+  std::map<int, u64> placement() const {
+    std::map<int, u64> res;
+    if (this->addr == nullptr)
+      return res;
+    const u64 num_pages = map_sz / page_sz;
+    const u64 step = std::max<u64>(1, num_pages / kMaxSamples);
+
+    std::vector<void *> pages;
+    for (u64 i = 0; i < num_pages; i += step)
+      pages.push_back(static_cast<char *>(this->addr) + i * page_sz);
+    std::vector<int> status(pages.size(), -1);
+    if (numa_available() < 0 ||
+        numa_move_pages(0, pages.size(), pages.data(), nullptr, status.data(),
+                        0) != 0) {
+      res[-1] = map_sz; // unknown
+      return res;
+    }
+    for (auto s : status)
+      res[s] += step * page_sz;
+    return res;
+  }
+
+  std::string placement_str() const {
+    std::ostringstream oss;
+    for (auto &p : placement())
+      oss << "node " << p.first << ": " << (p.second >> 20) << "MB; ";
+    return oss.str();
+  }
+
+  static const usize kMaxSamples = 4096;
+
+private:
+  std::vector<int> target_nodes() const {
+    if (!config.nodes.empty())
+      return config.nodes;
+    std::vector<int> res;
+    if (config.policy == Bind) {
+      res.push_back(std::max(0, numa_node_of_cpu(sched_getcpu())));
+      return res;
+    }
+    for (int n = 0; n <= numa_max_node(); ++n)
+      if (numa_bitmask_isbitset(numa_all_nodes_ptr, n))
+        res.push_back(n);
+    return res;
+  }
+
+  /*!
+    Set the memory policy of the region, then let the threads touch their
+    chunks of pages.
+   */
+  void prefault() {
+    const bool numa = numa_available() >= 0;
+    const auto nodes = numa ? target_nodes() : std::vector<int>();
+
+    const u64 num_pages = map_sz / page_sz;
+    const usize threads =
+        std::max<usize>(1, std::min<u64>(config.threads, num_pages));
+    // the chunk of a thread, in pages
+    const u64 chunk = (num_pages + threads - 1) / threads;
+
+    if (numa && !nodes.empty() && config.policy != Split) {
+      auto mask = numa_allocate_nodemask();
+      for (auto n : nodes)
+        numa_bitmask_setbit(mask, n);
+      if (config.policy == Bind)
+        numa_tonodemask_memory(this->addr, map_sz, mask);
+      else
+        numa_interleave_memory(this->addr, map_sz, mask);
+      numa_free_nodemask(mask);
+    }
+
+    std::vector<std::thread> workers;
+    for (uint i = 0; i < threads; ++i) {
+      const u64 start = std::min(num_pages, i * chunk);
+      const u64 end = std::min(num_pages, start + chunk);
+      char *base = static_cast<char *>(this->addr);
+      int node = -1;
+      if (numa && !nodes.empty() &&
+          (config.policy == Split || nodes.size() == 1))
+        node = nodes[i % nodes.size()];
+      workers.emplace_back([this, base, start, end, node]() {
+        if (node >= 0) {
+          // zero the pages with the node's cores
+          numa_run_on_node(node);
+          if (config.policy == Split && end > start)
+            numa_tonode_memory(base + start * page_sz,
+                               (end - start) * page_sz, node);
+        }
+        for (u64 p = start; p < end; ++p)
+          *(reinterpret_cast<volatile char *>(base + p * page_sz)) = 0;
+      });
+    }
+    for (auto &w : workers)
+      w.join();
+  }
+};
+
+} // namespace nvm
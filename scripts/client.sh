@@ -1 +1 @@
-./nvm_client -addr="192.168.98.70:8964" --force_use_numa_node=false --use_numa_node=0 --numa_type=1 --threads=56 --coros=1 --id=1 --use_nic_idx=1 --remote_nic_idx=1 --use_read=false --payload=256 --add_sync=false --address_space=8 --random=true -read_write=false --doorbell=true --batch=2 -two_qp=false
\ No newline at end of file
+./nvm_client -addr="192.168.98.70:8964" --bind_policy=nic --threads=56 --coros=1 --id=1 --use_nic_idx=1 --remote_nic_idx=1 --use_read=false --payload=256 --add_sync=false --address_space=8 --random=true -read_write=false --doorbell=true --batch=2 -two_qp=false
\ No newline at end of file
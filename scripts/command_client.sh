@@ -1,2 +1,2 @@
 #!/usr/bin/bash
-./nvm_client -addr="192.168.98.144:8999" --force_use_numa_node=false --use_numa_node=0 --threads=$1 --coros=$3 --id=0 --use_nic_idx=0 --use_read=true --payload=$2 --add_sync=false --address_space=1 --random=true --force_use_numa_node=false --use_nic_idx=1 --remote_nic_idx=1
\ No newline at end of file
+./nvm_client -addr="192.168.98.144:8999" --threads=$1 --coros=$3 --id=0 --use_nic_idx=0 --use_read=true --payload=$2 --add_sync=false --address_space=1 --random=true --use_nic_idx=1 --remote_nic_idx=1
\ No newline at end of file
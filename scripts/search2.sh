@@ -1 +1 @@
-./nvm_client -addr="192.168.98.74:8964" --force_use_numa_node=false --use_numa_node=0 --numa_type=1 --threads=56 --coros=2 --id=1 --use_nic_idx=0 --remote_nic_idx=0 --use_read=true --payload=512 --add_sync=false --address_space=8 --random=true -read_write=false -two_qp=false --search=true
\ No newline at end of file
+./nvm_client -addr="192.168.98.74:8964" --bind_policy=nic --threads=56 --coros=2 --id=1 --use_nic_idx=0 --remote_nic_idx=0 --use_read=true --payload=512 --add_sync=false --address_space=8 --random=true -read_write=false -two_qp=false --search=true
\ No newline at end of file
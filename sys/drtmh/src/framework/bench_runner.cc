@@ -24,6 +24,7 @@
 
 #include "ring_imm_msg.h"
 
+#include "../../nvm/emu_region.hh"
 #include "../../nvm/nvm_region.hh"
 #include "../../nvm/huge_region.hh"
 
@@ -42,6 +43,13 @@ size_t current_partition = 0;             // current worker id
 size_t distributed_ratio = 1; // the distributed transaction's ratio
 
 ::rdmaio::Arc<MemoryRegion> nvm_region = nullptr;
+// the NVM device, or an emulation spec (see nvm/emu_media.hh) to emulate it
+#if NUMA_OPT
+std::string nvm_file_name = "/dev/dax0.1";
+#else
+std::string nvm_file_name = "/dev/dax1.3";
+#endif
+std::string nvm_emu_spec = "";
 
 int tcp_port = 33333;
 
@@ -89,24 +97,26 @@ MemDB *backup_stores_[MAX_BACKUP_NUM];
 BenchRunner::BenchRunner(std::string &config_file)
     : barrier_a_(1),barrier_b_(1),init_worker_count_(0),store_(NULL)
 {
+  running = true;
+
+  parse_config(config_file); // should fill net_def_
+
   if (current_partition == 0) {
     // ASSERT(false) << "not partiton 0";
     // we only have one machine w NVM
-#if NUMA_OPT
-    const std::string nvm_file_name = "/dev/dax0.1";
-#else
-    const std::string nvm_file_name = "/dev/dax1.3";
-#endif
-    nvm_region = (NVMRegion::create(nvm_file_name, 10L * (1024 * 1024 * 1024L)).value());
-    LOG(4) << "nvm use region: " << nvm_file_name;
+    const uint64_t nvm_sz = 10L * (1024 * 1024 * 1024L);
+    if (nvm_emu_spec.empty()) {
+      nvm_region = (NVMRegion::create(nvm_file_name, nvm_sz).value());
+      LOG(4) << "nvm use region: " << nvm_file_name;
+    } else {
+      nvm_region = EmuRegion::create(nvm_sz, nvm_emu_spec).value();
+      LOG(4) << "nvm use emulated region: " << nvm_emu_spec;
+    }
     ASSERT(nvm_region->valid());
 
     //nvm_region = HugeRegion::create(4 * 1024 * 1024 * 1024L).value();
     ctrl.start_daemon();
   }
-  running = true;
-
-  parse_config(config_file); // should fill net_def_
 
   std::fill_n(backup_stores_,RTX_MAX_BACKUP,static_cast<MemDB *>(NULL));
 
@@ -365,6 +375,10 @@ void BenchRunner::parse_config(std::string &config_file) {
     } catch(const ptree_error &e) {
       // pass
     }
+    nvm_file_name = boost::trim_copy(
+        pt.get<std::string>("bench.nvm.file", nvm_file_name));
+    nvm_emu_spec = boost::trim_copy(
+        pt.get<std::string>("bench.nvm.emu", nvm_emu_spec));
     try {
       rep_factor = pt.get<size_t>("bench.rep_factor");
     } catch (const ptree_error &e) {
@@ -3,14 +3,10 @@
 #include "core/rdma_sched.h"
 #include "rdmaio.h"
 
-#include <emmintrin.h>
-#include <immintrin.h>
-#include <x86intrin.h>
-#include <xmmintrin.h>
-
 //#include "../../nvm/benchs/two_sided/core.hh"
 
 #include "../../nvm/nvm_region.hh"
+#include "../../nvm/persist.hh"
 
 using namespace nvm;
 
@@ -23,21 +19,6 @@ namespace rtx {
 using namespace rdmaio;
 using namespace oltp;
 
-inline usize nt_memcpy(char *src, u64 size, char *target) {
-  auto cur_ptr = src;
-  usize cur = 0;
-
-  for (cur = 0; cur < size;) {
-    // in 64 bytes granulaity
-    for (uint i = 0; i < 8; ++i) {
-      // I believe that compiler will unroll this
-      _mm_stream_pi((__m64 *)(target + cur), *((__m64 *)(src + cur)));
-      cur += sizeof(u64);
-    }
-  }
-  return cur;
-}
-
 class RpcLogger : public Logger {
 public:
   RpcLogger(RRpc *rpc, int log_rpc_id, int ack_rpc_id, uint64_t base_off,
@@ -68,8 +49,7 @@ public:
     // memcpy(local_ptr,msg,size);
     //memcpy(local_buffer + cid * MAX_MSG_SIZE, msg, size);
     //assert(nt_memcpy(msg,size,local_buffer + cid * MAX_MSG_SIZE) >= size);
-    assert(nt_memcpy(msg,size,local_ptr) >= size);
-    asm volatile("sfence" : : : "memory");
+    nvm::persist::copy(local_ptr, msg, size);
     //LOG(4) << "size: " << size ; sleep(1);
     //LOG(4) << "write to nvm_region: " << (void *)local_ptr << ", start of the region: "
     //<< nvm_region->addr; sleep(1);
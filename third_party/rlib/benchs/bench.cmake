@@ -5,11 +5,12 @@ add_executable(bench_server ./benchs/bench_server.cc)
 add_executable(fly_client ./benchs/fly_bench/client.cc)
 add_executable(or_client ./benchs/or_bench/client.cc)
 add_executable(db_client ./benchs/db_bench/client.cc)
+add_executable(bootstrap_bench ./benchs/bootstrap_bench.cc)
 
 
 set(benchs
 bench_client bench_server
-fly_client or_client db_client)
+fly_client or_client db_client bootstrap_bench)
 
 foreach(b ${benchs})
  target_link_libraries(${b} pthread ibverbs gflags)
@@ -0,0 +1,125 @@
+/*!
+  A loopback benchmark of the bootstrap RPC (RCtrl's SRpcHandler),
+  which runs the server and the clients in one process, so it needs no NIC.
+  Each client keeps "depth" calls in flight, and the server replies
+  "reply_sz" bytes per call, which takes multiple msgs if it is larger than
+  one.
+ */
+
+#include <gflags/gflags.h>
+
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include "../core/lib.hh"
+
+DEFINE_int64(port, 8890, "Server listener (UDP) port.");
+DEFINE_uint64(clients, 4, "#Client threads, each has its own SRpc.");
+DEFINE_uint64(depth, 8, "#Pipelined calls of a client.");
+DEFINE_uint64(handlers, 4, "#Handler threads of the server.");
+DEFINE_uint64(seconds, 5, "Seconds to run.");
+DEFINE_uint64(req_sz, 64, "Bytes of a call's parameter.");
+DEFINE_uint64(reply_sz, 64, "Bytes of a call's reply.");
+
+using namespace rdmaio;
+using namespace rdmaio::bootstrap;
+
+namespace {
+
+const rpc_id_t kBenchRPC = RCtrlBinderIdType::Reserved + 1;
+
+struct ClientStat {
+  u64 calls = 0;
+  u64 errors = 0;
+  // in usec
+  std::vector<double> lats;
+};
+
+void client_fn(ClientStat *stat, std::atomic<bool> *running) {
+  SRpc rpc(std::string("localhost:") + std::to_string(FLAGS_port));
+  const ByteBuffer param(FLAGS_req_sz, 'x');
+
+  // the in-flight calls and their start time
+  std::deque<std::pair<u64, Timer>> inflight;
+  while (running->load()) {
+    while (inflight.size() < FLAGS_depth) {
+      auto res = rpc.call_async(kBenchRPC, param);
+      if (res != IOCode::Ok) {
+        stat->errors += 1;
+        break;
+      }
+      inflight.push_back(std::make_pair(res.desc, Timer()));
+    }
+    if (inflight.empty())
+      continue;
+
+    auto call = inflight.front();
+    inflight.pop_front();
+    auto reply = rpc.wait_reply(call.first);
+    if (reply == IOCode::Ok && reply.desc.size() == FLAGS_reply_sz) {
+      stat->calls += 1;
+      stat->lats.push_back(call.second.passed_msec());
+    } else
+      stat->errors += 1;
+  }
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  RDMA_ASSERT(FLAGS_depth > 0 && FLAGS_depth <= SRpc::kMaxPipelined);
+  RDMA_ASSERT(FLAGS_reply_sz <= kMaxReplySegs * kReplySegSz)
+      << "reply at most: " << kMaxReplySegs * kReplySegSz;
+
+  RCtrl ctrl(FLAGS_port);
+  const ByteBuffer reply(FLAGS_reply_sz, 'y');
+  RDMA_ASSERT(ctrl.rpc.register_handler(
+      kBenchRPC, [&reply](const ByteBuffer &) -> ByteBuffer { return reply; }));
+  ctrl.start_daemon(FLAGS_handlers);
+
+  std::atomic<bool> running(true);
+  std::vector<ClientStat> stats(FLAGS_clients);
+  std::vector<std::thread> clients;
+  Timer timer;
+  for (uint i = 0; i < FLAGS_clients; ++i)
+    clients.push_back(std::thread(client_fn, &stats[i], &running));
+
+  sleep(FLAGS_seconds);
+  running = false;
+  for (auto &c : clients)
+    c.join();
+  const double sec = timer.passed_msec() / 1000000.0;
+  ctrl.stop_daemon();
+
+  u64 calls = 0, errors = 0;
+  std::vector<double> lats;
+  for (auto &s : stats) {
+    calls += s.calls;
+    errors += s.errors;
+    lats.insert(lats.end(), s.lats.begin(), s.lats.end());
+  }
+  std::sort(lats.begin(), lats.end());
+  double avg = 0;
+  for (auto l : lats)
+    avg += l;
+  avg = lats.empty() ? 0 : avg / lats.size();
+  auto percentile = [&lats](double p) -> double {
+    if (lats.empty())
+      return 0;
+    return lats[std::min<usize>(lats.size() - 1, lats.size() * p)];
+  };
+
+  std::cout << "{\"clients\":" << FLAGS_clients << ",\"depth\":" << FLAGS_depth
+            << ",\"handlers\":" << FLAGS_handlers
+            << ",\"req_sz\":" << FLAGS_req_sz
+            << ",\"reply_sz\":" << FLAGS_reply_sz << ",\"calls\":" << calls
+            << ",\"errors\":" << errors << ",\"thpt\":" << calls / sec
+            << ",\"avg_us\":" << avg << ",\"p50_us\":" << percentile(0.5)
+            << ",\"p99_us\":" << percentile(0.99) << "}" << std::endl;
+  return 0;
+}
@@ -2,8 +2,12 @@
 
 #include <arpa/inet.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <sys/epoll.h>
 #include <unistd.h>
 
+#include <vector>
+
 #include "../common.hh"
 
 #include "../utils/ipname.hh"
@@ -15,11 +19,17 @@ namespace bootstrap {
 
 const usize kMaxMsgSz = 4096;
 
+// max msgs received by RecvChannel with one recvmmsg
+const usize kRecvBatch = 32;
+
+// the socket buffer of a channel
+const usize kSockBufSz = 4 * 1024 * 1024;
+
 class AbsChannel {
 protected:
   int sock_fd = -1;
 
-  explicit AbsChannel(int sock) : sock_fd(sock) {}
+  explicit AbsChannel(int sock) : sock_fd(sock) { set_buf_sz(); }
 
   AbsChannel() : sock_fd(-1) {}
 
@@ -28,6 +38,20 @@ protected:
   // possible to set later
   void set_socket(int fd)  {
     sock_fd = fd;
+    set_buf_sz();
+  }
+
+  /*!
+    Enlarge the socket buffers so that a burst of msgs, i.e., pipelined
+    calls or a multi-msg reply, is not dropped.
+    The kernel caps it by net.core.{r,w}mem_max.
+   */
+  void set_buf_sz() {
+    if (!valid())
+      return;
+    int sz = kSockBufSz;
+    setsockopt(sock_fd, SOL_SOCKET, SO_RCVBUF, &sz, sizeof(sz));
+    setsockopt(sock_fd, SOL_SOCKET, SO_SNDBUF, &sz, sizeof(sz));
   }
 
   Result<> close_channel() {
@@ -57,12 +81,9 @@ protected:
   Result<sockaddr> try_recv(ByteBuffer &buf, const double to_usec = 1000000) {
     struct sockaddr addr;
 
-    fd_set rfds;
-    FD_ZERO(&rfds);
-    FD_SET(sock_fd, &rfds);
-    struct timeval tv = {.tv_sec = 0, .tv_usec = static_cast<int>(to_usec)};
-
-    auto ready = select(sock_fd + 1, &rfds, nullptr, nullptr, nullptr);
+    // poll, instead of select, has no limit on the fd
+    struct pollfd pfd = {.fd = sock_fd, .events = POLLIN, .revents = 0};
+    auto ready = poll(&pfd, 1, static_cast<int>((to_usec + 999) / 1000));
 
     switch (ready) {
     case 0:
@@ -70,7 +91,7 @@ protected:
     case -1:
       return Err(addr);
     default: {
-      if (FD_ISSET(sock_fd, &rfds)) {
+      if (pfd.revents & POLLIN) {
         // now recv the msg
         usize len = sizeof(addr);
         auto n = recvfrom(sock_fd, (char *)(buf.c_str()), buf.size(), 0,
@@ -85,7 +106,8 @@ protected:
           return Err(addr);
         }
       } else {
-        RDMA_ASSERT(false);
+        // POLLERR, etc
+        return Err(addr);
       }
     }
       // end switch
@@ -199,6 +221,9 @@ public:
 /*!
   A UDP-based channel for recving msgs.
   Each msg is at maxinum ::rdmaio::bootstrap::kMaxMsgSz .
+  The channel waits for msgs with epoll, and receives at most kRecvBatch
+  msgs (of any clients) with one recvmmsg into a reusable arena, so a burst
+  of requests costs one syscall per batch. cur() is sized to the msg.
   To use:
   `
   auto rc = RecvChannel::create (port_to_listen).value();
@@ -211,11 +236,18 @@ public:
  */
 class RecvChannel : public AbsChannel {
 
-  Option<sockaddr> cur_msg_client = {}; // who sent the current client
-  ByteBuffer cur_msg;
+  int epoll_fd = -1;
 
-  explicit RecvChannel(int port)
-      : cur_msg(::rdmaio::bootstrap::kMaxMsgSz, '\0') {
+  // the reusable receive arena, filled by one recvmmsg:
+  // msgs[cur_idx, num_recved) (sent by clients[...]) are not consumed
+  std::vector<ByteBuffer> msgs;
+  std::vector<sockaddr> clients;
+  std::vector<struct mmsghdr> hdrs;
+  std::vector<struct iovec> iovs;
+  usize num_recved = 0;
+  usize cur_idx = 0;
+
+  explicit RecvChannel(int port) {
     struct addrinfo hints, *servinfo, *p;
     socklen_t addr_len;
     memset(&hints, 0, sizeof hints);
@@ -256,10 +288,11 @@ class RecvChannel : public AbsChannel {
     if (valid()) {
       fcntl(this->sock_fd, F_SETFL, O_NONBLOCK);
     }
+    init_arena();
   }
 
   explicit RecvChannel(int port, const std::string &host)
-    : AbsChannel(socket(AF_INET, SOCK_DGRAM, 0)), cur_msg(kMaxMsgSz, '\0') {
+    : AbsChannel(socket(AF_INET, SOCK_DGRAM, 0)) {
     if (valid()) {
       // set as a non-blocking channel
       fcntl(this->sock_fd, F_SETFL, O_NONBLOCK);
@@ -278,6 +311,50 @@ class RecvChannel : public AbsChannel {
         close_channel();
       }
     }
+    init_arena();
+  }
+
+  void init_arena() {
+    msgs.assign(kRecvBatch, ByteBuffer(kMaxMsgSz, '\0'));
+    clients.resize(kRecvBatch);
+    hdrs.resize(kRecvBatch);
+    iovs.resize(kRecvBatch);
+
+    if (!valid())
+      return;
+    epoll_fd = epoll_create1(0);
+    struct epoll_event ev = {};
+    ev.events = EPOLLIN;
+    ev.data.fd = this->sock_fd;
+    if (epoll_fd < 0 ||
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, this->sock_fd, &ev) != 0) {
+      RDMA_LOG(4) << "failed to create epoll: " << strerror(errno);
+      close_channel();
+    }
+  }
+
+  /*!
+    Receive at most kRecvBatch msgs into the arena without blocking
+    \ret: #msgs received
+   */
+  usize fill_arena() {
+    for (uint i = 0; i < kRecvBatch; ++i) {
+      // the consumed msgs may be shrunk to their sz
+      msgs[i].resize(kMaxMsgSz);
+      iovs[i] = {.iov_base = (void *)(msgs[i].data()), .iov_len = kMaxMsgSz};
+      hdrs[i].msg_hdr = {};
+      hdrs[i].msg_hdr.msg_name = &clients[i];
+      hdrs[i].msg_hdr.msg_namelen = sizeof(sockaddr);
+      hdrs[i].msg_hdr.msg_iov = &iovs[i];
+      hdrs[i].msg_hdr.msg_iovlen = 1;
+    }
+    auto n = recvmmsg(this->sock_fd, hdrs.data(), kRecvBatch, MSG_DONTWAIT,
+                      nullptr);
+    if (n <= 0)
+      return 0;
+    for (int i = 0; i < n; ++i)
+      msgs[i].resize(hdrs[i].msg_len);
+    return static_cast<usize>(n);
   }
 
 public:
@@ -289,42 +366,64 @@ public:
     return {};
   }
 
+  ~RecvChannel() {
+    if (epoll_fd >= 0)
+      close(epoll_fd);
+  }
+
   /*!
-    Try recv a msg;
+    Try recv msgs; the received msgs are buffered, so that the following
+    next() calls consume them without syscalls.
     \param timeout: in usec
     */
   void start(const double &timeout_usec = 1000) {
     // donot over consume the current msg
     if (has_msg())
       return;
-    auto res = try_recv(cur_msg, timeout_usec);
-    if (res == IOCode::Ok) {
-      cur_msg_client = res.desc;
-    }
-  }
+    cur_idx = 0;
+    num_recved = fill_arena();
+    if (num_recved > 0 || !valid())
+      return;
 
-  bool has_msg() const {
-    if (cur_msg_client)
-      return true;
-    return false;
+    struct epoll_event ev;
+    if (epoll_wait(epoll_fd, &ev, 1,
+                   static_cast<int>((timeout_usec + 999) / 1000)) > 0)
+      num_recved = fill_arena();
   }
 
+  bool has_msg() const { return cur_idx < num_recved; }
+
   /*!
     Drop current msg, and try to recv another one
    */
   void next() {
-    cur_msg_client = {}; // re-set msg header
-    start();             // fill one msg
+    cur_idx += 1; // consume the current msg
+    start();      // fill msgs if all are consumed
   }
 
   /*!
     \note: this call is not safe
    */
-  ByteBuffer &cur() { return cur_msg; }
+  ByteBuffer &cur() { return msgs[cur_idx]; }
 
   Result<std::string> reply_cur(const ByteBuffer &buf) {
-    return raw_send(buf, cur_msg_client.value());
+    return raw_send(buf, clients[cur_idx]);
   };
+
+  /*!
+    The sender of the current msg, so that the msg can be replied later
+    (e.g., by another thread) using reply_to
+    \note: this call is not safe
+   */
+  sockaddr cur_client() const { return clients[cur_idx]; }
+
+  /*!
+    Reply to a client, whose msg may not be the current one.
+    It is safe to call it concurrently with the receiving thread.
+   */
+  Result<std::string> reply_to(const ByteBuffer &buf, const sockaddr &client) {
+    return raw_send(buf, client);
+  }
 }; // namespace bootstrap
 
 } // namespace bootstrap
@@ -19,6 +19,7 @@ enum RCtrlBinderIdType : rpc_id_t {
   CreateRCM,     // create an RC which uses message (for two-sided)
   DeleteRC,
   FetchQPAttr,  // fetch a created QP's attr. useful for UD QP
+  CreateRCBatch, // create (at most kMaxRCBatch) RCs in one call
   Reserved,
 };
 
@@ -79,6 +80,18 @@ struct __attribute__((packed)) RCReply {
   u64 key;
 };
 
+/*!
+  Req/Reply for creating a batch of RC QPs.
+  The request is an RCBatchHeader followed by *num* RCReq, and the reply is
+  an RCBatchHeader followed by *num* RCReply, one for each RCReq in order.
+ */
+struct __attribute__((packed)) RCBatchHeader {
+  u8 num = 0;
+};
+
+// so that a batch request fits in one kMaxMsgSz msg
+const usize kMaxRCBatch = 16;
+
 struct __attribute__((packed)) DelRCReq {
   // parameter for querying the QP
   char name[::rdmaio::qp::kMaxQPNameLen + 1];
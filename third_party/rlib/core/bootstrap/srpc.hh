@@ -1,12 +1,21 @@
 #pragma once
 
+#include <array>
+#include <atomic>
+#include <functional>
+#include <limits>
+#include <map>
 #include <mutex>   // lock
+#include <stdexcept>
 #include <utility> // std::pair
+#include <vector>
 
 #include "./channel.hh"
 #include "./multi_msg.hh"
 #include "./proto.hh"
 
+#include "../utils/timer.hh"
+
 namespace rdmaio {
 
 namespace bootstrap {
@@ -26,6 +35,11 @@ struct __attribute__((packed)) SRpcHeader {
   u64 checksum;
 };
 
+static_assert(sizeof(MsgsHeader) + sizeof(SRpcHeader) + sizeof(RCBatchHeader) +
+                      kMaxRCBatch * sizeof(RCReq) <=
+                  kMaxMsgSz,
+              "a batch of RCReq should fit in one msg");
+
 struct __attribute__((packed)) SReplyHeader {
   u8 callstatus;
   u64 checksum;
@@ -33,18 +47,60 @@ struct __attribute__((packed)) SReplyHeader {
   // then we will omit the checksum check at client
   // because it is a heartbeat reply message
   u8 dummy = 0;
+  // a reply larger than one msg is sent in num_segs msgs
+  u16 seg = 0;
+  u16 num_segs = 1;
 };
 
+// the reply payload carried by one msg
+const usize kReplySegSz =
+    kMaxMsgSz - sizeof(MsgsHeader) - sizeof(SReplyHeader);
+// so a reply is at most kMaxReplySegs * kReplySegSz (~1MB)
+const usize kMaxReplySegs = 256;
+
 /*!
   A simple RPC used for establish connection for RDMA.
+  Calls are matched with their replies by the checksum, so multiple calls
+  can be pipelined, and the replies may arrive out of order.
+
+  Example:
+  `
+  SRpc rpc("localhost:8888");
+  // a blocking call
+  rpc.call(id, param);
+  auto reply = rpc.receive_reply();
+
+  // pipelined calls
+  auto c0 = rpc.call_async(id, param0).value();
+  auto c1 = rpc.call_async(id, param1).value();
+  auto r1 = rpc.wait_reply(c1);
+  auto r0 = rpc.wait_reply(c0);
+  `
+  \note: SRpc is not thread-safe.
  */
 class SRpc {
 public:
   static const u64 invalid_checksum = 0;
 
+  // max calls in flight, the replies of the older ones are dropped
+  static const usize kMaxPipelined = 1024;
+
 private:
   Arc<SendChannel> channel;
+  // the checksum of the next call
   u64 checksum = invalid_checksum + 1;
+  // the call whose reply is returned by receive_reply
+  u64 last_call = invalid_checksum;
+
+  struct PendingReply {
+    SReplyHeader header;
+    usize recved = 0;
+    std::vector<ByteBuffer> segs;
+    std::vector<bool> got;
+
+    bool done() const { return recved > 0 && recved == segs.size(); }
+  };
+  std::map<u64, PendingReply> pending;
 
 public:
   using MMsg = MultiMsg<kMaxMsgSz>;
@@ -55,67 +111,143 @@ public:
     Send an RPC with id "id", using a specificed parameter.
     */
   Result<std::string> call(const rpc_id_t &id, const ByteBuffer &parameter) {
-    auto mmsg_o = MMsg::create_exact(sizeof(rpc_id_t) + parameter.size());
-    if (mmsg_o) {
-      auto &mmsg = mmsg_o.value();
-      RDMA_ASSERT(mmsg.append(::rdmaio::Marshal::dump<SRpcHeader>(
-          {.id = id, .checksum = checksum})));
-      RDMA_ASSERT(mmsg.append(parameter));
-      return channel->send(*mmsg.buf);
-    } else {
-      return ::rdmaio::Err(
-          std::string("Msg too large!, only kMaxMsgSz supported"));
-    }
+    auto res = send_call(id, parameter);
+    if (res == IOCode::Ok)
+      last_call = track_call();
+    return res;
+  }
+
+  /*!
+    Send an RPC without waiting for the previous ones.
+    \ret: the checksum of the call, to wait for its reply with wait_reply
+   */
+  Result<u64> call_async(const rpc_id_t &id, const ByteBuffer &parameter) {
+    auto res = send_call(id, parameter);
+    if (res != IOCode::Ok)
+      return ::rdmaio::transfer(res, static_cast<u64>(invalid_checksum));
+    return ::rdmaio::Ok(track_call());
   }
 
   /*!
     Recv a reply from the server ysing the timeout specified.
     \Note: this call must follow from a "call"
+    \param heartbeat: kept for compatibility, since the replies are matched
+    with their calls
     */
   Result<ByteBuffer> receive_reply(const double &timeout_usec = 1000000,
                                    bool heartbeat = false) {
-  retry:
-    auto res = channel->recv(timeout_usec);
-    if (res == IOCode::Ok) {
-
-      // further we decode the header for check
-      try {
+    return wait_reply(last_call, timeout_usec);
+  }
 
-        auto decoded_reply = MultiMsg<kMaxMsgSz>::create_from(res.desc).value();
+  /*!
+    Wait for the reply of the call (returned by call_async).
+    Replies of the other calls received meanwhile are buffered.
+   */
+  Result<ByteBuffer> wait_reply(const u64 &call,
+                                const double &timeout_usec = 1000000) {
+    Timer timer;
+    while (true) {
+      auto it = pending.find(call);
+      if (it == pending.end())
+        return ::rdmaio::Err(ByteBuffer("unknown call"));
+
+      if (it->second.done()) {
+        auto header = it->second.header;
+        ByteBuffer reply;
+        for (auto &seg : it->second.segs)
+          reply.append(seg);
+        pending.erase(it);
+
+        switch (header.callstatus) {
+        case CallStatus::Ok:
+          if (header.dummy)
+            return ::rdmaio::Ok(ByteBuffer(""));
+          return ::rdmaio::Ok(std::move(reply));
+        case CallStatus::Nop:
+          return ::rdmaio::Err(ByteBuffer("Not ready"));
+        default:
+          return ::rdmaio::Err(ByteBuffer("unknown error"));
+        }
+      }
 
-        auto header = ::rdmaio::Marshal::dedump<SReplyHeader>(
-                          decoded_reply.query_one(0).value())
-                          .value();
+      auto left = timeout_usec - timer.passed_msec();
+      if (left <= 0)
+        return ::rdmaio::Timeout(ByteBuffer(""));
+      auto res = channel->recv(left);
+      if (res != IOCode::Ok) {
+        // the receive has error, just return
+        return res;
+      }
+      if (!buffer_reply(res.desc))
+        return ::rdmaio::Err(ByteBuffer("Fatal checksum error"));
+    }
+  }
 
-        // first we handle heartbeat reply
-        if (header.dummy) {
-          if (!heartbeat)
-            goto retry; // ignore the heartbeat reply
+  /*!
+    #calls whose replies are not returned
+   */
+  usize pending_calls() const { return pending.size(); }
 
-          return ::rdmaio::Ok(ByteBuffer(""));
-        }
+private:
+  Result<std::string> send_call(const rpc_id_t &id,
+                                const ByteBuffer &parameter) {
+    auto mmsg_o = MMsg::create_exact(sizeof(SRpcHeader) + parameter.size());
+    if (mmsg_o) {
+      auto &mmsg = mmsg_o.value();
+      RDMA_ASSERT(mmsg.append(::rdmaio::Marshal::dump<SRpcHeader>(
+          {.id = id, .checksum = checksum})));
+      RDMA_ASSERT(mmsg.append(parameter));
+      return channel->send(*mmsg.buf);
+    } else {
+      return ::rdmaio::Err(
+          std::string("Msg too large!, only kMaxMsgSz supported"));
+    }
+  }
 
-        // then we handle normal reply
-        if (header.checksum == checksum) {
-          checksum += 1;
-          switch (header.callstatus) {
-          case CallStatus::Ok:
-            return ::rdmaio::Ok(decoded_reply.query_one(1).value());
-          case CallStatus::Nop:
-            return ::rdmaio::Err(ByteBuffer("Not ready"));
-          default:
-            return ::rdmaio::Err(ByteBuffer("unknown error"));
-          }
-        } else
-          return ::rdmaio::Err(ByteBuffer("Fatal checksum error"));
-      } catch (std::exception &e) {
+  u64 track_call() {
+    auto call = checksum++;
+    pending[call] = PendingReply();
+    while (pending.size() > kMaxPipelined)
+      pending.erase(pending.begin());
+    return call;
+  }
 
-        return ::rdmaio::Err(ByteBuffer("decode reply error"));
+  /*!
+    Buffer a received reply (segment) of a pending call
+    \ret: false if the server fails to decode a call
+   */
+  bool buffer_reply(ByteBuffer &msg) {
+    try {
+      auto decoded_reply = MultiMsg<kMaxMsgSz>::create_from(msg).value();
+      auto header = ::rdmaio::Marshal::dedump<SReplyHeader>(
+                        decoded_reply.query_one(0).value())
+                        .value();
+      if (header.callstatus == CallStatus::FatalErr)
+        return false;
+
+      auto it = pending.find(header.checksum);
+      if (it == pending.end() || header.num_segs == 0 ||
+          header.seg >= header.num_segs)
+        return true; // a stale reply, or a reply of a dropped call
+
+      auto &p = it->second;
+      if (p.segs.size() != header.num_segs) {
+        p.segs.assign(header.num_segs, ByteBuffer(""));
+        p.got.assign(header.num_segs, false);
+        p.recved = 0;
       }
-    } else {
-      // the receive has error, just return
-      return res;
+      if (!p.got[header.seg]) {
+        p.header = header;
+        p.got[header.seg] = true;
+        p.recved += 1;
+        auto payload = decoded_reply.query_one(1);
+        if (payload)
+          p.segs[header.seg] = payload.value();
+      }
+    } catch (std::exception &e) {
+      // decode reply error, ignore the msg
     }
+    return true;
   }
 };
 
@@ -127,11 +259,19 @@ class RPCFactory {
   handle(const ByteBuffer &req) -> ByteBuffer
    */
   using req_handler_f = std::function<ByteBuffer(const ByteBuffer &req)>;
-  std::map<rpc_id_t, req_handler_f> registered_handlers;
 
+  // indexed by the rpc id, so that serving a call takes no lock;
+  // a handler is never changed once registered
+  static const usize kMaxRPCs = std::numeric_limits<rpc_id_t>::max() + 1;
+  std::array<req_handler_f, kMaxRPCs> handlers;
+  std::array<std::atomic<bool>, kMaxRPCs> registered;
+
+  // serializes the registrations
   std::mutex lock;
 
   RPCFactory() {
+    for (auto &r : registered)
+      r.store(false);
     // register a default heartbeat handler
     register_handler(RCtrlBinderIdType::HeartBeat,
                      &RPCFactory::heartbeat_handler);
@@ -140,16 +280,17 @@ class RPCFactory {
 public:
   bool register_handler(rpc_id_t id, req_handler_f val) {
     std::lock_guard<std::mutex> guard(lock);
-    if (registered_handlers.find(id) == registered_handlers.end()) {
-      registered_handlers.insert(std::make_pair(id, val));
-      return true;
-    }
-    return false;
+    if (registered[id].load(std::memory_order_acquire))
+      return false;
+    handlers[id] = val;
+    registered[id].store(true, std::memory_order_release);
+    return true;
   }
 
   ByteBuffer call_one(rpc_id_t id, const ByteBuffer &parameter) {
-    auto fn = registered_handlers.find(id)->second;
-    return fn(parameter);
+    if (!registered[id].load(std::memory_order_acquire))
+      throw std::out_of_range("unknown rpc id");
+    return handlers[id](parameter);
   }
 
 private:
@@ -177,74 +318,113 @@ public:
   usize run_one_event_loop() {
     usize count = 0;
     for (channel->start(1000000); channel->has_msg(); channel->next(), count += 1) {
+      for (auto &seg : handle_one(channel->cur()))
+        channel->reply_cur(seg);
+    }
+    return count;
+  }
 
-      auto &msg = channel->cur();
-
-      u64 checksum = SRpc::invalid_checksum;
-      try {
-        MultiMsg<kMaxMsgSz> segmeneted_msg;
-        SRpcHeader header;
-        try {
-          // create from move the cur_msg to a MuiltiMsg
-          segmeneted_msg = MultiMsg<kMaxMsgSz>::create_from(msg).value();
-
-          // query the RPC call id
-          header = ::rdmaio::Marshal::dedump<SRpcHeader>(
-                       segmeneted_msg.query_one(0).value())
-                       .value();
-
-          checksum = header.checksum;
-        } catch (std::exception &e) {
-          // some error happens, which is fatal because we cannot decode the
-          // checksum
-
-          MultiMsg<kMaxMsgSz> coded_reply =
-            MultiMsg<kMaxMsgSz>::create_exact(sizeof(SReplyHeader)).value();
-
-          coded_reply.append(::rdmaio::Marshal::dump<SReplyHeader>(
-              {.callstatus = CallStatus::FatalErr,
-               .checksum = checksum,
-               .dummy = 0}));
-          channel->reply_cur(*coded_reply.buf);
-
-          continue;
-        }
-
-        // really handles the request
-        rpc_id_t id = header.id;
-
-        ByteBuffer parameter = segmeneted_msg.query_one(1).value();
+  /*!
+    Run a event loop to receive RPC calls, without serving them.
+    Each call is handed to "f" together with its client, so that it can be
+    served (by handle_one) and replied (by reply_to) at other threads.
+    \ret: number of PRCs received
+   */
+  using dispatch_f = std::function<void(ByteBuffer &&msg, const sockaddr &client)>;
+  usize dispatch_one_event_loop(const dispatch_f &f) {
+    usize count = 0;
+    for (channel->start(1000000); channel->has_msg(); channel->next(), count += 1) {
+      f(ByteBuffer(channel->cur()), channel->cur_client());
+    }
+    return count;
+  }
 
-        // call the RPC
-        ByteBuffer reply = factory.call_one(id, parameter);
+  Result<std::string> reply_to(const std::vector<ByteBuffer> &reply,
+                               const sockaddr &client) {
+    for (auto &seg : reply) {
+      auto res = channel->reply_to(seg, client);
+      if (res != IOCode::Ok)
+        return res;
+    }
+    return ::rdmaio::Ok(std::string(""));
+  }
 
-        MultiMsg<kMaxMsgSz> coded_reply =
-            MultiMsg<kMaxMsgSz>::create_exact(sizeof(SReplyHeader) +
-                                              reply.size())
-                .value();
-        coded_reply.append(::rdmaio::Marshal::dump<SReplyHeader>(
-            {.callstatus = CallStatus::Ok,
-             .checksum = checksum,
-             .dummy = (id == RCtrlBinderIdType::HeartBeat)
-                          ? static_cast<u8>(1)
-                          : static_cast<u8>(0)}));
-        coded_reply.append(reply);
+  /*!
+    Call the RPC encoded in the msg, and encode its reply, in one msg per
+    kReplySegSz bytes.
+    It is thread-safe as long as the registered handlers are.
+   */
+  std::vector<ByteBuffer> handle_one(ByteBuffer &msg) {
+    u64 checksum = SRpc::invalid_checksum;
+    try {
+      MultiMsg<kMaxMsgSz> segmeneted_msg;
+      SRpcHeader header;
+      try {
+        // create from move the cur_msg to a MuiltiMsg
+        segmeneted_msg = MultiMsg<kMaxMsgSz>::create_from(msg).value();
 
-        // send the reply to the client
-        channel->reply_cur(*coded_reply.buf);
+        // query the RPC call id
+        header = ::rdmaio::Marshal::dedump<SRpcHeader>(
+                     segmeneted_msg.query_one(0).value())
+                     .value();
 
+        checksum = header.checksum;
       } catch (std::exception &e) {
-        MultiMsg<kMaxMsgSz> coded_reply =
-          MultiMsg<kMaxMsgSz>::create_exact(sizeof(SReplyHeader)).value();
+        // some error happens, which is fatal because we cannot decode the
+        // checksum
+
+        SReplyHeader header = {.callstatus = CallStatus::FatalErr,
+                               .checksum = checksum,
+                               .dummy = 0};
+        return {encode_reply(header, ByteBuffer(""))};
+      }
 
-        // some error happens
-        coded_reply.append(::rdmaio::Marshal::dump<SReplyHeader>(
-            {.callstatus = CallStatus::Nop, .checksum = checksum}));
-        channel->reply_cur(*coded_reply.buf);
+      // really handles the request
+      rpc_id_t id = header.id;
+
+      ByteBuffer parameter = segmeneted_msg.query_one(1).value();
+
+      // call the RPC
+      ByteBuffer reply = factory.call_one(id, parameter);
+
+      SReplyHeader reply_header = {
+          .callstatus = CallStatus::Ok,
+          .checksum = checksum,
+          .dummy = (id == RCtrlBinderIdType::HeartBeat) ? static_cast<u8>(1)
+                                                        : static_cast<u8>(0)};
+      usize num_segs = (reply.size() + kReplySegSz - 1) / kReplySegSz;
+      num_segs = std::max<usize>(num_segs, 1);
+      if (num_segs > kMaxReplySegs)
+        throw std::length_error("reply too large");
+
+      std::vector<ByteBuffer> coded_reply;
+      reply_header.num_segs = static_cast<u16>(num_segs);
+      for (uint i = 0; i < num_segs; ++i) {
+        reply_header.seg = static_cast<u16>(i);
+        coded_reply.push_back(encode_reply(
+            reply_header, reply.substr(i * kReplySegSz, kReplySegSz)));
       }
+      return coded_reply;
+
+    } catch (std::exception &e) {
+      // some error happens
+      SReplyHeader header = {.callstatus = CallStatus::Nop,
+                             .checksum = checksum};
+      return {encode_reply(header, ByteBuffer(""))};
     }
+  }
 
-    return count;
+private:
+  static ByteBuffer encode_reply(const SReplyHeader &header,
+                                 const ByteBuffer &payload) {
+    MultiMsg<kMaxMsgSz> coded_reply =
+        MultiMsg<kMaxMsgSz>::create_exact(sizeof(SReplyHeader) +
+                                          payload.size())
+            .value();
+    coded_reply.append(::rdmaio::Marshal::dump<SReplyHeader>(header));
+    if (!payload.empty())
+      coded_reply.append(payload);
+    return *coded_reply.buf;
   }
 };
 
@@ -1,5 +1,9 @@
 #pragma once
 
+#include <future>
+#include <mutex>
+#include <vector>
+
 #include "./nicinfo.hh"
 /*!
   Utilities for query RDMA NIC on this machine.
@@ -60,6 +64,10 @@ class ConnectManager {
 protected:
   SRpc rpc;
 
+  // the rpc has at most one outstanding call, which may be issued by the
+  // async calls at other threads
+  std::mutex call_lock;
+
   const std::string err_name_to_long = "Name to long";
   const std::string err_decode_reply = "Decode reply error";
   const std::string err_not_found = "attribute not found";
@@ -70,6 +78,7 @@ public:
 
   Result<std::string> wait_ready(const double &timeout_usec,
                                  const usize &retry = 1) {
+    std::lock_guard<std::mutex> guard(call_lock);
     for (uint i = 0; i < retry; ++i) {
       // send a dummy request to the RPC
       auto res =
@@ -87,6 +96,7 @@ public:
 
   Result<std::string> delete_remote_rc(const std::string &name, const u64 &key,
                                        const double &timeout_usec = 1000000) {
+    std::lock_guard<std::mutex> guard(call_lock);
 
     if (unlikely(name.size() > ::rdmaio::qp::kMaxQPNameLen))
       return ::rdmaio::Err(std::string(err_name_to_long));
@@ -136,6 +146,7 @@ public:
                             const ::rdmaio::nic_id_t &nic_id,
                             const ::rdmaio::qp::QPConfig &config,
                             const double &timeout_usec = 1000000) {
+    std::lock_guard<std::mutex> guard(call_lock);
 
     auto err_str = std::string("unknown error");
     u64 temp_key = 0;
@@ -197,6 +208,130 @@ public:
     return ::rdmaio::Err(std::make_pair(err_str, temp_key));
   }
 
+  /*!
+    *C*reate and *C*onnect a batch of RC QPs at remote end: the i-th QP is
+    named names[i], and connects with rcs[i].
+    Compared to calling cc_rc for each QP, it takes one round trip per
+    proto::kMaxRCBatch QPs.
+
+    \ret: the (error msg, key) of each QP.
+    It is Ok only if all the QPs are connected. Otherwise, QPs with a non-zero
+    key have been created at remote end, which can be deleted with
+    delete_remote_rc.
+   */
+  Result<std::vector<cc_rc_ret_t>>
+  cc_rc_batch(const std::vector<std::string> &names,
+              const std::vector<Arc<::rdmaio::qp::RC>> &rcs,
+              const ::rdmaio::nic_id_t &nic_id,
+              const ::rdmaio::qp::QPConfig &config,
+              const double &timeout_usec = 1000000) {
+    std::lock_guard<std::mutex> guard(call_lock);
+
+    std::vector<cc_rc_ret_t> ret(rcs.size(),
+                                 std::make_pair(std::string("not sent"), 0));
+    if (unlikely(names.size() != rcs.size()))
+      return ::rdmaio::Err(ret);
+    for (uint i = 0; i < names.size(); ++i) {
+      if (unlikely(names[i].size() > ::rdmaio::qp::kMaxQPNameLen)) {
+        std::get<0>(ret[i]) = err_name_to_long;
+        return ::rdmaio::Err(ret);
+      }
+    }
+
+    bool all_ok = true;
+    for (usize start = 0; start < rcs.size(); start += proto::kMaxRCBatch) {
+      const usize num = std::min<usize>(proto::kMaxRCBatch, rcs.size() - start);
+
+      ByteBuffer req_buf = ::rdmaio::Marshal::dump<proto::RCBatchHeader>(
+          {.num = static_cast<u8>(num)});
+      for (uint i = start; i < start + num; ++i) {
+        proto::RCReq req = {};
+        memcpy(req.name, names[i].data(), names[i].size());
+        req.whether_create = 1;
+        req.whether_recv = 0;
+        req.nic_id = nic_id;
+        req.config = config;
+        req.attr = rcs[i]->my_attr();
+        req_buf.append(::rdmaio::Marshal::dump<proto::RCReq>(req));
+      }
+
+      auto res = rpc.call(proto::CreateRCBatch, req_buf);
+      if (unlikely(res != IOCode::Ok)) {
+        for (uint i = start; i < start + num; ++i)
+          std::get<0>(ret[i]) = res.desc;
+        return ::rdmaio::Err(ret);
+      }
+
+      auto res_reply = rpc.receive_reply(timeout_usec);
+      if (res_reply != IOCode::Ok) {
+        for (uint i = start; i < start + num; ++i)
+          std::get<0>(ret[i]) = res_reply.desc;
+        return ::rdmaio::transfer(res_reply, ret);
+      }
+
+      auto &reply = res_reply.desc;
+      auto header = ::rdmaio::Marshal::dedump<proto::RCBatchHeader>(reply);
+      if (!header || header.value().num != num ||
+          reply.size() < sizeof(proto::RCBatchHeader) +
+                             num * sizeof(proto::RCReply)) {
+        for (uint i = start; i < start + num; ++i)
+          std::get<0>(ret[i]) = err_decode_reply;
+        return ::rdmaio::Err(ret);
+      }
+
+      for (uint i = 0; i < num; ++i) {
+        auto qp_reply =
+            ::rdmaio::Marshal::dedump<proto::RCReply>(
+                reply.substr(sizeof(proto::RCBatchHeader) +
+                                 i * sizeof(proto::RCReply),
+                             sizeof(proto::RCReply)))
+                .value();
+        auto res_c = connect_with(rcs[start + i], qp_reply);
+        ret[start + i] = res_c.desc;
+        all_ok = all_ok && (res_c == IOCode::Ok);
+      }
+    }
+    if (!all_ok)
+      return ::rdmaio::Err(ret);
+    return ::rdmaio::Ok(ret);
+  }
+
+  /*!
+    The non-blocking versions of cc_rc and cc_rc_batch, which are issued at
+    another thread. Calls to the same ConnectManager are served one at a
+    time, so use one ConnectManager per server to connect them in parallel.
+
+    Example:
+    `
+    std::vector<Arc<ConnectManager>> cms; // one per server
+    std::vector<std::future<Result<std::vector<ConnectManager::cc_rc_ret_t>>>> fs;
+    for (uint i = 0; i < cms.size(); ++i)
+      fs.push_back(cms[i]->cc_rc_batch_async(names, rcs[i], nic_id, QPConfig()));
+    for (auto &f : fs)
+      RDMA_ASSERT(f.get() == IOCode::Ok);
+    `
+   */
+  std::future<Result<cc_rc_ret_t>>
+  cc_rc_async(const std::string &name, const Arc<::rdmaio::qp::RC> rc,
+              const ::rdmaio::nic_id_t &nic_id,
+              const ::rdmaio::qp::QPConfig &config,
+              const double &timeout_usec = 1000000) {
+    return std::async(std::launch::async, [=]() {
+      return cc_rc(name, rc, nic_id, config, timeout_usec);
+    });
+  }
+
+  std::future<Result<std::vector<cc_rc_ret_t>>>
+  cc_rc_batch_async(const std::vector<std::string> &names,
+                    const std::vector<Arc<::rdmaio::qp::RC>> &rcs,
+                    const ::rdmaio::nic_id_t &nic_id,
+                    const ::rdmaio::qp::QPConfig &config,
+                    const double &timeout_usec = 1000000) {
+    return std::async(std::launch::async, [=]() {
+      return cc_rc_batch(names, rcs, nic_id, config, timeout_usec);
+    });
+  }
+
   Result<cc_rc_ret_t> cc_rc_msg(const std::string &qp_name,
                                 const std::string &channel_name,
                                 const usize &msg_sz,
@@ -204,6 +339,7 @@ public:
                                 const ::rdmaio::nic_id_t &nic_id,
                                 const ::rdmaio::qp::QPConfig &config,
                                 const double &timeout_usec = 1000000) {
+    std::lock_guard<std::mutex> guard(call_lock);
 
     auto err_str = std::string("unknown error");
     u64 temp_key = 0;
@@ -278,6 +414,7 @@ public:
   using mr_res_t = std::pair<std::string, rmem::RegAttr>;
   Result<mr_res_t> fetch_remote_mr(const rmem::register_id_t &id,
                                    const double &timeout_usec = 1000000) {
+    std::lock_guard<std::mutex> guard(call_lock);
     auto res = rpc.call(proto::FetchMr,
                         ::rdmaio::Marshal::dump<proto::MRReq>({.id = id}));
     auto res_reply = rpc.receive_reply(timeout_usec);
@@ -310,6 +447,7 @@ public:
   using qp_attr_ret_t = std::pair<std::string, ::rdmaio::qp::QPAttr>;
   Result<qp_attr_ret_t> fetch_qp_attr(const std::string &name,
                                       const double &timeout_usec = 1000000) {
+    std::lock_guard<std::mutex> guard(call_lock);
     auto err_str = std::string("unknown error");
     {
       // 1. first, sanity check the arg
@@ -355,6 +493,30 @@ public:
   ErrCase:
     return ::rdmaio::Err(std::make_pair(err_str, ::rdmaio::qp::QPAttr()));
   }
+private:
+  /*!
+    Connect the local rc with the one created at remote end, which is
+    described by qp_reply
+   */
+  Result<cc_rc_ret_t> connect_with(const Arc<::rdmaio::qp::RC> &rc,
+                                   const proto::RCReply &qp_reply) {
+    switch (qp_reply.status) {
+    case proto::CallbackStatus::Ok: {
+      auto ret = rc->connect(qp_reply.attr);
+      if (ret != IOCode::Ok)
+        return ::rdmaio::Err(std::make_pair(ret.desc, qp_reply.key));
+      return ::rdmaio::Ok(std::make_pair(std::string(""), qp_reply.key));
+    }
+    case proto::CallbackStatus::ConnectErr:
+      return ::rdmaio::Err(
+          std::make_pair(std::string("Remote connect error"), u64(0)));
+    case proto::CallbackStatus::WrongArg:
+      return ::rdmaio::Err(std::make_pair(
+          std::string("Wrong arguments, possible the QP has exsists"), u64(0)));
+    default:
+      return ::rdmaio::Err(std::make_pair(err_unknown_status, u64(0)));
+    }
+  }
 };
 
 // a helper for hide wait_ready process
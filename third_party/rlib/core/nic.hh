@@ -60,6 +60,15 @@ public:
     return pd;
   }
 
+  /*!
+    The device name, e.g., "mlx5_0", which names its sysfs directory
+   */
+  std::string dev_name() const {
+    if (ctx == nullptr)
+      return "";
+    return std::string(ibv_get_device_name(ctx->device));
+  }
+
   ~RNic() {
     // pd must he deallocaed before ctx
     if (pd != nullptr) {
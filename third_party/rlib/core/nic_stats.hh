@@ -0,0 +1,223 @@
+#pragma once
+
+#include <dirent.h>
+
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "./nic.hh"
+#include "./qps/mod.hh"
+
+namespace rdmaio {
+
+// where the kernel exposes the RDMA devices
+const char kDefaultSysfsRoot[] = "/sys/class/infiniband";
+
+// counter name -> value, e.g., "hw_counters/rnr_nak_retry_err" -> 12
+using CounterSnapshot = std::map<std::string, u64>;
+
+/*!
+  NicCounters samples the counters of a port of an RNic from the sysfs:
+    <root>/<dev>/ports/<port>/counters/<name>     (IB port counters)
+    <root>/<dev>/ports/<port>/hw_counters/<name>  (device counters, e.g.,
+                                                   retransmits and NAKs)
+  The root is configurable, so it can be a fake tree in a test.
+  \note: the port data counters (e.g., port_xmit_data) are in 4-byte units.
+
+  Example:
+  `
+  auto counters = NicCounters::create(nic).value();
+  auto before = counters->sample();
+  // ... run
+  auto delta = NicCounters::delta(before, counters->sample());
+  RDMA_LOG(2) << NicCounters::to_json(NicCounters::transport_events(delta));
+  `
+ */
+class NicCounters {
+  const std::string port_dir;
+
+public:
+  const std::string dev_name;
+  const usize port;
+
+  NicCounters(const std::string &dev_name, const usize &port,
+              const std::string &root = kDefaultSysfsRoot)
+      : port_dir(root + "/" + dev_name + "/ports/" + std::to_string(port)),
+        dev_name(dev_name), port(port) {}
+
+  static Option<Arc<NicCounters>>
+  create(const std::string &dev_name, const usize &port,
+         const std::string &root = kDefaultSysfsRoot) {
+    auto res = std::make_shared<NicCounters>(dev_name, port, root);
+    if (res->valid())
+      return res;
+    return {};
+  }
+
+  static Option<Arc<NicCounters>>
+  create(const Arc<RNic> &nic, const std::string &root = kDefaultSysfsRoot) {
+    if (nic == nullptr || !nic->valid())
+      return {};
+    return create(nic->dev_name(), nic->id.port_id, root);
+  }
+
+  bool valid() const {
+    auto dir = opendir(port_dir.c_str());
+    if (dir == nullptr)
+      return false;
+    closedir(dir);
+    return true;
+  }
+
+  /*!
+    Read all the counters of the port; unreadable ones are skipped
+   */
+  CounterSnapshot sample() const {
+    CounterSnapshot res;
+    for (auto group : {"counters", "hw_counters"})
+      read_group(group, res);
+    return res;
+  }
+
+  /*!
+    The increase of each counter from old to cur; a counter which goes
+    backwards (e.g., reset) counts from zero
+   */
+  static CounterSnapshot delta(const CounterSnapshot &old,
+                               const CounterSnapshot &cur) {
+    CounterSnapshot res;
+    for (auto &c : cur) {
+      auto it = old.find(c.first);
+      u64 prev = (it == old.end() || it->second > c.second) ? 0 : it->second;
+      res[c.first] = c.second - prev;
+    }
+    return res;
+  }
+
+  /*!
+    The counters that indicate a transport problem (retransmits, NAKs,
+    errors); those not exposed by the device are absent
+   */
+  static CounterSnapshot transport_events(const CounterSnapshot &s) {
+    static const std::vector<std::string> events = {
+        "hw_counters/local_ack_timeout_err",
+        "hw_counters/rnr_nak_retry_err",
+        "hw_counters/packet_seq_err",
+        "hw_counters/out_of_sequence",
+        "hw_counters/implied_nak_seq_err",
+        "hw_counters/duplicate_request",
+        "hw_counters/out_of_buffer",
+        "hw_counters/req_cqe_error",
+        "hw_counters/resp_cqe_error",
+        "hw_counters/req_remote_access_errors",
+        "counters/port_rcv_errors",
+        "counters/port_xmit_discards",
+        "counters/port_xmit_wait",
+        "counters/symbol_error",
+        "counters/link_downed"};
+    CounterSnapshot res;
+    for (auto &e : events) {
+      auto it = s.find(e);
+      if (it != s.end())
+        res.insert(*it);
+    }
+    return res;
+  }
+
+  static std::string to_json(const CounterSnapshot &s) {
+    std::ostringstream oss;
+    oss << "{";
+    bool first = true;
+    for (auto &c : s) {
+      oss << (first ? "" : ",") << "\"" << c.first << "\":" << c.second;
+      first = false;
+    }
+    oss << "}";
+    return oss.str();
+  }
+
+private:
+  void read_group(const std::string &group, CounterSnapshot &res) const {
+    const auto dir_name = port_dir + "/" + group;
+    auto dir = opendir(dir_name.c_str());
+    if (dir == nullptr)
+      return;
+    for (auto e = readdir(dir); e != nullptr; e = readdir(dir)) {
+      const std::string name(e->d_name);
+      if (name.empty() || name[0] == '.')
+        continue;
+      std::ifstream in(dir_name + "/" + name);
+      u64 val = 0;
+      if (in >> val)
+        res[group + "/" + name] = val;
+    }
+    closedir(dir);
+  }
+};
+
+/*!
+  TransportStats collects the counters of some NICs and QPs, and reports
+  what happened since the previous report, so that a benchmark reporter can
+  correlate a throughput drop with the transport events of the same epoch.
+
+  Example:
+  `
+  TransportStats transport;
+  transport.add_nic(NicCounters::create(nic).value());
+  transport.add_qp(rc);
+  // every epoch
+  std::cout << transport.epoch_json() << std::endl;
+  `
+  \note: add_nic/add_qp should be called before the reports start.
+ */
+class TransportStats {
+  std::vector<Arc<NicCounters>> nics;
+  std::vector<CounterSnapshot> old_nics;
+
+  std::vector<Arc<qp::Dummy>> qps;
+  std::vector<qp::QPStats> old_qps;
+
+public:
+  void add_nic(const Arc<NicCounters> &n) {
+    nics.push_back(n);
+    old_nics.push_back(n->sample());
+  }
+
+  void add_qp(const Arc<qp::Dummy> &qp) {
+    qps.push_back(qp);
+    old_qps.push_back(qp->query_stats());
+  }
+
+  bool empty() const { return nics.empty() && qps.empty(); }
+
+  /*!
+    {"nics":[{"dev":..,"port":..,"events":{..}}],
+     "qps":[{"posted":..,"comps":..,..}]}
+    the counters (except in_flight) are the deltas since the last call
+   */
+  std::string epoch_json() {
+    std::ostringstream oss;
+    oss << "{\"nics\":[";
+    for (uint i = 0; i < nics.size(); ++i) {
+      auto cur = nics[i]->sample();
+      auto d = NicCounters::delta(old_nics[i], cur);
+      old_nics[i] = cur;
+      oss << (i ? "," : "") << "{\"dev\":\"" << nics[i]->dev_name
+          << "\",\"port\":" << nics[i]->port << ",\"events\":"
+          << NicCounters::to_json(NicCounters::transport_events(d)) << "}";
+    }
+    oss << "],\"qps\":[";
+    for (uint i = 0; i < qps.size(); ++i) {
+      auto cur = qps[i]->query_stats();
+      oss << (i ? "," : "") << cur.since(old_qps[i]).to_json();
+      old_qps[i] = cur;
+    }
+    oss << "]}";
+    return oss.str();
+  }
+};
+
+} // namespace rdmaio
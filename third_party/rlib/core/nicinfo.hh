@@ -6,8 +6,39 @@
 
 namespace rdmaio {
 
+/*!
+  The capabilities of an RNic, which bound the QPs and requests created on it
+ */
+struct DevCaps {
+  // max #scatter-gather entries of a (send or recv) request
+  int max_sge;
+  // max #outstanding requests of a QP's send (or recv) queue
+  int max_qp_wr;
+  int max_cqe;
+  int max_srq_wr;
+  // max #outstanding RDMA READs/atomics of a QP as the initiator
+  int max_qp_rd_atom;
+  ibv_atomic_cap atomic_cap;
+};
+
 class RNicInfo {
 public:
+  /*!
+    Query the capabilities of an opened RNic
+   */
+  static Option<DevCaps> query_caps(const Arc<RNic> &nic) {
+    ibv_device_attr attr;
+    if (nic == nullptr || !nic->valid() ||
+        ibv_query_device(nic->get_ctx(), &attr) != 0)
+      return {};
+    return DevCaps{.max_sge = attr.max_sge,
+                   .max_qp_wr = attr.max_qp_wr,
+                   .max_cqe = attr.max_cqe,
+                   .max_srq_wr = attr.max_srq_wr,
+                   .max_qp_rd_atom = attr.max_qp_rd_atom,
+                   .atomic_cap = attr.atomic_cap};
+  }
+
   /*!
     Query all available RNic on the host machine.
     Return a vector of all their index used by RLib,
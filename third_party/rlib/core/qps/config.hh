@@ -52,6 +52,19 @@ public:
     return max_send_size;
   }
 
+  /*!
+    The max #local segments (sges) of a send request, which should not
+    exceed the device's max_sge (see RNicInfo::query_caps)
+   */
+  QPConfig &set_max_send_sge(int num) {
+    max_send_sge = num;
+    return *this;
+  }
+
+  int max_send_sge_sz() const {
+    return max_send_sge;
+  }
+
   QPConfig &set_max_recv(int num) {
     max_recv_size = num;
     return *this;
@@ -108,6 +121,7 @@ private:
   int timeout = 20;
   int max_send_size = kRcMaxSendSz;
   int max_recv_size = kRcMaxRecvSz;
+  int max_send_sge = 1;
 
   int qkey = kDefaultQKey;
 
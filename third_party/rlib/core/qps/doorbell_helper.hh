@@ -35,10 +35,21 @@ const usize kNMaxDoorbell = 16;
   doorbell.freeze_done(); // re-set this doorbell to reuse, (optional)
   doorbell.clear(); // re-set the counter
   `
+
+  With NSGE > 1, a request can carry up to NSGE local segments:
+  `
+  DoorbellHelper<4, 2> doorbell(IBV_WR_RDMA_READ);
+  doorbell.next();
+  doorbell.cur_sge(0) = header_sge;
+  doorbell.cur_sge(1) = value_sge;
+  doorbell.cur_wr().num_sge = 2;
+  `
 */
-template <usize N = kNMaxDoorbell> struct DoorbellHelper {
+template <usize N = kNMaxDoorbell, usize NSGE = 1> struct DoorbellHelper {
+  static_assert(NSGE > 0, "");
   ibv_send_wr wrs[N];
-  ibv_sge sges[N];
+  // the sges of request i are [i * NSGE, (i + 1) * NSGE)
+  ibv_sge sges[N * NSGE];
 
   i8 cur_idx = -1;
 
@@ -54,7 +65,7 @@ template <usize N = kNMaxDoorbell> struct DoorbellHelper {
       // this is because before flushing the doorbelled requests,
       // we will modify change the laster pointer to nullptr
       wrs[i].next = &(wrs[i + 1]);
-      wrs[i].sg_list = &sges[i];
+      wrs[i].sg_list = &sges[i * NSGE];
     }
   }
 
@@ -70,6 +81,9 @@ template <usize N = kNMaxDoorbell> struct DoorbellHelper {
     if (unlikely(full()))
       return false;
     cur_idx += 1;
+    // a reused request may carry multiple sges of its last use
+    if (NSGE > 1)
+      wrs[cur_idx].num_sge = 1;
     return true;
   }
 
@@ -105,7 +119,16 @@ template <usize N = kNMaxDoorbell> struct DoorbellHelper {
 
   inline ibv_sge &cur_sge() {
     assert(!empty());
-    return sges[cur_idx];
+    return sges[cur_idx * NSGE];
+  }
+
+  /*!
+    The idx-th sge of the current request, idx in [0, NSGE);
+    set cur_wr().num_sge accordingly
+   */
+  inline ibv_sge &cur_sge(const usize &idx) {
+    assert(!empty() && idx < NSGE);
+    return sges[cur_idx * NSGE + idx];
   }
 
   inline ibv_send_wr *first_wr_ptr() { return &wrs[0]; }
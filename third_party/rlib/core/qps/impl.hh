@@ -112,11 +112,33 @@ public:
     return Ok(std::make_pair(ccq, std::string("")));
   }
 
+  /*!
+    create a shared receive queue, which holds at most max_wr recvs
+   */
+  using CreateSRQRes_t = Result<std::pair<ibv_srq *, std::string>>;
+  static CreateSRQRes_t create_srq(Arc<RNic> nic, const usize &max_wr) {
+    struct ibv_srq_init_attr srq_init_attr = {};
+    srq_init_attr.attr.max_wr = max_wr;
+    srq_init_attr.attr.max_sge = 1;
+
+    auto srq = ibv_create_srq(nic->get_pd(), &srq_init_attr);
+    if (srq == nullptr) {
+      return Err(std::make_pair(srq, std::string(strerror(errno))));
+    }
+    return Ok(std::make_pair(srq, std::string("")));
+  }
+
+  /*!
+    create the qp using underlying verbs API
+    if srq is not nullptr, the QP receives with the SRQ instead of its own
+    recv queue.
+   */
   using CreateQPRes_t = Result<std::pair<ibv_qp *, std::string>>;
   static CreateQPRes_t create_qp(Arc<RNic> nic, ibv_qp_type type,
                                  const QPConfig &config,
                                  ibv_cq *cq, // send cq
-                                 ibv_cq *recv_cq = nullptr) {
+                                 ibv_cq *recv_cq = nullptr,
+                                 ibv_srq *srq = nullptr) {
 
     if (cq == nullptr) {
       return Err(std::make_pair<ibv_qp *, std::string>(nullptr,
@@ -135,8 +157,9 @@ public:
     qp_init_attr.sq_sig_all = 0;
 
     qp_init_attr.cap.max_send_wr = config.max_send_sz();
-    qp_init_attr.cap.max_recv_wr = config.max_recv_sz();
-    qp_init_attr.cap.max_send_sge = 1;
+    qp_init_attr.cap.max_recv_wr = srq == nullptr ? config.max_recv_sz() : 0;
+    qp_init_attr.srq = srq;
+    qp_init_attr.cap.max_send_sge = config.max_send_sge;
     qp_init_attr.cap.max_recv_sge = 1;
     qp_init_attr.cap.max_inline_data = kMaxInlinSz;
 
@@ -0,0 +1,307 @@
+#pragma once
+
+#include <atomic>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+#include "./config.hh"
+#include "./transport.hh"
+
+namespace rdmaio {
+
+namespace qp {
+
+/*!
+  The maximum number of regions that can be registered to a LoopbackMem
+ */
+const usize kMaxLoopbackMRs = 64;
+
+/*!
+  LoopbackMem records the memory regions accessible by loopback transports,
+  it plays the role of the MR table of an RNIC.
+  Regions are registered before transports start to post requests, and
+  the lookup on the data path takes no lock.
+
+  A region can carry an access hook, which is called after each remote
+  access to it is executed, e.g., to emulate the latency of a slower memory.
+
+  Example:
+  `
+  auto mem = std::make_shared<LoopbackMem>();
+  RegAttr attr = mem->reg(buf, sz).value();
+  `
+ */
+class LoopbackMem {
+public:
+  // (addr, len, is_write)
+  using access_hook_t = std::function<void(const u64 &, const u64 &, bool)>;
+
+private:
+  struct Entry {
+    u64 buf;
+    u64 sz;
+    access_hook_t hook;
+  };
+
+  Entry entries[kMaxLoopbackMRs];
+  std::atomic<usize> num_entries;
+  std::mutex lock;
+
+public:
+  LoopbackMem() : num_entries(0) {}
+
+  /*!
+    Register [ptr, ptr + sz) and return its attribute.
+    The key is the index of the region in the table.
+   */
+  Option<RegAttr> reg(void *ptr, const u64 &sz,
+                      access_hook_t hook = nullptr) {
+    std::lock_guard<std::mutex> guard(lock);
+    auto idx = num_entries.load(std::memory_order_relaxed);
+    if (ptr == nullptr || idx >= kMaxLoopbackMRs)
+      return {};
+    entries[idx] = {
+        .buf = reinterpret_cast<u64>(ptr), .sz = sz, .hook = std::move(hook)};
+    num_entries.store(idx + 1, std::memory_order_release);
+    return RegAttr{.buf = reinterpret_cast<uintptr_t>(ptr),
+                   .sz = sz,
+                   .key = static_cast<mr_key_t>(idx)};
+  }
+
+  Option<RegAttr> reg(const Arc<RMem> &mem, access_hook_t hook = nullptr) {
+    return reg(mem->raw_ptr, mem->sz, std::move(hook));
+  }
+
+  /*!
+    Check whether [addr, addr + len) is covered by the region of key
+   */
+  bool valid_range(const mr_key_t &key, const u64 &addr,
+                   const u64 &len) const {
+    if (key >= num_entries.load(std::memory_order_acquire))
+      return false;
+    const auto &e = entries[key];
+    return addr >= e.buf && addr + len <= e.buf + e.sz && addr + len >= addr;
+  }
+
+  /*!
+    Notify the hook (if any) of the region of key on an executed access,
+    the range must have been checked by valid_range()
+   */
+  inline void on_access(const mr_key_t &key, const u64 &addr, const u64 &len,
+                        bool is_write) const {
+    const auto &e = entries[key];
+    if (unlikely(e.hook != nullptr))
+      e.hook(addr, len, is_write);
+  }
+};
+
+/*!
+  A software transport which executes one-sided requests against local memory
+  registered at a LoopbackMem, and reports completions via an emulated CQ.
+  It is used to run and debug the one-sided benchmarks without an RNIC, and to
+  compare the software-path overheads with the NIC numbers.
+
+  The emulation follows the RC semantics observable by the user:
+  - a request is executed at the time it is posted, in order;
+  - only the signaled requests generate completions;
+  - the send queue slots of unsignaled requests are only released when a
+    later signaled request has been polled, so posting too many unsignaled
+    requests results in an ENOMEM-like error as a real QP does;
+  - a failed request always generates an (error) completion, and moves the
+    transport into the error state, where all later requests complete with
+    IBV_WC_WR_FLUSH_ERR;
+  - atomics are 8-byte aligned and atomic w.r.t. other loopback atomics.
+
+  Example:
+  `
+  auto mem = std::make_shared<LoopbackMem>();
+  auto t = LoopbackTransport::create(mem).value();
+  t->bind_remote_mr(mem->reg(server_buf, sz).value());
+  t->bind_local_mr(mem->reg(client_buf, sz).value());
+  // then use it as any AbsTransport
+  `
+ */
+class LoopbackTransport : public AbsTransport {
+  struct Comp {
+    ibv_wc wc;
+    // #send queue slots released when this completion is polled
+    usize num_wrs;
+  };
+
+  Arc<LoopbackMem> mem;
+  const usize sq_depth;
+  const int max_sge;
+
+  // the emulated CQ
+  std::vector<Comp> cq;
+  usize cq_head = 0;
+  usize cq_num = 0;
+
+  usize sq_used = 0;
+  usize unsignaled_since_last = 0;
+
+  bool err = false;
+
+public:
+  LoopbackTransport(Arc<LoopbackMem> mem, const QPConfig &config = QPConfig())
+      : mem(std::move(mem)), sq_depth(config.max_send_sz()),
+        max_sge(config.max_send_sge_sz()), cq(config.max_send_sz()) {}
+
+  static Option<Arc<LoopbackTransport>>
+  create(Arc<LoopbackMem> mem, const QPConfig &config = QPConfig()) {
+    if (mem == nullptr || config.max_send_sz() <= 0)
+      return {};
+    return std::make_shared<LoopbackTransport>(std::move(mem), config);
+  }
+
+  bool in_error() const { return err; }
+
+  Result<std::string> post_send(ibv_send_wr &sr) override {
+    usize num = 0;
+    for (auto cur = &sr; cur != nullptr; cur = cur->next) {
+      // as ibv_post_send, reject requests exceeding the QP's max_send_sge
+      if (cur->num_sge > max_sge)
+        return ::rdmaio::Err(std::string(strerror(EINVAL)));
+      num += 1;
+    }
+    if (sq_used + num > sq_depth)
+      return ::rdmaio::Err(std::string(strerror(ENOMEM)));
+
+    for (auto cur = &sr; cur != nullptr; cur = cur->next) {
+      sq_used += 1;
+      unsignaled_since_last += 1;
+
+      auto status = err ? IBV_WC_WR_FLUSH_ERR : execute_one(*cur);
+      if (status != IBV_WC_SUCCESS)
+        err = true;
+
+      if ((cur->send_flags & IBV_SEND_SIGNALED) || status != IBV_WC_SUCCESS) {
+        push_comp(*cur, status);
+      }
+    }
+    return ::rdmaio::Ok(std::string(""));
+  }
+
+  int poll_comps(const int &num, ibv_wc *wcs) override {
+    int n = 0;
+    while (n < num && cq_num > 0) {
+      auto &c = cq[cq_head];
+      wcs[n++] = c.wc;
+      sq_used -= c.num_wrs;
+      cq_head = (cq_head + 1) % cq.size();
+      cq_num -= 1;
+    }
+    out_signaled -= n;
+    return n;
+  }
+
+private:
+  void push_comp(const ibv_send_wr &wr, const ibv_wc_status &status) {
+    auto &c = cq[(cq_head + cq_num) % cq.size()];
+    memset(&c.wc, 0, sizeof(ibv_wc));
+    c.wc.wr_id = wr.wr_id;
+    c.wc.status = status;
+    c.wc.opcode = wc_opcode(wr.opcode);
+    c.wc.byte_len = payload_sz(wr);
+    c.num_wrs = unsignaled_since_last;
+
+    unsignaled_since_last = 0;
+    cq_num += 1;
+    out_signaled += 1;
+  }
+
+  static ibv_wc_opcode wc_opcode(const ibv_wr_opcode &op) {
+    switch (op) {
+    case IBV_WR_RDMA_READ:
+      return IBV_WC_RDMA_READ;
+    case IBV_WR_ATOMIC_CMP_AND_SWP:
+      return IBV_WC_COMP_SWAP;
+    case IBV_WR_ATOMIC_FETCH_AND_ADD:
+      return IBV_WC_FETCH_ADD;
+    case IBV_WR_SEND:
+    case IBV_WR_SEND_WITH_IMM:
+      return IBV_WC_SEND;
+    default:
+      return IBV_WC_RDMA_WRITE;
+    }
+  }
+
+  static u32 payload_sz(const ibv_send_wr &wr) {
+    u32 sz = 0;
+    for (int i = 0; i < wr.num_sge; ++i)
+      sz += wr.sg_list[i].length;
+    return sz;
+  }
+
+  bool valid_local(const ibv_send_wr &wr) const {
+    if (wr.send_flags & IBV_SEND_INLINE)
+      return true;
+    for (int i = 0; i < wr.num_sge; ++i) {
+      const auto &sge = wr.sg_list[i];
+      if (!mem->valid_range(sge.lkey, sge.addr, sge.length))
+        return false;
+    }
+    return true;
+  }
+
+  ibv_wc_status execute_one(const ibv_send_wr &wr) {
+    if (!valid_local(wr))
+      return IBV_WC_LOC_PROT_ERR;
+
+    switch (wr.opcode) {
+    case IBV_WR_RDMA_READ:
+    case IBV_WR_RDMA_WRITE:
+    case IBV_WR_RDMA_WRITE_WITH_IMM: {
+      const auto total = payload_sz(wr);
+      if (!mem->valid_range(wr.wr.rdma.rkey, wr.wr.rdma.remote_addr, total))
+        return IBV_WC_REM_ACCESS_ERR;
+
+      char *remote = reinterpret_cast<char *>(wr.wr.rdma.remote_addr);
+      for (int i = 0; i < wr.num_sge; ++i) {
+        const auto &sge = wr.sg_list[i];
+        char *local = reinterpret_cast<char *>(sge.addr);
+        if (wr.opcode == IBV_WR_RDMA_READ)
+          memcpy(local, remote, sge.length);
+        else
+          memcpy(remote, local, sge.length);
+        remote += sge.length;
+      }
+      mem->on_access(wr.wr.rdma.rkey, wr.wr.rdma.remote_addr, total,
+                     wr.opcode != IBV_WR_RDMA_READ);
+    } break;
+    case IBV_WR_ATOMIC_CMP_AND_SWP:
+    case IBV_WR_ATOMIC_FETCH_AND_ADD: {
+      const auto raddr = wr.wr.atomic.remote_addr;
+      if (wr.num_sge != 1 || wr.sg_list[0].length != sizeof(u64) ||
+          raddr % sizeof(u64) != 0)
+        return IBV_WC_REM_INV_REQ_ERR;
+      if (!mem->valid_range(wr.wr.atomic.rkey, raddr, sizeof(u64)))
+        return IBV_WC_REM_ACCESS_ERR;
+
+      u64 *remote = reinterpret_cast<u64 *>(raddr);
+      u64 old = 0;
+      if (wr.opcode == IBV_WR_ATOMIC_CMP_AND_SWP) {
+        old = wr.wr.atomic.compare_add;
+        __atomic_compare_exchange_n(remote, &old, wr.wr.atomic.swap, false,
+                                    __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+      } else {
+        old = __atomic_fetch_add(remote, wr.wr.atomic.compare_add,
+                                 __ATOMIC_SEQ_CST);
+      }
+      // the original value is returned in the local buffer
+      memcpy(reinterpret_cast<void *>(wr.sg_list[0].addr), &old, sizeof(u64));
+      mem->on_access(wr.wr.atomic.rkey, raddr, sizeof(u64), true);
+    } break;
+    default:
+      // two-sided verbs require a receiver, which loopback does not have
+      return IBV_WC_REM_INV_REQ_ERR;
+    }
+    return IBV_WC_SUCCESS;
+  }
+};
+
+} // namespace qp
+
+} // namespace rdmaio
@@ -1,5 +1,9 @@
 #pragma once
 
+#include <algorithm>
+#include <sstream>
+#include <utility>
+
 #include "../common.hh"
 #include "../naming.hh"
 #include "../nic.hh"
@@ -15,26 +19,110 @@ namespace qp {
 
 const usize kMaxInlinSz = 64;
 
-using ProgressMark_t = u16;
-// Track the out-going and acknowledged reqs
+using ProgressMark_t = u64;
+/*!
+  Track the out-going and acknowledged reqs of a QP, by 64-bit sequence
+  numbers which never wrap in practice.
+  Only the low num_progress_bits of a sequence are packed into a wr_id
+  (alongside user bits); decode() recovers the full sequence, given that
+  less than 2^num_progress_bits reqs are pending, which is always true since
+  the send queue is much shallower.
+ */
 struct Progress {
-  static constexpr const u32 num_progress_bits = sizeof(ProgressMark_t) * 8;
+  // #bits of the sequence packed in a wr_id
+  static constexpr const u32 num_progress_bits = 16;
 
   ProgressMark_t high_watermark = 0;
   ProgressMark_t low_watermark = 0;
 
+  /*!
+    Issue num reqs, return the sequence of the last one
+   */
   ProgressMark_t forward(ProgressMark_t num) {
     high_watermark += num;
     return high_watermark;
   }
 
-  void done(int num) { low_watermark = num; }
+  /*!
+    All the reqs up to the sequence num are done
+   */
+  void done(ProgressMark_t num) {
+    if (num > low_watermark)
+      low_watermark = num;
+  }
+
+  /*!
+    Recover the full sequence from its low bits in a wr_id
+   */
+  ProgressMark_t decode(const u64 &low_bits) const {
+    const auto mask = bitmask<u64>(num_progress_bits);
+    return high_watermark - ((high_watermark - low_bits) & mask);
+  }
+
+  ProgressMark_t pending_reqs() const { return high_watermark - low_watermark; }
+};
+
+/*!
+  Per-QP counters of the send queue and its CQ, maintained by the rlib
+  post/poll paths (i.e., not by a raw ibv_post_send on the qp).
+  They are plain counters updated by the thread owning the QP, so a reader
+  from another thread (e.g., a reporter) may see slightly stale values.
+  Use Dummy::query_stats() to also fill the in-flight requests.
+ */
+struct QPStats {
+  // requests posted
+  u64 posted = 0;
+  // completions polled, and those with an error status
+  u64 comps = 0;
+  u64 err_comps = 0;
+  // polls of the send CQ, and those returning nothing
+  u64 polls = 0;
+  u64 empty_polls = 0;
+  // requests posted but not completed, filled by query_stats()
+  u64 in_flight = 0;
+
+  void on_post(const u64 &num) { posted += num; }
+
+  void on_poll(const int &num, const ibv_wc *wcs) {
+    polls += 1;
+    if (num <= 0) {
+      empty_polls += 1;
+      return;
+    }
+    comps += num;
+    for (int i = 0; i < num; ++i)
+      err_comps += (wcs[i].status != IBV_WC_SUCCESS) ? 1 : 0;
+  }
+
+  // exact if the unsignaled requests are tracked (see RC::pending_reqs),
+  // otherwise they count as completed once posted
+  u64 completed() const { return posted - std::min(posted, in_flight); }
 
-  ProgressMark_t pending_reqs() const {
-    if (high_watermark >= low_watermark)
-      return high_watermark - low_watermark;
-    return std::numeric_limits<ProgressMark_t>::max() -
-           (low_watermark - high_watermark) + 1;
+  // the ratio of polls that get completions
+  double poll_hit_ratio() const {
+    return polls == 0 ? 0 : static_cast<double>(polls - empty_polls) / polls;
+  }
+
+  /*!
+    The counters increased since old; in_flight is kept as the current one
+   */
+  QPStats since(const QPStats &old) const {
+    QPStats res = *this;
+    res.posted -= old.posted;
+    res.comps -= old.comps;
+    res.err_comps -= old.err_comps;
+    res.polls -= old.polls;
+    res.empty_polls -= old.empty_polls;
+    return res;
+  }
+
+  std::string to_json() const {
+    std::ostringstream oss;
+    oss << "{\"posted\":" << posted << ",\"comps\":" << comps
+        << ",\"err_comps\":" << err_comps << ",\"in_flight\":" << in_flight
+        << ",\"polls\":" << polls << ",\"poll_hit\":" << poll_hit_ratio()
+        << "}";
+    return oss.str();
   }
 };
 
@@ -60,6 +148,8 @@ public:
   // #of outsignaled RDMA requests
   usize out_signaled = 0;
 
+  QPStats stats;
+
   Arc<RNic> nic;
 
   ~Dummy() {
@@ -79,6 +169,24 @@ public:
 
   inline usize ongoing_signaled() const { return out_signaled; }
 
+  /*!
+    #requests posted but not completed; without a finer tracking,
+    only the signaled ones are known
+   */
+  virtual u64 pending_reqs() const { return out_signaled; }
+
+  /*!
+    Called on each completion polled by poll_send_comp (and wait_one_comp),
+    e.g., RC retires the requests it covers
+   */
+  virtual void on_send_comp(const ibv_wc &wc) {}
+
+  QPStats query_stats() const {
+    QPStats res = stats;
+    res.in_flight = pending_reqs();
+    return res;
+  }
+
   /*!
     Send the requests specificed by the sr
     \ret: errno
@@ -89,6 +197,7 @@ public:
     auto rc = ibv_post_send(qp, &sr, bad_sr);
     if (rc == 0) {
       // ok
+      stats.on_post(num);
       return Ok(0);
     }
     return Err(errno);
@@ -101,8 +210,11 @@ public:
   inline std::pair<int,ibv_wc> poll_send_comp(const int &num) {
     ibv_wc wc;
     auto poll_result = ibv_poll_cq(cq, num, &wc);
-    if (poll_result > 0)
+    if (poll_result > 0) {
       out_signaled -= 1;
+      on_send_comp(wc);
+    }
+    stats.on_poll(poll_result, &wc);
     return std::make_pair(poll_result,wc);
   }
 
@@ -180,6 +292,7 @@ public:
 
 #include "rc.hh"
 #include "ud.hh"
+#include "srq.hh"
 
 namespace rdmaio {
 namespace qp {
@@ -39,6 +39,15 @@ enum op_type {
       op.set_atomic_rbuf(rbuf_ptr, rmr.key).set_fetch_add(add_data);
       op.set_payload(lbuf_ptr, sizeof(u64), lmr.key)
       auto ret = op.execute(qp, IBV_SEND_SIGNALED);
+
+ scatter-gather operation, without copying the fragments into one buffer.
+ The QP should be created with QPConfig().set_max_send_sge(NSGE).
+      // read a (remote contiguous) record into a local header and value
+      Op<2> op;
+      op.set_rdma_addr(off, rmr).set_read().clear_payloads();
+      op.add_payload(header_ptr, sizeof(Header), lmr.key);
+      op.add_payload(value_ptr, value_sz, lmr.key);
+      auto ret = op.execute(qp, IBV_SEND_SIGNALED);
  */
 template <usize NSGE = 1> struct Op {
   static_assert(NSGE > 0 && NSGE <= 64, "shoud use NSGE in (0,64]");
@@ -146,6 +155,41 @@ public:
     return true;
   }
 
+  /*!
+    Reset the local segments, to add_payload() them one by one
+   */
+  inline Op &clear_payloads() {
+    this->wr.num_sge = 0;
+    return *this;
+  }
+
+  /*!
+    Append a local segment to the request, at most NSGE
+   */
+  template <typename T>
+  inline bool add_payload(const T *addr, const u32 &length, const u32 &lkey) {
+    if (unlikely(this->wr.num_sge >= static_cast<int>(NSGE)))
+      return false;
+    this->sges[this->wr.num_sge++] = {
+        .addr = (u64)addr,
+        .length = length,
+        .lkey = lkey,
+    };
+    return true;
+  }
+
+  inline int sge_num() const { return this->wr.num_sge; }
+
+  /*!
+    Total bytes of the local segments
+   */
+  inline u64 payload_sz() const {
+    u64 sz = 0;
+    for (int i = 0; i < this->wr.num_sge; ++i)
+      sz += this->sges[i].length;
+    return sz;
+  }
+
   inline auto execute_batch(const Arc<RC> &qp) -> Result<std::string> {
     // to avoid performance overhead of Arc, we first extract QP's raw pointer
     // out
@@ -154,6 +198,9 @@ public:
       temp;
     });
 
+    if (unlikely(this->wr.num_sge > qp_ptr->my_config.max_send_sge_sz()))
+      return ::rdmaio::Err(std::string("too many sges for the QP"));
+
     if (this->wr.send_flags & IBV_SEND_SIGNALED) {
       qp_ptr->out_signaled += 1;
     }
@@ -161,6 +208,7 @@ public:
     auto res = ibv_post_send(qp_ptr->qp, &this->wr, &bad_sr);
 
     if (0 == res) {
+      qp_ptr->stats.on_post(1);
       return ::rdmaio::Ok(std::string(""));
     }
     return ::rdmaio::Err(std::string(strerror(errno)));
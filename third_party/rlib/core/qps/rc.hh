@@ -1,7 +1,12 @@
 #pragma once
 
+#include <algorithm>
+#include <vector>
+
 #include "../rmem/handler.hh"
 
+#include "../nicinfo.hh"
+
 #include "./mod.hh"
 #include "./impl.hh"
 
@@ -52,9 +57,15 @@ public:
 
   // pending requests monitor
   Progress progress;
+
+  // the user wr_ids of the pending requests, indexed by their sequences
+  std::vector<u64> user_wrs;
 public:
   const QPConfig my_config;
 
+  // the shared receive queue of this QP, if any
+  ibv_srq *srq = nullptr;
+
   /* the only constructor
      make it private because it may failed to create
      use the factory method to create it:
@@ -64,7 +75,9 @@ public:
      }
   */
 private:
-  RC(Arc<RNic> nic, const QPConfig &config,ibv_cq *recv_cq = nullptr) : Dummy(nic), my_config(config) {
+  RC(Arc<RNic> nic, const QPConfig &config, ibv_cq *recv_cq = nullptr,
+     ibv_srq *srq = nullptr, ibv_cq *send_cq = nullptr)
+      : Dummy(nic), my_config(config), srq(srq) {
     /*
       It takes 3 steps to create an RC QP during the initialization
       according to the RDMA programming mannal.
@@ -72,24 +85,43 @@ private:
       Then, we create the qp.
       Finally, we change the qp to read_to_init status.
      */
-    // 1 cq
-    auto res = Impl::create_cq(nic, my_config.max_send_sz());
-    if (res != IOCode::Ok) {
-      RDMA_LOG(4) << "Error on creating CQ: " << std::get<1>(res.desc);
-      return;
+    // 0 sanity check the scatter-gather entries against the device
+    if (my_config.max_send_sge_sz() > 1) {
+      auto caps = RNicInfo::query_caps(nic);
+      if (!caps || caps.value().max_sge < my_config.max_send_sge_sz()) {
+        RDMA_LOG(4) << "the device does not support "
+                    << my_config.max_send_sge_sz() << " sges per request";
+        return;
+      }
+    }
+
+    // 1 cq, which may be shared with other QPs
+    if (send_cq == nullptr) {
+      auto res = Impl::create_cq(nic, my_config.max_send_sz());
+      if (res != IOCode::Ok) {
+        RDMA_LOG(4) << "Error on creating CQ: " << std::get<1>(res.desc);
+        return;
+      }
+      send_cq = std::get<0>(res.desc);
     }
-    this->cq = std::get<0>(res.desc);
+    this->cq = send_cq;
 
     // FIXME: we donot sanity check the the incoming recv_cq
     // The choice is that the recv cq could be shared among other QPs
     // shall we replace this with smart pointers ?
     this->recv_cq = recv_cq;
 
+    // the send queue bounds the #pending requests
+    usize ring_sz = 1;
+    while (ring_sz < static_cast<usize>(std::max(my_config.max_send_sz(), 1)))
+      ring_sz <<= 1;
+    user_wrs.resize(ring_sz);
+
     // 2 qp
-    auto res_qp =
-        Impl::create_qp(nic, IBV_QPT_RC, my_config, this->cq, this->recv_cq);
+    auto res_qp = Impl::create_qp(nic, IBV_QPT_RC, my_config, this->cq,
+                                  this->recv_cq, this->srq);
     if (res_qp != IOCode::Ok) {
-      RDMA_LOG(4) << "Error on creating QP: " << std::get<1>(res.desc);
+      RDMA_LOG(4) << "Error on creating QP: " << std::get<1>(res_qp.desc);
       return;
     }
     this->qp = std::get<0>(res_qp.desc);
@@ -103,10 +135,21 @@ private:
   }
 
 public:
+  /*!
+    Create an RC QP.
+    - recv_cq: the recv_cq shared with other QPs, nullptr to use the send CQ;
+    - srq: the shared receive queue (see srq.hh) to receive with, instead of
+      a private recv queue, so recvs must be posted to the SRQ;
+    - send_cq: the send CQ shared with other QPs, nullptr to create a
+      private one. A shared send CQ returns the completions of all its QPs,
+      so the wr_ids should tell them apart.
+   */
   static Option<Arc<RC>> create(Arc<RNic> nic,
                                 const QPConfig &config = QPConfig(),
-                                ibv_cq *recv_cq = nullptr) {
-    auto res = Arc<RC>(new RC(nic, config,recv_cq));
+                                ibv_cq *recv_cq = nullptr,
+                                ibv_srq *srq = nullptr,
+                                ibv_cq *send_cq = nullptr) {
+    auto res = Arc<RC>(new RC(nic, config, recv_cq, srq, send_cq));
     if (res->valid()) {
       return Option<Arc<RC>>(std::move(res));
     }
@@ -200,9 +243,19 @@ public:
     return send_normal(desc, payload, local_mr.value(), remote_mr.value());
   }
 
+  /*!
+    Issue forward_num requests on behalf of the user wr, and encode the
+    sequence of the last one in the wr_id to post.
+    \note: the user wr should fit in (64 - Progress::num_progress_bits) bits
+   */
   u64 encode_my_wr(const u64 &wr, int forward_num) {
+    auto seq = progress.forward(forward_num);
+    RDMA_ASSERT(progress.pending_reqs() <= user_wrs.size())
+        << "too many pending requests: " << progress.pending_reqs();
+    for (auto s = seq - forward_num + 1; s <= seq; ++s)
+      user_wrs[s & (user_wrs.size() - 1)] = wr;
     return (static_cast<u64>(wr) << Progress::num_progress_bits) |
-           static_cast<u64>(progress.forward(forward_num));
+           (seq & bitmask<u64>(Progress::num_progress_bits));
   }
 
   Result<std::string> send_normal(const ReqDesc &desc,
@@ -235,6 +288,7 @@ public:
 
     auto rc = ibv_post_send(qp, &sr, &bad_sr);
     if (0 == rc) {
+      stats.on_post(1);
       return Ok(std::string(""));
     }
     return Err(std::string(strerror(errno)));
@@ -249,14 +303,63 @@ public:
     auto num_wc = poll_send_comp(1);
     if (std::get<0>(num_wc) == 0)
       return {};
+    // the progress is retired by on_send_comp
     auto &wc = std::get<1>(num_wc);
     u64 user_wr = wc.wr_id >> (Progress::num_progress_bits);
+    return std::make_pair(user_wr, wc);
+  }
 
+  /*!
+    Retire the requests covered by a completion of poll_send_comp, so that
+    the callers reaping by wait_one_comp also keep the progress.
+    \note: the requests should be posted with wr_ids of encode_my_wr
+   */
+  void on_send_comp(const ibv_wc &wc) override {
+    if (progress.pending_reqs() == 0)
+      return;
     const auto mask = bitmask<u64>(Progress::num_progress_bits);
-    u64 water_mark = wc.wr_id & bitmask<u64>(Progress::num_progress_bits);
-    progress.done(water_mark);
+    progress.done(progress.decode(wc.wr_id & mask));
+  }
 
-    return std::make_pair(user_wr, wc);
+  /*!
+    Poll at most n (up to kMaxRcPollBatch) completions at once.
+    RC completes requests in order, so a (selectively) signaled completion
+    also completes all the unsignaled requests posted before it.
+    For every completed request, in order, calls
+      f(user_wr, seq, wc)
+    where seq is its 64-bit sequence, and wc is the completion covering it.
+
+    \ret the number of polled completions, negative on a poll error
+    \note: the requests should be posted with wr_ids of encode_my_wr (e.g.,
+    by send_normal)
+
+    Example:
+    `
+    qp->poll_rc_comps(16, [&](const u64 &user_wr, const u64 &seq,
+                              const ibv_wc &wc) {
+      // e.g., wake up the coroutine user_wr
+    });
+    `
+   */
+  static constexpr int kMaxRcPollBatch = 64;
+
+  template <typename F> int poll_rc_comps(const int &n, F &&f) {
+    ibv_wc wcs[kMaxRcPollBatch];
+    auto num = ibv_poll_cq(cq, std::min<int>(n, int(kMaxRcPollBatch)), wcs);
+    stats.on_poll(num, wcs);
+    if (num <= 0)
+      return num;
+    out_signaled -= std::min<usize>(out_signaled, num);
+
+    const auto mask = bitmask<u64>(Progress::num_progress_bits);
+    const auto ring_mask = user_wrs.size() - 1;
+    for (int i = 0; i < num; ++i) {
+      auto seq = progress.decode(wcs[i].wr_id & mask);
+      for (auto s = progress.low_watermark + 1; s <= seq; ++s)
+        f(user_wrs[s & ring_mask], s, wcs[i]);
+      progress.done(seq);
+    }
+    return num;
   }
 
   Result<std::pair<u64, ibv_wc>>
@@ -277,6 +380,16 @@ public:
   }
 
   int max_send_sz() const { return my_config.max_send_size; }
+
+  /*!
+    The requests posted with encode_my_wr (e.g., by send_normal) are tracked
+    by the progress, including the unsignaled ones, and retired by all the
+    poll paths; the others (e.g., posted by an Op or an RCTransport) are
+    only known by out_signaled.
+   */
+  u64 pending_reqs() const override {
+    return std::max<u64>(progress.pending_reqs(), out_signaled);
+  }
 };
 
 } // namespace qp
@@ -8,17 +8,21 @@ namespace rdmaio {
 
 namespace qp {
 /*!
-  Common structure shared by a recv endpoint
+  Common structure shared by a recv endpoint.
+  If srq is set, the QPs of the endpoint receive with the SRQ (and its
+  recv_cq, which should be cq), so no per-QP recv entries are allocated.
  */
 struct RecvCommon {
   ibv_cq *cq;
   Arc<AbsRecvAllocator> allocator;
+  Arc<SRQ> srq = nullptr;
 
-  RecvCommon(ibv_cq *cq, Arc<AbsRecvAllocator> alloc)
-      : cq(cq), allocator(alloc) {}
+  RecvCommon(ibv_cq *cq, Arc<AbsRecvAllocator> alloc, Arc<SRQ> srq = nullptr)
+      : cq(cq), allocator(alloc), srq(srq) {}
 
-  static Option<Arc<RecvCommon>> create(ibv_cq *cq, Arc<AbsRecvAllocator> alloc) {
-    return std::make_shared<RecvCommon>(cq,alloc);
+  static Option<Arc<RecvCommon>> create(ibv_cq *cq, Arc<AbsRecvAllocator> alloc,
+                                        Arc<SRQ> srq = nullptr) {
+    return std::make_shared<RecvCommon>(cq, alloc, srq);
   }
 };
 
@@ -59,7 +63,7 @@ public:
 
       // 1. sanity check the request
       if (!(rc_req.whether_create == static_cast<u8>(1) ||
-            rc_req.whether_create != static_cast<u8>(0)))
+            rc_req.whether_create == static_cast<u8>(0)))
         goto WA;
 
       // 1. check whether we need to create the QP
@@ -72,17 +76,26 @@ public:
 
         // 1.0 check whether we are able to use the registered recv_cq
         ibv_cq *recv_cq = nullptr;
+        Arc<SRQ> srq = nullptr;
         if (rc_req.whether_recv == 1) {
           auto recv_c_res = reg_recv_cqs.query(rc_req.name_recv);
           if (!recv_c_res)
             recv_cq = nullptr;
-          else
+          else {
             recv_cq = recv_c_res.value()->cq;
+            srq = recv_c_res.value()->srq;
+          }
         }
+        if (recv_cq == nullptr)
+          goto WA;
 
         // 1.1 try to create and register this QP
-        auto rc = qp::RC::create(nic.value(), rc_req.config, recv_cq).value();
-        auto rc_status = rctrl_p->registered_qps.reg(rc_req.name, rc);
+        auto rc_res = qp::RC::create(nic.value(), rc_req.config, recv_cq,
+                                     srq ? srq->srq : nullptr);
+        if (!rc_res)
+          goto Err;
+        auto rc = rc_res.value();
+        auto rc_status = rctrl_p->reg_client_qp(rc_req.name, rc);
 
         if (!rc_status) {
           // clean up
@@ -98,9 +111,15 @@ public:
         key = rc_status.value();
 
         // 1.3 this QP is done, alloc the recv; entries
+        // the QPs with an SRQ share its (already posted) recv entries
+        if (srq != nullptr)
+          return rctrl_p->fetch_qp_attr(rc_req, key);
         auto recv_c_res = reg_recv_cqs.query(rc_req.name_recv); // must exsist, because we have checked in step 1.0
         auto recv_entries = RecvEntriesFactoryv2<R>::create(recv_c_res.value()->allocator, rc_req.max_recv_sz);
-        RDMA_ASSERT(reg_recv_entries.reg(rc_req.name, recv_entries));
+        if (rctrl_p->is_persistent())
+          reg_recv_entries.reg_or_replace(rc_req.name, recv_entries);
+        else
+          RDMA_ASSERT(reg_recv_entries.reg(rc_req.name, recv_entries));
 
         // 1.4 we post_recvs
         auto res = rc->post_recvs(*recv_entries, R);
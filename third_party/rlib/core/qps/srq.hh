@@ -0,0 +1,177 @@
+#pragma once
+
+#include <unordered_map>
+#include <vector>
+
+#include "../nic.hh"
+#include "./impl.hh"
+#include "./recv_helper.hh"
+
+namespace rdmaio {
+
+namespace qp {
+
+/*!
+  A shared receive queue (SRQ), and the recv_cq of the QPs attached to it.
+  All QPs attached to an SRQ consume its recv buffers, so a server hosts
+  many clients with a fixed receive pool, instead of one RecvEntries per QP.
+
+  Unlike a QP's recv queue, messages from different QPs consume the buffers
+  out of order. So SRQ re-posts exactly the buffers of the polled
+  completions (identified by their wr_id, i.e., the buffer address), which
+  makes it a drop-in QP for RecvIter.
+
+  Example:
+  `
+  auto srq = SRQ::create(nic, 4096).value();
+  auto entries = RecvEntriesFactoryv2<4096>::create(alloc, 4096);
+  RDMA_ASSERT(srq->attach(*entries) == IOCode::Ok);
+
+  // QPs created with the SRQ share its recv buffers, and its recv_cq
+  auto rc = RC::create(nic, QPConfig(), srq->recv_cq, srq->srq).value();
+
+  for (RecvIter<SRQ, 4096> iter(srq, entries); iter.has_msgs(); iter.next()) {
+    auto imm_msg = iter.cur_msg().value();
+    // handle the msg
+  }
+  `
+ */
+class SRQ {
+public:
+  ibv_srq *srq = nullptr;
+  // the recv_cq shared by the QPs attached to this SRQ
+  ibv_cq *recv_cq = nullptr;
+
+  const usize max_wr;
+
+  Arc<RNic> nic;
+
+  /*!
+    Create an SRQ with at most max_wr outstanding recvs.
+    If recv_cq is nullptr, a recv_cq which holds max_wr completions is
+    created for the SRQ.
+   */
+  static Option<Arc<SRQ>> create(Arc<RNic> nic, const usize &max_wr,
+                                 ibv_cq *recv_cq = nullptr) {
+    auto res = Arc<SRQ>(new SRQ(nic, max_wr, recv_cq));
+    if (res->valid())
+      return res;
+    return {};
+  }
+
+  bool valid() const { return srq != nullptr && recv_cq != nullptr; }
+
+  /*!
+    Post all the recv entries to the SRQ.
+    The entries should be created by RecvEntriesFactory(v2), whose wr_id
+    is the address of the recv buffer.
+   */
+  template <usize N> Result<int> attach(RecvEntries<N> &r) {
+    if (posted.size() + N > max_wr)
+      return Err(ENOMEM);
+    for (uint i = 0; i < N; ++i)
+      posted.insert(std::make_pair(r.rs[i].wr_id, r.sges[i]));
+
+    auto temp = std::exchange(r.wr_ptr(N - 1)->next, nullptr);
+    struct ibv_recv_wr *bad_rr;
+    auto rc = ibv_post_srq_recv(srq, r.wr_ptr(0), &bad_rr);
+    r.wr_ptr(N - 1)->next = temp;
+
+    if (rc != 0)
+      return Err(errno);
+    return Ok(0);
+  }
+
+  /*!
+    Re-post the recv buffers of the first *num* completions in r.wcs,
+    which are filled by RecvIter.
+
+    \ret
+    - Err: errno
+    - Ok: -
+   */
+  template <usize N> Result<int> post_recvs(RecvEntries<N> &r, int num) {
+    int n = 0;
+    for (int i = 0; i < num; ++i) {
+      auto it = posted.find(r.wcs[i].wr_id);
+      if (unlikely(it == posted.end())) {
+        RDMA_LOG(4) << "unknown recv buffer: " << r.wcs[i].wr_id;
+        continue;
+      }
+      sges[n] = it->second;
+      rs[n].wr_id = it->first;
+      rs[n].sg_list = &sges[n];
+      rs[n].num_sge = 1;
+      rs[n].next = rs.data() + n + 1;
+      n += 1;
+    }
+    if (n == 0)
+      return Ok(0);
+    rs[n - 1].next = nullptr;
+
+    struct ibv_recv_wr *bad_rr;
+    auto rc = ibv_post_srq_recv(srq, &rs[0], &bad_rr);
+    if (rc != 0)
+      return Err(errno);
+    return Ok(0);
+  }
+
+  /*!
+    The number of recv buffers attached to this SRQ
+   */
+  usize attached() const { return posted.size(); }
+
+  /*!
+    \note: the QPs attached should be destroyed before
+   */
+  ~SRQ() {
+    if (srq) {
+      int rc = ibv_destroy_srq(srq);
+      RDMA_VERIFY(WARNING, rc == 0)
+          << "Failed to destroy SRQ " << strerror(errno);
+    }
+    if (own_cq && recv_cq) {
+      int rc = ibv_destroy_cq(recv_cq);
+      RDMA_VERIFY(WARNING, rc == 0)
+          << "Failed to destroy the recv CQ of SRQ " << strerror(errno);
+    }
+  }
+
+private:
+  // whether the recv_cq is created by (and destroyed with) this SRQ
+  bool own_cq = false;
+
+  // recv buffer address -> its sge
+  std::unordered_map<u64, ibv_sge> posted;
+
+  // scratch space for re-posting
+  std::vector<ibv_recv_wr> rs;
+  std::vector<ibv_sge> sges;
+
+  SRQ(Arc<RNic> nic, const usize &max_wr, ibv_cq *cq)
+      : max_wr(max_wr), nic(nic), rs(max_wr), sges(max_wr) {
+    if (cq == nullptr) {
+      auto res = Impl::create_cq(nic, max_wr);
+      if (res != IOCode::Ok) {
+        RDMA_LOG(4) << "Error on creating recv CQ: " << std::get<1>(res.desc);
+        return;
+      }
+      cq = std::get<0>(res.desc);
+      own_cq = true;
+    }
+    this->recv_cq = cq;
+
+    auto res_srq = Impl::create_srq(nic, max_wr);
+    if (res_srq != IOCode::Ok) {
+      RDMA_LOG(4) << "Error on creating SRQ: " << std::get<1>(res_srq.desc);
+      return;
+    }
+    this->srq = std::get<0>(res_srq.desc);
+  }
+
+  DISABLE_COPY_AND_ASSIGN(SRQ);
+};
+
+} // namespace qp
+
+} // namespace rdmaio
@@ -0,0 +1,186 @@
+#pragma once
+
+#include "./recv_helper.hh"
+
+namespace rdmaio {
+
+namespace qp {
+
+// the strides are aligned to cache lines
+const usize kStrideAlign = 64;
+
+/*!
+  StridedRecvEntries carves a single registered buffer into N back-to-back
+  strides, each holds one message of at most msg_sz bytes, plus reserved
+  bytes at its head (e.g., kGRHSz for UD).
+  Compared to RecvEntriesFactory, which allocates one (page-aligned) buffer
+  per entry, a server receiving small messages uses a fraction of the
+  memory; e.g., 2048 entries for 256B UD messages take 640KB instead of 16MB.
+
+  Consumed entries are re-posted lazily by StridedRecvIter, in batches of
+  repost_batch, so the receive side rings fewer doorbells.
+
+  Example:
+  `
+  // 2048 entries, each for a UD message of at most 256 bytes
+  auto recv_rs = StridedRecvEntries<2048>::create(alloc, 256, kGRHSz).value();
+  RDMA_ASSERT(ud->post_recvs(*recv_rs, 2048) == IOCode::Ok);
+
+  for (StridedRecvIter<UD, 2048> iter(ud, recv_rs); iter.has_msgs();
+       iter.next()) {
+    auto msg = iter.cur_msg().value();
+    // msg.payload points to the message (after the GRH) of msg.sz bytes
+  }
+  `
+ */
+template <usize N> class StridedRecvEntries : public RecvEntries<N> {
+public:
+  char *base = nullptr;
+  // bytes of an entry, including the reserved bytes
+  usize stride = 0;
+  // bytes reserved at the head of an entry
+  usize reserved = 0;
+
+  // #entries consumed but not re-posted
+  usize pending = 0;
+  // re-post the consumed entries when pending reaches it
+  usize repost_batch = 64;
+
+  // #doorbells (ibv_post_recv) used to re-post entries
+  u64 reposts = 0;
+
+  static usize stride_of(const usize &msg_sz, const usize &reserved) {
+    auto sz = msg_sz + reserved;
+    auto r = sz % kStrideAlign;
+    return r ? sz + kStrideAlign - r : sz;
+  }
+
+  /*!
+    Allocate the buffer of all the entries at once from the allocator
+    (AbsRecvAllocator, or a class providing alloc_one).
+   */
+  template <class Alloc>
+  static Option<Arc<StridedRecvEntries<N>>>
+  create(Alloc &alloc, const usize &msg_sz, const usize &reserved = 0) {
+    static_assert(N >= 2, "");
+    Arc<StridedRecvEntries<N>> ret(new StridedRecvEntries<N>);
+    ret->stride = stride_of(msg_sz, reserved);
+    ret->reserved = reserved;
+    ret->repost_batch = std::min<usize>(ret->repost_batch, N / 2);
+
+    auto buf_res = alloc.alloc_one(ret->stride * N);
+    if (!buf_res)
+      return {};
+    auto buf = buf_res.value();
+    ret->base = static_cast<char *>(std::get<0>(buf));
+
+    for (uint i = 0; i < N; ++i) {
+      struct ibv_sge sge = {
+          .addr = reinterpret_cast<uintptr_t>(ret->base + i * ret->stride),
+          .length = static_cast<u32>(ret->stride),
+          .lkey = std::get<1>(buf)};
+
+      { // unsafe code
+        ret->rs[i].wr_id = sge.addr;
+        ret->rs[i].sg_list = &(ret->sges[i]);
+        ret->rs[i].num_sge = 1;
+        ret->rs[i].next = (i < N - 1) ? (&(ret->rs[i + 1])) : (&(ret->rs[0]));
+
+        ret->sges[i] = sge;
+      }
+    }
+    return ret;
+  }
+
+  /*!
+    Set the #consumed entries to re-post with one doorbell, at most N / 2,
+    so that the QP always has recvs posted
+   */
+  void set_repost_batch(const usize &b) {
+    repost_batch = std::max<usize>(1, std::min<usize>(b, N / 2));
+  }
+
+  usize mem_sz() const { return stride * N; }
+
+  usize max_msg_sz() const { return stride - reserved; }
+};
+
+/*!
+  A received message of StridedRecvIter
+ */
+struct StridedMsg {
+  u32 imm_data;
+  // the message, after the reserved bytes
+  char *payload;
+  // bytes of the message, excluding the reserved bytes
+  u32 sz;
+};
+
+/*!
+  StridedRecvIter walks the messages packed in the strides of
+  StridedRecvEntries, skipping failed completions (e.g., a message which
+  overflows a stride).
+  On destruction, it re-posts the consumed entries once at least
+  repost_batch of them are pending.
+ */
+template <typename QP, usize es> class StridedRecvIter {
+  QP *qp = nullptr;
+  StridedRecvEntries<es> *entries = nullptr;
+
+  int idx = 0;
+  const int total_msgs = -1;
+
+public:
+  StridedRecvIter(Arc<QP> &qp, Arc<StridedRecvEntries<es>> &e)
+      : qp(qp.get()), entries(e.get()),
+        total_msgs(ibv_poll_cq(qp->recv_cq, es, e->wcs)) {
+    skip_failed();
+  }
+
+  Option<StridedMsg> cur_msg() const {
+    if (has_msgs()) {
+      auto &wc = entries->wcs[idx];
+      auto sz = wc.byte_len > entries->reserved
+                    ? wc.byte_len - entries->reserved
+                    : 0;
+      return StridedMsg{.imm_data = wc.imm_data,
+                        .payload = reinterpret_cast<char *>(wc.wr_id) +
+                                   entries->reserved,
+                        .sz = static_cast<u32>(sz)};
+    }
+    return {};
+  }
+
+  inline void next() {
+    idx += 1;
+    skip_failed();
+  }
+
+  inline bool has_msgs() const { return idx < total_msgs; }
+
+  ~StridedRecvIter() {
+    if (total_msgs <= 0)
+      return;
+    // the entries complete in the order they are posted, so the consumed
+    // ones start at entries->header
+    entries->pending += total_msgs;
+    if (entries->pending >= entries->repost_batch) {
+      auto res = qp->post_recvs(*entries, entries->pending);
+      if (unlikely(res != IOCode::Ok))
+        RDMA_LOG(4) << "post recv error: " << strerror(res.desc);
+      entries->pending = 0;
+      entries->reposts += 1;
+    }
+  }
+
+private:
+  void skip_failed() {
+    while (has_msgs() && unlikely(entries->wcs[idx].status != IBV_WC_SUCCESS)) {
+      RDMA_LOG(4) << "recv error: " << ibv_wc_status_str(entries->wcs[idx].status);
+      idx += 1;
+    }
+  }
+};
+
+} // namespace qp
+} // namespace rdmaio
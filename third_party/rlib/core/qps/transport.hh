@@ -0,0 +1,174 @@
+#pragma once
+
+#include <vector>
+
+#include "./rc.hh"
+
+namespace rdmaio {
+
+namespace qp {
+
+/*!
+  The maximum number of completions polled at once by AbsTransport::poll_for
+ */
+const int kPollBatch = 16;
+
+/*!
+  AbsTransport abstracts the send path of a connected RC QP:
+  post a (chain of) send request(s), and poll the completions of the signaled
+  ones. Benchmarks written against this interface can run either on a real
+  RNIC (RCTransport), or on a software backend (e.g., LoopbackTransport) which
+  requires no NIC at all.
+
+  Example:
+  `
+  Arc<AbsTransport> t = RCTransport::create(rc).value();
+  t->bind_local_mr(local_attr);
+  t->bind_remote_mr(remote_attr);
+
+  Op<> op;
+  op.set_rdma_addr(0xc, t->remote_mr.value()).set_read();
+  op.set_payload(lbuf_ptr, sizeof(u64), t->local_mr.value().key);
+  op.set_flags(IBV_SEND_SIGNALED).set_wrid(73);
+  op.wr.next = nullptr;
+
+  auto res = t->post_send(op.wr);
+  auto res_p = t->wait_one_comp();
+  `
+ */
+class AbsTransport {
+public:
+  // default local MR used by this transport
+  Option<RegAttr> local_mr;
+  // default remote MR used by this transport
+  Option<RegAttr> remote_mr;
+
+  // #of outsignaled RDMA requests
+  usize out_signaled = 0;
+
+  virtual ~AbsTransport() = default;
+
+  void bind_remote_mr(const RegAttr &mr) { remote_mr = Option<RegAttr>(mr); }
+
+  void bind_local_mr(const RegAttr &mr) { local_mr = Option<RegAttr>(mr); }
+
+  /*!
+    Post the requests chained by sr.next
+    \note: the chain must be terminated with a nullptr
+   */
+  virtual Result<std::string> post_send(ibv_send_wr &sr) = 0;
+
+  /*!
+    Poll at most *num* completions into wcs
+    \ret: number of completions polled, < 0 on error
+   */
+  virtual int poll_comps(const int &num, ibv_wc *wcs) = 0;
+
+  inline usize ongoing_signaled() const { return out_signaled; }
+
+  /*!
+    do a loop to poll one completion.
+    \note timeout is measured in microseconds
+   */
+  Result<ibv_wc>
+  wait_one_comp(const double &timeout = ::rdmaio::Timer::no_timeout()) {
+    Timer t;
+    ibv_wc wc;
+    int n = 0;
+    do {
+      n = poll_comps(1, &wc);
+    } while (n == 0 && t.passed_msec() <= timeout);
+    if (n == 0)
+      return ::rdmaio::Timeout(wc);
+    if (unlikely(n < 0 || wc.status != IBV_WC_SUCCESS))
+      return ::rdmaio::Err(wc);
+    return ::rdmaio::Ok(wc);
+  }
+
+  /*!
+    Poll the completion whose wr_id equals to *wr_id*.
+    Completions of other requests polled during the call are stashed, so that
+    multiple users (e.g., coroutines) can share one transport.
+   */
+  Option<ibv_wc> poll_for(const u64 &wr_id) {
+    for (auto it = stashed.begin(); it != stashed.end(); ++it) {
+      if (it->wr_id == wr_id) {
+        auto wc = *it;
+        *it = stashed.back();
+        stashed.pop_back();
+        return wc;
+      }
+    }
+
+    ibv_wc wcs[kPollBatch];
+    Option<ibv_wc> res = {};
+    auto n = poll_comps(kPollBatch, wcs);
+    for (int i = 0; i < n; ++i) {
+      if (!res && wcs[i].wr_id == wr_id)
+        res = wcs[i];
+      else
+        stashed.push_back(wcs[i]);
+    }
+    return res;
+  }
+
+private:
+  std::vector<ibv_wc> stashed;
+};
+
+/*!
+  The transport backed by a (connected) RC QP on a real RNIC.
+ */
+class RCTransport : public AbsTransport {
+  Arc<RC> rc;
+
+public:
+  explicit RCTransport(Arc<RC> rc) : rc(std::move(rc)) {
+    if (this->rc->local_mr)
+      bind_local_mr(this->rc->local_mr.value());
+    if (this->rc->remote_mr)
+      bind_remote_mr(this->rc->remote_mr.value());
+  }
+
+  static Option<Arc<RCTransport>> create(Arc<RC> rc) {
+    if (rc == nullptr || !rc->valid())
+      return {};
+    return std::make_shared<RCTransport>(std::move(rc));
+  }
+
+  Arc<RC> qp() const { return rc; }
+
+  Result<std::string> post_send(ibv_send_wr &sr) override {
+    u64 num = 0;
+    u64 signaled = 0;
+    for (auto cur = &sr; cur != nullptr; cur = cur->next) {
+      if (cur->send_flags & IBV_SEND_SIGNALED)
+        signaled += 1;
+      num += 1;
+    }
+    out_signaled += signaled;
+    struct ibv_send_wr *bad_sr;
+    auto res = ibv_post_send(rc->qp, &sr, &bad_sr);
+    if (0 == res) {
+      rc->out_signaled += signaled;
+      rc->stats.on_post(num);
+      return ::rdmaio::Ok(std::string(""));
+    }
+    return ::rdmaio::Err(std::string(strerror(errno)));
+  }
+
+  int poll_comps(const int &num, ibv_wc *wcs) override {
+    auto n = ibv_poll_cq(rc->cq, num, wcs);
+    rc->stats.on_poll(n, wcs);
+    if (n > 0) {
+      out_signaled -= n;
+      // keep the QP's in-flight requests of query_stats()
+      rc->out_signaled -= std::min<usize>(rc->out_signaled, n);
+    }
+    return n;
+  }
+};
+
+} // namespace qp
+
+} // namespace rdmaio
@@ -37,8 +37,15 @@ public:
 
   const QPConfig my_config;
 
-  static Option<Arc<UD>> create(Arc<RNic> nic, const QPConfig &config) {
-    auto ud_ptr = Arc<UD>(new UD(nic, config));
+  /*!
+    Create a UD QP.
+    recv_cq (shared with other QPs) and srq (see srq.hh) are optional;
+    by default, the UD uses a private recv_cq and recv queue.
+   */
+  static Option<Arc<UD>> create(Arc<RNic> nic, const QPConfig &config,
+                                ibv_cq *recv_cq = nullptr,
+                                ibv_srq *srq = nullptr) {
+    auto ud_ptr = Arc<UD>(new UD(nic, config, recv_cq, srq));
     if (ud_ptr->valid())
       return ud_ptr;
     return {};
@@ -81,7 +88,8 @@ public:
   }
 
 private:
-  UD(Arc<RNic> nic, const QPConfig &config) : Dummy(nic), my_config(config) {
+  UD(Arc<RNic> nic, const QPConfig &config, ibv_cq *recv_cq, ibv_srq *srq)
+      : Dummy(nic), my_config(config) {
 
     // create qp, cq, recv_cq
     auto res = Impl::create_cq(nic, my_config.max_send_sz());
@@ -92,16 +100,19 @@ private:
     }
     this->cq = std::get<0>(res.desc);
 
-    auto res_recv = Impl::create_cq(nic, my_config.max_recv_sz());
-    if (res_recv != IOCode::Ok) {
-      RDMA_LOG(4) << "Error on creating recv CQ: " << std::get<1>(res.desc);
-      return;
+    if (recv_cq == nullptr) {
+      auto res_recv = Impl::create_cq(nic, my_config.max_recv_sz());
+      if (res_recv != IOCode::Ok) {
+        RDMA_LOG(4) << "Error on creating recv CQ: "
+                    << std::get<1>(res_recv.desc);
+        return;
+      }
+      recv_cq = std::get<0>(res_recv.desc);
     }
+    this->recv_cq = recv_cq;
 
-    this->recv_cq = std::get<0>(res_recv.desc);
-
-    auto res_qp =
-        Impl::create_qp(nic, IBV_QPT_UD, my_config, this->cq, this->recv_cq);
+    auto res_qp = Impl::create_qp(nic, IBV_QPT_UD, my_config, this->cq,
+                                  this->recv_cq, srq);
     if (res_qp != IOCode::Ok) {
       RDMA_LOG(4) << "Error on creating UD QP: " << std::get<1>(res_qp.desc);
       return;
@@ -6,6 +6,10 @@
 #include "./bootstrap/srpc.hh"
 
 #include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <thread>
+#include <vector>
 
 #include <pthread.h>
 
@@ -19,8 +23,18 @@ class RCtrl {
 
   std::atomic<bool> running;
 
+  // whether to replace the registered QP of a re-created name,
+  // see set_persistent()
+  std::atomic<bool> persistent;
+
   pthread_t handler_tid;
 
+  // the handler pool, which serves the requests received by the daemon
+  std::vector<std::thread> handlers;
+  std::deque<std::pair<ByteBuffer, sockaddr>> pending_reqs;
+  std::mutex pending_lock;
+  std::condition_variable pending_cv;
+
   /*!
     The two factory which allow user to **register** the QP, MR so that others
     can establish communication with them.
@@ -29,13 +43,14 @@ public:
   rmem::MRFactory registered_mrs;
   qp::QPFactory registered_qps;
   Factory<nic_id_t, RNic> opened_nics;
-  // Factory<std::string, ibv_cq> rc_recv_cqs;
+  // the SRQs (and their recv_cqs) shared by the RC QPs created by peers
+  Factory<std::string, qp::SRQ> registered_srqs;
 
   bootstrap::SRpcHandler rpc;
 
 public:
   explicit RCtrl(const usize &port, const std::string &h = "localhost")
-      : running(false), rpc(port, h) {
+      : running(false), persistent(false), rpc(port, h) {
     RDMA_ASSERT(rpc.register_handler(
         proto::FetchMr,
         std::bind(&RCtrl::fetch_mr_handler, this, std::placeholders::_1)));
@@ -51,15 +66,66 @@ public:
     RDMA_ASSERT(rpc.register_handler(
         proto::FetchQPAttr,
         std::bind(&RCtrl::fetch_qp_attr_wrapper, this, std::placeholders::_1)));
+
+    RDMA_ASSERT(rpc.register_handler(
+        proto::CreateRCBatch,
+        std::bind(&RCtrl::rc_batch_handler, this, std::placeholders::_1)));
+  }
+
+  ~RCtrl() { stop_daemon(); }
+
+  /*!
+    In the persistent mode, RCtrl is a long-lived daemon which keeps its NICs,
+    PDs and MRs across the runs of its clients, so only the (cheap) QPs are
+    re-created per run.
+    A restarted client re-attaches to the server by the names it used before:
+    the MRs are queried from registered_mrs as usual, and a CreateRC(M)
+    request with the name of a registered QP replaces the stale QP, instead of
+    failing with WrongArg.
+    \note: clients should use unique QP names, because a name in use is also
+    replaced.
+
+    Example:
+    `
+    RCtrl ctrl(8888);
+    ctrl.set_persistent();
+    ctrl.registered_mrs.reg(73, mr); // the (multi-GB) MR registered once
+    ctrl.start_daemon();
+    `
+   */
+  void set_persistent(const bool &p = true) { persistent = p; }
+
+  bool is_persistent() const { return persistent; }
+
+  /*!
+    Register the RC created for a client with the name.
+    In the persistent mode, the QP previously registered with the name is
+    replaced.
+   */
+  Option<u64> reg_client_qp(const std::string &name, Arc<qp::RC> rc) {
+    if (!persistent)
+      return registered_qps.reg(name, rc);
+    auto res = registered_qps.reg_or_replace(name, rc);
+    if (std::get<1>(res))
+      RDMA_LOG(2) << "replace the stale QP: " << name;
+    return std::get<0>(res);
   }
 
   /*!
-    Start the daemon thread for handling RDMA connection requests
+    Start the daemon thread for handling RDMA connection requests.
+    If num_handlers > 1, the daemon only receives the requests, and a pool of
+    num_handlers threads serves them, so that QP creations of different
+    clients overlap.
    */
-  bool start_daemon() {
+  bool start_daemon(const usize &num_handlers = 1) {
     running = true;
     asm volatile("" ::: "memory");
 
+    if (num_handlers > 1) {
+      for (uint i = 0; i < num_handlers; ++i)
+        handlers.emplace_back(&RCtrl::handler_loop, this);
+    }
+
     pthread_attr_t attr;
     pthread_attr_init(&attr);
     return (pthread_create(&handler_tid, &attr, &RCtrl::daemon, this) == 0);
@@ -74,6 +140,15 @@ public:
 
       asm volatile("" ::: "memory");
       pthread_join(handler_tid, nullptr);
+
+      {
+        // so that no handler misses the stop
+        std::lock_guard<std::mutex> guard(pending_lock);
+      }
+      pending_cv.notify_all();
+      for (auto &h : handlers)
+        h.join();
+      handlers.clear();
     }
   }
 
@@ -81,8 +156,19 @@ public:
     RCtrl &ctrl = *((RCtrl *)ctx);
     u64 total_reqs = 0;
     while (ctrl.running) {
-      total_reqs += ctrl.rpc.run_one_event_loop();
-      continue;
+      if (ctrl.handlers.empty()) {
+        total_reqs += ctrl.rpc.run_one_event_loop();
+        continue;
+      }
+      // hand the requests to the handler pool
+      total_reqs += ctrl.rpc.dispatch_one_event_loop(
+          [&ctrl](ByteBuffer &&msg, const sockaddr &client) {
+            {
+              std::lock_guard<std::mutex> guard(ctrl.pending_lock);
+              ctrl.pending_reqs.emplace_back(std::move(msg), client);
+            }
+            ctrl.pending_cv.notify_one();
+          });
     }
     RDMA_LOG(INFO) << "stop with :" << total_reqs << " processed.";
     return nullptr; // nothing should return
@@ -90,6 +176,24 @@ public:
 
   // handlers of the dameon call
 private:
+  void handler_loop() {
+    while (true) {
+      std::pair<ByteBuffer, sockaddr> req;
+      {
+        std::unique_lock<std::mutex> guard(pending_lock);
+        pending_cv.wait(guard,
+                        [this] { return !running || !pending_reqs.empty(); });
+        if (pending_reqs.empty())
+          return; // stopped
+        req = std::move(pending_reqs.front());
+        pending_reqs.pop_front();
+      }
+      auto res = rpc.reply_to(rpc.handle_one(std::get<0>(req)), std::get<1>(req));
+      if (res != IOCode::Ok)
+        RDMA_LOG(4) << "reply error: " << res.desc;
+    }
+  }
+
   ByteBuffer fetch_mr_handler(const ByteBuffer &b) {
     auto o_id = ::rdmaio::Marshal::dedump<proto::MRReq>(b);
     if (o_id) {
@@ -175,7 +279,7 @@ private:
 
       // 1. sanity check the request
       if (!(rc_req.whether_create == static_cast<u8>(1) ||
-            rc_req.whether_create != static_cast<u8>(0)))
+            rc_req.whether_create == static_cast<u8>(0)))
         goto WA;
 
       // 1. check whether we need to create the QP
@@ -186,17 +290,25 @@ private:
         if (!nic)
           goto WA; // failed to find Nic
 
-        // 1.0 check whether we are able to use the registered recv_cq
+        // 1.0 check whether we are able to use the registered SRQ, so the
+        // QP shares its recv buffers and recv_cq.
+        // (recv_cqs with per-QP recv entries are handled by RecvManager)
         ibv_cq *recv_cq = nullptr;
-#if 0 // we move this to a separte class
+        ibv_srq *srq = nullptr;
         if (rc_req.whether_recv == 1) {
-          recv_cq = rc_recv_cqs.query_or_default(rc_req.name_recv,nullptr).get();
+          auto srq_res = registered_srqs.query(rc_req.name_recv);
+          if (srq_res) {
+            recv_cq = srq_res.value()->recv_cq;
+            srq = srq_res.value()->srq;
+          }
         }
-#endif
 
         // 1.1 try to create and register this QP
-        auto rc = qp::RC::create(nic.value(), rc_req.config, recv_cq).value();
-        auto rc_status = registered_qps.reg(rc_req.name, rc);
+        auto rc_res = qp::RC::create(nic.value(), rc_req.config, recv_cq, srq);
+        if (!rc_res)
+          goto Err;
+        auto rc = rc_res.value();
+        auto rc_status = reg_client_qp(rc_req.name, rc);
 
         if (!rc_status) {
           // clean up
@@ -223,6 +335,34 @@ private:
     return ::rdmaio::Marshal::dump<proto::RCReply>(
         {.status = proto::CallbackStatus::ConnectErr});
   }
+
+  /*!
+    Handling a batch of RC requests, each is handled as rc_handler.
+    A failed request does not affect others, its status is in its RCReply.
+   */
+  ByteBuffer rc_batch_handler(const ByteBuffer &b) {
+    auto header_o = ::rdmaio::Marshal::dedump<proto::RCBatchHeader>(b);
+    if (!header_o || header_o.value().num > proto::kMaxRCBatch ||
+        b.size() < sizeof(proto::RCBatchHeader) +
+                       header_o.value().num * sizeof(proto::RCReq))
+      return ::rdmaio::Marshal::dump<proto::RCBatchHeader>({.num = 0});
+
+    auto num = header_o.value().num;
+    ByteBuffer reply = ::rdmaio::Marshal::dump<proto::RCBatchHeader>(
+        {.num = static_cast<u8>(num)});
+    reply.reserve(sizeof(proto::RCBatchHeader) +
+                  num * sizeof(proto::RCReply));
+
+    for (uint i = 0; i < num; ++i) {
+      auto reply_one = rc_handler(b.substr(
+          sizeof(proto::RCBatchHeader) + i * sizeof(proto::RCReq),
+          sizeof(proto::RCReq)));
+      // all replies of rc_handler are sizeof(RCReply), pad the short ones
+      reply_one.resize(sizeof(proto::RCReply), '\0');
+      reply.append(reply_one);
+    }
+    return reply;
+  }
 };
 
 } // namespace rdmaio
@@ -70,6 +70,25 @@ public:
     return wrapper_raw_ptr(def);
   }
 
+  /*!
+    Register a v to the factory, replacing the one registered with the same k.
+    Unlike reg, it always succeeds, so it is meant for the owner of the
+    factory, e.g., RCtrl replacing the stale QP of a restarted client.
+    \ret: the authentication key of v, and the replaced entry (if any)
+   */
+  std::pair<u64, Option<Arc<V>>> reg_or_replace(const K &k, Arc<V> v) {
+    std::lock_guard<std::mutex> guard(lock);
+    Option<Arc<V>> replaced = {};
+    auto it = store.find(k);
+    if (it != store.end()) {
+      replaced = std::get<0>(it->second);
+      store.erase(it);
+    }
+    auto key = generate_key();
+    store.insert(std::make_pair(k, std::make_pair(v, key)));
+    return std::make_pair(key, replaced);
+  }
+
   Option<Arc<V>> dereg(const K &id, const u64 &k) {
     std::lock_guard<std::mutex> guard(lock);
     auto it = store.find(id);
@@ -1,5 +1,7 @@
 #include <gtest/gtest.h>
 
+#include <thread>
+
 #include "../core/lib.hh"
 #include "../core/qps/mod.hh"
 
@@ -79,4 +81,72 @@ TEST(CM, QP) {
   ctrl.stop_daemon();
 }
 
+TEST(CM, RCBatch) {
+  // serve the requests with a handler pool; no NIC is required, since the
+  // requests only query QPs or use a NIC not opened
+  RCtrl ctrl(8889);
+  ctrl.start_daemon(4);
+
+  ConnectManager cm("localhost:8889");
+  if (cm.wait_ready(1000000, 2) ==
+      IOCode::Timeout) // wait 1 second for server to ready, retry 2 times
+    assert(false);
+
+  // concurrent clients, each issues several batches
+  std::vector<std::thread> clients;
+  for (uint c = 0; c < 4; ++c) {
+    clients.emplace_back([c]() {
+      SRpc rpc("localhost:8889");
+      for (uint round = 0; round < 16; ++round) {
+        const usize num = 1 + (c + round) % proto::kMaxRCBatch;
+        ByteBuffer req_buf = ::rdmaio::Marshal::dump<proto::RCBatchHeader>(
+            {.num = static_cast<u8>(num)});
+        for (uint i = 0; i < num; ++i) {
+          proto::RCReq req = {};
+          snprintf(req.name, sizeof(req.name), "missing-%u-%u", c, i);
+          // odd ones try to create at an un-opened NIC
+          req.whether_create = i % 2;
+          req.nic_id = 73;
+          req_buf.append(::rdmaio::Marshal::dump<proto::RCReq>(req));
+        }
+        RDMA_ASSERT(rpc.call(proto::CreateRCBatch, req_buf) == IOCode::Ok);
+        auto res = rpc.receive_reply();
+        RDMA_ASSERT(res == IOCode::Ok) << res.desc;
+
+        auto &reply = res.desc;
+        ASSERT_EQ(::rdmaio::Marshal::dedump<proto::RCBatchHeader>(reply)
+                      .value()
+                      .num,
+                  num);
+        ASSERT_GE(reply.size(), sizeof(proto::RCBatchHeader) +
+                                    num * sizeof(proto::RCReply));
+        for (uint i = 0; i < num; ++i) {
+          auto qp_reply =
+              ::rdmaio::Marshal::dedump<proto::RCReply>(
+                  reply.substr(sizeof(proto::RCBatchHeader) +
+                               i * sizeof(proto::RCReply)))
+                  .value();
+          ASSERT_EQ(qp_reply.status, i % 2 ? proto::CallbackStatus::WrongArg
+                                           : proto::CallbackStatus::NotFound);
+        }
+      }
+    });
+  }
+  for (auto &t : clients)
+    t.join();
+
+  // a batch larger than kMaxRCBatch is rejected
+  SRpc rpc("localhost:8889");
+  RDMA_ASSERT(rpc.call(proto::CreateRCBatch,
+                       ::rdmaio::Marshal::dump<proto::RCBatchHeader>(
+                           {.num = proto::kMaxRCBatch + 1})) == IOCode::Ok);
+  auto res = rpc.receive_reply();
+  RDMA_ASSERT(res == IOCode::Ok) << res.desc;
+  ASSERT_EQ(
+      ::rdmaio::Marshal::dedump<proto::RCBatchHeader>(res.desc).value().num,
+      0);
+
+  ctrl.stop_daemon();
+}
+
 }// namespace test
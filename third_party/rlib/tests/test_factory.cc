@@ -0,0 +1,37 @@
+#include <gtest/gtest.h>
+
+#include "../core/utils/abs_factory.hh"
+
+namespace test {
+
+using namespace rdmaio;
+
+TEST(Factory, RegOrReplace) {
+  Factory<std::string, u64> factory;
+
+  auto v0 = Arc<u64>(new u64(73));
+  auto key0 = factory.reg("qp", v0).value();
+
+  // a name in use cannot be registered again
+  ASSERT_FALSE(factory.reg("qp", Arc<u64>(new u64(74))));
+
+  // but it can be replaced
+  auto v1 = Arc<u64>(new u64(74));
+  auto res = factory.reg_or_replace("qp", v1);
+  ASSERT_TRUE(std::get<1>(res));
+  ASSERT_EQ(std::get<1>(res).value(), v0);
+  ASSERT_EQ(*(factory.query("qp").value()), 74);
+  ASSERT_EQ(factory.reg_entries(), 1);
+
+  // the replaced key is no longer valid
+  ASSERT_FALSE(factory.dereg("qp", key0));
+  ASSERT_TRUE(factory.dereg("qp", std::get<0>(res)));
+  ASSERT_FALSE(factory.query("qp"));
+
+  // replacing a free name is a reg
+  res = factory.reg_or_replace("qp", v0);
+  ASSERT_FALSE(std::get<1>(res));
+  ASSERT_EQ(*(factory.query("qp").value()), 73);
+}
+
+} // namespace test
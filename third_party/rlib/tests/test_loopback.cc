@@ -0,0 +1,280 @@
+#include <gtest/gtest.h>
+
+#include "../core/qps/doorbell_helper.hh"
+#include "../core/qps/loopback.hh"
+#include "../core/qps/op.hh"
+
+namespace test {
+
+using namespace rdmaio;
+using namespace rdmaio::qp;
+
+class LoopbackTest : public testing::Test {
+protected:
+  virtual void SetUp() override {
+    mem = std::make_shared<LoopbackMem>();
+    remote = Arc<RMem>(new RMem(4096));
+    local = Arc<RMem>(new RMem(4096));
+    memset(remote->raw_ptr, 0, 4096);
+    memset(local->raw_ptr, 0, 4096);
+
+    rmr = mem->reg(remote).value();
+    lmr = mem->reg(local).value();
+
+    t = LoopbackTransport::create(mem, QPConfig().set_max_send(16)).value();
+    t->bind_remote_mr(rmr);
+    t->bind_local_mr(lmr);
+  }
+
+  Arc<LoopbackMem> mem;
+  Arc<RMem> remote;
+  Arc<RMem> local;
+  RegAttr rmr;
+  RegAttr lmr;
+  Arc<LoopbackTransport> t;
+};
+
+TEST_F(LoopbackTest, ReadWrite) {
+  u64 *rbuf = reinterpret_cast<u64 *>(rmr.buf);
+  u64 *lbuf = reinterpret_cast<u64 *>(lmr.buf);
+  lbuf[0] = 73;
+
+  Op<> op;
+  op.set_rdma_addr(sizeof(u64), rmr).set_write();
+  op.set_payload(lbuf, sizeof(u64), lmr.key);
+  op.set_flags(IBV_SEND_SIGNALED).set_wrid(12);
+  op.wr.next = nullptr;
+  ASSERT_EQ(t->post_send(op.wr).code.c, IOCode::Ok);
+
+  auto res = t->wait_one_comp();
+  ASSERT_EQ(res.code.c, IOCode::Ok);
+  ASSERT_EQ(res.desc.wr_id, 12);
+  ASSERT_EQ(res.desc.opcode, IBV_WC_RDMA_WRITE);
+  ASSERT_EQ(rbuf[1], 73);
+
+  op.set_read().set_payload(lbuf + 1, sizeof(u64), lmr.key);
+  ASSERT_EQ(t->post_send(op.wr).code.c, IOCode::Ok);
+  ASSERT_EQ(t->wait_one_comp().code.c, IOCode::Ok);
+  ASSERT_EQ(lbuf[1], 73);
+  ASSERT_EQ(t->ongoing_signaled(), 0);
+}
+
+TEST_F(LoopbackTest, Atomic) {
+  u64 *rbuf = reinterpret_cast<u64 *>(rmr.buf);
+  u64 *lbuf = reinterpret_cast<u64 *>(lmr.buf);
+  rbuf[0] = 73;
+
+  Op<> op;
+  op.set_atomic_rbuf(rbuf, rmr.key).set_fetch_add(12);
+  op.set_payload(lbuf, sizeof(u64), lmr.key);
+  op.set_flags(IBV_SEND_SIGNALED);
+  op.wr.next = nullptr;
+  ASSERT_EQ(t->post_send(op.wr).code.c, IOCode::Ok);
+  ASSERT_EQ(t->wait_one_comp().code.c, IOCode::Ok);
+  ASSERT_EQ(lbuf[0], 73);
+  ASSERT_EQ(rbuf[0], 73 + 12);
+
+  // a failed CAS returns the original value
+  op.set_cas(0, 1);
+  ASSERT_EQ(t->post_send(op.wr).code.c, IOCode::Ok);
+  ASSERT_EQ(t->wait_one_comp().code.c, IOCode::Ok);
+  ASSERT_EQ(lbuf[0], 73 + 12);
+  ASSERT_EQ(rbuf[0], 73 + 12);
+
+  op.set_cas(73 + 12, 1);
+  ASSERT_EQ(t->post_send(op.wr).code.c, IOCode::Ok);
+  ASSERT_EQ(t->wait_one_comp().code.c, IOCode::Ok);
+  ASSERT_EQ(rbuf[0], 1);
+
+  // unaligned atomics are rejected
+  op.set_atomic_rbuf((u64 *)((char *)rbuf + 1), rmr.key);
+  ASSERT_EQ(t->post_send(op.wr).code.c, IOCode::Ok);
+  auto res = t->wait_one_comp();
+  ASSERT_EQ(res.code.c, IOCode::Err);
+  ASSERT_EQ(res.desc.status, IBV_WC_REM_INV_REQ_ERR);
+}
+
+TEST_F(LoopbackTest, Doorbell) {
+  u64 *rbuf = reinterpret_cast<u64 *>(rmr.buf);
+  u64 *lbuf = reinterpret_cast<u64 *>(lmr.buf);
+  for (uint i = 0; i < 4; ++i)
+    rbuf[i] = i + 73;
+
+  DoorbellHelper<4> doorbell(IBV_WR_RDMA_READ);
+  for (uint i = 0; i < 4; ++i) {
+    doorbell.next();
+    doorbell.cur_wr().send_flags = 0;
+    doorbell.cur_wr().wr.rdma.remote_addr = rmr.buf + i * sizeof(u64);
+    doorbell.cur_wr().wr.rdma.rkey = rmr.key;
+    doorbell.cur_sge() = {.addr = (u64)(lbuf + i),
+                          .length = sizeof(u64),
+                          .lkey = lmr.key};
+  }
+  doorbell.cur_wr().send_flags = IBV_SEND_SIGNALED;
+  doorbell.cur_wr().wr_id = 3;
+  doorbell.freeze();
+  ASSERT_EQ(t->post_send(*doorbell.first_wr_ptr()).code.c, IOCode::Ok);
+  doorbell.clear();
+
+  // only the signaled request generates a completion
+  ibv_wc wcs[4];
+  ASSERT_EQ(t->poll_comps(4, wcs), 1);
+  ASSERT_EQ(wcs[0].wr_id, 3);
+  for (uint i = 0; i < 4; ++i)
+    ASSERT_EQ(lbuf[i], i + 73);
+}
+
+TEST_F(LoopbackTest, SendQueueFull) {
+  u64 *lbuf = reinterpret_cast<u64 *>(lmr.buf);
+
+  Op<> op;
+  op.set_rdma_addr(0, rmr).set_read();
+  op.set_payload(lbuf, sizeof(u64), lmr.key);
+  op.set_flags(0);
+  op.wr.next = nullptr;
+
+  // unsignaled requests hold their slots until a signaled one is polled
+  for (uint i = 0; i < 16; ++i)
+    ASSERT_EQ(t->post_send(op.wr).code.c, IOCode::Ok);
+  ASSERT_EQ(t->post_send(op.wr).code.c, IOCode::Err);
+
+  ibv_wc wc;
+  ASSERT_EQ(t->poll_comps(1, &wc), 0);
+}
+
+TEST_F(LoopbackTest, AccessError) {
+  u64 *lbuf = reinterpret_cast<u64 *>(lmr.buf);
+
+  Op<> op;
+  op.set_rdma_addr(4096 - 4, rmr).set_read();
+  op.set_payload(lbuf, sizeof(u64), lmr.key);
+  op.set_flags(0).set_wrid(1);
+  op.wr.next = nullptr;
+  ASSERT_EQ(t->post_send(op.wr).code.c, IOCode::Ok);
+
+  // the erroneous request completes even if it is unsignaled
+  auto res = t->wait_one_comp();
+  ASSERT_EQ(res.code.c, IOCode::Err);
+  ASSERT_EQ(res.desc.status, IBV_WC_REM_ACCESS_ERR);
+  ASSERT_TRUE(t->in_error());
+
+  // later requests are flushed
+  op.set_rdma_addr(0, rmr).set_flags(IBV_SEND_SIGNALED).set_wrid(2);
+  ASSERT_EQ(t->post_send(op.wr).code.c, IOCode::Ok);
+  res = t->wait_one_comp();
+  ASSERT_EQ(res.desc.status, IBV_WC_WR_FLUSH_ERR);
+  ASSERT_EQ(res.desc.wr_id, 2);
+}
+
+TEST_F(LoopbackTest, PollFor) {
+  u64 *lbuf = reinterpret_cast<u64 *>(lmr.buf);
+
+  Op<> op;
+  op.set_rdma_addr(0, rmr).set_read();
+  op.set_payload(lbuf, sizeof(u64), lmr.key);
+  op.set_flags(IBV_SEND_SIGNALED);
+  op.wr.next = nullptr;
+  for (u64 i = 0; i < 3; ++i) {
+    op.set_wrid(i);
+    ASSERT_EQ(t->post_send(op.wr).code.c, IOCode::Ok);
+  }
+
+  // completions of others are kept for their owners
+  ASSERT_TRUE(t->poll_for(2));
+  ASSERT_TRUE(t->poll_for(0));
+  ASSERT_FALSE(t->poll_for(2));
+  ASSERT_TRUE(t->poll_for(1));
+}
+
+TEST(Loopback, AccessHook) {
+  auto mem = std::make_shared<LoopbackMem>();
+  auto remote = Arc<RMem>(new RMem(4096));
+  auto local = Arc<RMem>(new RMem(4096));
+
+  u64 reads = 0, writes = 0, last_addr = 0, last_len = 0;
+  auto rmr = mem->reg(remote, [&](const u64 &addr, const u64 &len,
+                                  bool is_write) {
+                  (is_write ? writes : reads) += 1;
+                  last_addr = addr;
+                  last_len = len;
+                }).value();
+  auto lmr = mem->reg(local).value();
+
+  auto t = LoopbackTransport::create(mem).value();
+  u64 *lbuf = reinterpret_cast<u64 *>(lmr.buf);
+
+  Op<> op;
+  op.set_rdma_addr(64, rmr).set_write();
+  op.set_payload(lbuf, 256, lmr.key);
+  op.set_flags(IBV_SEND_SIGNALED).set_wrid(1);
+  op.wr.next = nullptr;
+  ASSERT_EQ(t->post_send(op.wr).code.c, IOCode::Ok);
+  ASSERT_EQ(t->wait_one_comp().code.c, IOCode::Ok);
+  ASSERT_EQ(writes, 1);
+  ASSERT_EQ(last_addr, rmr.buf + 64);
+  ASSERT_EQ(last_len, 256);
+
+  op.set_read();
+  ASSERT_EQ(t->post_send(op.wr).code.c, IOCode::Ok);
+  ASSERT_EQ(t->wait_one_comp().code.c, IOCode::Ok);
+  ASSERT_EQ(reads, 1);
+
+  // the failed requests are not reported
+  op.set_rdma_addr(4096 - 4, rmr);
+  ASSERT_EQ(t->post_send(op.wr).code.c, IOCode::Ok);
+  ASSERT_EQ(t->wait_one_comp().code.c, IOCode::Err);
+  ASSERT_EQ(reads, 1);
+}
+
+TEST_F(LoopbackTest, ScatterGather) {
+  char *rbuf = reinterpret_cast<char *>(rmr.buf);
+  char *lbuf = reinterpret_cast<char *>(lmr.buf);
+  for (uint i = 0; i < 64; ++i)
+    rbuf[i] = static_cast<char>(i);
+
+  // a QP only accepts the sges configured
+  Op<3> op;
+  op.set_rdma_addr(0, rmr).set_read().clear_payloads();
+  ASSERT_TRUE(op.add_payload(lbuf + 1024, 8, lmr.key));
+  ASSERT_TRUE(op.add_payload(lbuf + 2048, 16, lmr.key));
+  ASSERT_TRUE(op.add_payload(lbuf + 3072, 40, lmr.key));
+  ASSERT_FALSE(op.add_payload(lbuf, 8, lmr.key));
+  ASSERT_EQ(op.sge_num(), 3);
+  ASSERT_EQ(op.payload_sz(), 64);
+  op.set_flags(IBV_SEND_SIGNALED).set_wrid(3);
+  op.wr.next = nullptr;
+  ASSERT_EQ(t->post_send(op.wr).code.c, IOCode::Err);
+
+  auto sg = LoopbackTransport::create(
+                mem, QPConfig().set_max_send(16).set_max_send_sge(3))
+                .value();
+
+  // the remote contiguous bytes are scattered into the local fragments
+  ASSERT_EQ(sg->post_send(op.wr).code.c, IOCode::Ok);
+  ASSERT_EQ(sg->wait_one_comp().code.c, IOCode::Ok);
+  ASSERT_EQ(memcmp(lbuf + 1024, rbuf, 8), 0);
+  ASSERT_EQ(memcmp(lbuf + 2048, rbuf + 8, 16), 0);
+  ASSERT_EQ(memcmp(lbuf + 3072, rbuf + 24, 40), 0);
+
+  // and gathered back by a doorbelled write
+  DoorbellHelper<2, 3> doorbell(IBV_WR_RDMA_WRITE);
+  doorbell.next();
+  doorbell.cur_sge(0) = op.sges[2];
+  doorbell.cur_sge(1) = op.sges[0];
+  doorbell.cur_wr().num_sge = 2;
+  doorbell.cur_wr().wr.rdma.remote_addr = rmr.buf + 128;
+  doorbell.cur_wr().wr.rdma.rkey = rmr.key;
+  doorbell.cur_wr().send_flags = IBV_SEND_SIGNALED;
+  doorbell.freeze();
+  ASSERT_EQ(sg->post_send(*doorbell.first_wr_ptr()).code.c, IOCode::Ok);
+  ASSERT_EQ(sg->wait_one_comp().code.c, IOCode::Ok);
+  ASSERT_EQ(memcmp(rbuf + 128, rbuf + 24, 40), 0);
+  ASSERT_EQ(memcmp(rbuf + 168, rbuf, 8), 0);
+
+  // a reused request starts with one sge
+  doorbell.clear();
+  doorbell.next();
+  ASSERT_EQ(doorbell.cur_wr().num_sge, 1);
+}
+
+} // namespace test
@@ -0,0 +1,95 @@
+#include <gtest/gtest.h>
+
+#include <stdlib.h>
+#include <sys/stat.h>
+
+#include <fstream>
+
+#include "../core/nic_stats.hh"
+
+namespace test {
+
+using namespace rdmaio;
+using namespace rdmaio::qp;
+
+namespace {
+
+void write_counter(const std::string &path, const u64 &val) {
+  std::ofstream out(path);
+  out << val << "\n";
+}
+
+} // namespace
+
+TEST(Stats, FakeSysfs) {
+  char tmpl[] = "/tmp/rlib_sysfs_XXXXXX";
+  ASSERT_NE(mkdtemp(tmpl), nullptr);
+  const std::string root(tmpl);
+
+  const std::string port = root + "/mlx5_0/ports/1";
+  for (auto d : {"/mlx5_0", "/mlx5_0/ports", "/mlx5_0/ports/1",
+                 "/mlx5_0/ports/1/counters", "/mlx5_0/ports/1/hw_counters"})
+    ASSERT_EQ(mkdir((root + d).c_str(), 0755), 0);
+
+  write_counter(port + "/counters/port_xmit_data", 100);
+  write_counter(port + "/hw_counters/rnr_nak_retry_err", 3);
+  write_counter(port + "/hw_counters/local_ack_timeout_err", 0);
+
+  ASSERT_FALSE(NicCounters::create("mlx5_1", 1, root));
+  auto counters = NicCounters::create("mlx5_0", 1, root).value();
+
+  auto before = counters->sample();
+  ASSERT_EQ(before.size(), 3);
+  ASSERT_EQ(before["counters/port_xmit_data"], 100);
+  ASSERT_EQ(before["hw_counters/rnr_nak_retry_err"], 3);
+
+  write_counter(port + "/counters/port_xmit_data", 164);
+  write_counter(port + "/hw_counters/rnr_nak_retry_err", 10);
+  auto delta = NicCounters::delta(before, counters->sample());
+  ASSERT_EQ(delta["counters/port_xmit_data"], 64);
+  ASSERT_EQ(delta["hw_counters/rnr_nak_retry_err"], 7);
+  ASSERT_EQ(delta["hw_counters/local_ack_timeout_err"], 0);
+
+  // only the transport events are kept
+  auto events = NicCounters::transport_events(delta);
+  ASSERT_EQ(events.size(), 2);
+  ASSERT_EQ(events.count("counters/port_xmit_data"), 0);
+
+  TransportStats transport;
+  transport.add_nic(counters);
+  write_counter(port + "/hw_counters/local_ack_timeout_err", 2);
+  ASSERT_EQ(transport.epoch_json(),
+            "{\"nics\":[{\"dev\":\"mlx5_0\",\"port\":1,\"events\":{"
+            "\"hw_counters/local_ack_timeout_err\":2,"
+            "\"hw_counters/rnr_nak_retry_err\":0}}],\"qps\":[]}");
+
+  ASSERT_EQ(system((std::string("rm -rf ") + root).c_str()), 0);
+}
+
+TEST(Stats, QPStats) {
+  QPStats stats;
+  stats.on_post(16);
+
+  ibv_wc wcs[2];
+  wcs[0].status = IBV_WC_SUCCESS;
+  wcs[1].status = IBV_WC_RNR_RETRY_EXC_ERR;
+  stats.on_poll(0, wcs);
+  stats.on_poll(2, wcs);
+  stats.in_flight = 4;
+
+  ASSERT_EQ(stats.comps, 2);
+  ASSERT_EQ(stats.err_comps, 1);
+  ASSERT_EQ(stats.completed(), 12);
+  ASSERT_DOUBLE_EQ(stats.poll_hit_ratio(), 0.5);
+
+  auto old = stats;
+  stats.on_post(4);
+  stats.on_poll(1, wcs);
+  auto d = stats.since(old);
+  ASSERT_EQ(d.posted, 4);
+  ASSERT_EQ(d.comps, 1);
+  ASSERT_EQ(d.polls, 1);
+  ASSERT_EQ(d.in_flight, 4);
+}
+
+} // namespace test
@@ -53,4 +53,25 @@ TEST(QP, Progress) {
 #endif
 }
 
+TEST(QP, ProgressDecode) {
+  Progress progress;
+
+  // run far beyond the bits packed in a wr_id, with requests pending
+  const u64 window = 100;
+  const u64 mask = bitmask<u64>(Progress::num_progress_bits);
+  for (u64 i = 0; i < 3 * (mask + 1); i += window) {
+    auto last = progress.forward(window);
+    ASSERT_EQ(last, i + window);
+    for (u64 seq = last - window + 1; seq <= last; seq += 7)
+      ASSERT_EQ(progress.decode(seq & mask), seq);
+    ASSERT_EQ(progress.pending_reqs(), window);
+    progress.done(last);
+    ASSERT_EQ(progress.pending_reqs(), 0);
+  }
+
+  // a stale watermark does not move it backward
+  progress.done(1);
+  ASSERT_EQ(progress.low_watermark, progress.high_watermark);
+}
+
 } // namespace test
@@ -59,6 +59,85 @@ TEST(RRC, basic) {
   ASSERT_EQ(test_loc[1],73);
 }
 
+TEST(RRC, SelectiveSignal) {
+
+  auto res = RNicInfo::query_dev_names();
+  ASSERT_FALSE(res.empty());
+  auto nic = RNic::create(res[0]).value();
+
+  auto qpp = RC::create(nic, QPConfig()).value();
+
+  auto mem = Arc<RMem>(new RMem(4096));
+  RegHandler handler(mem, nic);
+  auto mr = handler.get_reg_attr().value();
+
+  RC &qp = *qpp;
+  qp.bind_remote_mr(mr);
+  qp.bind_local_mr(mr);
+  RDMA_ASSERT(qp.connect(qp.my_attr()) == IOCode::Ok);
+
+  // signal one of every 16 requests, in rounds beyond 2^16 requests
+  const u64 batch = 16;
+  u64 completed = 0;
+  for (u64 i = 0; i < (1 << 17); ++i) {
+    auto res_s = qp.send_normal(
+        {.op = IBV_WR_RDMA_WRITE,
+         .flags = IBV_SEND_INLINE |
+                  ((i % batch == batch - 1) ? IBV_SEND_SIGNALED : 0),
+         .len = sizeof(u64),
+         .wr_id = i},
+        {.local_addr = mem->raw_ptr, .remote_addr = sizeof(u64)});
+    RDMA_ASSERT(res_s == IOCode::Ok);
+
+    while (qp.progress.pending_reqs() >= batch * 4) {
+      auto n = qp.poll_rc_comps(
+          16, [&](const u64 &user_wr, const u64 &seq, const ibv_wc &wc) {
+            // every request is resolved, in order
+            ASSERT_EQ(wc.status, IBV_WC_SUCCESS);
+            ASSERT_EQ(user_wr, completed);
+            ASSERT_EQ(seq, completed + 1);
+            completed += 1;
+          });
+      ASSERT_GE(n, 0);
+    }
+  }
+  ASSERT_GE(completed, (1 << 17) - batch * 4);
+}
+
+TEST(RRC, WaitOneComp) {
+
+  auto res = RNicInfo::query_dev_names();
+  ASSERT_FALSE(res.empty());
+  auto nic = RNic::create(res[0]).value();
+
+  auto qpp = RC::create(nic, QPConfig()).value();
+
+  auto mem = Arc<RMem>(new RMem(4096));
+  RegHandler handler(mem, nic);
+  auto mr = handler.get_reg_attr().value();
+
+  RC &qp = *qpp;
+  qp.bind_remote_mr(mr);
+  qp.bind_local_mr(mr);
+  RDMA_ASSERT(qp.connect(qp.my_attr()) == IOCode::Ok);
+
+  // reaping by wait_one_comp also retires the progress, so the round trips
+  // can go far beyond the send queue
+  for (int i = 0; i < qp.max_send_sz() * 4; ++i) {
+    auto res_s = qp.send_normal(
+        {.op = IBV_WR_RDMA_WRITE,
+         .flags = IBV_SEND_INLINE | IBV_SEND_SIGNALED,
+         .len = sizeof(u64),
+         .wr_id = static_cast<u64>(i)},
+        {.local_addr = mem->raw_ptr, .remote_addr = sizeof(u64)});
+    RDMA_ASSERT(res_s == IOCode::Ok);
+    ASSERT_EQ(qp.wait_one_comp().code.c, IOCode::Ok);
+    ASSERT_EQ(qp.progress.pending_reqs(), 0);
+    ASSERT_EQ(qp.query_stats().in_flight, 0);
+  }
+  ASSERT_EQ(qp.query_stats().completed(), qp.max_send_sz() * 4);
+}
+
 TEST(RRC, Factory) {
 
   ::rdmaio::qp::RCFactory factory;
@@ -43,4 +43,49 @@ TEST(RPC, Basic) {
   }
 }
 
+TEST(RPC, Pipelined) {
+
+  SRpc rpc("localhost:1112");
+  SRpcHandler handler(1112);
+
+  // echo the parameter, repeated by its first byte
+  handler.register_handler(73, [](const ByteBuffer &b) -> ByteBuffer {
+    ByteBuffer reply;
+    for (uint i = 0; i < static_cast<u8>(b[0]); ++i)
+      reply.append(b);
+    return reply;
+  });
+
+  // the last two replies take multiple msgs
+  std::vector<u8> repeats = {1, 7, 3, 200, 255};
+  std::vector<u64> calls;
+  for (auto r : repeats) {
+    auto res = rpc.call_async(73, ByteBuffer(1024, static_cast<char>(r)));
+    ASSERT_TRUE(res == IOCode::Ok);
+    calls.push_back(res.desc);
+  }
+  ASSERT_EQ(rpc.pending_calls(), repeats.size());
+
+  usize handled = 0;
+  for (uint i = 0; i < 10 && handled < repeats.size(); ++i)
+    handled += handler.run_one_event_loop();
+  ASSERT_EQ(handled, repeats.size());
+
+  // wait in the reverse order
+  for (int i = repeats.size() - 1; i >= 0; --i) {
+    auto res = rpc.wait_reply(calls[i]);
+    ASSERT_TRUE(res == IOCode::Ok) << res.desc;
+    ASSERT_EQ(res.desc.size(), 1024 * static_cast<usize>(repeats[i]));
+    ASSERT_EQ(res.desc,
+              ByteBuffer(res.desc.size(), static_cast<char>(repeats[i])));
+  }
+  ASSERT_EQ(rpc.pending_calls(), 0);
+
+  // an unknown rpc
+  auto res = rpc.call(74, ByteBuffer(1, 'a'));
+  ASSERT_TRUE(res == IOCode::Ok);
+  handler.run_one_event_loop();
+  ASSERT_FALSE(rpc.receive_reply() == IOCode::Ok);
+}
+
 } // namespace test
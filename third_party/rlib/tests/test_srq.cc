@@ -0,0 +1,124 @@
+#include <gtest/gtest.h>
+
+#include "../core/nicinfo.hh"
+
+#include "../core/qps/rc.hh"
+#include "../core/qps/recv_iter.hh"
+#include "../core/qps/srq.hh"
+
+#include "../core/utils/marshal.hh"
+
+namespace test {
+
+using namespace rdmaio;
+using namespace rdmaio::qp;
+using namespace rdmaio::rmem;
+
+class SRQAllocator : AbsRecvAllocator {
+  RMem::raw_ptr_t buf = nullptr;
+  usize total_mem = 0;
+  mr_key_t key;
+
+public:
+  SRQAllocator(Arc<RMem> mem, mr_key_t key)
+      : buf(mem->raw_ptr), total_mem(mem->sz), key(key) {}
+
+  Option<std::pair<rmem::RMem::raw_ptr_t, rmem::mr_key_t>>
+  alloc_one(const usize &sz) override {
+    if (total_mem < sz)
+      return {};
+    auto ret = buf;
+    buf = static_cast<char *>(buf) + sz;
+    total_mem -= sz;
+    return std::make_pair(ret, key);
+  }
+
+  Option<std::pair<rmem::RMem::raw_ptr_t, rmem::RegAttr>>
+  alloc_one_for_remote(const usize &sz) override {
+    return {};
+  }
+};
+
+TEST(RC, SRQ) {
+  auto res = RNicInfo::query_dev_names();
+  ASSERT_FALSE(res.empty());
+  auto nic = RNic::create(res.at(0)).value();
+
+  // 1. create the SRQ, and its recv cq
+  const usize recv_depth = 512;
+  auto srq = SRQ::create(nic, recv_depth).value();
+
+  // 2. post the shared recv buffers
+  auto mem = Arc<RMem>(new RMem(4 * 1024 * 1024));
+  ASSERT_TRUE(mem->valid());
+
+  auto handler = RegHandler::create(mem, nic).value();
+  auto mr = handler->get_reg_attr().value();
+
+  SRQAllocator alloc(mem, mr.key);
+  auto recv_rs =
+      RecvEntriesFactory<SRQAllocator, recv_depth, 1000>::create(alloc);
+  RDMA_ASSERT(srq->attach(*recv_rs) == IOCode::Ok);
+  ASSERT_EQ(srq->attached(), recv_depth);
+
+  // 3. create QPs, which share the SRQ and its recv cq
+  const usize num_qps = 4;
+  std::vector<Arc<RC>> qps;
+  for (uint i = 0; i < num_qps; ++i) {
+    auto qp = RC::create(nic, QPConfig(), srq->recv_cq, srq->srq).value();
+    qp->bind_remote_mr(mr);
+    qp->bind_local_mr(mr);
+    // connect the QP with myself
+    RDMA_ASSERT(qp->connect(qp->my_attr()) == IOCode::Ok);
+    qps.push_back(qp);
+  }
+
+  // 4. send from all the QPs, twice as many msgs as the shared buffers,
+  // so the buffers must be re-posted
+  const usize per_qp = recv_depth / num_qps;
+  for (uint round = 0; round < 2; ++round) {
+    for (uint i = 0; i < per_qp; ++i) {
+      for (uint q = 0; q < num_qps; ++q) {
+        auto msg = ::rdmaio::Marshal::dump<u64>(q * per_qp + i);
+        auto res_s = qps[q]->send_normal(
+            {.op = IBV_WR_SEND_WITH_IMM,
+             .flags = IBV_SEND_SIGNALED | IBV_SEND_INLINE,
+             .len = sizeof(u64),
+             .wr_id = 0},
+            {.local_addr = (RMem::raw_ptr_t)(msg.data()),
+             .remote_addr = 0,
+             .imm_data = q});
+        RDMA_ASSERT(res_s == IOCode::Ok);
+        RDMA_ASSERT(qps[q]->wait_one_comp() == IOCode::Ok);
+      }
+    }
+
+    sleep(1);
+
+    // the msgs of all QPs arrive at the SRQ's recv cq
+    std::vector<usize> recved(num_qps, 0);
+    usize total = 0;
+    while (total < recv_depth) {
+      for (RecvIter<SRQ, recv_depth> iter(srq, recv_rs); iter.has_msgs();
+           iter.next()) {
+        auto imm_msg = iter.cur_msg().value();
+        auto q = std::get<0>(imm_msg);
+        ASSERT_LT(q, num_qps);
+
+        auto buf = static_cast<char *>(std::get<1>(imm_msg));
+        auto res =
+            ::rdmaio::Marshal::dedump<u64>(std::string(buf, sizeof(u64)))
+                .value();
+        // msgs of a QP arrive in order
+        ASSERT_EQ(res, q * per_qp + recved[q]);
+
+        recved[q] += 1;
+        total += 1;
+      }
+    }
+    for (auto n : recved)
+      ASSERT_EQ(n, per_qp);
+  }
+}
+
+} // namespace test
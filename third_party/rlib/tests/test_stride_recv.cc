@@ -0,0 +1,62 @@
+#include <gtest/gtest.h>
+
+#include "../core/qps/stride_recv.hh"
+
+namespace test {
+
+using namespace rdmaio;
+using namespace rdmaio::qp;
+using namespace rdmaio::rmem;
+
+class BufAllocator {
+  char *buf = nullptr;
+  usize total_mem = 0;
+
+public:
+  BufAllocator(char *buf, usize sz) : buf(buf), total_mem(sz) {}
+
+  Option<std::pair<rmem::RMem::raw_ptr_t, rmem::mr_key_t>>
+  alloc_one(const usize &sz) {
+    if (total_mem < sz)
+      return {};
+    auto ret = buf;
+    buf += sz;
+    total_mem -= sz;
+    return std::make_pair(ret, static_cast<mr_key_t>(73));
+  }
+};
+
+TEST(RecvEntries, Strided) {
+  ASSERT_EQ(StridedRecvEntries<16>::stride_of(256, 40), 320);
+  ASSERT_EQ(StridedRecvEntries<16>::stride_of(24, 40), 64);
+  ASSERT_EQ(StridedRecvEntries<16>::stride_of(64, 0), 64);
+
+  std::vector<char> mem(64 * 1024);
+  BufAllocator alloc(mem.data(), mem.size());
+
+  auto rs = StridedRecvEntries<128>::create(alloc, 200, 40).value();
+  rs->sanity_check();
+  ASSERT_EQ(rs->stride, 256);
+  ASSERT_EQ(rs->mem_sz(), 128 * 256);
+  ASSERT_EQ(rs->max_msg_sz(), 256 - 40);
+  ASSERT_EQ(rs->base, mem.data());
+
+  // the entries are packed back-to-back in one buffer
+  for (uint i = 0; i < 128; ++i) {
+    ASSERT_EQ(rs->rs[i].wr_id, (u64)(mem.data() + i * 256));
+    ASSERT_EQ(rs->sges[i].length, 256);
+    ASSERT_EQ(rs->sges[i].lkey, 73);
+  }
+  // the last entry links back to the first
+  ASSERT_EQ(rs->rs[127].next, &(rs->rs[0]));
+
+  rs->set_repost_batch(1024);
+  ASSERT_EQ(rs->repost_batch, 64);
+  rs->set_repost_batch(0);
+  ASSERT_EQ(rs->repost_batch, 1);
+
+  // the allocator has no space for another one
+  ASSERT_FALSE(StridedRecvEntries<1024>::create(alloc, 200, 40));
+}
+
+} // namespace test